@@ -416,6 +416,27 @@ static void print_default_format(struct strbuf *scratch, struct expand_data *dat
 		    (uintmax_t)data->size);
 }
 
+static void batch_object_print(struct strbuf *scratch,
+			       struct batch_options *opt,
+			       struct expand_data *data)
+{
+	strbuf_reset(scratch);
+
+	if (!opt->format) {
+		print_default_format(scratch, data);
+	} else {
+		strbuf_expand(scratch, opt->format, expand_format, data);
+		strbuf_addch(scratch, '\n');
+	}
+
+	batch_write(opt, scratch->buf, scratch->len);
+
+	if (opt->batch_mode == BATCH_MODE_CONTENTS) {
+		print_object_or_die(opt, data);
+		batch_write(opt, "\n", 1);
+	}
+}
+
 /*
  * If "pack" is non-NULL, then "offset" is the byte offset within the pack from
  * which the object may be accessed (though note that we may also rely on
@@ -446,21 +467,7 @@ static void batch_object_write(const char *obj_name,
 		}
 	}
 
-	strbuf_reset(scratch);
-
-	if (!opt->format) {
-		print_default_format(scratch, data);
-	} else {
-		strbuf_expand(scratch, opt->format, expand_format, data);
-		strbuf_addch(scratch, '\n');
-	}
-
-	batch_write(opt, scratch->buf, scratch->len);
-
-	if (opt->batch_mode == BATCH_MODE_CONTENTS) {
-		print_object_or_die(opt, data);
-		batch_write(opt, "\n", 1);
-	}
+	batch_object_print(scratch, opt, data);
 }
 
 static void batch_one_object(const char *obj_name,
@@ -514,6 +521,100 @@ static void batch_one_object(const char *obj_name,
 	batch_object_write(obj_name, scratch, opt, data, NULL, 0);
 }
 
+/*
+ * With --buffer, --batch-check does not have to answer one line before
+ * reading the next, so it collects this many lines and looks up their
+ * objects together with oid_object_info_batch().
+ */
+#define INFO_BATCH_NR 4096
+
+struct queued_info {
+	char *name;
+	char *rest;
+	int pos; /* index into info_batch.oids, or -1 if not resolved */
+	enum object_type type;
+	unsigned long size;
+	off_t disk_size;
+	struct object_id delta_base_oid;
+};
+
+struct info_batch {
+	struct queued_info *queue;
+	struct object_id *oids;
+	struct object_info *info;
+	int *ret;
+	size_t nr, nr_oids;
+};
+
+static void queue_info(struct info_batch *batch, const char *obj_name,
+		       const char *rest, struct batch_options *opt,
+		       struct expand_data *data)
+{
+	struct queued_info *q = &batch->queue[batch->nr++];
+	struct object_context ctx;
+	int flags = opt->follow_symlinks ? GET_OID_FOLLOW_SYMLINKS : 0;
+
+	q->name = xstrdup(obj_name);
+	q->rest = xstrdup_or_null(rest);
+	q->pos = -1;
+
+	/*
+	 * Anything that does not resolve to an object is handed back to
+	 * batch_one_object() when the batch is printed, which reports it.
+	 */
+	if (get_oid_with_context(the_repository, obj_name, flags,
+				 &batch->oids[batch->nr_oids], &ctx) == FOUND &&
+	    ctx.mode) {
+		struct object_info *oi = &batch->info[batch->nr_oids];
+
+		memset(oi, 0, sizeof(*oi));
+		if (data->info.typep)
+			oi->typep = &q->type;
+		if (data->info.sizep)
+			oi->sizep = &q->size;
+		if (data->info.disk_sizep)
+			oi->disk_sizep = &q->disk_size;
+		if (data->info.delta_base_oid)
+			oi->delta_base_oid = &q->delta_base_oid;
+		q->pos = batch->nr_oids++;
+	}
+	strbuf_release(&ctx.symlink_path);
+}
+
+static void dispatch_info_batch(struct info_batch *batch,
+				struct strbuf *scratch,
+				struct batch_options *opt,
+				struct expand_data *data)
+{
+	size_t i;
+
+	oid_object_info_batch(the_repository, batch->oids, batch->info,
+			      batch->ret, batch->nr_oids,
+			      OBJECT_INFO_LOOKUP_REPLACE);
+
+	for (i = 0; i < batch->nr; i++) {
+		struct queued_info *q = &batch->queue[i];
+
+		data->rest = q->rest;
+		if (q->pos < 0) {
+			batch_one_object(q->name, scratch, opt, data);
+		} else if (batch->ret[q->pos] < 0) {
+			printf("%s missing\n", q->name);
+			fflush(stdout);
+		} else {
+			oidcpy(&data->oid, &batch->oids[q->pos]);
+			data->type = q->type;
+			data->size = q->size;
+			data->disk_size = q->disk_size;
+			oidcpy(&data->delta_base_oid, &q->delta_base_oid);
+			batch_object_print(scratch, opt, data);
+		}
+		free(q->name);
+		free(q->rest);
+	}
+	batch->nr = batch->nr_oids = 0;
+}
+
 struct object_cb_data {
 	struct batch_options *opt;
 	struct expand_data *expand;
@@ -724,6 +825,7 @@ static int batch_objects(struct batch_options *opt)
 	struct strbuf input = STRBUF_INIT;
 	struct strbuf output = STRBUF_INIT;
 	struct expand_data data;
+	struct info_batch batch = { 0 };
 	int save_warning;
 	int retval = 0;
 
@@ -808,6 +910,13 @@ static int batch_objects(struct batch_options *opt)
 		goto cleanup;
 	}
 
+	if (opt->buffer_output && opt->batch_mode == BATCH_MODE_INFO) {
+		ALLOC_ARRAY(batch.queue, INFO_BATCH_NR);
+		ALLOC_ARRAY(batch.oids, INFO_BATCH_NR);
+		ALLOC_ARRAY(batch.info, INFO_BATCH_NR);
+		ALLOC_ARRAY(batch.ret, INFO_BATCH_NR);
+	}
+
 	while (1) {
 		int ret;
 		if (opt->nul_terminated)
@@ -832,10 +941,22 @@ static int batch_objects(struct batch_options *opt)
 			data.rest = p;
 		}
 
-		batch_one_object(input.buf, &output, opt, &data);
+		if (!batch.queue) {
+			batch_one_object(input.buf, &output, opt, &data);
+			continue;
+		}
+		queue_info(&batch, input.buf, data.rest, opt, &data);
+		if (batch.nr == INFO_BATCH_NR)
+			dispatch_info_batch(&batch, &output, opt, &data);
 	}
+	if (batch.nr)
+		dispatch_info_batch(&batch, &output, opt, &data);
 
  cleanup:
+	free(batch.queue);
+	free(batch.oids);
+	free(batch.info);
+	free(batch.ret);
 	strbuf_release(&input);
 	strbuf_release(&output);
 	warn_on_object_refname_ambiguity = save_warning;
@@ -13,6 +13,9 @@
 #include "quote.h"
 #include "packfile.h"
 #include "object-store.h"
+#include "revision.h"
+#include "list-objects.h"
+#include "pack-bitmap.h"
 
 static unsigned long garbage;
 static off_t size_garbage;
@@ -86,18 +89,111 @@ static int print_alternate(struct object_directory *odb, void *data)
 	return 0;
 }
 
+static void add_object_stats(struct object *obj,
+			     struct bitmap_type_stats *stats)
+{
+	struct object_info oi = OBJECT_INFO_INIT;
+	unsigned long size;
+	off_t disk_size;
+
+	oi.sizep = &size;
+	oi.disk_sizep = &disk_size;
+	if (oid_object_info_extended(the_repository, &obj->oid, &oi, 0) < 0)
+		die(_("unable to get size of '%s'"), oid_to_hex(&obj->oid));
+
+	stats[obj->type].count++;
+	stats[obj->type].size += size;
+	stats[obj->type].disk_size += disk_size;
+}
+
+static void reachable_commit(struct commit *commit, void *data)
+{
+	add_object_stats(&commit->object, data);
+}
+
+static void reachable_object(struct object *obj, const char *name, void *data)
+{
+	add_object_stats(obj, data);
+}
+
+/*
+ * Count the objects reachable from the refs and HEAD, and add up their
+ * sizes: with the reachability bitmaps if there are some, by walking
+ * the objects otherwise.
+ */
+static void count_reachable(struct bitmap_type_stats *stats)
+{
+	const char *args[] = { "count-objects", "--all", "--objects", NULL };
+	struct rev_info revs;
+	struct bitmap_index *bitmap_git;
+
+	repo_init_revisions(the_repository, &revs, NULL);
+	setup_revisions(ARRAY_SIZE(args) - 1, args, &revs, NULL);
+
+	bitmap_git = prepare_bitmap_walk(&revs, 0);
+	if (bitmap_git) {
+		get_stats_from_bitmap(bitmap_git,
+				      (1 << OBJ_COMMIT) | (1 << OBJ_TREE) |
+				      (1 << OBJ_BLOB) | (1 << OBJ_TAG),
+				      BITMAP_STATS_DISK_SIZE | BITMAP_STATS_SIZE,
+				      stats);
+		free_bitmap_index(bitmap_git);
+	} else {
+		memset(stats, 0, sizeof(*stats) * (OBJ_TAG + 1));
+		if (prepare_revision_walk(&revs))
+			die(_("revision walk setup failed"));
+		traverse_commit_list(&revs, reachable_commit, reachable_object,
+				     stats);
+	}
+	release_revisions(&revs);
+}
+
+static void print_reachable(int human_readable)
+{
+	struct bitmap_type_stats stats[OBJ_TAG + 1];
+	struct strbuf size_buf = STRBUF_INIT;
+	struct strbuf disk_buf = STRBUF_INIT;
+	enum object_type type;
+
+	count_reachable(stats);
+
+	for (type = OBJ_COMMIT; type <= OBJ_TAG; type++) {
+		const char *name = type_name(type);
+
+		strbuf_reset(&size_buf);
+		strbuf_reset(&disk_buf);
+		if (human_readable) {
+			strbuf_humanise_bytes(&size_buf, stats[type].size);
+			strbuf_humanise_bytes(&disk_buf, stats[type].disk_size);
+		} else {
+			strbuf_addf(&size_buf, "%"PRIuMAX,
+				    (uintmax_t)(stats[type].size / 1024));
+			strbuf_addf(&disk_buf, "%"PRIuMAX,
+				    (uintmax_t)(stats[type].disk_size / 1024));
+		}
+
+		printf("reachable-%ss: %"PRIu32"\n", name, stats[type].count);
+		printf("reachable-%ss-size: %s\n", name, size_buf.buf);
+		printf("reachable-%ss-disk-usage: %s\n", name, disk_buf.buf);
+	}
+	strbuf_release(&size_buf);
+	strbuf_release(&disk_buf);
+}
+
 static char const * const count_objects_usage[] = {
-	"git count-objects [-v] [-H | --human-readable]",
+	"git count-objects [-v] [-H | --human-readable] [--reachable]",
 	NULL
 };
 
 int cmd_count_objects(int argc, const char **argv, const char *prefix)
 {
-	int human_readable = 0;
+	int human_readable = 0, reachable = 0;
 	struct option opts[] = {
 		OPT__VERBOSE(&verbose, N_("be verbose")),
 		OPT_BOOL('H', "human-readable", &human_readable,
 			 N_("print sizes in human readable format")),
+		OPT_BOOL(0, "reachable", &reachable,
+			 N_("count the reachable objects of each type")),
 		OPT_END(),
 	};
 
@@ -168,5 +264,7 @@ int cmd_count_objects(int argc, const char **argv, const char *prefix)
 		printf("%lu objects, %s\n", loose, buf.buf);
 		strbuf_release(&buf);
 	}
+	if (reachable)
+		print_reachable(human_readable);
 	return 0;
 }
@@ -86,6 +86,27 @@ static LIST_HEAD(done_head);
 static size_t base_cache_used;
 static size_t base_cache_limit;
 
+/*
+ * Non-delta objects inflated by parse_pack_objects() that are waiting for
+ * a first_pass_worker() to hash and check them. The queue is a ring of
+ * first_pass_alloc entries, and the reader stops adding to it once
+ * first_pass_bytes (the total size of the queued objects) would exceed
+ * first_pass_limit.
+ *
+ * Everything here is guarded by first_pass_mutex.
+ */
+struct first_pass_job {
+	struct object_entry *obj;
+	void *data;
+};
+static struct first_pass_job *first_pass_queue;
+static int first_pass_alloc, first_pass_head, first_pass_nr;
+static size_t first_pass_bytes, first_pass_limit;
+static int first_pass_done;
+static pthread_mutex_t first_pass_mutex;
+static pthread_cond_t first_pass_work_cond;
+static pthread_cond_t first_pass_space_cond;
+
 struct thread_local {
 	pthread_t thread;
 	int pack_fd;
@@ -452,17 +473,24 @@ static void *unpack_entry_data(off_t offset, unsigned long size,
 	char hdr[32];
 	int hdrlen;
 
-	if (!is_delta_type(type)) {
-		hdrlen = format_object_header(hdr, sizeof(hdr), type, size);
-		the_hash_algo->init_fn(&c);
-		the_hash_algo->update_fn(&c, hdr, hdrlen);
-	} else
-		oid = NULL;
 	if (type == OBJ_BLOB && size > big_file_threshold)
 		buf = fixed_buf;
 	else
 		buf = xmallocz(size);
 
+	/*
+	 * Objects we keep in memory are hashed by a first_pass_worker()
+	 * when there are any; only streamed large blobs must be hashed
+	 * while inflating.
+	 */
+	if (is_delta_type(type) || (first_pass_queue && buf != fixed_buf))
+		oid = NULL;
+	if (oid) {
+		hdrlen = format_object_header(hdr, sizeof(hdr), type, size);
+		the_hash_algo->init_fn(&c);
+		the_hash_algo->update_fn(&c, hdr, hdrlen);
+	}
+
 	memset(&stream, 0, sizeof(stream));
 	git_inflate_init(&stream);
 	stream.next_out = buf;
@@ -1142,11 +1170,110 @@ static void *threaded_second_pass(void *data)
 	return NULL;
 }
 
+static void *first_pass_worker(void *data)
+{
+	for (;;) {
+		struct first_pass_job job;
+
+		pthread_mutex_lock(&first_pass_mutex);
+		while (!first_pass_nr && !first_pass_done)
+			pthread_cond_wait(&first_pass_work_cond, &first_pass_mutex);
+		if (!first_pass_nr) {
+			pthread_mutex_unlock(&first_pass_mutex);
+			break;
+		}
+		job = first_pass_queue[first_pass_head];
+		first_pass_head = (first_pass_head + 1) % first_pass_alloc;
+		first_pass_nr--;
+		pthread_mutex_unlock(&first_pass_mutex);
+
+		hash_object_file(the_hash_algo, job.data, job.obj->size,
+				 job.obj->type, &job.obj->idx.oid);
+		sha1_object(job.data, NULL, job.obj->size, job.obj->type,
+			    &job.obj->idx.oid);
+		free(job.data);
+
+		pthread_mutex_lock(&first_pass_mutex);
+		first_pass_bytes -= job.obj->size;
+		pthread_cond_signal(&first_pass_space_cond);
+		pthread_mutex_unlock(&first_pass_mutex);
+	}
+	return NULL;
+}
+
+/*
+ * Hand an inflated non-delta object over to the first pass workers, which
+ * take ownership of "data".
+ */
+static void queue_first_pass(struct object_entry *obj, void *data)
+{
+	pthread_mutex_lock(&first_pass_mutex);
+	while (first_pass_nr == first_pass_alloc ||
+	       (first_pass_nr && first_pass_bytes + obj->size > first_pass_limit))
+		pthread_cond_wait(&first_pass_space_cond, &first_pass_mutex);
+	first_pass_queue[(first_pass_head + first_pass_nr) % first_pass_alloc].obj = obj;
+	first_pass_queue[(first_pass_head + first_pass_nr) % first_pass_alloc].data = data;
+	first_pass_nr++;
+	first_pass_bytes += obj->size;
+	pthread_cond_signal(&first_pass_work_cond);
+	pthread_mutex_unlock(&first_pass_mutex);
+}
+
+static void start_first_pass_threads(void)
+{
+	int i;
+
+	init_recursive_mutex(&read_mutex);
+	pthread_mutex_init(&first_pass_mutex, NULL);
+	pthread_cond_init(&first_pass_work_cond, NULL);
+	pthread_cond_init(&first_pass_space_cond, NULL);
+	first_pass_alloc = 64 * nr_threads;
+	CALLOC_ARRAY(first_pass_queue, first_pass_alloc);
+	first_pass_limit = delta_base_cache_limit;
+	CALLOC_ARRAY(thread_data, nr_threads);
+	threads_active = 1;
+
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&thread_data[i].thread, NULL,
+					 first_pass_worker, NULL);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+}
+
+/*
+ * Wait until every queued object has been hashed; only then are the
+ * object names of the first pass complete.
+ */
+static void finish_first_pass_threads(void)
+{
+	int i;
+
+	pthread_mutex_lock(&first_pass_mutex);
+	first_pass_done = 1;
+	pthread_cond_broadcast(&first_pass_work_cond);
+	pthread_mutex_unlock(&first_pass_mutex);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(thread_data[i].thread, NULL);
+
+	threads_active = 0;
+	FREE_AND_NULL(thread_data);
+	FREE_AND_NULL(first_pass_queue);
+	pthread_cond_destroy(&first_pass_space_cond);
+	pthread_cond_destroy(&first_pass_work_cond);
+	pthread_mutex_destroy(&first_pass_mutex);
+	pthread_mutex_destroy(&read_mutex);
+}
+
 /*
  * First pass:
  * - find locations of all objects;
  * - calculate SHA1 of all non-delta objects;
  * - remember base (SHA1 or offset) for all deltas.
+ *
+ * With threads, the calling thread only reads and inflates the pack,
+ * which has to happen in order to find where each object ends. Hashing
+ * and checking the non-delta objects is left to a pool of workers.
  */
 static void parse_pack_objects(unsigned char *hash)
 {
@@ -1155,6 +1282,9 @@ static void parse_pack_objects(unsigned char *hash)
 	struct object_id ref_delta_oid;
 	struct stat st;
 
+	if (HAVE_THREADS && (nr_threads > 1 || getenv("GIT_FORCE_THREADS")))
+		start_first_pass_threads();
+
 	if (verbose)
 		progress = start_progress(
 				progress_title ? progress_title :
@@ -1179,6 +1309,9 @@ static void parse_pack_objects(unsigned char *hash)
 			/* large blobs, check later */
 			obj->real_type = OBJ_BAD;
 			nr_delays++;
+		} else if (first_pass_queue) {
+			queue_first_pass(obj, data);
+			data = NULL;
 		} else
 			sha1_object(data, NULL, obj->size, obj->type,
 				    &obj->idx.oid);
@@ -1186,6 +1319,8 @@ static void parse_pack_objects(unsigned char *hash)
 		display_progress(progress, i+1);
 	}
 	objects[i].idx.offset = consumed_bytes;
+	if (first_pass_queue)
+		finish_first_pass_threads();
 	stop_progress(&progress);
 
 	/* Check pack integrity */
@@ -383,6 +383,40 @@ static void construct_fullname(struct strbuf *out, const struct repository *repo
 	strbuf_addstr(out, ce->name);
 }
 
+/*
+ * Without --sparse, a sparse directory entry has to be shown as the
+ * files it stands for, which needs the index to be expanded.  That is
+ * only the case when some pathspec item could match inside one.
+ */
+static int pathspec_reaches_sparse_dir(struct repository *repo)
+{
+	struct index_state *istate = repo->index;
+	int i, j;
+
+	if (!istate->sparse_index)
+		return 0;
+	if (!pathspec.nr || repo->submodule_prefix ||
+	    (pathspec.magic & ~PATHSPEC_LITERAL))
+		return 1;
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		if (!S_ISSPARSEDIR(ce->ce_mode))
+			continue;
+		for (j = 0; j < pathspec.nr; j++) {
+			const struct pathspec_item *item = &pathspec.items[j];
+			int len = item->nowildcard_len;
+
+			if (len > ce_namelen(ce))
+				len = ce_namelen(ce);
+			if (!strncmp(item->match, ce->name, len))
+				return 1;
+		}
+	}
+	return 0;
+}
+
 static void show_files(struct repository *repo, struct dir_struct *dir)
 {
 	int i;
@@ -402,7 +436,7 @@ static void show_files(struct repository *repo, struct dir_struct *dir)
 	if (!(show_cached || show_stage || show_deleted || show_modified))
 		return;
 
-	if (!show_sparse_dirs)
+	if (!show_sparse_dirs && pathspec_reaches_sparse_dir(repo))
 		ensure_full_index(repo->index);
 
 	for (i = 0; i < repo->index->cache_nr; i++) {
@@ -156,6 +156,63 @@ static int empty_dir_has_sparse_contents(const char *name)
 	return ret;
 }
 
+/*
+ * A sparse index can be used as is when every source and destination
+ * lies inside the sparse-checkout cone and no source directory has a
+ * sparse directory entry below it; anything else is looked up entry by
+ * entry and needs the index expanded.
+ */
+static int mv_needs_expanded_index(const char **source, int nr,
+				   const char *dest)
+{
+	struct strbuf dir = STRBUF_INIT, sb = STRBUF_INIT;
+	int i, pos, ret = 0;
+
+	if (!the_index.sparse_index)
+		return 0;
+
+	strbuf_addstr(&dir, dest);
+	strbuf_strip_suffix(&dir, "/");
+	if (!path_in_cone_mode_sparse_checkout(dir.buf, &the_index))
+		ret = 1;
+	if (dir.len)
+		strbuf_addch(&dir, '/');
+
+	for (i = 0; !ret && i < nr; i++) {
+		const char *base = strrchr(source[i], '/');
+
+		strbuf_reset(&sb);
+		strbuf_addbuf(&sb, &dir);
+		strbuf_addstr(&sb, base ? base + 1 : source[i]);
+		if (!path_in_cone_mode_sparse_checkout(source[i], &the_index) ||
+		    !path_in_cone_mode_sparse_checkout(sb.buf, &the_index)) {
+			ret = 1;
+			break;
+		}
+
+		strbuf_reset(&sb);
+		strbuf_addf(&sb, "%s/", source[i]);
+		pos = cache_name_pos(sb.buf, sb.len);
+		if (pos >= 0) {
+			ret = 1;
+			break;
+		}
+		for (pos = -pos - 1; pos < active_nr; pos++) {
+			const struct cache_entry *ce = active_cache[pos];
+
+			if (strncmp(ce->name, sb.buf, sb.len))
+				break;
+			if (S_ISSPARSEDIR(ce->ce_mode)) {
+				ret = 1;
+				break;
+			}
+		}
+	}
+	strbuf_release(&dir);
+	strbuf_release(&sb);
+	return ret;
+}
+
 int cmd_mv(int argc, const char **argv, const char *prefix)
 {
 	int i, flags, gitmodules_modified = 0;
@@ -189,6 +246,9 @@ int cmd_mv(int argc, const char **argv, const char *prefix)
 	if (--argc < 1)
 		usage_with_options(builtin_mv_usage, builtin_mv_options);
 
+	prepare_repo_settings(the_repository);
+	the_repository->settings.command_requires_full_index = 0;
+
 	hold_locked_index(&lock_file, LOCK_DIE_ON_ERROR);
 	if (read_cache() < 0)
 		die(_("index file corrupt"));
@@ -205,6 +265,8 @@ int cmd_mv(int argc, const char **argv, const char *prefix)
 	if (argc == 1 && is_directory(argv[0]) && !is_directory(argv[1]))
 		flags = 0;
 	dest_path = internal_prefix_pathspec(prefix, argv + argc, 1, flags);
+	if (mv_needs_expanded_index(source, argc, dest_path[0]))
+		ensure_full_index(&the_index);
 	dst_w_slash = add_slash(dest_path[0]);
 	submodule_gitfile = xcalloc(argc, sizeof(char *));
 
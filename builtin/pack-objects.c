@@ -2798,6 +2798,11 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
  *
  * The main thread steals half of the work from the worker that has
  * most work left to hand it to the idle worker.
+ *
+ * "Work" is measured in bytes of object data rather than in objects, as
+ * the cost of the delta search grows with the size of the objects: a
+ * worker left with a few hundred large blobs can otherwise keep running
+ * long after everybody else has finished.
  */
 
 struct thread_params {
@@ -2816,6 +2821,62 @@ struct thread_params {
 
 static pthread_cond_t progress_cond;
 
+/*
+ * delta_search_work[i] is the total size of the objects before position i
+ * of the object list given to ll_find_deltas(), so that the amount of work
+ * in any part of the list can be computed in constant time.
+ */
+static struct object_entry **delta_search_list;
+static uint64_t *delta_search_work;
+
+static void prepare_delta_search_work(struct object_entry **list,
+				      unsigned list_size)
+{
+	unsigned i;
+
+	delta_search_list = list;
+	ALLOC_ARRAY(delta_search_work, st_add(list_size, 1));
+	delta_search_work[0] = 0;
+	for (i = 0; i < list_size; i++)
+		delta_search_work[i + 1] = delta_search_work[i] +
+					   SIZE(list[i]) + 1;
+}
+
+/* The caller must hold progress_mutex. */
+static uint64_t remaining_work(const struct thread_params *p)
+{
+	size_t end = p->list + p->list_size - delta_search_list;
+
+	return delta_search_work[end] -
+	       delta_search_work[end - p->remaining];
+}
+
+/*
+ * Return how many objects to steal from the end of the victim's list, so
+ * that the victim and the thief end up with about the same amount of work
+ * left. Both keep at least "window" objects, so that neither is left with
+ * a list too short to find good deltas in. The caller must hold
+ * progress_mutex.
+ */
+static unsigned work_split_point(const struct thread_params *victim)
+{
+	size_t end = victim->list + victim->list_size - delta_search_list;
+	size_t lo = end - victim->remaining + victim->window;
+	size_t hi = end - victim->window;
+	uint64_t target = delta_search_work[end] -
+			  remaining_work(victim) / 2;
+
+	/* find the first position whose preceding work reaches the target */
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+		if (delta_search_work[mi] < target)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return end - lo;
+}
+
 /*
  * Mutex and conditional variable can't be statically-initialized on Windows.
  */
@@ -2887,6 +2948,7 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 		fprintf_ln(stderr, _("Delta compression using up to %d threads"),
 			   delta_search_threads);
 	CALLOC_ARRAY(p, delta_search_threads);
+	prepare_delta_search_work(list, list_size);
 
 	/* Partition the work amongst work threads. */
 	for (i = 0; i < delta_search_threads; i++) {
@@ -2932,10 +2994,10 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 	/*
 	 * Now let's wait for work completion.  Each time a thread is done
 	 * with its work, we steal half of the remaining work from the
-	 * thread with the largest number of unprocessed objects and give
-	 * it to that newly idle thread.  This ensure good load balancing
-	 * until the remaining object list segments are simply too short
-	 * to be worth splitting anymore.
+	 * thread with the largest amount of unprocessed object data and
+	 * give it to that newly idle thread.  This ensure good load
+	 * balancing until the remaining object list segments are simply
+	 * too short to be worth splitting anymore.
 	 */
 	while (active_threads) {
 		struct thread_params *target = NULL;
@@ -2954,10 +3016,11 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 
 		for (i = 0; i < delta_search_threads; i++)
 			if (p[i].remaining > 2*window &&
-			    (!victim || victim->remaining < p[i].remaining))
+			    (!victim ||
+			     remaining_work(victim) < remaining_work(&p[i])))
 				victim = &p[i];
 		if (victim) {
-			sub_size = victim->remaining / 2;
+			sub_size = work_split_point(victim);
 			list = victim->list + victim->list_size - sub_size;
 			while (sub_size && list[0]->hash &&
 			       list[0]->hash == list[-1]->hash) {
@@ -2969,9 +3032,9 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 				 * It is possible for some "paths" to have
 				 * so many objects that no hash boundary
 				 * might be found.  Let's just steal the
-				 * exact half in that case.
+				 * split point we computed in that case.
 				 */
-				sub_size = victim->remaining / 2;
+				sub_size = work_split_point(victim);
 				list -= sub_size;
 			}
 			target->list = list;
@@ -2996,6 +3059,8 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 		}
 	}
 	cleanup_threaded_search();
+	FREE_AND_NULL(delta_search_work);
+	delta_search_list = NULL;
 	free(p);
 }
 
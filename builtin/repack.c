@@ -614,6 +614,49 @@ static void midx_included_packs(struct string_list *include,
 	}
 }
 
+/*
+ * Whether the MIDX can be written as a new layer on top of its
+ * incremental layers, instead of collapsing them: that is the case
+ * when every pack in the existing layers stays, and, when writing
+ * bitmaps, the existing layers have one to build upon.
+ */
+static int midx_keep_chain(struct string_list *include, int write_bitmaps)
+{
+	struct strbuf chain = STRBUF_INIT;
+	struct multi_pack_index *m;
+	int keep = 0;
+
+	get_midx_chain_filename(&chain, get_object_directory());
+	if (!file_exists(chain.buf))
+		goto out;
+
+	/* the object store was closed for the new packs */
+	reprepare_packed_git(the_repository);
+	m = get_local_multi_pack_index(the_repository);
+	if (!m || !m->base_midx)
+		goto out;
+	if (write_bitmaps) {
+		struct bitmap_index *bitmap_git = prepare_midx_bitmap_git(m);
+		int have_bitmap = bitmap_git && bitmap_is_midx(bitmap_git);
+
+		free_bitmap_index(bitmap_git);
+		if (!have_bitmap)
+			goto out;
+	}
+	for (; m; m = m->base_midx) {
+		uint32_t i;
+
+		for (i = 0; i < m->num_packs; i++)
+			if (!string_list_has_string(include, m->pack_names[i]))
+				goto out;
+	}
+	keep = 1;
+out:
+	close_object_store(the_repository->objects);
+	strbuf_release(&chain);
+	return keep;
+}
+
 static int write_midx_included_packs(struct string_list *include,
 				     struct pack_geometry *geometry,
 				     const char *refs_snapshot,
@@ -622,12 +665,15 @@ static int write_midx_included_packs(struct string_list *include,
 	struct child_process cmd = CHILD_PROCESS_INIT;
 	struct string_list_item *item;
 	struct packed_git *largest = get_largest_active_pack(geometry);
+	int incremental;
 	FILE *in;
 	int ret;
 
 	if (!include->nr)
 		return 0;
 
+	incremental = midx_keep_chain(include, write_bitmaps);
+
 	cmd.in = -1;
 	cmd.git_cmd = 1;
 
@@ -642,7 +688,10 @@ static int write_midx_included_packs(struct string_list *include,
 	if (write_bitmaps)
 		strvec_push(&cmd.args, "--bitmap");
 
-	if (largest)
+	/* the preferred pack is that of the bottom layer */
+	if (incremental)
+		strvec_push(&cmd.args, "--incremental");
+	else if (largest)
 		strvec_pushf(&cmd.args, "--preferred-pack=%s",
 			     pack_basename(largest));
 
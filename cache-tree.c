@@ -8,6 +8,8 @@
 #include "replace-object.h"
 #include "promisor-remote.h"
 #include "sparse-index.h"
+#include "config.h"
+#include "thread-utils.h"
 
 #ifndef DEBUG_CACHE_TREE
 #define DEBUG_CACHE_TREE 0
@@ -458,6 +460,200 @@ static int update_one(struct cache_tree *it,
 	return i;
 }
 
+/*
+ * Invalid subtrees of a large index are independent of each other, so
+ * they are rebuilt, and their tree objects written, on several threads
+ * before the usual recursion runs.  That recursion then finds them
+ * valid and only has the levels above them left to do.  A thread that
+ * fails reports the error itself, as the recursion would have, and the
+ * update stops there.
+ */
+
+/* Below this many entries the threads are not worth starting. */
+#define CACHE_TREE_THREAD_MIN_ENTRIES 8192
+
+struct cache_tree_job {
+	struct cache_tree *it;
+	struct cache_entry **cache;
+	int entries;
+	const char *base;
+	int baselen;
+};
+
+struct cache_tree_threads {
+	pthread_mutex_t mutex;
+	struct cache_tree_job *jobs;
+	int nr, alloc, next;
+	/* subtrees with more entries than this are split further */
+	int chunk;
+	int flags;
+	int failed;
+};
+
+static int count_subtree_entries(struct cache_entry **cache, int entries,
+				 const char *base, int baselen)
+{
+	int i;
+
+	/* a sparse directory entry is named exactly "base" */
+	for (i = 0; i < entries; i++)
+		if (ce_namelen(cache[i]) < baselen ||
+		    memcmp(cache[i]->name, base, baselen))
+			break;
+	return i;
+}
+
+/*
+ * Walk the invalid part of "it" the way update_one() does, and queue
+ * the invalid subtrees that are small enough, or that cannot be split
+ * any further, as jobs.  Return the number of jobs queued.
+ */
+static int add_cache_tree_jobs(struct cache_tree_threads *ct,
+			       struct cache_tree *it,
+			       struct cache_entry **cache, int entries,
+			       const char *base, int baselen)
+{
+	int i = 0, nr = ct->nr;
+
+	while (i < entries) {
+		const struct cache_entry *ce = cache[i];
+		struct cache_tree_sub *sub;
+		const char *path, *slash;
+		int pathlen, sublen, subcnt;
+
+		path = ce->name;
+		pathlen = ce_namelen(ce);
+		if (pathlen <= baselen || memcmp(base, path, baselen))
+			break;
+
+		slash = strchr(path + baselen, '/');
+		if (!slash) {
+			i++;
+			continue;
+		}
+		sublen = slash - (path + baselen);
+		subcnt = count_subtree_entries(cache + i, entries - i, path,
+					       baselen + sublen + 1);
+		sub = find_subtree(it, path + baselen, sublen, 1);
+		if (!sub->cache_tree)
+			sub->cache_tree = cache_tree();
+
+		/* valid subtrees are left to update_one() to check */
+		if (sub->cache_tree->entry_count < 0 &&
+		    (subcnt <= ct->chunk ||
+		     !add_cache_tree_jobs(ct, sub->cache_tree, cache + i, subcnt,
+					  path, baselen + sublen + 1))) {
+			ALLOC_GROW(ct->jobs, ct->nr + 1, ct->alloc);
+			ct->jobs[ct->nr].it = sub->cache_tree;
+			ct->jobs[ct->nr].cache = cache + i;
+			ct->jobs[ct->nr].entries = subcnt;
+			ct->jobs[ct->nr].base = path;
+			ct->jobs[ct->nr].baselen = baselen + sublen + 1;
+			ct->nr++;
+		}
+		i += subcnt;
+	}
+	return ct->nr - nr;
+}
+
+static int cache_tree_job_cmp(const void *a_, const void *b_)
+{
+	const struct cache_tree_job *a = a_, *b = b_;
+
+	/* largest first, so the threads finish at about the same time */
+	return b->entries - a->entries;
+}
+
+static void *cache_tree_thread(void *data)
+{
+	struct cache_tree_threads *ct = data;
+
+	while (1) {
+		struct cache_tree_job *job;
+		int skip;
+
+		pthread_mutex_lock(&ct->mutex);
+		if (ct->failed || ct->next >= ct->nr) {
+			pthread_mutex_unlock(&ct->mutex);
+			break;
+		}
+		job = &ct->jobs[ct->next++];
+		pthread_mutex_unlock(&ct->mutex);
+
+		if (update_one(job->it, job->cache, job->entries,
+			       job->base, job->baselen, &skip, ct->flags) < 0) {
+			pthread_mutex_lock(&ct->mutex);
+			ct->failed = 1;
+			pthread_mutex_unlock(&ct->mutex);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Returns -1 if a subtree could not be updated, in which case the error
+ * has been reported already.
+ */
+static int update_subtrees_threaded(struct index_state *istate, int flags)
+{
+	struct cache_tree_threads ct = { 0 };
+	pthread_t *threads;
+	int nr_threads, own_obj_read_lock, i;
+
+	/* lazily fetching missing objects is not something to do on threads */
+	if (!HAVE_THREADS || has_promisor_remote() ||
+	    istate->cache_tree->entry_count >= 0)
+		return 0;
+	nr_threads = repo_config_thread_count(istate->repo ?
+					      istate->repo : the_repository,
+					      "index.cachetreethreads",
+					      "GIT_TEST_CACHE_TREE_THREADS",
+					      istate->cache_nr < CACHE_TREE_THREAD_MIN_ENTRIES);
+	if (nr_threads < 2)
+		return 0;
+
+	ct.chunk = istate->cache_nr / (nr_threads * 4);
+	ct.flags = flags;
+	add_cache_tree_jobs(&ct, istate->cache_tree, istate->cache,
+			    istate->cache_nr, "", 0);
+	if (ct.nr < 2) {
+		free(ct.jobs);
+		return 0;
+	}
+	QSORT(ct.jobs, ct.nr, cache_tree_job_cmp);
+
+	pthread_mutex_init(&ct.mutex, NULL);
+	own_obj_read_lock = !obj_read_use_lock;
+	enable_obj_read_lock();
+
+	/* the main thread takes jobs, too */
+	nr_threads--;
+	if (nr_threads > ct.nr - 1)
+		nr_threads = ct.nr - 1;
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL,
+					 cache_tree_thread, &ct);
+		if (err)
+			die(_("unable to create cache-tree thread: %s"),
+			    strerror(err));
+	}
+	cache_tree_thread(&ct);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	if (own_obj_read_lock)
+		disable_obj_read_lock();
+	pthread_mutex_destroy(&ct.mutex);
+	trace2_data_intmax("cache_tree", the_repository,
+			   "update/threads", nr_threads + 1);
+	trace2_data_intmax("cache_tree", the_repository,
+			   "update/jobs", ct.nr);
+	free(threads);
+	free(ct.jobs);
+	return ct.failed ? -1 : 0;
+}
+
 int cache_tree_update(struct index_state *istate, int flags)
 {
 	int skip, i;
@@ -476,8 +672,11 @@ int cache_tree_update(struct index_state *istate, int flags)
 	trace_performance_enter();
 	trace2_region_enter("cache_tree", "update", the_repository);
 	begin_odb_transaction();
-	i = update_one(istate->cache_tree, istate->cache, istate->cache_nr,
-		       "", 0, &skip, flags);
+	if (update_subtrees_threaded(istate, flags) < 0)
+		i = -1;
+	else
+		i = update_one(istate->cache_tree, istate->cache,
+			       istate->cache_nr, "", 0, &skip, flags);
 	end_odb_transaction();
 	trace2_region_leave("cache_tree", "update", the_repository);
 	trace_performance_leave("cache_tree_update");
@@ -857,6 +1056,14 @@ int cache_tree_matches_traversal(struct cache_tree *root,
 	return 0;
 }
 
+int cache_tree_matches_tree(struct index_state *istate,
+			    const struct object_id *oid)
+{
+	struct cache_tree *it = istate->cache_tree;
+
+	return it && it->entry_count >= 0 && oideq(&it->oid, oid);
+}
+
 static void verify_one_sparse(struct index_state *istate,
 			      struct strbuf *path,
 			      int pos)
@@ -54,6 +54,12 @@ void prime_cache_tree(struct repository *, struct index_state *, struct tree *);
 
 int cache_tree_matches_traversal(struct cache_tree *, struct name_entry *ent, struct traverse_info *info);
 
+/*
+ * Does the index, as recorded by its cache-tree, hold exactly the
+ * given tree?
+ */
+int cache_tree_matches_tree(struct index_state *, const struct object_id *oid);
+
 #ifdef USE_THE_INDEX_COMPATIBILITY_MACROS
 static inline int write_cache_as_tree(struct object_id *oid, int flags, const char *prefix)
 {
@@ -306,6 +306,8 @@ static inline unsigned int canon_mode(unsigned int mode)
 #define FSMONITOR_CHANGED	(1 << 8)
 
 struct split_index;
+struct index_journal;
+struct name_hash_snapshot;
 struct untracked_cache;
 struct progress;
 struct pattern_list;
@@ -340,6 +342,7 @@ struct index_state {
 	struct string_list *resolve_undo;
 	struct cache_tree *cache_tree;
 	struct split_index *split_index;
+	struct index_journal *journal;
 	struct cache_time timestamp;
 	unsigned name_hash_initialized : 1,
 		 initialized : 1,
@@ -350,6 +353,7 @@ struct index_state {
 	enum sparse_index_mode sparse_index;
 	struct hashmap name_hash;
 	struct hashmap dir_hash;
+	struct name_hash_snapshot *name_hash_snapshot;
 	struct object_id oid;
 	struct untracked_cache *untracked;
 	char *fsmonitor_last_update;
@@ -366,6 +370,12 @@ void add_name_hash(struct index_state *istate, struct cache_entry *ce);
 void remove_name_hash(struct index_state *istate, struct cache_entry *ce);
 void free_name_hash(struct index_state *istate);
 
+/* Precomputed name hash tables stored in the index */
+void write_name_hash_snapshot(struct strbuf *sb, struct index_state *istate);
+struct name_hash_snapshot *read_name_hash_snapshot(const char *data,
+						   unsigned long sz);
+void free_name_hash_snapshot(struct index_state *istate);
+
 /* Cache entry creation and cleanup */
 
 /*
@@ -670,8 +680,10 @@ int path_inside_repo(const char *prefix, const char *path);
 
 int init_db(const char *git_dir, const char *real_git_dir,
 	    const char *template_dir, int hash_algo,
+	    int ref_storage_format,
 	    const char *initial_branch, unsigned int flags);
-void initialize_repository_version(int hash_algo, int reinit);
+void initialize_repository_version(int hash_algo, int ref_storage_format,
+				   int reinit);
 
 void sanitize_stdfds(void);
 int daemonize(void);
@@ -1153,6 +1165,7 @@ struct repository_format {
 	int worktree_config;
 	int is_bare;
 	int hash_algo;
+	int ref_storage_format;
 	int sparse_index;
 	char *work_tree;
 	struct string_list unknown_extensions;
@@ -1169,6 +1182,7 @@ struct repository_format {
 	.version = -1, \
 	.is_bare = -1, \
 	.hash_algo = GIT_HASH_SHA1, \
+	.ref_storage_format = REF_STORAGE_FORMAT_FILES, \
 	.unknown_extensions = STRING_LIST_INIT_DUP, \
 	.v1_only_extensions = STRING_LIST_INIT_DUP, \
 }
@@ -1255,6 +1269,7 @@ enum sharedrepo {
 	PERM_EVERYBODY      = 0664
 };
 int git_config_perm(const char *var, const char *value);
+int calc_shared_perm(int mode);
 int adjust_shared_perm(const char *path);
 
 /*
@@ -46,6 +46,11 @@ void git_test_write_commit_graph_or_die(void)
 #define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
 #define GRAPH_CHUNKID_BASE 0x42415345 /* "BASE" */
 
+#define GRAPH_LOOKUP_SIGNATURE 0x43474c4b /* "CGLK" */
+#define GRAPH_LOOKUP_CHUNKID_LAYERS 0x4c415952 /* "LAYR" */
+#define GRAPH_LOOKUP_CHUNKID_POSITIONS 0x43504f53 /* "CPOS" */
+#define GRAPH_LOOKUP_VERSION 0x1
+
 #define GRAPH_DATA_WIDTH (the_hash_algo->rawsz + 16)
 
 #define GRAPH_VERSION_1 0x1
@@ -193,6 +198,12 @@ char *get_commit_graph_chain_filename(struct object_directory *odb)
 	return xstrfmt("%s/info/commit-graphs/commit-graph-chain", odb->path);
 }
 
+char *get_commit_graph_chain_lookup_filename(struct object_directory *odb)
+{
+	return xstrfmt("%s/info/commit-graphs/commit-graph-chain.lookup",
+		       odb->path);
+}
+
 static struct commit_graph *alloc_commit_graph(void)
 {
 	struct commit_graph *g = xcalloc(1, sizeof(*g));
@@ -566,6 +577,166 @@ static struct commit_graph *load_commit_graph_chain(struct repository *r,
 	return graph_chain;
 }
 
+/*
+ * A single table mapping every commit in a commit-graph chain to its graph
+ * position, so that a lookup does not have to search each layer in turn.
+ */
+struct commit_graph_chain_lookup {
+	const unsigned char *data;
+	size_t data_len;
+
+	uint32_t num_layers;
+	uint32_t num_commits;
+
+	const unsigned char *chunk_layers;
+	const uint32_t *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_positions;
+};
+
+static int lookup_read_layers(const unsigned char *chunk_start,
+			      size_t chunk_size, void *data)
+{
+	struct commit_graph_chain_lookup *lookup = data;
+
+	if (chunk_size % the_hash_algo->rawsz)
+		return -1;
+	lookup->chunk_layers = chunk_start;
+	lookup->num_layers = chunk_size / the_hash_algo->rawsz;
+	return 0;
+}
+
+static int lookup_read_oid_fanout(const unsigned char *chunk_start,
+				  size_t chunk_size, void *data)
+{
+	struct commit_graph_chain_lookup *lookup = data;
+	uint32_t i;
+
+	if (chunk_size != GRAPH_FANOUT_SIZE)
+		return -1;
+	lookup->chunk_oid_fanout = (const uint32_t *)chunk_start;
+	for (i = 0; i < 255; i++)
+		if (ntohl(lookup->chunk_oid_fanout[i]) >
+		    ntohl(lookup->chunk_oid_fanout[i + 1]))
+			return -1;
+	return 0;
+}
+
+static int lookup_read_oid_lookup(const unsigned char *chunk_start,
+				  size_t chunk_size, void *data)
+{
+	struct commit_graph_chain_lookup *lookup = data;
+
+	if (chunk_size % the_hash_algo->rawsz)
+		return -1;
+	lookup->chunk_oid_lookup = chunk_start;
+	lookup->num_commits = chunk_size / the_hash_algo->rawsz;
+	return 0;
+}
+
+static int lookup_read_positions(const unsigned char *chunk_start,
+				 size_t chunk_size, void *data)
+{
+	struct commit_graph_chain_lookup *lookup = data;
+
+	if (chunk_size / sizeof(uint32_t) != lookup->num_commits ||
+	    chunk_size % sizeof(uint32_t))
+		return -1;
+	lookup->chunk_positions = chunk_start;
+	return 0;
+}
+
+static void free_commit_graph_chain_lookup(struct commit_graph_chain_lookup *lookup)
+{
+	if (!lookup)
+		return;
+	munmap((void *)lookup->data, lookup->data_len);
+	free(lookup);
+}
+
+/*
+ * Load the lookup index of the chain whose top layer is "chain", if
+ * there is one and it was written for exactly this chain. Any problem
+ * with it is not an error, as we can always search the layers instead.
+ */
+static struct commit_graph_chain_lookup *load_commit_graph_chain_lookup(struct commit_graph *chain,
+									struct object_directory *odb)
+{
+	const unsigned hashsz = the_hash_algo->rawsz;
+	struct commit_graph_chain_lookup *lookup;
+	struct chunkfile *cf = NULL;
+	struct commit_graph *g;
+	const unsigned char *data;
+	char *lookup_name;
+	struct stat st;
+	size_t size;
+	uint32_t i;
+	int fd;
+
+	lookup_name = get_commit_graph_chain_lookup_filename(odb);
+	if (!open_commit_graph(lookup_name, &fd, &st)) {
+		free(lookup_name);
+		return NULL;
+	}
+	free(lookup_name);
+
+	size = xsize_t(st.st_size);
+	if (size < GRAPH_HEADER_SIZE + GRAPH_FANOUT_SIZE + hashsz) {
+		close(fd);
+		return NULL;
+	}
+
+	CALLOC_ARRAY(lookup, 1);
+	lookup->data = data = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	lookup->data_len = size;
+	close(fd);
+
+	if (get_be32(data) != GRAPH_LOOKUP_SIGNATURE ||
+	    data[4] != GRAPH_LOOKUP_VERSION ||
+	    data[5] != oid_version(the_hash_algo))
+		goto invalid;
+
+	/*
+	 * The trailing hash is left to "git commit-graph verify": hashing
+	 * the whole file would cost every process as much as the index
+	 * saves, and search_commit_pos_in_chain_lookup() checks each
+	 * position it uses against the layers anyway.
+	 */
+	cf = init_chunkfile(NULL);
+	if (read_table_of_contents(cf, data, size, GRAPH_HEADER_SIZE, data[6]) ||
+	    read_chunk(cf, GRAPH_LOOKUP_CHUNKID_LAYERS,
+		       lookup_read_layers, lookup) ||
+	    read_chunk(cf, GRAPH_CHUNKID_OIDFANOUT,
+		       lookup_read_oid_fanout, lookup) ||
+	    read_chunk(cf, GRAPH_CHUNKID_OIDLOOKUP,
+		       lookup_read_oid_lookup, lookup) ||
+	    read_chunk(cf, GRAPH_LOOKUP_CHUNKID_POSITIONS,
+		       lookup_read_positions, lookup))
+		goto invalid;
+
+	if (ntohl(lookup->chunk_oid_fanout[255]) != lookup->num_commits ||
+	    lookup->num_commits > chain->num_commits + chain->num_commits_in_base)
+		goto invalid;
+
+	/* The layers are listed base first, like the chain file. */
+	i = lookup->num_layers;
+	for (g = chain; g && i; g = g->base_graph) {
+		i--;
+		if (!hasheq(g->oid.hash, lookup->chunk_layers + hashsz * i))
+			goto invalid;
+	}
+	if (g || i)
+		goto invalid;
+
+	free_chunkfile(cf);
+	return lookup;
+
+invalid:
+	free_chunkfile(cf);
+	free_commit_graph_chain_lookup(lookup);
+	return NULL;
+}
+
 /*
  * returns 1 if and only if all graphs in the chain have
  * corrected commit dates stored in the generation_data chunk.
@@ -596,8 +767,11 @@ struct commit_graph *read_commit_graph_one(struct repository *r,
 {
 	struct commit_graph *g = load_commit_graph_v1(r, odb);
 
-	if (!g)
+	if (!g) {
 		g = load_commit_graph_chain(r, odb);
+		if (g)
+			g->chain_lookup = load_commit_graph_chain_lookup(g, odb);
+	}
 
 	validate_mixed_generation_chain(g);
 
@@ -861,11 +1035,45 @@ static int fill_commit_in_graph(struct repository *r,
 	return 1;
 }
 
+/*
+ * Returns 1 if "id" is found in the lookup index of the chain "g", 0 if it
+ * is not, and -1 if the index points somewhere it should not (in which
+ * case the caller should search the layers).
+ */
+static int search_commit_pos_in_chain_lookup(const struct object_id *id,
+					     struct commit_graph *g,
+					     uint32_t *pos)
+{
+	struct commit_graph_chain_lookup *lookup = g->chain_lookup;
+	struct object_id oid;
+	uint32_t index, graph_pos;
+
+	if (!bsearch_hash(id->hash, lookup->chunk_oid_fanout,
+			  lookup->chunk_oid_lookup, the_hash_algo->rawsz, &index))
+		return 0;
+
+	graph_pos = get_be32(lookup->chunk_positions + sizeof(uint32_t) * index);
+	if (graph_pos >= g->num_commits + g->num_commits_in_base)
+		return -1;
+	load_oid_from_graph(g, graph_pos, &oid);
+	if (!oideq(&oid, id))
+		return -1;
+
+	*pos = graph_pos;
+	return 1;
+}
+
 static int search_commit_pos_in_graph(const struct object_id *id, struct commit_graph *g, uint32_t *pos)
 {
 	struct commit_graph *cur_g = g;
 	uint32_t lex_index;
 
+	if (g && g->chain_lookup) {
+		int ret = search_commit_pos_in_chain_lookup(id, g, pos);
+		if (ret >= 0)
+			return ret;
+	}
+
 	while (cur_g && !bsearch_graph(cur_g, id, &lex_index))
 		cur_g = cur_g->base_graph;
 
@@ -2270,6 +2478,159 @@ static void expire_commit_graphs(struct write_commit_graph_context *ctx)
 	strbuf_release(&path);
 }
 
+struct chain_lookup_entry {
+	const unsigned char *hash;
+	uint32_t pos;
+};
+
+struct write_chain_lookup_context {
+	struct commit_graph *chain;
+	struct chain_lookup_entry *entries;
+	uint32_t nr;
+};
+
+static int chain_lookup_entry_cmp(const void *va, const void *vb)
+{
+	const struct chain_lookup_entry *a = va, *b = vb;
+	int cmp = hashcmp(a->hash, b->hash);
+
+	if (cmp)
+		return cmp;
+	/* Layer searches find a commit in the topmost layer first. */
+	return a->pos < b->pos ? 1 : a->pos > b->pos ? -1 : 0;
+}
+
+static void write_chain_lookup_layers_1(struct hashfile *f,
+					struct commit_graph *g)
+{
+	if (!g)
+		return;
+	write_chain_lookup_layers_1(f, g->base_graph);
+	hashwrite(f, g->oid.hash, the_hash_algo->rawsz);
+}
+
+static int write_chain_lookup_layers(struct hashfile *f, void *data)
+{
+	struct write_chain_lookup_context *ctx = data;
+	write_chain_lookup_layers_1(f, ctx->chain);
+	return 0;
+}
+
+static int write_chain_lookup_fanout(struct hashfile *f, void *data)
+{
+	struct write_chain_lookup_context *ctx = data;
+	uint32_t i, count = 0;
+
+	for (i = 0; i < 256; i++) {
+		while (count < ctx->nr && ctx->entries[count].hash[0] == i)
+			count++;
+		hashwrite_be32(f, count);
+	}
+	return 0;
+}
+
+static int write_chain_lookup_oids(struct hashfile *f, void *data)
+{
+	struct write_chain_lookup_context *ctx = data;
+	uint32_t i;
+
+	for (i = 0; i < ctx->nr; i++)
+		hashwrite(f, ctx->entries[i].hash, the_hash_algo->rawsz);
+	return 0;
+}
+
+static int write_chain_lookup_positions(struct hashfile *f, void *data)
+{
+	struct write_chain_lookup_context *ctx = data;
+	uint32_t i;
+
+	for (i = 0; i < ctx->nr; i++)
+		hashwrite_be32(f, ctx->entries[i].pos);
+	return 0;
+}
+
+/*
+ * Write (or, when it is not wanted, remove) the lookup index for the
+ * commit-graph chain that was just written.
+ */
+static int write_commit_graph_chain_lookup(struct write_commit_graph_context *ctx)
+{
+	struct write_chain_lookup_context lctx = { 0 };
+	char *lookup_name = get_commit_graph_chain_lookup_filename(ctx->odb);
+	struct lock_file lk = LOCK_INIT;
+	struct commit_graph *g;
+	struct chunkfile *cf;
+	struct hashfile *f;
+	uint32_t i, nr = 0, num_layers = 0;
+	int fd;
+
+	if (!ctx->split || !ctx->r->settings.commit_graph_write_chain_lookup) {
+		unlink(lookup_name);
+		free(lookup_name);
+		return 0;
+	}
+
+	lctx.chain = load_commit_graph_chain(ctx->r, ctx->odb);
+	if (!lctx.chain) {
+		free(lookup_name);
+		return error(_("unable to read the commit-graph chain that was just written"));
+	}
+
+	for (g = lctx.chain; g; g = g->base_graph)
+		num_layers++;
+	ALLOC_ARRAY(lctx.entries, lctx.chain->num_commits +
+				  lctx.chain->num_commits_in_base);
+	for (g = lctx.chain; g; g = g->base_graph) {
+		for (i = 0; i < g->num_commits; i++) {
+			lctx.entries[nr].hash = g->chunk_oid_lookup + g->hash_len * i;
+			lctx.entries[nr].pos = g->num_commits_in_base + i;
+			nr++;
+		}
+	}
+	QSORT(lctx.entries, nr, chain_lookup_entry_cmp);
+	for (i = 0; i < nr; i++) {
+		if (lctx.nr && hasheq(lctx.entries[lctx.nr - 1].hash,
+				      lctx.entries[i].hash))
+			continue;
+		lctx.entries[lctx.nr++] = lctx.entries[i];
+	}
+
+	hold_lock_file_for_update_mode(&lk, lookup_name, LOCK_DIE_ON_ERROR, 0444);
+	free(lookup_name);
+	fd = get_lock_file_fd(&lk);
+	f = hashfd(fd, get_lock_file_path(&lk));
+
+	cf = init_chunkfile(f);
+	add_chunk(cf, GRAPH_LOOKUP_CHUNKID_LAYERS,
+		  the_hash_algo->rawsz * num_layers, write_chain_lookup_layers);
+	add_chunk(cf, GRAPH_CHUNKID_OIDFANOUT, GRAPH_FANOUT_SIZE,
+		  write_chain_lookup_fanout);
+	add_chunk(cf, GRAPH_CHUNKID_OIDLOOKUP,
+		  the_hash_algo->rawsz * lctx.nr, write_chain_lookup_oids);
+	add_chunk(cf, GRAPH_LOOKUP_CHUNKID_POSITIONS,
+		  sizeof(uint32_t) * lctx.nr, write_chain_lookup_positions);
+
+	hashwrite_be32(f, GRAPH_LOOKUP_SIGNATURE);
+	hashwrite_u8(f, GRAPH_LOOKUP_VERSION);
+	hashwrite_u8(f, oid_version(the_hash_algo));
+	hashwrite_u8(f, get_num_chunks(cf));
+	hashwrite_u8(f, 0); /* unused padding byte */
+
+	write_chunkfile(cf, &lctx);
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_COMMIT_GRAPH,
+			  CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+	free_chunkfile(cf);
+	commit_lock_file(&lk);
+
+	free(lctx.entries);
+	while (lctx.chain) {
+		g = lctx.chain->base_graph;
+		free_commit_graph(lctx.chain);
+		lctx.chain = g;
+	}
+	return 0;
+}
+
 int write_commit_graph(struct object_directory *odb,
 		       const struct string_list *const pack_indexes,
 		       struct oidset *commits,
@@ -2425,6 +2786,9 @@ int write_commit_graph(struct object_directory *odb,
 
 	expire_commit_graphs(ctx);
 
+	if (!res)
+		res = write_commit_graph_chain_lookup(ctx);
+
 cleanup:
 	free(ctx->graph_name);
 	free(ctx->commits.list);
@@ -2495,6 +2859,11 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 		verify_commit_graph_error = VERIFY_COMMIT_GRAPH_ERROR_HASH;
 	}
 
+	if (g->chain_lookup &&
+	    !hashfile_checksum_valid(g->chain_lookup->data,
+				     g->chain_lookup->data_len))
+		graph_report(_("the commit-graph chain lookup index has incorrect checksum and is likely corrupt"));
+
 	for (i = 0; i < g->num_commits; i++) {
 		struct commit *graph_commit;
 
@@ -2648,6 +3017,7 @@ void free_commit_graph(struct commit_graph *g)
 	}
 	free(g->filename);
 	free(g->bloom_filter_settings);
+	free_commit_graph_chain_lookup(g->chain_lookup);
 	free(g);
 }
 
@@ -19,6 +19,7 @@
 void git_test_write_commit_graph_or_die(void);
 
 struct commit;
+struct commit_graph_chain_lookup;
 struct bloom_filter_settings;
 struct repository;
 struct raw_object_store;
@@ -26,6 +27,7 @@ struct string_list;
 
 char *get_commit_graph_filename(struct object_directory *odb);
 char *get_commit_graph_chain_filename(struct object_directory *odb);
+char *get_commit_graph_chain_lookup_filename(struct object_directory *odb);
 int open_commit_graph(const char *graph_file, int *fd, struct stat *st);
 
 /*
@@ -101,6 +103,12 @@ struct commit_graph {
 
 	struct topo_level_slab *topo_levels;
 	struct bloom_filter_settings *bloom_filter_settings;
+
+	/*
+	 * Only set on the top layer of a chain, if the chain has an
+	 * up-to-date lookup index covering all of its layers.
+	 */
+	struct commit_graph_chain_lookup *chain_lookup;
 };
 
 struct commit_graph *load_commit_graph_one_fd_st(struct repository *r,
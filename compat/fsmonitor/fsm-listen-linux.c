@@ -0,0 +1,713 @@
+#include "cache.h"
+#include "fsmonitor.h"
+#include "fsm-listen.h"
+#include "fsmonitor--daemon.h"
+#include <sys/inotify.h>
+
+/*
+ * inotify only reports events for directories that we explicitly
+ * watch; there is no recursive watch.  So we walk the working
+ * directory at startup and add a watch for every directory in it, and
+ * we add and drop watches as directories are created, deleted, and
+ * renamed.
+ *
+ * Events only carry the watch descriptor and the basename of the
+ * affected entry, so we keep a map from each watch descriptor back to
+ * the path of the watched directory.
+ */
+
+enum watch_type {
+	/* A directory within the working directory (proper). */
+	WATCH_WORKDIR = 0,
+
+	/* An external <gitdir> referenced by a ".git" file. */
+	WATCH_GITDIR,
+
+	/* The directory in which clients create our cookie files. */
+	WATCH_COOKIES,
+};
+
+struct watch_entry {
+	struct hashmap_entry ent;
+	int wd;
+	enum watch_type type;
+
+	/* Relative to the root of the working directory; "" for the root. */
+	char *path;
+
+	/* The last scan of the working directory that found it. */
+	unsigned int generation;
+};
+
+struct fsm_listen_data
+{
+	int fd_inotify;
+	int fd_stop[2];
+
+	struct hashmap watches;
+	unsigned int generation;
+
+	char *buf;
+	size_t buf_size;
+
+	enum shutdown_style {
+		SHUTDOWN_EVENT = 0,
+		FORCE_SHUTDOWN,
+		FORCE_ERROR_STOP,
+	} shutdown_style;
+};
+
+#define WATCH_WORKDIR_MASK (IN_ATTRIB | IN_CREATE | IN_DELETE | \
+			    IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF | \
+			    IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | \
+			    IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+#define WATCH_GITDIR_MASK (IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define WATCH_COOKIES_MASK (IN_CREATE | IN_DELETE_SELF | IN_MOVE_SELF | \
+			    IN_ONLYDIR)
+
+/*
+ * Large enough for many events per read(), and always for at least one
+ * event with the longest possible name.
+ */
+#define EVENT_BUF_SIZE (64 * 1024)
+
+static unsigned int watch_hash(int wd)
+{
+	return memhash(&wd, sizeof(wd));
+}
+
+static int watch_entry_cmp(const void *cmp_data UNUSED,
+			   const struct hashmap_entry *he1,
+			   const struct hashmap_entry *he2,
+			   const void *keydata UNUSED)
+{
+	const struct watch_entry *a =
+		container_of(he1, const struct watch_entry, ent);
+	const struct watch_entry *b =
+		container_of(he2, const struct watch_entry, ent);
+
+	return a->wd != b->wd;
+}
+
+static struct watch_entry *find_watch(struct fsm_listen_data *data, int wd)
+{
+	struct watch_entry key;
+
+	hashmap_entry_init(&key.ent, watch_hash(wd));
+	key.wd = wd;
+	return hashmap_get_entry(&data->watches, &key, ent, NULL);
+}
+
+static void free_watch(struct fsm_listen_data *data, struct watch_entry *w)
+{
+	hashmap_remove(&data->watches, &w->ent, NULL);
+	free(w->path);
+	free(w);
+}
+
+/*
+ * Add a watch for the directory at `abs_path`.  A directory that
+ * disappears before we can watch it is not an error; whoever removed
+ * it caused an event in its parent.
+ *
+ * Returns 0 on success, or -1 if the watch could not be added.
+ */
+static int add_watch(struct fsm_listen_data *data, const char *abs_path,
+		     const char *rel_path, enum watch_type type)
+{
+	struct watch_entry *w;
+	uint32_t mask;
+	int wd;
+
+	switch (type) {
+	case WATCH_GITDIR:
+		mask = WATCH_GITDIR_MASK;
+		break;
+	case WATCH_COOKIES:
+		mask = WATCH_COOKIES_MASK;
+		break;
+	case WATCH_WORKDIR:
+	default:
+		mask = WATCH_WORKDIR_MASK;
+		break;
+	}
+
+	wd = inotify_add_watch(data->fd_inotify, abs_path, mask);
+	if (wd < 0) {
+		if (errno == ENOENT || errno == ENOTDIR)
+			return 0;
+		if (errno == ENOSPC)
+			return error(_("inotify watch limit reached while "
+				       "watching '%s'; consider raising "
+				       "fs.inotify.max_user_watches"),
+				     abs_path);
+		return error_errno(_("could not watch '%s'"), abs_path);
+	}
+
+	/*
+	 * Watching a directory that we already watch (e.g. because it
+	 * was moved and we saw it again under its new name) returns the
+	 * existing descriptor.
+	 */
+	w = find_watch(data, wd);
+	if (w) {
+		free(w->path);
+	} else {
+		CALLOC_ARRAY(w, 1);
+		hashmap_entry_init(&w->ent, watch_hash(wd));
+		w->wd = wd;
+		hashmap_add(&data->watches, &w->ent);
+	}
+	w->type = type;
+	w->path = xstrdup(rel_path);
+	w->generation = data->generation;
+
+	return 0;
+}
+
+static int is_dir_entry(const char *abs_path, struct dirent *de)
+{
+	struct stat st;
+
+	switch (DTYPE(de)) {
+	case DT_DIR:
+		return 1;
+	case DT_UNKNOWN:
+		return !lstat(abs_path, &st) && S_ISDIR(st.st_mode);
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Watch the working directory subtree rooted at `rel` (relative to the
+ * root of the working directory).
+ *
+ * When `batch` is given, the subtree was just created or moved into
+ * place, and entries may have been added to it before our watch was in
+ * place.  So report every path that we find as changed.
+ */
+static int add_watches_recursive(struct fsmonitor_daemon_state *state,
+				 struct strbuf *abs, struct strbuf *rel,
+				 struct fsmonitor_batch *batch)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	size_t abs_len = abs->len, rel_len = rel->len;
+	struct dirent *de;
+	DIR *dir;
+	int ret = 0;
+
+	if (add_watch(data, abs->buf, rel->buf, WATCH_WORKDIR))
+		return -1;
+
+	/*
+	 * Read the directory only after the watch is in place, so
+	 * that we see everything created before the watch in the scan
+	 * and everything created after it as an event.
+	 */
+	dir = opendir(abs->buf);
+	if (!dir)
+		return 0;
+
+	while (!ret && (de = readdir(dir))) {
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+
+		strbuf_setlen(rel, rel_len);
+		if (rel_len)
+			strbuf_addch(rel, '/');
+		strbuf_addstr(rel, de->d_name);
+
+		if (fsmonitor_classify_path_workdir_relative(rel->buf) !=
+		    IS_WORKDIR_PATH)
+			continue;
+
+		strbuf_setlen(abs, abs_len);
+		strbuf_addch(abs, '/');
+		strbuf_addstr(abs, de->d_name);
+
+		if (batch)
+			fsmonitor_batch__add_path(batch, rel->buf);
+
+		if (!is_dir_entry(abs->buf, de))
+			continue;
+
+		if (batch) {
+			strbuf_addch(rel, '/');
+			fsmonitor_batch__add_path(batch, rel->buf);
+			strbuf_setlen(rel, rel->len - 1);
+		}
+
+		ret = add_watches_recursive(state, abs, rel, batch);
+	}
+
+	closedir(dir);
+	strbuf_setlen(abs, abs_len);
+	strbuf_setlen(rel, rel_len);
+	return ret;
+}
+
+/*
+ * Stop watching the directory `rel` and everything below it, e.g.
+ * because it has been moved away and our paths for it are stale.
+ */
+static void remove_watches_recursive(struct fsm_listen_data *data,
+				     const char *rel)
+{
+	struct hashmap_iter iter;
+	struct watch_entry *w;
+	struct watch_entry **victims = NULL;
+	size_t nr = 0, alloc = 0, i;
+	size_t len = strlen(rel);
+
+	hashmap_for_each_entry(&data->watches, &iter, w, ent) {
+		if (w->type != WATCH_WORKDIR)
+			continue;
+		if (strncmp(w->path, rel, len) ||
+		    (w->path[len] && w->path[len] != '/'))
+			continue;
+		ALLOC_GROW(victims, nr + 1, alloc);
+		victims[nr++] = w;
+	}
+
+	for (i = 0; i < nr; i++) {
+		inotify_rm_watch(data->fd_inotify, victims[i]->wd);
+		free_watch(data, victims[i]);
+	}
+
+	free(victims);
+}
+
+/*
+ * Walk the whole working directory again and watch every directory in
+ * it, e.g. after the kernel dropped events and we may have missed the
+ * creation, removal or renaming of some of them.
+ *
+ * The watches of directories that are still there are kept, with their
+ * path updated if they moved.  Those of directories that the walk did
+ * not find are dropped.
+ */
+static int rewatch_worktree(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct strbuf abs = STRBUF_INIT;
+	struct strbuf rel = STRBUF_INIT;
+	struct hashmap_iter iter;
+	struct watch_entry *w;
+	struct watch_entry **victims = NULL;
+	size_t nr = 0, alloc = 0, i;
+	int ret;
+
+	data->generation++;
+	strbuf_addbuf(&abs, &state->path_worktree_watch);
+	ret = add_watches_recursive(state, &abs, &rel, NULL);
+	strbuf_release(&abs);
+	strbuf_release(&rel);
+	if (ret)
+		return -1;
+
+	hashmap_for_each_entry(&data->watches, &iter, w, ent) {
+		if (w->type != WATCH_WORKDIR ||
+		    w->generation == data->generation)
+			continue;
+		ALLOC_GROW(victims, nr + 1, alloc);
+		victims[nr++] = w;
+	}
+
+	for (i = 0; i < nr; i++) {
+		inotify_rm_watch(data->fd_inotify, victims[i]->wd);
+		free_watch(data, victims[i]);
+	}
+	free(victims);
+
+	trace_printf_key(&trace_fsmonitor,
+			 "inotify: rewatched %d directories, dropped %d",
+			 hashmap_get_size(&data->watches), (int)nr);
+	return 0;
+}
+
+static void log_mask_set(const char *path, uint32_t mask)
+{
+	struct strbuf msg = STRBUF_INIT;
+
+	if (mask & IN_ACCESS)
+		strbuf_addstr(&msg, "IN_ACCESS|");
+	if (mask & IN_MODIFY)
+		strbuf_addstr(&msg, "IN_MODIFY|");
+	if (mask & IN_ATTRIB)
+		strbuf_addstr(&msg, "IN_ATTRIB|");
+	if (mask & IN_CLOSE_WRITE)
+		strbuf_addstr(&msg, "IN_CLOSE_WRITE|");
+	if (mask & IN_CLOSE_NOWRITE)
+		strbuf_addstr(&msg, "IN_CLOSE_NOWRITE|");
+	if (mask & IN_OPEN)
+		strbuf_addstr(&msg, "IN_OPEN|");
+	if (mask & IN_MOVED_FROM)
+		strbuf_addstr(&msg, "IN_MOVED_FROM|");
+	if (mask & IN_MOVED_TO)
+		strbuf_addstr(&msg, "IN_MOVED_TO|");
+	if (mask & IN_CREATE)
+		strbuf_addstr(&msg, "IN_CREATE|");
+	if (mask & IN_DELETE)
+		strbuf_addstr(&msg, "IN_DELETE|");
+	if (mask & IN_DELETE_SELF)
+		strbuf_addstr(&msg, "IN_DELETE_SELF|");
+	if (mask & IN_MOVE_SELF)
+		strbuf_addstr(&msg, "IN_MOVE_SELF|");
+	if (mask & IN_UNMOUNT)
+		strbuf_addstr(&msg, "IN_UNMOUNT|");
+	if (mask & IN_Q_OVERFLOW)
+		strbuf_addstr(&msg, "IN_Q_OVERFLOW|");
+	if (mask & IN_IGNORED)
+		strbuf_addstr(&msg, "IN_IGNORED|");
+	if (mask & IN_ISDIR)
+		strbuf_addstr(&msg, "IN_ISDIR|");
+
+	trace_printf_key(&trace_fsmonitor, "inotify: '%s', mask=0x%x %s",
+			 path, mask, msg.buf);
+
+	strbuf_release(&msg);
+}
+
+/*
+ * Handle an event on a directory within the working directory.
+ *
+ * Returns -1 if the daemon should shut down.
+ */
+static int handle_workdir_event(struct fsmonitor_daemon_state *state,
+				struct watch_entry *w,
+				const struct inotify_event *ev,
+				struct fsmonitor_batch **batch)
+{
+	struct strbuf rel = STRBUF_INIT;
+	struct strbuf abs = STRBUF_INIT;
+	int ret = 0;
+
+	if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+		/*
+		 * For subdirectories, the event in the parent directory
+		 * already told us everything we need to know.
+		 */
+		if (!*w->path) {
+			trace_printf_key(&trace_fsmonitor,
+					 "event: worktree root removed or renamed");
+			return -1;
+		}
+		return 0;
+	}
+
+	/* Changes to the directory itself are reported by its parent. */
+	if (!ev->len)
+		return 0;
+
+	strbuf_addstr(&rel, w->path);
+	if (rel.len)
+		strbuf_addch(&rel, '/');
+	strbuf_addstr(&rel, ev->name);
+
+	switch (fsmonitor_classify_path_workdir_relative(rel.buf)) {
+	case IS_DOT_GIT:
+		/*
+		 * If .git directory is deleted or renamed away,
+		 * we have to quit.
+		 */
+		if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+			trace_printf_key(&trace_fsmonitor,
+					 "event: gitdir removed or renamed");
+			ret = -1;
+		}
+		break;
+
+	case IS_WORKDIR_PATH:
+		if (trace_pass_fl(&trace_fsmonitor))
+			log_mask_set(rel.buf, ev->mask);
+
+		if (!*batch)
+			*batch = fsmonitor_batch__new();
+		fsmonitor_batch__add_path(*batch, rel.buf);
+
+		if (!(ev->mask & IN_ISDIR))
+			break;
+
+		/*
+		 * Tell the client to invalidate everything below the
+		 * directory, too.
+		 */
+		strbuf_addch(&rel, '/');
+		fsmonitor_batch__add_path(*batch, rel.buf);
+		strbuf_setlen(&rel, rel.len - 1);
+
+		if (ev->mask & IN_MOVED_FROM)
+			remove_watches_recursive(state->listen_data, rel.buf);
+
+		if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+			strbuf_addbuf(&abs, &state->path_worktree_watch);
+			strbuf_addch(&abs, '/');
+			strbuf_addbuf(&abs, &rel);
+			if (add_watches_recursive(state, &abs, &rel, *batch))
+				ret = -1;
+		}
+		break;
+
+	case IS_INSIDE_DOT_GIT_WITH_COOKIE_PREFIX:
+	case IS_INSIDE_DOT_GIT:
+	case IS_OUTSIDE_CONE:
+	default:
+		/* we do not watch inside .git, except for the cookie dir */
+		break;
+	}
+
+	strbuf_release(&rel);
+	strbuf_release(&abs);
+	return ret;
+}
+
+/*
+ * Process the events in one read() worth of buffer.
+ *
+ * Returns -1 if the daemon should shut down.
+ */
+static int process_events(struct fsmonitor_daemon_state *state,
+			  const char *buf, ssize_t len)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct fsmonitor_batch *batch = NULL;
+	struct string_list cookie_list = STRING_LIST_INIT_DUP;
+	const char *p;
+
+	/*
+	 * Build a list of all filesystem changes into a private/local
+	 * list and without holding any locks.
+	 */
+	for (p = buf; p < buf + len;
+	     p += sizeof(struct inotify_event) +
+		     ((const struct inotify_event *)p)->len) {
+		const struct inotify_event *ev =
+			(const struct inotify_event *)p;
+		struct watch_entry *w;
+
+		if (ev->mask & IN_Q_OVERFLOW) {
+			/*
+			 * The kernel dropped events, so we have lost sync
+			 * with the filesystem.  Flush the cached data and
+			 * discard the batch that we were locally building
+			 * (since it is conceptually relative to the just
+			 * flushed token).
+			 *
+			 * The dropped events may have created or moved
+			 * directories that we do not watch yet, so walk
+			 * the working directory again, as at startup.
+			 */
+			trace_printf_key(&trace_fsmonitor,
+					 "event: inotify queue overflow");
+			fsmonitor_force_resync(state);
+			fsmonitor_batch__free_list(batch);
+			batch = NULL;
+			string_list_clear(&cookie_list, 0);
+			if (rewatch_worktree(state))
+				goto force_shutdown;
+			continue;
+		}
+
+		w = find_watch(data, ev->wd);
+		if (!w)
+			continue; /* a watch that we already dropped */
+
+		if (ev->mask & IN_IGNORED) {
+			/*
+			 * The kernel has already removed the watch, e.g.
+			 * because the directory was deleted or its file
+			 * system unmounted.  We cannot go on without the
+			 * worktree root, the <gitdir> or the cookie dir.
+			 */
+			int essential = w->type != WATCH_WORKDIR || !*w->path;
+
+			free_watch(data, w);
+			if (essential) {
+				trace_printf_key(&trace_fsmonitor,
+						 "event: essential watch removed");
+				goto force_shutdown;
+			}
+			continue;
+		}
+
+		switch (w->type) {
+		case WATCH_COOKIES:
+			if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+				trace_printf_key(&trace_fsmonitor,
+						 "event: cookie dir removed");
+				goto force_shutdown;
+			}
+			if (ev->len)
+				string_list_append(&cookie_list, ev->name);
+			break;
+
+		case WATCH_GITDIR:
+			if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+				trace_printf_key(&trace_fsmonitor,
+						 "event: gitdir removed or renamed");
+				goto force_shutdown;
+			}
+			break;
+
+		case WATCH_WORKDIR:
+		default:
+			if (handle_workdir_event(state, w, ev, &batch))
+				goto force_shutdown;
+			break;
+		}
+	}
+
+	fsmonitor_publish(state, batch, &cookie_list);
+	string_list_clear(&cookie_list, 0);
+	return 0;
+
+force_shutdown:
+	fsmonitor_batch__free_list(batch);
+	string_list_clear(&cookie_list, 0);
+	return -1;
+}
+
+int fsm_listen__ctor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+	struct strbuf abs = STRBUF_INIT;
+	struct strbuf rel = STRBUF_INIT;
+
+	CALLOC_ARRAY(data, 1);
+	state->listen_data = data;
+	data->fd_stop[0] = data->fd_stop[1] = -1;
+	hashmap_init(&data->watches, watch_entry_cmp, NULL, 0);
+
+	data->fd_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (data->fd_inotify < 0) {
+		error_errno(_("could not initialize inotify"));
+		goto failed;
+	}
+
+	if (pipe(data->fd_stop) < 0) {
+		error_errno(_("could not create pipe"));
+		goto failed;
+	}
+
+	data->buf_size = EVENT_BUF_SIZE;
+	data->buf = xmalloc(data->buf_size);
+
+	strbuf_addbuf(&abs, &state->path_worktree_watch);
+	if (add_watches_recursive(state, &abs, &rel, NULL))
+		goto failed;
+
+	if (state->nr_paths_watching > 1 &&
+	    add_watch(data, state->path_gitdir_watch.buf, "", WATCH_GITDIR))
+		goto failed;
+
+	if (add_watch(data, state->path_cookie_prefix.buf, "", WATCH_COOKIES))
+		goto failed;
+
+	trace_printf_key(&trace_fsmonitor, "inotify: watching %d directories",
+			 hashmap_get_size(&data->watches));
+
+	strbuf_release(&abs);
+	strbuf_release(&rel);
+	return 0;
+
+failed:
+	strbuf_release(&abs);
+	strbuf_release(&rel);
+	fsm_listen__dtor(state);
+	return -1;
+}
+
+void fsm_listen__dtor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+	struct hashmap_iter iter;
+	struct watch_entry *w;
+
+	if (!state || !state->listen_data)
+		return;
+
+	data = state->listen_data;
+
+	hashmap_for_each_entry(&data->watches, &iter, w, ent)
+		free(w->path);
+	hashmap_clear_and_free(&data->watches, struct watch_entry, ent);
+
+	if (data->fd_inotify >= 0)
+		close(data->fd_inotify);
+	if (data->fd_stop[0] >= 0)
+		close(data->fd_stop[0]);
+	if (data->fd_stop[1] >= 0)
+		close(data->fd_stop[1]);
+	free(data->buf);
+
+	FREE_AND_NULL(state->listen_data);
+}
+
+void fsm_listen__stop_async(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+
+	data = state->listen_data;
+	data->shutdown_style = SHUTDOWN_EVENT;
+
+	if (write_in_full(data->fd_stop[1], "", 1) < 0)
+		warning_errno(_("could not wake up the inotify listener"));
+}
+
+void fsm_listen__loop(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+
+	data = state->listen_data;
+
+	for (;;) {
+		struct pollfd pfd[2];
+		ssize_t len;
+
+		pfd[0].fd = data->fd_inotify;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = data->fd_stop[0];
+		pfd[1].events = POLLIN;
+
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			error_errno(_("could not poll inotify"));
+			data->shutdown_style = FORCE_ERROR_STOP;
+			break;
+		}
+
+		if (pfd[1].revents)
+			break; /* fsm_listen__stop_async() was called */
+
+		if (!(pfd[0].revents & POLLIN))
+			continue;
+
+		len = read(data->fd_inotify, data->buf, data->buf_size);
+		if (len < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			error_errno(_("could not read inotify events"));
+			data->shutdown_style = FORCE_ERROR_STOP;
+			break;
+		}
+
+		if (process_events(state, data->buf, len)) {
+			data->shutdown_style = FORCE_SHUTDOWN;
+			break;
+		}
+	}
+
+	switch (data->shutdown_style) {
+	case FORCE_ERROR_STOP:
+		state->listen_error_code = -1;
+		/* fall thru */
+	case FORCE_SHUTDOWN:
+		ipc_server_stop_async(state->ipc_server_data);
+		/* fall thru */
+	case SHUTDOWN_EVENT:
+	default:
+		break;
+	}
+}
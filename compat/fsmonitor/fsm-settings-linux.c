@@ -0,0 +1,75 @@
+#include "cache.h"
+#include "config.h"
+#include "repository.h"
+#include "fsmonitor-settings.h"
+#include "fsmonitor.h"
+#include <sys/vfs.h>
+
+/*
+ * Filesystem magic numbers from <linux/magic.h>.  Define the ones we
+ * need here, since not every libc ships that header.
+ */
+#define NFS_SUPER_MAGIC   0x6969
+#define SMB_SUPER_MAGIC   0x517b
+#define CIFS_SUPER_MAGIC  0xff534d42
+#define SMB2_SUPER_MAGIC  0xfe534d42
+#define CODA_SUPER_MAGIC  0x73757245
+#define AFS_SUPER_MAGIC   0x5346414f
+#define V9FS_MAGIC        0x01021997
+#define MSDOS_SUPER_MAGIC 0x4d44
+#define EXFAT_SUPER_MAGIC 0x2011bab0
+
+/*
+ * [1] Remote working directories are problematic for FSMonitor.
+ *
+ * inotify only reports changes made through the local kernel.  On a
+ * network file system, changes made by other clients (or on the
+ * server itself) are not reported at all, so the daemon would
+ * silently miss them.  Mark remote working directories as
+ * incompatible.
+ *
+ * [2] FAT32 and exFAT working directories are problematic too.
+ *
+ * The builtin FSMonitor uses a Unix domain socket in the .git
+ * directory for IPC.  These drive formats do not support Unix domain
+ * sockets, so mark them as incompatible for the daemon.
+ */
+static enum fsmonitor_reason check_volume(struct repository *r)
+{
+	struct statfs fs;
+
+	if (statfs(r->worktree, &fs) == -1) {
+		int saved_errno = errno;
+		trace_printf_key(&trace_fsmonitor, "statfs('%s') failed: %s",
+				 r->worktree, strerror(saved_errno));
+		errno = saved_errno;
+		return FSMONITOR_REASON_ERROR;
+	}
+
+	trace_printf_key(&trace_fsmonitor,
+			 "statfs('%s') [type 0x%08lx]",
+			 r->worktree, (unsigned long)fs.f_type);
+
+	switch ((unsigned long)fs.f_type) {
+	case NFS_SUPER_MAGIC:
+	case SMB_SUPER_MAGIC:
+	case CIFS_SUPER_MAGIC:
+	case SMB2_SUPER_MAGIC:
+	case CODA_SUPER_MAGIC:
+	case AFS_SUPER_MAGIC:
+	case V9FS_MAGIC:
+		return FSMONITOR_REASON_REMOTE;
+
+	case MSDOS_SUPER_MAGIC:
+	case EXFAT_SUPER_MAGIC:
+		return FSMONITOR_REASON_NOSOCKETS;
+
+	default:
+		return FSMONITOR_REASON_OK;
+	}
+}
+
+enum fsmonitor_reason fsm_os__incompatible(struct repository *r)
+{
+	return check_volume(r);
+}
@@ -0,0 +1,223 @@
+#include "git-compat-util.h"
+#include "compat/linux/statx-batch.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+
+/*
+ * A minimal io_uring client: only what is needed to queue statx()
+ * calls and wait for all of them, without depending on liburing.
+ */
+struct statx_batch {
+	int fd;
+	unsigned size;
+
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned *sq_head, *sq_tail, sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, cq_mask;
+	struct io_uring_cqe *cqes;
+
+	struct statx *stx;
+
+	/* calls still running after a failure; "stx" must then be kept */
+	unsigned inflight;
+};
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+			  unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+struct statx_batch *statx_batch_init(unsigned size)
+{
+	struct io_uring_params p;
+	struct statx_batch *b;
+
+	memset(&p, 0, sizeof(p));
+	CALLOC_ARRAY(b, 1);
+	b->fd = io_uring_setup(size, &p);
+	if (b->fd < 0) {
+		free(b);
+		return NULL;
+	}
+	/* the completion ring is at least as large as the submission ring */
+	b->size = p.sq_entries < size ? p.sq_entries : size;
+
+	b->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	b->cq_ring_size = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (b->cq_ring_size > b->sq_ring_size)
+			b->sq_ring_size = b->cq_ring_size;
+		b->cq_ring_size = b->sq_ring_size;
+	}
+	b->sq_ring = mmap(NULL, b->sq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, b->fd, IORING_OFF_SQ_RING);
+	if (b->sq_ring == MAP_FAILED)
+		goto fail_sq;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		b->cq_ring = b->sq_ring;
+	} else {
+		b->cq_ring = mmap(NULL, b->cq_ring_size, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_POPULATE, b->fd,
+				  IORING_OFF_CQ_RING);
+		if (b->cq_ring == MAP_FAILED)
+			goto fail_cq;
+	}
+	b->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	b->sqes = mmap(NULL, b->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, b->fd, IORING_OFF_SQES);
+	if (b->sqes == MAP_FAILED)
+		goto fail_sqes;
+
+	b->sq_head = (unsigned *)((char *)b->sq_ring + p.sq_off.head);
+	b->sq_tail = (unsigned *)((char *)b->sq_ring + p.sq_off.tail);
+	b->sq_mask = *(unsigned *)((char *)b->sq_ring + p.sq_off.ring_mask);
+	b->sq_array = (unsigned *)((char *)b->sq_ring + p.sq_off.array);
+	b->cq_head = (unsigned *)((char *)b->cq_ring + p.cq_off.head);
+	b->cq_tail = (unsigned *)((char *)b->cq_ring + p.cq_off.tail);
+	b->cq_mask = *(unsigned *)((char *)b->cq_ring + p.cq_off.ring_mask);
+	b->cqes = (struct io_uring_cqe *)((char *)b->cq_ring + p.cq_off.cqes);
+
+	CALLOC_ARRAY(b->stx, b->size);
+	return b;
+
+fail_sqes:
+	if (b->cq_ring != b->sq_ring)
+		munmap(b->cq_ring, b->cq_ring_size);
+fail_cq:
+	munmap(b->sq_ring, b->sq_ring_size);
+fail_sq:
+	close(b->fd);
+	free(b);
+	return NULL;
+}
+
+static void statx_to_stat(const struct statx *stx, struct stat *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	st->st_ino = stx->stx_ino;
+	st->st_mode = stx->stx_mode;
+	st->st_nlink = stx->stx_nlink;
+	st->st_uid = stx->stx_uid;
+	st->st_gid = stx->stx_gid;
+	st->st_size = stx->stx_size;
+	st->st_atim.tv_sec = stx->stx_atime.tv_sec;
+	st->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+	st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+	st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+	st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+	st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+/*
+ * Wait for the calls that are still running when the ring fails, as
+ * they write into "stx" and read their paths from the caller's memory.
+ * If even that fails, "inflight" is left set.
+ */
+static void statx_batch_drain(struct statx_batch *b)
+{
+	while (b->inflight) {
+		unsigned head, ctail;
+		int ret = io_uring_enter(b->fd, 0, b->inflight,
+					 IORING_ENTER_GETEVENTS);
+
+		if (ret < 0 && errno != EINTR)
+			return;
+
+		head = *b->cq_head;
+		ctail = __atomic_load_n(b->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != ctail && b->inflight; head++)
+			b->inflight--;
+		__atomic_store_n(b->cq_head, head, __ATOMIC_RELEASE);
+	}
+}
+
+int statx_batch_run(struct statx_batch *b, const char **paths,
+		    struct stat *st, int *errs, unsigned nr)
+{
+	unsigned tail, i, submitted = 0, done = 0;
+
+	if (nr > b->size)
+		BUG("statx batch of %u paths, but room for %u", nr, b->size);
+
+	tail = *b->sq_tail;
+	for (i = 0; i < nr; i++) {
+		unsigned idx = tail++ & b->sq_mask;
+		struct io_uring_sqe *sqe = &b->sqes[idx];
+
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_STATX;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uintptr_t)paths[i];
+		sqe->len = STATX_BASIC_STATS;
+		sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+		sqe->off = (uintptr_t)&b->stx[i];
+		sqe->user_data = i;
+		b->sq_array[idx] = idx;
+	}
+	__atomic_store_n(b->sq_tail, tail, __ATOMIC_RELEASE);
+
+	while (done < nr) {
+		unsigned head, ctail;
+		int ret = io_uring_enter(b->fd, nr - submitted, 1,
+					 IORING_ENTER_GETEVENTS);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			b->inflight = submitted - done;
+			statx_batch_drain(b);
+			return -1;
+		}
+		submitted += ret;
+
+		head = *b->cq_head;
+		ctail = __atomic_load_n(b->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != ctail; head++) {
+			struct io_uring_cqe *cqe = &b->cqes[head & b->cq_mask];
+			unsigned j = cqe->user_data;
+
+			if (j >= nr)
+				BUG("unexpected statx completion %u", j);
+			if (cqe->res < 0) {
+				errs[j] = -cqe->res;
+			} else {
+				errs[j] = 0;
+				statx_to_stat(&b->stx[j], &st[j]);
+			}
+			done++;
+		}
+		__atomic_store_n(b->cq_head, head, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+void statx_batch_release(struct statx_batch *b)
+{
+	if (!b)
+		return;
+	munmap(b->sqes, b->sqes_size);
+	if (b->cq_ring != b->sq_ring)
+		munmap(b->cq_ring, b->cq_ring_size);
+	munmap(b->sq_ring, b->sq_ring_size);
+	close(b->fd);
+	/* leak what the calls we could not wait for may still write to */
+	if (!b->inflight)
+		free(b->stx);
+	free(b);
+}
@@ -0,0 +1,32 @@
+#ifndef COMPAT_LINUX_STATX_BATCH_H
+#define COMPAT_LINUX_STATX_BATCH_H
+
+/*
+ * lstat() many paths at once by queuing statx() calls on an io_uring,
+ * for when the cost of lstat() is dominated by waiting on storage
+ * rather than by the system call itself.
+ */
+struct statx_batch;
+
+/*
+ * Set up a batch able to take up to "size" paths at once. Returns NULL
+ * when io_uring is not available, e.g. on older kernels or when it is
+ * disabled by a seccomp policy; callers fall back to lstat().
+ */
+struct statx_batch *statx_batch_init(unsigned size);
+
+/*
+ * lstat() the "nr" paths, which must not be more than the batch's
+ * size. For each path, errs[i] is set to 0 and st[i] filled in on
+ * success, or errs[i] is set to the errno the call failed with.
+ * Returns -1 when the ring itself failed, in which case neither array
+ * should be looked at, and the batch can only be released. The calls
+ * that were already submitted are waited for before returning, unless
+ * even waiting fails.
+ */
+int statx_batch_run(struct statx_batch *batch, const char **paths,
+		    struct stat *st, int *errs, unsigned nr);
+
+void statx_batch_release(struct statx_batch *batch);
+
+#endif /* COMPAT_LINUX_STATX_BATCH_H */
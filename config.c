@@ -2810,6 +2810,23 @@ int git_config_get_index_threads(int *dest)
 	return 1;
 }
 
+int repo_config_thread_count(struct repository *r, const char *key,
+			     const char *test_env, int small)
+{
+	int is_bool, val;
+
+	val = git_env_ulong(test_env, 0);
+	if (val)
+		return val;
+	if (small)
+		return 1;
+	if (!repo_config_get_bool_or_int(r, key, &is_bool, &val) && is_bool)
+		val = val ? 0 : 1;
+	if (!val)
+		val = online_cpus() > 8 ? 8 : online_cpus();
+	return val;
+}
+
 NORETURN
 void git_die_config_linenr(const char *key, const char *filename, int linenr)
 {
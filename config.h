@@ -611,6 +611,16 @@ int git_config_get_maybe_bool(const char *key, int *dest);
 int git_config_get_pathname(const char *key, const char **dest);
 
 int git_config_get_index_threads(int *dest);
+
+/**
+ * Get the number of threads to use for some work from `key`, a boolean
+ * or integer setting: 0 or true mean one thread per CPU (up to 8), and
+ * 1 or false mean a single thread, as is always used for `small` work.
+ * The `test_env` environment variable overrides both, so that the test
+ * suite can force threads on small repositories.
+ */
+int repo_config_thread_count(struct repository *r, const char *key,
+			     const char *test_env, int small);
 int git_config_get_split_index(void);
 int git_config_get_max_percent_split_change(void);
 
@@ -0,0 +1,3 @@
+NO_GETTEXT = YesPlease
+DEVELOPER = 1
+DEVOPTS = no-error
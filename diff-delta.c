@@ -314,6 +314,30 @@ unsigned long sizeof_delta_index(struct delta_index *index)
  */
 #define MAX_OP_SIZE	(5 + 5 + 1 + RABIN_WINDOW + 7)
 
+/*
+ * Return the number of leading bytes that "a" and "b" have in common,
+ * looking at no more than "limit" bytes.  Matches are often kilobytes
+ * long, so compare a word at a time until the first difference and only
+ * then look at single bytes.
+ */
+static inline size_t match_forward(const unsigned char *a,
+				   const unsigned char *b, size_t limit)
+{
+	size_t n = 0;
+
+	while (limit - n >= sizeof(uint64_t)) {
+		uint64_t x, y;
+		memcpy(&x, a + n, sizeof(x));
+		memcpy(&y, b + n, sizeof(y));
+		if (x != y)
+			break;
+		n += sizeof(uint64_t);
+	}
+	while (n < limit && a[n] == b[n])
+		n++;
+	return n;
+}
+
 void *
 create_delta(const struct delta_index *index,
 	     const void *trg_buf, unsigned long trg_size,
@@ -386,8 +410,7 @@ create_delta(const struct delta_index *index,
 					ref_size = top - src;
 				if (ref_size <= msize)
 					break;
-				while (ref_size-- && *src++ == *ref)
-					ref++;
+				ref += match_forward(ref, src, ref_size);
 				if (msize < ref - entry->ptr) {
 					/* this is our best match so far */
 					msize = ref - entry->ptr;
@@ -537,6 +537,21 @@ static int diff_cache(struct rev_info *revs,
 	if (!tree)
 		return error("bad tree object %s",
 			     tree_name ? tree_name : oid_to_hex(tree_oid));
+
+	/*
+	 * A valid cache-tree at the top that records the very same tree
+	 * means the index has no unmerged, intent-to-add or changed
+	 * entries compared to it, so there is nothing to show without
+	 * even setting up the traversal.  Subtrees that match are skipped
+	 * the same way during the traversal, see unpack_callback().
+	 */
+	if (cached && !revs->diffopt.flags.find_copies_harder &&
+	    cache_tree_matches_tree(revs->diffopt.repo->index, &tree->object.oid)) {
+		trace2_data_string("diff", revs->diffopt.repo,
+				   "diff_cache", "cache-tree");
+		return 0;
+	}
+
 	memset(&opts, 0, sizeof(opts));
 	opts.head_idx = 1;
 	opts.index_only = cached;
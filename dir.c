@@ -18,6 +18,8 @@
 #include "ewah/ewok.h"
 #include "fsmonitor.h"
 #include "submodule-config.h"
+#include "strmap.h"
+#include "thread-utils.h"
 
 /*
  * Tells read_directory_recursive how a file or directory should be treated.
@@ -35,8 +37,11 @@ enum path_treatment {
 /*
  * Support data structure for our opendir/readdir/closedir wrappers
  */
+struct dir_listing;
+
 struct cached_dir {
 	DIR *fdir;
+	struct dir_listing *listing;
 	struct untracked_cache_dir *untracked;
 	int nr_files;
 	int nr_dirs;
@@ -53,6 +58,7 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 	int check_only, int stop_at_first_file, const struct pathspec *pathspec);
 static int resolve_dtype(int dtype, struct index_state *istate,
 			 const char *path, int len);
+static void free_pattern_matcher(struct pattern_matcher *pm);
 struct dirent *readdir_skip_dot_and_dotdot(DIR *dirp)
 {
 	struct dirent *e;
@@ -929,6 +935,7 @@ void clear_pattern_list(struct pattern_list *pl)
 	free(pl->filebuf);
 	hashmap_clear_and_free(&pl->recursive_hashmap, struct pattern_entry, ent);
 	hashmap_clear_and_free(&pl->parent_hashmap, struct pattern_entry, ent);
+	free_pattern_matcher(pl->matcher);
 
 	memset(pl, 0, sizeof(*pl));
 }
@@ -1300,6 +1307,276 @@ int match_pathname(const char *pathname, int pathlen,
 				 WM_PATHNAME) == 0;
 }
 
+/*
+ * Does "pattern" match "pathname"?  Resolves *dtype when the pattern
+ * only applies to directories.
+ */
+static int match_one_pattern(struct path_pattern *pattern,
+			     const char *pathname, int pathlen,
+			     const char *basename, int *dtype,
+			     struct index_state *istate)
+{
+	const char *exclude = pattern->pattern;
+	int prefix = pattern->nowildcardlen;
+
+	if (pattern->flags & PATTERN_FLAG_MUSTBEDIR) {
+		*dtype = resolve_dtype(*dtype, istate, pathname, pathlen);
+		if (*dtype != DT_DIR)
+			return 0;
+	}
+
+	if (pattern->flags & PATTERN_FLAG_NODIR)
+		return match_basename(basename,
+				      pathlen - (basename - pathname),
+				      exclude, prefix, pattern->patternlen,
+				      pattern->flags);
+
+	assert(pattern->baselen == 0 ||
+	       pattern->base[pattern->baselen - 1] == '/');
+	return match_pathname(pathname, pathlen,
+			      pattern->base,
+			      pattern->baselen ? pattern->baselen - 1 : 0,
+			      exclude, prefix, pattern->patternlen);
+}
+
+/*
+ * Large ignore files are mostly made of patterns that need no
+ * wildmatch() at all: literal basenames ("Thumbs.db"), literal
+ * extensions ("*.o") and literal paths ("/build/out"). A list with
+ * many patterns gets those indexed by the literal text they need,
+ * so that checking a path costs a few hash lookups plus a walk over
+ * the remaining wild patterns, instead of a walk over all of them.
+ * Candidates are always verified with match_one_pattern(), and are
+ * tried in the same descending order as the plain scan, so the result
+ * is the same.
+ */
+#define PATTERN_MATCHER_MIN_PATTERNS 32
+
+struct pattern_matcher_entry {
+	struct hashmap_entry ent;
+	const char *key;
+	int keylen;
+	/* indices into pl->patterns, ascending */
+	int *pos;
+	int pos_nr, pos_alloc;
+};
+
+struct pattern_matcher {
+	/* the number of patterns indexed */
+	int nr;
+	struct hashmap basenames;
+	struct hashmap suffixes;
+	struct hashmap paths;
+	struct strbuf path_keys;
+	/* the distinct lengths of the keys in "suffixes" */
+	int *suffix_lens;
+	int suffix_lens_nr, suffix_lens_alloc;
+	/* patterns that are not indexed, ascending */
+	int *wild;
+	int wild_nr, wild_alloc;
+};
+
+static int pattern_matcher_entry_cmp(const void *cmp_data UNUSED,
+				     const struct hashmap_entry *eptr,
+				     const struct hashmap_entry *entry_or_key,
+				     const void *keydata UNUSED)
+{
+	const struct pattern_matcher_entry *a, *b;
+
+	a = container_of(eptr, const struct pattern_matcher_entry, ent);
+	b = container_of(entry_or_key, const struct pattern_matcher_entry, ent);
+	return a->keylen != b->keylen || memcmp(a->key, b->key, a->keylen);
+}
+
+static void pattern_matcher_add(struct hashmap *map, const char *key,
+				int keylen, int pos)
+{
+	struct pattern_matcher_entry k, *e;
+
+	hashmap_entry_init(&k.ent, memhash(key, keylen));
+	k.key = key;
+	k.keylen = keylen;
+	e = hashmap_get_entry(map, &k, ent, NULL);
+	if (!e) {
+		CALLOC_ARRAY(e, 1);
+		hashmap_entry_init(&e->ent, k.ent.hash);
+		e->key = key;
+		e->keylen = keylen;
+		hashmap_add(map, &e->ent);
+	}
+	ALLOC_GROW(e->pos, e->pos_nr + 1, e->pos_alloc);
+	e->pos[e->pos_nr++] = pos;
+}
+
+static struct pattern_matcher_entry *pattern_matcher_get(struct hashmap *map,
+							 const char *key,
+							 int keylen)
+{
+	struct pattern_matcher_entry k;
+
+	hashmap_entry_init(&k.ent, memhash(key, keylen));
+	k.key = key;
+	k.keylen = keylen;
+	return hashmap_get_entry(map, &k, ent, NULL);
+}
+
+static void free_pattern_matcher_map(struct hashmap *map)
+{
+	struct hashmap_iter iter;
+	struct pattern_matcher_entry *e;
+
+	hashmap_for_each_entry(map, &iter, e, ent)
+		free(e->pos);
+	hashmap_clear_and_free(map, struct pattern_matcher_entry, ent);
+}
+
+static void free_pattern_matcher(struct pattern_matcher *pm)
+{
+	if (!pm)
+		return;
+	free_pattern_matcher_map(&pm->basenames);
+	free_pattern_matcher_map(&pm->suffixes);
+	free_pattern_matcher_map(&pm->paths);
+	strbuf_release(&pm->path_keys);
+	free(pm->suffix_lens);
+	free(pm->wild);
+	free(pm);
+}
+
+static struct pattern_matcher *compile_pattern_list(struct pattern_list *pl)
+{
+	struct pattern_matcher *pm;
+	size_t *path_key_ofs = NULL, path_key_nr = 0, path_key_alloc = 0, k;
+	int *path_key_pos = NULL;
+	int i, j;
+
+	CALLOC_ARRAY(pm, 1);
+	pm->nr = pl->nr;
+	hashmap_init(&pm->basenames, pattern_matcher_entry_cmp, NULL, 0);
+	hashmap_init(&pm->suffixes, pattern_matcher_entry_cmp, NULL, 0);
+	hashmap_init(&pm->paths, pattern_matcher_entry_cmp, NULL, 0);
+	strbuf_init(&pm->path_keys, 0);
+
+	for (i = 0; i < pl->nr; i++) {
+		struct path_pattern *pattern = pl->patterns[i];
+		const char *p = pattern->pattern;
+		int len = pattern->patternlen;
+
+		if (pattern->flags & PATTERN_FLAG_NODIR) {
+			if (pattern->nowildcardlen == len) {
+				pattern_matcher_add(&pm->basenames, p, len, i);
+				continue;
+			}
+			if (pattern->flags & PATTERN_FLAG_ENDSWITH) {
+				pattern_matcher_add(&pm->suffixes, p + 1,
+						    len - 1, i);
+				for (j = 0; j < pm->suffix_lens_nr; j++)
+					if (pm->suffix_lens[j] == len - 1)
+						break;
+				if (j == pm->suffix_lens_nr) {
+					ALLOC_GROW(pm->suffix_lens,
+						   pm->suffix_lens_nr + 1,
+						   pm->suffix_lens_alloc);
+					pm->suffix_lens[pm->suffix_lens_nr++] = len - 1;
+				}
+				continue;
+			}
+		} else if (pattern->nowildcardlen == len &&
+			   len > (*p == '/')) {
+			/*
+			 * A literal pattern with a slash only matches the
+			 * path made of its base and itself.  The keys
+			 * are added once path_keys stops moving.
+			 */
+			ALLOC_GROW(path_key_ofs, path_key_nr + 1, path_key_alloc);
+			REALLOC_ARRAY(path_key_pos, path_key_alloc);
+			path_key_ofs[path_key_nr] = pm->path_keys.len;
+			path_key_pos[path_key_nr++] = i;
+			strbuf_add(&pm->path_keys, pattern->base, pattern->baselen);
+			if (*p == '/')
+				strbuf_add(&pm->path_keys, p + 1, len - 1);
+			else
+				strbuf_add(&pm->path_keys, p, len);
+			strbuf_addch(&pm->path_keys, '\0');
+			continue;
+		}
+		ALLOC_GROW(pm->wild, pm->wild_nr + 1, pm->wild_alloc);
+		pm->wild[pm->wild_nr++] = i;
+	}
+
+	for (k = 0; k < path_key_nr; k++) {
+		const char *key = pm->path_keys.buf + path_key_ofs[k];
+		pattern_matcher_add(&pm->paths, key, strlen(key),
+				    path_key_pos[k]);
+	}
+	free(path_key_ofs);
+	free(path_key_pos);
+	return pm;
+}
+
+static void add_candidates(struct pattern_matcher_entry *e,
+			   int **cand, int *nr, int *alloc)
+{
+	if (!e)
+		return;
+	ALLOC_GROW(*cand, *nr + e->pos_nr, *alloc);
+	COPY_ARRAY(*cand + *nr, e->pos, e->pos_nr);
+	*nr += e->pos_nr;
+}
+
+static int cmp_int_desc(const void *a_, const void *b_)
+{
+	int a = *(const int *)a_, b = *(const int *)b_;
+	return a < b ? 1 : a > b ? -1 : 0;
+}
+
+static struct path_pattern *last_matching_pattern_compiled(const char *pathname,
+							   int pathlen,
+							   const char *basename,
+							   int *dtype,
+							   struct pattern_list *pl,
+							   struct index_state *istate)
+{
+	struct pattern_matcher *pm = pl->matcher;
+	int basenamelen = pathlen - (basename - pathname);
+	int *cand = NULL, nr = 0, alloc = 0, ci, wi, i;
+	struct path_pattern *res = NULL;
+
+	add_candidates(pattern_matcher_get(&pm->basenames, basename,
+					   basenamelen),
+		       &cand, &nr, &alloc);
+	for (i = 0; i < pm->suffix_lens_nr; i++) {
+		int len = pm->suffix_lens[i];
+		if (len > basenamelen)
+			continue;
+		add_candidates(pattern_matcher_get(&pm->suffixes,
+						   basename + basenamelen - len,
+						   len),
+			       &cand, &nr, &alloc);
+	}
+	add_candidates(pattern_matcher_get(&pm->paths, pathname, pathlen),
+		       &cand, &nr, &alloc);
+	QSORT(cand, nr, cmp_int_desc);
+
+	ci = 0;
+	wi = pm->wild_nr - 1;
+	while (ci < nr || wi >= 0) {
+		int pos;
+
+		if (wi < 0 || (ci < nr && cand[ci] > pm->wild[wi]))
+			pos = cand[ci++];
+		else
+			pos = pm->wild[wi--];
+		if (match_one_pattern(pl->patterns[pos], pathname, pathlen,
+				      basename, dtype, istate)) {
+			res = pl->patterns[pos];
+			break;
+		}
+	}
+	free(cand);
+	return res;
+}
+
 /*
  * Scan the given exclude list in reverse to see whether pathname
  * should be ignored.  The first match (i.e. the last on the list), if
@@ -1313,45 +1590,31 @@ static struct path_pattern *last_matching_pattern_from_list(const char *pathname
 						       struct pattern_list *pl,
 						       struct index_state *istate)
 {
-	struct path_pattern *res = NULL; /* undecided */
 	int i;
 
 	if (!pl->nr)
 		return NULL;	/* undefined */
 
-	for (i = pl->nr - 1; 0 <= i; i--) {
-		struct path_pattern *pattern = pl->patterns[i];
-		const char *exclude = pattern->pattern;
-		int prefix = pattern->nowildcardlen;
-
-		if (pattern->flags & PATTERN_FLAG_MUSTBEDIR) {
-			*dtype = resolve_dtype(*dtype, istate, pathname, pathlen);
-			if (*dtype != DT_DIR)
-				continue;
+	if (pl->nr >= PATTERN_MATCHER_MIN_PATTERNS && !ignore_case) {
+		if (pl->matcher && pl->matcher->nr != pl->nr) {
+			free_pattern_matcher(pl->matcher);
+			pl->matcher = NULL;
 		}
+		if (!pl->matcher)
+			pl->matcher = compile_pattern_list(pl);
+		return last_matching_pattern_compiled(pathname, pathlen,
+						      basename, dtype,
+						      pl, istate);
+	}
 
-		if (pattern->flags & PATTERN_FLAG_NODIR) {
-			if (match_basename(basename,
-					   pathlen - (basename - pathname),
-					   exclude, prefix, pattern->patternlen,
-					   pattern->flags)) {
-				res = pattern;
-				break;
-			}
-			continue;
-		}
+	for (i = pl->nr - 1; 0 <= i; i--) {
+		struct path_pattern *pattern = pl->patterns[i];
 
-		assert(pattern->baselen == 0 ||
-		       pattern->base[pattern->baselen - 1] == '/');
-		if (match_pathname(pathname, pathlen,
-				   pattern->base,
-				   pattern->baselen ? pattern->baselen - 1 : 0,
-				   exclude, prefix, pattern->patternlen)) {
-			res = pattern;
-			break;
-		}
+		if (match_one_pattern(pattern, pathname, pathlen,
+				      basename, dtype, istate))
+			return pattern;
 	}
-	return res;
+	return NULL;
 }
 
 /*
@@ -2419,6 +2682,325 @@ static int valid_cached_dir(struct dir_struct *dir,
 	return untracked->valid;
 }
 
+/*
+ * Most of the time spent walking a large worktree goes to reading
+ * directories. The walk itself has to stay on one thread, since
+ * treat_path() and the exclude machinery keep per-directory state, but
+ * the directories it is going to open can be read ahead:
+ *
+ *  - every directory holding tracked files is always visited, so
+ *    worker threads read those, in index order;
+ *  - whenever the walk opens a directory, the subdirectories in its
+ *    listing are handed to the workers first, so untracked directories
+ *    are read one level ahead of the walk.
+ *
+ * The workers readdir() and, where the file system does not report
+ * the type of an entry, lstat() it. open_cached_dir() picks up their
+ * listings when it gets there, and reads anything the workers have
+ * not got to yet itself.
+ */
+
+/* Workers pause when this much has been read ahead and not used yet. */
+#define DIR_PREFETCH_MAX_BYTES (64 * 1024 * 1024)
+
+struct dir_listing {
+	/* the entries' names, each NUL-terminated */
+	struct strbuf names;
+	unsigned char *types;
+	size_t nr, pos, offset;
+};
+
+struct dir_prefetch {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct strmap listings;
+	struct strset seen;
+	size_t bytes;
+	int stop;
+	unsigned used;
+
+	struct string_list dirs;
+	size_t next_dir;
+
+	/* subdirectories of what the walk opened, read before "dirs" */
+	struct string_list found;
+	size_t next_found;
+
+	pthread_t *threads;
+	int nr_threads;
+};
+
+static void free_dir_listing(struct dir_listing *l)
+{
+	if (!l)
+		return;
+	strbuf_release(&l->names);
+	free(l->types);
+	free(l);
+}
+
+/*
+ * Read the directory "path", which is empty or ends in a slash. With
+ * "resolve_types", entries of unknown type are lstat()ed.
+ */
+static struct dir_listing *read_dir_listing(const char *path,
+					    int resolve_types)
+{
+	struct dir_listing *l;
+	struct dirent *de;
+	struct strbuf sb = STRBUF_INIT;
+	size_t alloc = 0;
+	DIR *fdir = opendir(*path ? path : ".");
+
+	if (!fdir)
+		return NULL;
+	CALLOC_ARRAY(l, 1);
+	strbuf_init(&l->names, 0);
+	strbuf_addstr(&sb, path);
+	while ((de = readdir_skip_dot_and_dotdot(fdir))) {
+		unsigned char dtype = DTYPE(de);
+
+		if (dtype == DT_UNKNOWN && resolve_types) {
+			struct stat st;
+
+			strbuf_setlen(&sb, strlen(path));
+			strbuf_addstr(&sb, de->d_name);
+			if (!lstat(sb.buf, &st))
+				dtype = S_ISREG(st.st_mode) ? DT_REG :
+					S_ISDIR(st.st_mode) ? DT_DIR :
+					S_ISLNK(st.st_mode) ? DT_LNK :
+					DT_UNKNOWN;
+		}
+		ALLOC_GROW(l->types, l->nr + 1, alloc);
+		l->types[l->nr++] = dtype;
+		strbuf_add(&l->names, de->d_name, strlen(de->d_name) + 1);
+	}
+	closedir(fdir);
+	strbuf_release(&sb);
+	return l;
+}
+
+static void *dir_prefetch_thread(void *data)
+{
+	struct dir_prefetch *dp = data;
+
+	while (1) {
+		struct dir_listing *l;
+		const char *path;
+		int seen;
+
+		pthread_mutex_lock(&dp->mutex);
+		while (!dp->stop &&
+		       (dp->bytes > DIR_PREFETCH_MAX_BYTES ||
+			(dp->next_found >= dp->found.nr &&
+			 dp->next_dir >= dp->dirs.nr)))
+			pthread_cond_wait(&dp->cond, &dp->mutex);
+		if (dp->stop) {
+			pthread_mutex_unlock(&dp->mutex);
+			break;
+		}
+		if (dp->next_found < dp->found.nr)
+			path = dp->found.items[dp->next_found++].string;
+		else
+			path = dp->dirs.items[dp->next_dir++].string;
+		seen = !strset_add(&dp->seen, path);
+		pthread_mutex_unlock(&dp->mutex);
+		if (seen)
+			continue;
+
+		/* failures are left to the walk, which reports them */
+		l = read_dir_listing(path, 1);
+		if (!l)
+			continue;
+
+		pthread_mutex_lock(&dp->mutex);
+		if (dp->stop) {
+			free_dir_listing(l);
+		} else {
+			strmap_put(&dp->listings, path, l);
+			dp->bytes += l->names.len + l->nr;
+		}
+		pthread_mutex_unlock(&dp->mutex);
+	}
+	return NULL;
+}
+
+/*
+ * Collect the directories holding tracked files under "base", in index
+ * order. As entries below a directory sort together, only the range of
+ * the index under "base" is looked at, and a directory is new whenever
+ * the previous entry does not share it.
+ */
+static void collect_tracked_dirs(struct index_state *istate,
+				 const char *base, int baselen,
+				 struct string_list *dirs)
+{
+	const char *prev = NULL;
+	struct strbuf sb = STRBUF_INIT;
+	int i = 0;
+
+	string_list_append_nodup(dirs, xmemdupz(base, baselen));
+	if (baselen) {
+		i = index_name_pos_sparse(istate, base, baselen);
+		if (i < 0)
+			i = -i - 1;
+	}
+	for (; i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+		const char *slash;
+
+		if (strncmp(ce->name, base, baselen))
+			break;
+		if (ce_skip_worktree(ce))
+			continue;
+		for (slash = strchr(ce->name + baselen, '/'); slash;
+		     slash = strchr(slash + 1, '/')) {
+			size_t len = slash - ce->name + 1;
+
+			if (prev && !strncmp(prev, ce->name, len))
+				continue;
+			strbuf_reset(&sb);
+			strbuf_add(&sb, ce->name, len);
+			string_list_append_nodup(dirs, strbuf_detach(&sb, NULL));
+		}
+		prev = ce->name;
+	}
+	strbuf_release(&sb);
+}
+
+static void start_dir_prefetch(struct dir_struct *dir,
+			       struct index_state *istate,
+			       const char *base, int baselen,
+			       const struct pathspec *pathspec)
+{
+	struct dir_prefetch *dp;
+	int nr_threads, i;
+
+	/* a usable untracked cache spares most of the reading already */
+	if (!HAVE_THREADS || dir->untracked || (pathspec && pathspec->nr) ||
+	    (baselen && base[baselen - 1] != '/'))
+		return;
+	nr_threads = repo_config_thread_count(istate->repo ?
+					      istate->repo : the_repository,
+					      "core.untrackedscanthreads",
+					      "GIT_TEST_UNTRACKED_SCAN_THREADS", 0);
+	if (nr_threads < 2)
+		return;
+
+	CALLOC_ARRAY(dp, 1);
+	string_list_init_dup(&dp->dirs);
+	string_list_init_dup(&dp->found);
+	collect_tracked_dirs(istate, base, baselen, &dp->dirs);
+
+	pthread_mutex_init(&dp->mutex, NULL);
+	pthread_cond_init(&dp->cond, NULL);
+	strmap_init(&dp->listings);
+	strset_init(&dp->seen);
+
+	/* the main thread does its share of the reading */
+	dp->nr_threads = nr_threads - 1;
+	CALLOC_ARRAY(dp->threads, dp->nr_threads);
+	for (i = 0; i < dp->nr_threads; i++) {
+		int err = pthread_create(&dp->threads[i], NULL,
+					 dir_prefetch_thread, dp);
+		if (err)
+			die(_("unable to create directory prefetch thread: %s"),
+			    strerror(err));
+	}
+	trace2_data_intmax("dir", istate->repo,
+			   "prefetch/threads", dp->nr_threads);
+	dir->prefetch = dp;
+}
+
+static void stop_dir_prefetch(struct dir_struct *dir, struct repository *r)
+{
+	struct dir_prefetch *dp = dir->prefetch;
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	int i;
+
+	if (!dp)
+		return;
+
+	pthread_mutex_lock(&dp->mutex);
+	dp->stop = 1;
+	pthread_cond_broadcast(&dp->cond);
+	pthread_mutex_unlock(&dp->mutex);
+	for (i = 0; i < dp->nr_threads; i++)
+		pthread_join(dp->threads[i], NULL);
+
+	trace2_data_intmax("dir", r, "prefetch/dirs_used", dp->used);
+
+	strmap_for_each_entry(&dp->listings, &iter, e)
+		free_dir_listing(e->value);
+	strmap_clear(&dp->listings, 0);
+	strset_clear(&dp->seen);
+	string_list_clear(&dp->dirs, 0);
+	string_list_clear(&dp->found, 0);
+	pthread_cond_destroy(&dp->cond);
+	pthread_mutex_destroy(&dp->mutex);
+	free(dp->threads);
+	FREE_AND_NULL(dir->prefetch);
+}
+
+/*
+ * Take the listing of "path" read ahead by the prefetch threads, if
+ * there is one.
+ */
+static struct dir_listing *take_dir_listing(struct dir_struct *dir,
+					    const char *path)
+{
+	struct dir_prefetch *dp = dir->prefetch;
+	struct dir_listing *l;
+
+	if (!dp)
+		return NULL;
+	pthread_mutex_lock(&dp->mutex);
+	l = strmap_get(&dp->listings, path);
+	if (l) {
+		strmap_remove(&dp->listings, path, 0);
+		if (dp->bytes > DIR_PREFETCH_MAX_BYTES)
+			pthread_cond_broadcast(&dp->cond);
+		dp->bytes -= l->names.len + l->nr;
+		dp->used++;
+	} else {
+		/* we are reading it ourselves; do not bother the workers */
+		strset_add(&dp->seen, path);
+	}
+	pthread_mutex_unlock(&dp->mutex);
+	return l;
+}
+
+/*
+ * Hand the subdirectories in the listing "l" of "path" to the prefetch
+ * threads, as the walk is likely to open them soon. The workers skip
+ * the ones that have been read already.
+ */
+static void prefetch_subdirs(struct dir_struct *dir, const char *path,
+			     struct dir_listing *l)
+{
+	struct dir_prefetch *dp = dir->prefetch;
+	struct strbuf sb = STRBUF_INIT;
+	const char *name = l->names.buf;
+	size_t i, queued = 0;
+
+	pthread_mutex_lock(&dp->mutex);
+	for (i = 0; i < l->nr; name += strlen(name) + 1, i++) {
+		if (l->types[i] != DT_DIR || !fspathcmp(name, ".git"))
+			continue;
+		strbuf_reset(&sb);
+		strbuf_addf(&sb, "%s%s/", path, name);
+		if (strset_contains(&dp->seen, sb.buf))
+			continue;
+		string_list_append(&dp->found, sb.buf);
+		queued++;
+	}
+	if (queued)
+		pthread_cond_broadcast(&dp->cond);
+	pthread_mutex_unlock(&dp->mutex);
+	strbuf_release(&sb);
+}
+
 static int open_cached_dir(struct cached_dir *cdir,
 			   struct dir_struct *dir,
 			   struct untracked_cache_dir *untracked,
@@ -2433,14 +3015,24 @@ static int open_cached_dir(struct cached_dir *cdir,
 	if (valid_cached_dir(dir, untracked, istate, path, check_only))
 		return 0;
 	c_path = path->len ? path->buf : ".";
-	cdir->fdir = opendir(c_path);
-	if (!cdir->fdir)
-		warning_errno(_("could not open directory '%s'"), c_path);
+	if (dir->prefetch) {
+		cdir->listing = take_dir_listing(dir, path->buf);
+		if (!cdir->listing)
+			cdir->listing = read_dir_listing(path->buf, 0);
+		if (cdir->listing)
+			prefetch_subdirs(dir, path->buf, cdir->listing);
+		else
+			warning_errno(_("could not open directory '%s'"), c_path);
+	} else {
+		cdir->fdir = opendir(c_path);
+		if (!cdir->fdir)
+			warning_errno(_("could not open directory '%s'"), c_path);
+	}
 	if (dir->untracked) {
 		invalidate_directory(dir->untracked, untracked);
 		dir->untracked->dir_opened++;
 	}
-	if (!cdir->fdir)
+	if (!cdir->fdir && !cdir->listing)
 		return -1;
 	return 0;
 }
@@ -2460,6 +3052,19 @@ static int read_cached_dir(struct cached_dir *cdir)
 		cdir->d_type = DTYPE(de);
 		return 0;
 	}
+	if (cdir->listing) {
+		struct dir_listing *l = cdir->listing;
+
+		if (l->pos >= l->nr) {
+			cdir->d_name = NULL;
+			cdir->d_type = DT_UNKNOWN;
+			return -1;
+		}
+		cdir->d_name = l->names.buf + l->offset;
+		cdir->d_type = l->types[l->pos++];
+		l->offset += strlen(cdir->d_name) + 1;
+		return 0;
+	}
 	while (cdir->nr_dirs < cdir->untracked->dirs_nr) {
 		struct untracked_cache_dir *d = cdir->untracked->dirs[cdir->nr_dirs];
 		if (!d->recurse) {
@@ -2483,6 +3088,7 @@ static void close_cached_dir(struct cached_dir *cdir)
 {
 	if (cdir->fdir)
 		closedir(cdir->fdir);
+	free_dir_listing(cdir->listing);
 	/*
 	 * We have gone through this directory and found no untracked
 	 * entries. Mark it valid.
@@ -2518,7 +3124,7 @@ static void add_path_to_appropriate_result_list(struct dir_struct *dir,
 		if (dir->flags & DIR_SHOW_IGNORED)
 			break;
 		dir_add_name(dir, istate, path->buf, path->len);
-		if (cdir->fdir)
+		if (cdir->fdir || cdir->listing)
 			add_untracked(untracked, path->buf + baselen);
 		break;
 
@@ -2623,7 +3229,7 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 
 			/* abort early if maximum state has been reached */
 			if (dir_state == path_untracked) {
-				if (cdir.fdir)
+				if (cdir.fdir || cdir.listing)
 					add_untracked(untracked, path.buf + baselen);
 				break;
 			}
@@ -3003,8 +3609,11 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 		 * e.g. prep_exclude()
 		 */
 		dir->untracked = NULL;
-	if (!len || treat_leading_path(dir, istate, path, len, pathspec))
+	if (!len || treat_leading_path(dir, istate, path, len, pathspec)) {
+		start_dir_prefetch(dir, istate, path, len, pathspec);
 		read_directory_recursive(dir, istate, path, len, untracked, 0, 0, pathspec);
+		stop_dir_prefetch(dir, istate->repo);
+	}
 	QSORT(dir->entries, dir->nr, cmp_dir_entry);
 	QSORT(dir->ignored, dir->ignored_nr, cmp_dir_entry);
 
@@ -115,6 +115,12 @@ struct pattern_list {
 	 * Used to check single-level parents of blobs.
 	 */
 	struct hashmap parent_hashmap;
+
+	/*
+	 * Index of the literal patterns of a long list, built on first
+	 * use.  See last_matching_pattern_from_list().
+	 */
+	struct pattern_matcher *matcher;
 };
 
 /*
@@ -340,6 +346,9 @@ struct dir_struct {
 	/* Stats about the traversal */
 	unsigned visited_paths;
 	unsigned visited_directories;
+
+	/* Directories read ahead on other threads; for internal use */
+	struct dir_prefetch *prefetch;
 };
 
 #define DIR_INIT { 0 }
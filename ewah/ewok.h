@@ -190,4 +190,25 @@ void bitmap_or(struct bitmap *self, const struct bitmap *other);
 
 size_t bitmap_popcount(struct bitmap *self);
 
+/**
+ * Roaring bitmap, as stored in version 2 of the bitmap index: the
+ * positions are split in chunks of 2^16, each stored as an array, a
+ * plain bitmap or a list of runs, whichever is the smallest.  A roaring
+ * bitmap read with `roaring_read_mmap` is used from the map in place;
+ * the map must outlive it.  Reading fails if a container holds positions
+ * from `nr_bits` on, so that ORing the bitmap into another one does not
+ * make that grow beyond the objects it describes.
+ */
+struct roaring_bitmap;
+
+struct roaring_bitmap *roaring_new(void);
+void roaring_free(struct roaring_bitmap *self);
+ssize_t roaring_read_mmap(struct roaring_bitmap *self, const void *map,
+			  size_t len, uint32_t nr_bits);
+void roaring_serialize_ewah(struct ewah_bitmap *ewah, struct strbuf *out);
+
+struct bitmap *roaring_to_bitmap(const struct roaring_bitmap *roaring);
+void bitmap_or_roaring(struct bitmap *self, const struct roaring_bitmap *other);
+size_t roaring_popcount(const struct roaring_bitmap *self);
+
 #endif
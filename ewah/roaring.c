@@ -0,0 +1,357 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cache.h"
+#include "ewok.h"
+
+/*
+ * A roaring bitmap splits the positions in chunks of 2^16, and stores
+ * each non-empty chunk in a "container" of whichever type is smallest
+ * for it:
+ *
+ *  - an array of the (sorted) low 16 bits of its positions,
+ *  - a plain bitmap of 1024 words, or
+ *  - a list of runs, as (start, length - 1) pairs.
+ *
+ * On disk, everything is in network byte order:
+ *
+ *	be32 container count (N)
+ *	N times: be16 key, be16 type, be32 count
+ *	N payloads, in the same order
+ *
+ * where "key" is the high 16 bits of the positions in the container,
+ * and "count" is the number of positions for arrays and bitmaps, and
+ * the number of runs for run containers.  Containers are in increasing
+ * key order.
+ *
+ * The payloads are used from the mapped file where they are; only the
+ * container headers are decoded when reading.
+ */
+
+#define ROARING_CONTAINER_BITS 16
+#define ROARING_CONTAINER_WORDS ((1 << ROARING_CONTAINER_BITS) / BITS_IN_EWORD)
+#define ROARING_ARRAY_MAX 4096
+
+enum roaring_type {
+	ROARING_ARRAY = 1,
+	ROARING_BITMAP = 2,
+	ROARING_RUN = 3,
+};
+
+struct roaring_container {
+	uint16_t key;
+	uint16_t type;
+	uint32_t count;
+	const unsigned char *data;
+};
+
+struct roaring_bitmap {
+	struct roaring_container *containers;
+	size_t nr, alloc;
+};
+
+struct roaring_bitmap *roaring_new(void)
+{
+	struct roaring_bitmap *self;
+
+	CALLOC_ARRAY(self, 1);
+	return self;
+}
+
+void roaring_free(struct roaring_bitmap *self)
+{
+	if (!self)
+		return;
+	free(self->containers);
+	free(self);
+}
+
+static size_t container_size(uint16_t type, uint32_t count)
+{
+	switch (type) {
+	case ROARING_ARRAY:
+		return st_mult(count, 2);
+	case ROARING_BITMAP:
+		return ROARING_CONTAINER_WORDS * sizeof(eword_t);
+	case ROARING_RUN:
+		return st_mult(count, 4);
+	}
+	return 0;
+}
+
+ssize_t roaring_read_mmap(struct roaring_bitmap *self, const void *map,
+			  size_t len, uint32_t nr_bits)
+{
+	const unsigned char *ptr = map, *data;
+	uint32_t i, nr;
+	size_t remaining;
+
+	if (len < 4)
+		return error(_("corrupt roaring bitmap: truncated header"));
+	nr = get_be32(ptr);
+	ptr += 4;
+	len -= 4;
+	if (nr > len / 8)
+		return error(_("corrupt roaring bitmap: %"PRIu32" containers do not fit"),
+			     nr);
+	data = ptr + st_mult(nr, 8);
+	remaining = len - st_mult(nr, 8);
+
+	self->nr = 0;
+	ALLOC_GROW(self->containers, nr, self->alloc);
+	for (i = 0; i < nr; i++) {
+		struct roaring_container *c = &self->containers[i];
+		size_t size;
+
+		c->key = get_be16(ptr);
+		c->type = get_be16(ptr + 2);
+		c->count = get_be32(ptr + 4);
+		ptr += 8;
+
+		if (i && c->key <= self->containers[i - 1].key)
+			return error(_("corrupt roaring bitmap: unordered containers"));
+		if ((uint32_t)c->key << ROARING_CONTAINER_BITS >= nr_bits)
+			return error(_("corrupt roaring bitmap: container %d "
+				       "past the last object"), c->key);
+		if (!c->count || c->count > (1 << ROARING_CONTAINER_BITS))
+			return error(_("corrupt roaring bitmap: bad container size"));
+		size = container_size(c->type, c->count);
+		if (!size)
+			return error(_("corrupt roaring bitmap: unknown container type %d"),
+				     c->type);
+		if (size > remaining)
+			return error(_("corrupt roaring bitmap: truncated container"));
+
+		c->data = data;
+		data += size;
+		remaining -= size;
+		self->nr++;
+	}
+	return data - (const unsigned char *)map;
+}
+
+static void put_be16(void *ptr, uint16_t value)
+{
+	unsigned char *p = ptr;
+	p[0] = value >> 8;
+	p[1] = value >> 0;
+}
+
+static void bitmap_grow_words(struct bitmap *self, size_t word_alloc)
+{
+	size_t old = self->word_alloc;
+
+	if (word_alloc <= old)
+		return;
+	REALLOC_ARRAY(self->words, word_alloc);
+	memset(self->words + old, 0, (word_alloc - old) * sizeof(eword_t));
+	self->word_alloc = word_alloc;
+}
+
+/* Set the bits [start, end) of the container's words. */
+static void set_range(eword_t *words, uint32_t start, uint32_t end)
+{
+	uint32_t first = start / BITS_IN_EWORD, last = (end - 1) / BITS_IN_EWORD;
+	eword_t head = (eword_t)~0 << (start % BITS_IN_EWORD);
+	eword_t tail = (eword_t)~0 >> (BITS_IN_EWORD - 1 - (end - 1) % BITS_IN_EWORD);
+
+	if (first == last) {
+		words[first] |= head & tail;
+		return;
+	}
+	words[first] |= head;
+	while (++first < last)
+		words[first] = ~(eword_t)0;
+	words[last] |= tail;
+}
+
+void bitmap_or_roaring(struct bitmap *self, const struct roaring_bitmap *other)
+{
+	size_t i;
+	uint32_t j;
+
+	if (!other->nr)
+		return;
+	bitmap_grow_words(self, ((size_t)other->containers[other->nr - 1].key + 1) *
+				ROARING_CONTAINER_WORDS);
+
+	for (i = 0; i < other->nr; i++) {
+		const struct roaring_container *c = &other->containers[i];
+		size_t base = (size_t)c->key * ROARING_CONTAINER_WORDS;
+		eword_t *words = self->words + base;
+
+		switch (c->type) {
+		case ROARING_ARRAY:
+			for (j = 0; j < c->count; j++) {
+				uint16_t low = get_be16(c->data + 2 * j);
+				words[low / BITS_IN_EWORD] |=
+					(eword_t)1 << (low % BITS_IN_EWORD);
+			}
+			break;
+		case ROARING_BITMAP:
+			for (j = 0; j < ROARING_CONTAINER_WORDS; j++)
+				words[j] |= get_be64(c->data + 8 * j);
+			break;
+		case ROARING_RUN:
+			for (j = 0; j < c->count; j++) {
+				uint32_t start = get_be16(c->data + 4 * j);
+				uint32_t end = start + get_be16(c->data + 4 * j + 2) + 1;
+
+				if (end > (1 << ROARING_CONTAINER_BITS))
+					end = 1 << ROARING_CONTAINER_BITS;
+				set_range(words, start, end);
+			}
+			break;
+		}
+	}
+}
+
+struct bitmap *roaring_to_bitmap(const struct roaring_bitmap *roaring)
+{
+	struct bitmap *bitmap = bitmap_word_alloc(0);
+
+	bitmap_or_roaring(bitmap, roaring);
+	/* like ewah_to_bitmap(), do not keep trailing empty words */
+	while (bitmap->word_alloc && !bitmap->words[bitmap->word_alloc - 1])
+		bitmap->word_alloc--;
+	return bitmap;
+}
+
+size_t roaring_popcount(const struct roaring_bitmap *self)
+{
+	size_t i, count = 0;
+	uint32_t j;
+
+	for (i = 0; i < self->nr; i++) {
+		const struct roaring_container *c = &self->containers[i];
+
+		if (c->type != ROARING_RUN) {
+			count += c->count;
+			continue;
+		}
+		for (j = 0; j < c->count; j++)
+			count += get_be16(c->data + 4 * j + 2) + 1;
+	}
+	return count;
+}
+
+/*
+ * Append the container for the 1024 words of "chunk" to "headers" and
+ * "payload".
+ */
+static void add_container(struct strbuf *headers, struct strbuf *payload,
+			  uint16_t key, const eword_t *chunk)
+{
+	uint32_t i, card = 0, runs = 0;
+	eword_t prev = 0;
+	size_t array_size, run_size;
+	unsigned char buf[8];
+
+	for (i = 0; i < ROARING_CONTAINER_WORDS; i++) {
+		eword_t w = chunk[i];
+
+		card += ewah_bit_popcount64(w);
+		/* count the bits that start a run */
+		runs += ewah_bit_popcount64(w & ~((w << 1) | (prev >> 63)));
+		prev = w;
+	}
+	if (!card)
+		return;
+
+	array_size = card <= ROARING_ARRAY_MAX ? container_size(ROARING_ARRAY, card) : SIZE_MAX;
+	run_size = container_size(ROARING_RUN, runs);
+
+	put_be16(buf, key);
+	if (array_size <= run_size &&
+	    array_size <= container_size(ROARING_BITMAP, card)) {
+		put_be16(buf + 2, ROARING_ARRAY);
+		put_be32(buf + 4, card);
+		for (i = 0; i < ROARING_CONTAINER_WORDS; i++) {
+			eword_t w = chunk[i];
+
+			while (w) {
+				unsigned char low[2];
+
+				put_be16(low, i * BITS_IN_EWORD + ewah_bit_ctz64(w));
+				strbuf_add(payload, low, 2);
+				w &= w - 1;
+			}
+		}
+	} else if (run_size < container_size(ROARING_BITMAP, card)) {
+		uint32_t pos = 0, end = 1 << ROARING_CONTAINER_BITS;
+
+		put_be16(buf + 2, ROARING_RUN);
+		put_be32(buf + 4, runs);
+		while (pos < end) {
+			unsigned char run[4];
+			uint32_t start;
+
+			while (pos < end &&
+			       !(chunk[pos / BITS_IN_EWORD] & ((eword_t)1 << (pos % BITS_IN_EWORD))))
+				pos++;
+			if (pos == end)
+				break;
+			start = pos;
+			while (pos < end &&
+			       (chunk[pos / BITS_IN_EWORD] & ((eword_t)1 << (pos % BITS_IN_EWORD))))
+				pos++;
+			put_be16(run, start);
+			put_be16(run + 2, pos - start - 1);
+			strbuf_add(payload, run, 4);
+		}
+	} else {
+		put_be16(buf + 2, ROARING_BITMAP);
+		put_be32(buf + 4, card);
+		for (i = 0; i < ROARING_CONTAINER_WORDS; i++) {
+			unsigned char word[8];
+
+			put_be64(word, chunk[i]);
+			strbuf_add(payload, word, 8);
+		}
+	}
+	strbuf_add(headers, buf, 8);
+}
+
+void roaring_serialize_ewah(struct ewah_bitmap *ewah, struct strbuf *out)
+{
+	struct strbuf headers = STRBUF_INIT, payload = STRBUF_INIT;
+	eword_t *chunk;
+	struct ewah_iterator it;
+	eword_t word;
+	size_t i = 0;
+	uint32_t key = 0;
+	unsigned char nr[4];
+
+	CALLOC_ARRAY(chunk, ROARING_CONTAINER_WORDS);
+	ewah_iterator_init(&it, ewah);
+	while (ewah_iterator_next(&word, &it)) {
+		chunk[i++] = word;
+		if (i < ROARING_CONTAINER_WORDS)
+			continue;
+		add_container(&headers, &payload, key++, chunk);
+		memset(chunk, 0, ROARING_CONTAINER_WORDS * sizeof(eword_t));
+		i = 0;
+	}
+	if (i)
+		add_container(&headers, &payload, key, chunk);
+
+	put_be32(nr, headers.len / 8);
+	strbuf_add(out, nr, 4);
+	strbuf_addbuf(out, &headers);
+	strbuf_addbuf(out, &payload);
+
+	strbuf_release(&headers);
+	strbuf_release(&payload);
+	free(chunk);
+}
@@ -102,11 +102,42 @@ int oid_pos(const struct object_id *oid, const void *table, size_t nr,
 
 int bsearch_hash(const unsigned char *hash, const uint32_t *fanout_nbo,
 		 const unsigned char *table, size_t stride, uint32_t *result)
+{
+	return bsearch_hash_from(hash, fanout_nbo, table, stride, 0, result);
+}
+
+int bsearch_hash_from(const unsigned char *hash, const uint32_t *fanout_nbo,
+		      const unsigned char *table, size_t stride, uint32_t start,
+		      uint32_t *result)
 {
 	uint32_t hi, lo;
 
 	hi = ntohl(fanout_nbo[*hash]);
 	lo = ((*hash == 0x0) ? 0 : ntohl(fanout_nbo[*hash - 1]));
+	if (lo < start) {
+		uint32_t step = 1;
+
+		/*
+		 * The hash is likely to be close to the previous one, so
+		 * gallop forward from there before bisecting what is left.
+		 */
+		lo = start;
+		while (lo < hi && step < hi - lo) {
+			int cmp = hashcmp(table + (lo + step) * stride, hash);
+
+			if (!cmp) {
+				if (result)
+					*result = lo + step;
+				return 1;
+			}
+			if (cmp > 0) {
+				hi = lo + step;
+				break;
+			}
+			lo += step + 1;
+			step *= 2;
+		}
+	}
 
 	while (lo < hi) {
 		unsigned mi = lo + (hi - lo) / 2;
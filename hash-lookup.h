@@ -29,4 +29,15 @@ int oid_pos(const struct object_id *oid,
  */
 int bsearch_hash(const unsigned char *hash, const uint32_t *fanout_nbo,
 		 const unsigned char *table, size_t stride, uint32_t *result);
+
+/*
+ * Like bsearch_hash(), but ignore the elements of table before index "start".
+ * Callers looking up hashes in ascending order can pass the result of the
+ * previous search, which is then used as the starting point of an
+ * exponential search, so that a sorted batch of lookups costs about one
+ * sweep over the table.
+ */
+int bsearch_hash_from(const unsigned char *hash, const uint32_t *fanout_nbo,
+		      const unsigned char *table, size_t stride, uint32_t start,
+		      uint32_t *result);
 #endif
@@ -34,6 +34,7 @@
 #define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
 #define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
 #define MIDX_CHUNKID_REVINDEX 0x52494458 /* "RIDX" */
+#define MIDX_CHUNKID_BASE 0x42415345 /* "BASE" */
 #define MIDX_CHUNK_FANOUT_SIZE (sizeof(uint32_t) * 256)
 #define MIDX_CHUNK_OFFSET_WIDTH (2 * sizeof(uint32_t))
 #define MIDX_CHUNK_LARGE_OFFSET_WIDTH (sizeof(uint64_t))
@@ -51,9 +52,37 @@ void get_midx_filename(struct strbuf *out, const char *object_dir)
 	strbuf_addf(out, "%s/pack/multi-pack-index", object_dir);
 }
 
+void get_midx_chain_dirname(struct strbuf *out, const char *object_dir)
+{
+	strbuf_addf(out, "%s/pack/multi-pack-index.d", object_dir);
+}
+
+void get_midx_chain_filename(struct strbuf *out, const char *object_dir)
+{
+	get_midx_chain_dirname(out, object_dir);
+	strbuf_addstr(out, "/multi-pack-index-chain");
+}
+
+static void get_midx_layer_filename(struct strbuf *out, const char *object_dir,
+				    const char *hex)
+{
+	get_midx_chain_dirname(out, object_dir);
+	strbuf_addf(out, "/multi-pack-index-%s.midx", hex);
+}
+
+void get_midx_filename_prefix(struct strbuf *out, struct multi_pack_index *m)
+{
+	if (m->base_midx) {
+		get_midx_chain_dirname(out, m->object_dir);
+		strbuf_addstr(out, "/multi-pack-index");
+	} else {
+		get_midx_filename(out, m->object_dir);
+	}
+}
+
 void get_midx_rev_filename(struct strbuf *out, struct multi_pack_index *m)
 {
-	get_midx_filename(out, m->object_dir);
+	get_midx_filename_prefix(out, m);
 	strbuf_addf(out, "-%s.rev", hash_to_hex(get_midx_checksum(m)));
 }
 
@@ -70,7 +99,23 @@ static int midx_read_oid_fanout(const unsigned char *chunk_start,
 	return 0;
 }
 
-struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+static int midx_read_base(const unsigned char *chunk_start,
+			  size_t chunk_size, void *data)
+{
+	struct multi_pack_index *m = data;
+	m->chunk_base = chunk_start;
+
+	if (chunk_size % the_hash_algo->rawsz) {
+		error(_("multi-pack-index base chunk is of the wrong size"));
+		return 1;
+	}
+	m->num_bases = chunk_size / the_hash_algo->rawsz;
+	return 0;
+}
+
+static struct multi_pack_index *load_multi_pack_index_one(const char *object_dir,
+							  const char *midx_name,
+							  int local)
 {
 	struct multi_pack_index *m = NULL;
 	int fd;
@@ -78,31 +123,26 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	size_t midx_size;
 	void *midx_map = NULL;
 	uint32_t hash_version;
-	struct strbuf midx_name = STRBUF_INIT;
 	uint32_t i;
 	const char *cur_pack_name;
 	struct chunkfile *cf = NULL;
 
-	get_midx_filename(&midx_name, object_dir);
-
-	fd = git_open(midx_name.buf);
+	fd = git_open(midx_name);
 
 	if (fd < 0)
 		goto cleanup_fail;
 	if (fstat(fd, &st)) {
-		error_errno(_("failed to read %s"), midx_name.buf);
+		error_errno(_("failed to read %s"), midx_name);
 		goto cleanup_fail;
 	}
 
 	midx_size = xsize_t(st.st_size);
 
 	if (midx_size < MIDX_MIN_SIZE) {
-		error(_("multi-pack-index file %s is too small"), midx_name.buf);
+		error(_("multi-pack-index file %s is too small"), midx_name);
 		goto cleanup_fail;
 	}
 
-	strbuf_release(&midx_name);
-
 	midx_map = xmmap(NULL, midx_size, PROT_READ, MAP_PRIVATE, fd, 0);
 	close(fd);
 
@@ -153,6 +193,9 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	if (git_env_bool("GIT_TEST_MIDX_READ_RIDX", 1))
 		pair_chunk(cf, MIDX_CHUNKID_REVINDEX, &m->chunk_revindex);
 
+	if (read_chunk(cf, MIDX_CHUNKID_BASE, midx_read_base, m) > 0)
+		goto cleanup_fail;
+
 	m->num_objects = ntohl(m->chunk_oid_fanout[255]);
 
 	CALLOC_ARRAY(m->pack_names, m->num_packs);
@@ -178,7 +221,6 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 
 cleanup_fail:
 	free(m);
-	strbuf_release(&midx_name);
 	free_chunkfile(cf);
 	if (midx_map)
 		munmap(midx_map, midx_size);
@@ -187,6 +229,95 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	return NULL;
 }
 
+struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+{
+	struct strbuf midx_name = STRBUF_INIT;
+	struct multi_pack_index *m;
+
+	get_midx_filename(&midx_name, object_dir);
+	m = load_multi_pack_index_one(object_dir, midx_name.buf, local);
+	strbuf_release(&midx_name);
+
+	return m;
+}
+
+/*
+ * Check that the layer "m" was written on top of exactly the layers
+ * "base" (and below), as recorded in its BASE chunk, root first.
+ */
+static int midx_layer_matches_base(struct multi_pack_index *m,
+				   struct multi_pack_index *base)
+{
+	uint32_t n = m->num_bases;
+
+	for (; base; base = base->base_midx) {
+		if (!n--)
+			return 0;
+		if (!hasheq(m->chunk_base + st_mult(n, m->hash_len),
+			    get_midx_checksum(base)))
+			return 0;
+	}
+	return !n;
+}
+
+/*
+ * Load the layers listed in the chain file of "object_dir" on top of
+ * its regular multi-pack-index "root", and return the topmost layer;
+ * the layers below it are reachable through "base_midx" and "next". A
+ * layer that cannot be loaded, or that was not written on top of the
+ * layers below it, is ignored along with every layer above it.
+ */
+static struct multi_pack_index *load_midx_chain(const char *object_dir,
+						struct multi_pack_index *root,
+						int local)
+{
+	struct strbuf chain_name = STRBUF_INIT;
+	struct strbuf line = STRBUF_INIT;
+	struct multi_pack_index *top = root;
+	FILE *fp;
+
+	get_midx_chain_filename(&chain_name, object_dir);
+	fp = fopen(chain_name.buf, "r");
+	if (!fp)
+		goto cleanup;
+
+	while (strbuf_getline_lf(&line, fp) != EOF) {
+		struct multi_pack_index *m;
+		struct object_id oid;
+
+		if (get_oid_hex(line.buf, &oid) || line.len != the_hash_algo->hexsz) {
+			warning(_("invalid multi-pack-index chain: line '%s' not a hash"),
+				line.buf);
+			break;
+		}
+
+		strbuf_reset(&chain_name);
+		get_midx_layer_filename(&chain_name, object_dir, line.buf);
+		m = load_multi_pack_index_one(object_dir, chain_name.buf, local);
+		if (!m) {
+			warning(_("unable to find all multi-pack-index layers"));
+			break;
+		}
+		if (!hasheq(oid.hash, get_midx_checksum(m)) ||
+		    !midx_layer_matches_base(m, top)) {
+			warning(_("multi-pack-index chain does not match"));
+			close_midx(m);
+			break;
+		}
+
+		m->base_midx = top;
+		m->num_objects_in_base = top->num_objects_in_base + top->num_objects;
+		m->next = top;
+		top = m;
+	}
+
+	fclose(fp);
+cleanup:
+	strbuf_release(&chain_name);
+	strbuf_release(&line);
+	return top;
+}
+
 void close_midx(struct multi_pack_index *m)
 {
 	uint32_t i;
@@ -351,7 +482,50 @@ static int cmp_idx_or_pack_name(const char *idx_or_pack_name,
 	return strcmp(idx_or_pack_name, idx_name);
 }
 
-int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name)
+/*
+ * Like fill_midx_entry(), but for the entries of "e" that are still unset;
+ * "oids" must be sorted. Returns the number of entries filled in.
+ */
+size_t fill_midx_entries(struct repository *r, const struct object_id *oids,
+			 size_t nr, struct pack_entry *e,
+			 struct multi_pack_index *m)
+{
+	uint32_t pos = 0;
+	size_t i, found = 0;
+
+	for (i = 0; i < nr; i++) {
+		uint32_t pack_int_id;
+		struct packed_git *p;
+
+		if (e[i].p)
+			continue;
+		if (!bsearch_hash_from(oids[i].hash, m->chunk_oid_fanout,
+				       m->chunk_oid_lookup,
+				       the_hash_algo->rawsz, pos, &pos))
+			continue;
+		if (pos >= m->num_objects)
+			continue;
+
+		pack_int_id = nth_midxed_pack_int_id(m, pos);
+		if (prepare_midx_pack(r, m, pack_int_id))
+			continue;
+		p = m->packs[pack_int_id];
+
+		if (!is_pack_valid(p))
+			continue;
+		if (oidset_size(&p->bad_objects) &&
+		    oidset_contains(&p->bad_objects, &oids[i]))
+			continue;
+
+		e[i].offset = nth_midxed_offset(m, pos);
+		e[i].p = p;
+		found++;
+	}
+	return found;
+}
+
+static int midx_contains_pack_1(struct multi_pack_index *m,
+				const char *idx_or_pack_name)
 {
 	uint32_t first = 0, last = m->num_packs;
 
@@ -374,6 +548,14 @@ int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name)
 	return 0;
 }
 
+int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name)
+{
+	for (; m; m = m->base_midx)
+		if (midx_contains_pack_1(m, idx_or_pack_name))
+			return 1;
+	return 0;
+}
+
 int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, int local)
 {
 	struct multi_pack_index *m;
@@ -391,8 +573,15 @@ int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, i
 
 	if (m) {
 		struct multi_pack_index *mp = r->objects->multi_pack_index;
+		struct multi_pack_index *root = m;
+
+		/*
+		 * The layers of an incremental MIDX come right before
+		 * the regular one in the list, topmost first.
+		 */
+		m = load_midx_chain(object_dir, root, local);
 		if (mp) {
-			m->next = mp->next;
+			root->next = mp->next;
 			mp->next = m;
 		} else
 			r->objects->multi_pack_index = m;
@@ -446,6 +635,13 @@ struct write_midx_context {
 	struct progress *progress;
 	unsigned pack_paths_checked;
 
+	/*
+	 * When writing an incremental layer, the topmost layer (or
+	 * regular MIDX) to write it on top of. Packs and objects it
+	 * already contains are left out of the new layer.
+	 */
+	struct multi_pack_index *base;
+
 	struct pack_midx_entry *entries;
 	uint32_t entries_nr;
 
@@ -467,10 +663,10 @@ static void add_pack_to_midx(const char *full_path, size_t full_path_len,
 	if (ends_with(file_name, ".idx")) {
 		display_progress(ctx->progress, ++ctx->pack_paths_checked);
 		/*
-		 * Note that at most one of ctx->m and ctx->to_include are set,
-		 * so we are testing midx_contains_pack() and
-		 * string_list_has_string() independently (guarded by the
-		 * appropriate NULL checks).
+		 * Note that ctx->m is never set together with ctx->base
+		 * or ctx->to_include. An incremental layer may be
+		 * restricted to ctx->to_include, in which case packs
+		 * already in the layers below it are skipped first.
 		 *
 		 * We could support passing to_include while reusing an existing
 		 * MIDX, but don't currently since the reuse process drags
@@ -483,6 +679,8 @@ static void add_pack_to_midx(const char *full_path, size_t full_path_len,
 		 */
 		if (ctx->m && midx_contains_pack(ctx->m, file_name))
 			return;
+		else if (ctx->base && midx_contains_pack(ctx->base, file_name))
+			return;
 		else if (ctx->to_include &&
 			 !string_list_has_string(ctx->to_include, file_name))
 			return;
@@ -593,6 +791,15 @@ static void midx_fanout_sort(struct midx_fanout *fanout)
 	QSORT(fanout->entries, fanout->nr, midx_oid_compare);
 }
 
+static int midx_chain_has_oid(struct multi_pack_index *m,
+			      const struct object_id *oid)
+{
+	for (; m; m = m->base_midx)
+		if (bsearch_midx(oid, m, NULL))
+			return 1;
+	return 0;
+}
+
 static void midx_fanout_add_midx_fanout(struct midx_fanout *fanout,
 					struct multi_pack_index *m,
 					uint32_t cur_fanout,
@@ -658,9 +865,11 @@ static void midx_fanout_add_pack_fanout(struct midx_fanout *fanout,
  * tables to group the data, copy to a local array, then sort.
  *
  * Copy only the de-duplicated entries (selected by most-recent modified time
- * of a packfile containing the object).
+ * of a packfile containing the object), leaving out the objects that are
+ * already in "base" or its layers.
  */
 static struct pack_midx_entry *get_sorted_entries(struct multi_pack_index *m,
+						  struct multi_pack_index *base,
 						  struct pack_info *info,
 						  uint32_t nr_packs,
 						  uint32_t *nr_objects,
@@ -715,6 +924,9 @@ static struct pack_midx_entry *get_sorted_entries(struct multi_pack_index *m,
 			if (cur_object && oideq(&fanout.entries[cur_object - 1].oid,
 						&fanout.entries[cur_object].oid))
 				continue;
+			if (base && midx_chain_has_oid(base,
+						       &fanout.entries[cur_object].oid))
+				continue;
 
 			ALLOC_GROW(deduplicated_entries, *nr_objects + 1, alloc_objects);
 			memcpy(&deduplicated_entries[*nr_objects],
@@ -886,6 +1098,22 @@ static int write_midx_revindex(struct hashfile *f,
 	return 0;
 }
 
+static void write_midx_base_1(struct hashfile *f, struct multi_pack_index *m)
+{
+	if (m->base_midx)
+		write_midx_base_1(f, m->base_midx);
+	hashwrite(f, get_midx_checksum(m), the_hash_algo->rawsz);
+}
+
+static int write_midx_base(struct hashfile *f,
+			   void *data)
+{
+	struct write_midx_context *ctx = data;
+
+	write_midx_base_1(f, ctx->base);
+	return 0;
+}
+
 struct midx_pack_order_data {
 	uint32_t nr;
 	uint32_t pack;
@@ -1024,6 +1252,12 @@ static void bitmap_show_commit(struct commit *commit, void *_data)
 	data->commits[data->commits_nr++] = commit;
 }
 
+static int bitmap_commit_not_in_base(struct commit *commit, void *_data)
+{
+	struct write_midx_context *ctx = _data;
+	return !midx_chain_has_oid(ctx->base, &commit->object.oid);
+}
+
 static int read_refs_snapshot(const char *refs_snapshot,
 			      struct rev_info *revs)
 {
@@ -1091,6 +1325,15 @@ static struct commit **find_commits_for_midx_bitmap(uint32_t *indexed_commits_nr
 	fetch_if_missing = 0;
 	revs.exclude_promisor_objects = 1;
 
+	/*
+	 * The commits in the layers below an incremental MIDX are not
+	 * candidates, and neither are their ancestors; stop there.
+	 */
+	if (ctx->base) {
+		revs.include_check = bitmap_commit_not_in_base;
+		revs.include_check_data = ctx;
+	}
+
 	if (prepare_revision_walk(&revs))
 		die(_("revision walk setup failed"));
 
@@ -1108,6 +1351,8 @@ static int write_midx_bitmap(const char *midx_name,
 			     struct commit **commits,
 			     uint32_t commits_nr,
 			     uint32_t *pack_order,
+			     struct bitmap_index *base_bitmap,
+			     uint32_t base_nr,
 			     unsigned flags)
 {
 	int ret, i;
@@ -1132,6 +1377,8 @@ static int write_midx_bitmap(const char *midx_name,
 		index[i] = &pdata->objects[i].idx;
 
 	bitmap_writer_show_progress(flags & MIDX_PROGRESS);
+	if (base_bitmap)
+		bitmap_writer_set_base(base_bitmap, base_nr);
 	bitmap_writer_build_type_index(pdata, index, pdata->nr_objects);
 
 	/*
@@ -1164,6 +1411,10 @@ static int write_midx_bitmap(const char *midx_name,
 	return ret;
 }
 
+/*
+ * Return the multi-pack-index of "object_dir", or the topmost of its
+ * incremental layers if it has any.
+ */
 static struct multi_pack_index *lookup_multi_pack_index(struct repository *r,
 							const char *object_dir)
 {
@@ -1189,6 +1440,31 @@ static struct multi_pack_index *lookup_multi_pack_index(struct repository *r,
 	return result;
 }
 
+static struct multi_pack_index *midx_chain_root(struct multi_pack_index *m)
+{
+	while (m && m->base_midx)
+		m = m->base_midx;
+	return m;
+}
+
+static void write_midx_chain_1(FILE *fp, struct multi_pack_index *m)
+{
+	if (!m->base_midx)
+		return; /* the regular MIDX is not listed */
+	write_midx_chain_1(fp, m->base_midx);
+	fprintf(fp, "%s\n", hash_to_hex(get_midx_checksum(m)));
+}
+
+static void clear_midx_chain(const char *object_dir)
+{
+	struct strbuf path = STRBUF_INIT;
+
+	get_midx_chain_dirname(&path, object_dir);
+	if (remove_dir_recursively(&path, 0))
+		die_errno(_("failed to remove %s"), path.buf);
+	strbuf_release(&path);
+}
+
 static int write_midx_internal(const char *object_dir,
 			       struct string_list *packs_to_include,
 			       struct string_list *packs_to_drop,
@@ -1201,29 +1477,66 @@ static int write_midx_internal(const char *object_dir,
 	uint32_t i;
 	struct hashfile *f = NULL;
 	struct lock_file lk;
+	struct tempfile *layer = NULL;
+	struct bitmap_index *base_bitmap = NULL;
 	struct write_midx_context ctx = { 0 };
 	int pack_name_concat_len = 0;
 	int dropped_packs = 0;
 	int result = 0;
 	struct chunkfile *cf;
 
-	get_midx_filename(&midx_name, object_dir);
-	if (safe_create_leading_directories(midx_name.buf))
-		die_errno(_("unable to create leading directories of %s"),
-			  midx_name.buf);
-
-	if (!packs_to_include) {
+	if (!packs_to_include || (flags & MIDX_WRITE_INCREMENTAL)) {
 		/*
 		 * Only reference an existing MIDX when not filtering which
 		 * packs to include, since all packs and objects are copied
-		 * blindly from an existing MIDX if one is present.
+		 * blindly from an existing MIDX if one is present. An
+		 * incremental layer only needs it as its base.
 		 */
 		ctx.m = lookup_multi_pack_index(the_repository, object_dir);
 	}
 
-	if (ctx.m && !midx_checksum_valid(ctx.m)) {
-		warning(_("ignoring existing multi-pack-index; checksum mismatch"));
+	if (flags & MIDX_WRITE_INCREMENTAL) {
+		struct multi_pack_index *m;
+
+		if (packs_to_drop)
+			BUG("cannot drop packs while writing an incremental MIDX");
+
+		for (m = ctx.m; m; m = m->base_midx) {
+			if (!midx_checksum_valid(m)) {
+				warning(_("ignoring existing multi-pack-index; checksum mismatch"));
+				ctx.m = NULL;
+				break;
+			}
+		}
+
+		/*
+		 * Without an existing MIDX to write on top of, write a
+		 * regular one.
+		 */
+		ctx.base = ctx.m;
 		ctx.m = NULL;
+		if (!ctx.base)
+			flags &= ~MIDX_WRITE_INCREMENTAL;
+	} else {
+		/*
+		 * A full write replaces the regular MIDX and all of its
+		 * incremental layers.
+		 */
+		ctx.m = midx_chain_root(ctx.m);
+		if (ctx.m && !midx_checksum_valid(ctx.m)) {
+			warning(_("ignoring existing multi-pack-index; checksum mismatch"));
+			ctx.m = NULL;
+		}
+	}
+
+	if (ctx.base) {
+		get_midx_chain_dirname(&midx_name, object_dir);
+		strbuf_addstr(&midx_name, "/multi-pack-index");
+	} else {
+		get_midx_filename(&midx_name, object_dir);
+		if (safe_create_leading_directories(midx_name.buf))
+			die_errno(_("unable to create leading directories of %s"),
+				  midx_name.buf);
 	}
 
 	ctx.nr = 0;
@@ -1273,6 +1586,25 @@ static int write_midx_internal(const char *object_dir,
 	for_each_file_in_pack_dir(object_dir, add_pack_to_midx, &ctx);
 	stop_progress(&ctx.progress);
 
+	if (ctx.base && !ctx.nr) {
+		/* All packs are already in the existing layers. */
+		goto cleanup;
+	}
+
+	if (ctx.base && (flags & MIDX_WRITE_BITMAP)) {
+		/*
+		 * The bitmaps of a new layer are built on top of those
+		 * of the layers below it.
+		 */
+		base_bitmap = prepare_midx_bitmap_git(ctx.base);
+		if (!base_bitmap) {
+			error(_("cannot write an incremental multi-pack bitmap "
+				"without a bitmap for the existing multi-pack-index"));
+			result = 1;
+			goto cleanup;
+		}
+	}
+
 	if ((ctx.m && ctx.nr == ctx.m->num_packs) &&
 	    !(packs_to_include || packs_to_drop)) {
 		struct bitmap_index *bitmap_git;
@@ -1295,7 +1627,13 @@ static int write_midx_internal(const char *object_dir,
 		}
 	}
 
-	if (preferred_pack_name) {
+	if (ctx.base) {
+		/*
+		 * Only the regular MIDX has a preferred pack, whose objects
+		 * come first in the bitmap order of all of its layers.
+		 */
+		ctx.preferred_pack_idx = -1;
+	} else if (preferred_pack_name) {
 		int found = 0;
 		for (i = 0; i < ctx.nr; i++) {
 			if (!cmp_idx_or_pack_name(preferred_pack_name,
@@ -1359,8 +1697,8 @@ static int write_midx_internal(const char *object_dir,
 		}
 	}
 
-	ctx.entries = get_sorted_entries(ctx.m, ctx.info, ctx.nr, &ctx.entries_nr,
-					 ctx.preferred_pack_idx);
+	ctx.entries = get_sorted_entries(ctx.m, ctx.base, ctx.info, ctx.nr,
+					 &ctx.entries_nr, ctx.preferred_pack_idx);
 
 	ctx.large_offsets_needed = 0;
 	for (i = 0; i < ctx.entries_nr; i++) {
@@ -1439,8 +1777,43 @@ static int write_midx_internal(const char *object_dir,
 		pack_name_concat_len += MIDX_CHUNK_ALIGNMENT -
 					(pack_name_concat_len % MIDX_CHUNK_ALIGNMENT);
 
-	hold_lock_file_for_update(&lk, midx_name.buf, LOCK_DIE_ON_ERROR);
-	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	if (ctx.base) {
+		struct strbuf path = STRBUF_INIT;
+
+		/*
+		 * The new layer is written to a temporary file, named
+		 * after its checksum once complete, and then appended
+		 * to the chain with its lock held all along.
+		 */
+		get_midx_chain_filename(&path, object_dir);
+		if (safe_create_leading_directories(path.buf))
+			die_errno(_("unable to create leading directories of %s"),
+				  path.buf);
+		hold_lock_file_for_update(&lk, path.buf, LOCK_DIE_ON_ERROR);
+
+		strbuf_reset(&path);
+		get_midx_chain_dirname(&path, object_dir);
+		strbuf_addstr(&path, "/tmp_midx_XXXXXX");
+		layer = mks_tempfile_m(path.buf, 0444);
+		if (!layer) {
+			error_errno(_("unable to create temporary multi-pack-index layer"));
+			strbuf_release(&path);
+			result = 1;
+			goto cleanup;
+		}
+		strbuf_release(&path);
+
+		if (adjust_shared_perm(get_tempfile_path(layer))) {
+			error(_("unable to adjust shared permissions for '%s'"),
+			      get_tempfile_path(layer));
+			result = 1;
+			goto cleanup;
+		}
+		f = hashfd(get_tempfile_fd(layer), get_tempfile_path(layer));
+	} else {
+		hold_lock_file_for_update(&lk, midx_name.buf, LOCK_DIE_ON_ERROR);
+		f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	}
 
 	if (ctx.nr - dropped_packs == 0) {
 		error(_("no pack files to index."));
@@ -1448,7 +1821,7 @@ static int write_midx_internal(const char *object_dir,
 		goto cleanup;
 	}
 
-	if (!ctx.entries_nr) {
+	if (!ctx.entries_nr && !ctx.base) {
 		if (flags & MIDX_WRITE_BITMAP)
 			warning(_("refusing to write multi-pack .bitmap without any objects"));
 		flags &= ~(MIDX_WRITE_REV_INDEX | MIDX_WRITE_BITMAP);
@@ -1479,6 +1852,17 @@ static int write_midx_internal(const char *object_dir,
 			  write_midx_revindex);
 	}
 
+	if (ctx.base) {
+		size_t layers = 0;
+		struct multi_pack_index *m;
+
+		for (m = ctx.base; m; m = m->base_midx)
+			layers++;
+		add_chunk(cf, MIDX_CHUNKID_BASE,
+			  st_mult(layers, the_hash_algo->rawsz),
+			  write_midx_base);
+	}
+
 	write_midx_header(f, get_num_chunks(cf), ctx.nr - dropped_packs);
 	write_chunkfile(cf, &ctx);
 
@@ -1495,7 +1879,7 @@ static int write_midx_internal(const char *object_dir,
 		struct commit **commits;
 		uint32_t commits_nr;
 
-		if (!ctx.entries_nr)
+		if (!ctx.entries_nr && !ctx.base)
 			BUG("cannot write a bitmap without any objects");
 
 		prepare_midx_packing_data(&pdata, &ctx);
@@ -1513,6 +1897,9 @@ static int write_midx_internal(const char *object_dir,
 
 		if (write_midx_bitmap(midx_name.buf, midx_hash, &pdata,
 				      commits, commits_nr, ctx.pack_order,
+				      base_bitmap,
+				      ctx.base ? ctx.base->num_objects_in_base +
+						 ctx.base->num_objects : 0,
 				      flags) < 0) {
 			error(_("could not write multi-pack bitmap"));
 			result = 1;
@@ -1524,6 +1911,28 @@ static int write_midx_internal(const char *object_dir,
 	 * have been freed in the previous if block.
 	 */
 
+	if (ctx.base) {
+		struct strbuf layer_name = STRBUF_INIT;
+		FILE *chain = fdopen_lock_file(&lk, "w");
+
+		if (!chain)
+			die_errno(_("unable to open multi-pack-index chain file"));
+
+		get_midx_layer_filename(&layer_name, object_dir,
+					hash_to_hex(midx_hash));
+		if (rename_tempfile(&layer, layer_name.buf) < 0)
+			die_errno(_("unable to rename new multi-pack-index layer to '%s'"),
+				  layer_name.buf);
+		strbuf_release(&layer_name);
+
+		write_midx_chain_1(chain, ctx.base);
+		fprintf(chain, "%s\n", hash_to_hex(midx_hash));
+
+		if (commit_lock_file(&lk) < 0)
+			die_errno(_("could not write multi-pack-index chain"));
+		goto cleanup;
+	}
+
 	if (ctx.m)
 		close_object_store(the_repository->objects);
 
@@ -1532,6 +1941,7 @@ static int write_midx_internal(const char *object_dir,
 
 	clear_midx_files_ext(object_dir, ".bitmap", midx_hash);
 	clear_midx_files_ext(object_dir, ".rev", midx_hash);
+	clear_midx_chain(object_dir);
 
 cleanup:
 	for (i = 0; i < ctx.nr; i++) {
@@ -1546,6 +1956,8 @@ static int write_midx_internal(const char *object_dir,
 	free(ctx.entries);
 	free(ctx.pack_perm);
 	free(ctx.pack_order);
+	free_bitmap_index(base_bitmap);
+	delete_tempfile(&layer);
 	strbuf_release(&midx_name);
 
 	return result;
@@ -1624,6 +2036,7 @@ void clear_midx_file(struct repository *r)
 
 	clear_midx_files_ext(r->objects->odb->path, ".bitmap", NULL);
 	clear_midx_files_ext(r->objects->odb->path, ".rev", NULL);
+	clear_midx_chain(r->objects->odb->path);
 
 	strbuf_release(&midx);
 }
@@ -1667,28 +2080,13 @@ static int compare_pair_pos_vs_id(const void *_a, const void *_b)
 			display_progress(progress, _n); \
 	} while (0)
 
-int verify_midx_file(struct repository *r, const char *object_dir, unsigned flags)
+static void verify_midx_layer(struct repository *r,
+			      struct multi_pack_index *m,
+			      unsigned flags)
 {
 	struct pair_pos_vs_id *pairs = NULL;
 	uint32_t i;
 	struct progress *progress = NULL;
-	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
-	verify_midx_error = 0;
-
-	if (!m) {
-		int result = 0;
-		struct stat sb;
-		struct strbuf filename = STRBUF_INIT;
-
-		get_midx_filename(&filename, object_dir);
-
-		if (!stat(filename.buf, &sb)) {
-			error(_("multi-pack-index file exists, but failed to parse"));
-			result = 1;
-		}
-		strbuf_release(&filename);
-		return result;
-	}
 
 	if (!midx_checksum_valid(m))
 		midx_report(_("incorrect checksum"));
@@ -1799,6 +2197,123 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 
 cleanup:
 	free(pairs);
+}
+
+/*
+ * Load and verify the layers listed in the chain file of "object_dir"
+ * on top of its regular multi-pack-index "root", and return the topmost
+ * one that could be loaded. Unlike load_midx_chain(), report a layer
+ * not matching the chain instead of quietly ignoring it.
+ */
+static struct multi_pack_index *verify_midx_chain(struct repository *r,
+						  const char *object_dir,
+						  struct multi_pack_index *root,
+						  unsigned flags)
+{
+	struct strbuf chain_name = STRBUF_INIT;
+	struct strbuf line = STRBUF_INIT;
+	struct multi_pack_index *top = root;
+	FILE *fp;
+
+	get_midx_chain_filename(&chain_name, object_dir);
+	fp = fopen(chain_name.buf, "r");
+	if (!fp) {
+		if (errno != ENOENT)
+			midx_report(_("unable to open multi-pack-index chain '%s'"),
+				    chain_name.buf);
+		goto cleanup;
+	}
+
+	while (strbuf_getline_lf(&line, fp) != EOF) {
+		struct multi_pack_index *m, *base;
+		struct object_id oid;
+		uint32_t i, nr_base = 0;
+
+		if (get_oid_hex(line.buf, &oid) || line.len != the_hash_algo->hexsz) {
+			midx_report(_("invalid multi-pack-index chain: line '%s' not a hash"),
+				    line.buf);
+			break;
+		}
+
+		strbuf_reset(&chain_name);
+		get_midx_layer_filename(&chain_name, object_dir, line.buf);
+		m = load_multi_pack_index_one(object_dir, chain_name.buf, 1);
+		if (!m) {
+			midx_report(_("failed to load multi-pack-index layer %s"),
+				    line.buf);
+			break;
+		}
+
+		for (base = top; base; base = base->base_midx)
+			nr_base++;
+		if (!hasheq(oid.hash, get_midx_checksum(m)))
+			midx_report(_("multi-pack-index layer %s has checksum %s"),
+				    line.buf, hash_to_hex(get_midx_checksum(m)));
+		if (m->num_bases != nr_base)
+			midx_report(_("multi-pack-index layer %s has %"PRIu32" bases, "
+				      "expected %"PRIu32),
+				    line.buf, m->num_bases, nr_base);
+		else if (!midx_layer_matches_base(m, top))
+			midx_report(_("multi-pack-index layer %s does not match "
+				      "the layers below it"), line.buf);
+
+		if (unsigned_add_overflows(top->num_objects_in_base, top->num_objects) ||
+		    unsigned_add_overflows(top->num_objects_in_base + top->num_objects,
+					   m->num_objects))
+			midx_report(_("multi-pack-index layer %s has too many objects"),
+				    line.buf);
+
+		m->base_midx = top;
+		m->num_objects_in_base = top->num_objects_in_base + top->num_objects;
+		m->next = top;
+		top = m;
+
+		verify_midx_layer(r, m, flags);
+
+		/*
+		 * A layer only covers objects that are not in the layers
+		 * below it, or their bit positions would overlap.
+		 */
+		for (i = 0; i < m->num_objects; i++) {
+			struct object_id layer_oid;
+
+			nth_midxed_object_oid(&layer_oid, m, i);
+			if (midx_chain_has_oid(m->base_midx, &layer_oid))
+				midx_report(_("object %s of multi-pack-index layer %s "
+					      "is in a layer below it"),
+					    oid_to_hex(&layer_oid), line.buf);
+		}
+	}
+
+	fclose(fp);
+cleanup:
+	strbuf_release(&chain_name);
+	strbuf_release(&line);
+	return top;
+}
+
+int verify_midx_file(struct repository *r, const char *object_dir, unsigned flags)
+{
+	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
+	verify_midx_error = 0;
+
+	if (!m) {
+		int result = 0;
+		struct stat sb;
+		struct strbuf filename = STRBUF_INIT;
+
+		get_midx_filename(&filename, object_dir);
+
+		if (!stat(filename.buf, &sb)) {
+			error(_("multi-pack-index file exists, but failed to parse"));
+			result = 1;
+		}
+		strbuf_release(&filename);
+		return result;
+	}
+
+	verify_midx_layer(r, m, flags);
+	m = verify_midx_chain(r, object_dir, m, flags);
 	close_midx(m);
 
 	return verify_midx_error;
@@ -1808,7 +2323,7 @@ int expire_midx_packs(struct repository *r, const char *object_dir, unsigned fla
 {
 	uint32_t i, *count, result = 0;
 	struct string_list packs_to_drop = STRING_LIST_INIT_DUP;
-	struct multi_pack_index *m = lookup_multi_pack_index(r, object_dir);
+	struct multi_pack_index *m = midx_chain_root(lookup_multi_pack_index(r, object_dir));
 	struct progress *progress = NULL;
 
 	if (!m)
@@ -1979,7 +2494,7 @@ int midx_repack(struct repository *r, const char *object_dir, size_t batch_size,
 	struct child_process cmd = CHILD_PROCESS_INIT;
 	FILE *cmd_in;
 	struct strbuf base_name = STRBUF_INIT;
-	struct multi_pack_index *m = lookup_multi_pack_index(r, object_dir);
+	struct multi_pack_index *m = midx_chain_root(lookup_multi_pack_index(r, object_dir));
 
 	/*
 	 * When updating the default for these configuration
@@ -15,6 +15,16 @@ struct repository;
 struct multi_pack_index {
 	struct multi_pack_index *next;
 
+	/*
+	 * For a layer of an incremental MIDX, the layer (or the regular
+	 * MIDX) it was written on top of. A layer only covers packs
+	 * that are not in its base, and only objects that are not in
+	 * its base. Layers come before their base in the "next" list.
+	 */
+	struct multi_pack_index *base_midx;
+	/* Number of objects in all of the layers below this one. */
+	uint32_t num_objects_in_base;
+
 	const unsigned char *data;
 	size_t data_len;
 
@@ -37,6 +47,8 @@ struct multi_pack_index {
 	const unsigned char *chunk_object_offsets;
 	const unsigned char *chunk_large_offsets;
 	const unsigned char *chunk_revindex;
+	const unsigned char *chunk_base;
+	uint32_t num_bases;
 
 	const char **pack_names;
 	struct packed_git **packs;
@@ -48,10 +60,22 @@ struct multi_pack_index {
 #define MIDX_WRITE_BITMAP (1 << 2)
 #define MIDX_WRITE_BITMAP_HASH_CACHE (1 << 3)
 #define MIDX_WRITE_BITMAP_LOOKUP_TABLE (1 << 4)
+/*
+ * Write a new layer on top of the existing MIDX, covering only the packs
+ * it does not contain yet, instead of rewriting it.
+ */
+#define MIDX_WRITE_INCREMENTAL (1 << 5)
 
 const unsigned char *get_midx_checksum(struct multi_pack_index *m);
 void get_midx_filename(struct strbuf *out, const char *object_dir);
 void get_midx_rev_filename(struct strbuf *out, struct multi_pack_index *m);
+void get_midx_chain_dirname(struct strbuf *out, const char *object_dir);
+void get_midx_chain_filename(struct strbuf *out, const char *object_dir);
+/*
+ * The files derived from "m" (bitmap, reverse index) are named by
+ * appending "-<checksum>.<ext>" to this prefix.
+ */
+void get_midx_filename_prefix(struct strbuf *out, struct multi_pack_index *m);
 
 struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local);
 int prepare_midx_pack(struct repository *r, struct multi_pack_index *m, uint32_t pack_int_id);
@@ -62,6 +86,10 @@ struct object_id *nth_midxed_object_oid(struct object_id *oid,
 					struct multi_pack_index *m,
 					uint32_t n);
 int fill_midx_entry(struct repository *r, const struct object_id *oid, struct pack_entry *e, struct multi_pack_index *m);
+size_t fill_midx_entries(struct repository *r, const struct object_id *oids,
+			 size_t nr, struct pack_entry *e,
+			 struct multi_pack_index *m);
+/* Whether "m" or one of its base layers contains the given pack. */
 int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name);
 int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, int local);
 
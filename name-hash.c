@@ -576,6 +576,206 @@ static void threaded_lazy_init_name_hash(
 	free(lazy_entries);
 }
 
+/*
+ * The "NHSH" index extension records the hash of every entry name
+ * and, when written with core.ignorecase, the directory table, so that
+ * a process reading the index can fill its hash tables without hashing
+ * a single name.  The snapshot describes the entries the index was
+ * written with and is dropped as soon as the entries are added to or
+ * removed from.
+ */
+struct name_hash_snapshot {
+	unsigned int nr, nr_dirs;
+	const char *hashes;
+	const char *dirs;
+	char *buf;
+};
+
+/* each directory is a hash, a count, a parent and a name length */
+#define SNAPSHOT_DIR_SIZE 16
+
+static void strbuf_add_be32(struct strbuf *sb, uint32_t value)
+{
+	uint32_t be = htonl(value);
+
+	strbuf_add(sb, &be, sizeof(be));
+}
+
+static int dir_entry_ptr_cmp(const void *a_, const void *b_)
+{
+	const struct dir_entry *a = *(const struct dir_entry **)a_;
+	const struct dir_entry *b = *(const struct dir_entry **)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+void write_name_hash_snapshot(struct strbuf *sb, struct index_state *istate)
+{
+	struct index_state scratch = { 0 };
+	struct dir_entry *dir, **dirs = NULL;
+	struct hashmap_iter iter;
+	unsigned int i, nr = 0, nr_dirs = 0;
+
+	for (i = 0; i < istate->cache_nr; i++)
+		if (!(istate->cache[i]->ce_flags & CE_REMOVE))
+			nr++;
+
+	strbuf_add_be32(sb, nr);
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (!(ce->ce_flags & CE_REMOVE))
+			strbuf_add_be32(sb, memihash(ce->name, ce_namelen(ce)));
+	}
+
+	if (!ignore_case) {
+		strbuf_add_be32(sb, 0);
+		return;
+	}
+
+	/*
+	 * Build the directory table the way hash_index_entry() would,
+	 * on the side so as not to disturb the tables of "istate".
+	 */
+	hashmap_init(&scratch.dir_hash, dir_entry_cmp, NULL, istate->cache_nr);
+	for (i = 0; i < istate->cache_nr; i++)
+		if (!(istate->cache[i]->ce_flags & CE_REMOVE))
+			add_dir_entry(&scratch, istate->cache[i]);
+
+	ALLOC_ARRAY(dirs, hashmap_get_size(&scratch.dir_hash));
+	hashmap_for_each_entry(&scratch.dir_hash, &iter, dir, ent)
+		dirs[nr_dirs++] = dir;
+	QSORT(dirs, nr_dirs, dir_entry_ptr_cmp);
+
+	strbuf_add_be32(sb, nr_dirs);
+	for (i = 0; i < nr_dirs; i++) {
+		struct dir_entry **parent = NULL;
+
+		dir = dirs[i];
+		if (dir->parent)
+			parent = bsearch(&dir->parent, dirs, nr_dirs,
+					 sizeof(*dirs), dir_entry_ptr_cmp);
+		strbuf_add_be32(sb, dir->ent.hash);
+		strbuf_add_be32(sb, dir->nr);
+		strbuf_add_be32(sb, parent ? parent - dirs + 1 : 0);
+		strbuf_add_be32(sb, dir->namelen);
+		strbuf_add(sb, dir->name, dir->namelen);
+	}
+
+	free(dirs);
+	hashmap_clear_and_free(&scratch.dir_hash, struct dir_entry, ent);
+}
+
+struct name_hash_snapshot *read_name_hash_snapshot(const char *data,
+						   unsigned long sz)
+{
+	struct name_hash_snapshot *snapshot;
+	const char *p, *end = data + sz;
+	unsigned int nr, nr_dirs, i;
+
+	if (sz < 4)
+		return NULL;
+	nr = get_be32(data);
+	if ((sz - 4) / 4 < nr || sz - 4 - (size_t)nr * 4 < 4)
+		return NULL;
+	p = data + 4 + (size_t)nr * 4;
+	nr_dirs = get_be32(p);
+	p += 4;
+	for (i = 0; i < nr_dirs; i++) {
+		if (end - p < SNAPSHOT_DIR_SIZE ||
+		    get_be32(p + 8) > nr_dirs ||
+		    get_be32(p + 12) > end - p - SNAPSHOT_DIR_SIZE)
+			return NULL;
+		p += SNAPSHOT_DIR_SIZE + get_be32(p + 12);
+	}
+	if (p != end)
+		return NULL;
+
+	CALLOC_ARRAY(snapshot, 1);
+	snapshot->buf = xmemdupz(data, sz);
+	snapshot->nr = nr;
+	snapshot->nr_dirs = nr_dirs;
+	snapshot->hashes = snapshot->buf + 4;
+	snapshot->dirs = snapshot->hashes + (size_t)nr * 4 + 4;
+	return snapshot;
+}
+
+void free_name_hash_snapshot(struct index_state *istate)
+{
+	if (!istate->name_hash_snapshot)
+		return;
+	free(istate->name_hash_snapshot->buf);
+	FREE_AND_NULL(istate->name_hash_snapshot);
+}
+
+static void load_snapshot_dirs(struct index_state *istate,
+			       const struct name_hash_snapshot *snapshot)
+{
+	struct dir_entry **dirs;
+	const char *p;
+	unsigned int i;
+
+	ALLOC_ARRAY(dirs, snapshot->nr_dirs);
+	for (i = 0, p = snapshot->dirs; i < snapshot->nr_dirs; i++) {
+		unsigned int namelen = get_be32(p + 12);
+
+		FLEX_ALLOC_MEM(dirs[i], name, p + SNAPSHOT_DIR_SIZE, namelen);
+		hashmap_entry_init(&dirs[i]->ent, get_be32(p));
+		dirs[i]->nr = get_be32(p + 4);
+		dirs[i]->namelen = namelen;
+		p += SNAPSHOT_DIR_SIZE + namelen;
+	}
+	for (i = 0, p = snapshot->dirs; i < snapshot->nr_dirs; i++) {
+		unsigned int parent = get_be32(p + 8);
+
+		dirs[i]->parent = parent ? dirs[parent - 1] : NULL;
+		hashmap_add(&istate->dir_hash, &dirs[i]->ent);
+		p += SNAPSHOT_DIR_SIZE + dirs[i]->namelen;
+	}
+	free(dirs);
+}
+
+/*
+ * Fill the hash tables from the snapshot read with the index, if it
+ * still describes its entries.  Returns 1 if it was used.
+ */
+static int lazy_init_from_snapshot(struct index_state *istate)
+{
+	struct name_hash_snapshot *snapshot = istate->name_hash_snapshot;
+	int nr;
+
+	if (!snapshot)
+		return 0;
+	if (snapshot->nr != istate->cache_nr ||
+	    (istate->cache_changed & (CE_ENTRY_ADDED | CE_ENTRY_REMOVED))) {
+		free_name_hash_snapshot(istate);
+		return 0;
+	}
+
+	for (nr = 0; nr < istate->cache_nr; nr++) {
+		struct cache_entry *ce = istate->cache[nr];
+
+		ce->ce_flags |= CE_HASHED;
+		if (S_ISSPARSEDIR(ce->ce_mode))
+			continue;
+		hashmap_entry_init(&ce->ent,
+				   get_be32(snapshot->hashes + (size_t)nr * 4));
+		hashmap_add(&istate->name_hash, &ce->ent);
+	}
+
+	/* the snapshot may have been written without the directories */
+	if (ignore_case && snapshot->nr_dirs)
+		load_snapshot_dirs(istate, snapshot);
+	else if (ignore_case)
+		for (nr = 0; nr < istate->cache_nr; nr++)
+			add_dir_entry(istate, istate->cache[nr]);
+
+	trace2_data_intmax("index", istate->repo, "name-hash-init/snapshot",
+			   istate->cache_nr);
+	free_name_hash_snapshot(istate);
+	return 1;
+}
+
 static void lazy_init_name_hash(struct index_state *istate)
 {
 
@@ -586,7 +786,9 @@ static void lazy_init_name_hash(struct index_state *istate)
 	hashmap_init(&istate->name_hash, cache_entry_cmp, NULL, istate->cache_nr);
 	hashmap_init(&istate->dir_hash, dir_entry_cmp, NULL, istate->cache_nr);
 
-	if (lookup_lazy_params(istate)) {
+	if (lazy_init_from_snapshot(istate)) {
+		/* the names were hashed when the index was written */
+	} else if (lookup_lazy_params(istate)) {
 		/*
 		 * Disable item counting and automatic rehashing because
 		 * we do per-chain (mod n) locking rather than whole hashmap
@@ -1514,6 +1514,7 @@ void enable_obj_read_lock(void)
 
 	obj_read_use_lock = 1;
 	init_recursive_mutex(&obj_read_mutex);
+	enable_delta_base_cache_locks();
 }
 
 void disable_obj_read_lock(void)
@@ -1523,6 +1524,7 @@ void disable_obj_read_lock(void)
 
 	obj_read_use_lock = 0;
 	pthread_mutex_destroy(&obj_read_mutex);
+	disable_delta_base_cache_locks();
 }
 
 int fetch_if_missing = 1;
@@ -1642,6 +1644,103 @@ int oid_object_info_extended(struct repository *r, const struct object_id *oid,
 }
 
 
+static int compare_batch_oids(const void *va, const void *vb, void *ctx)
+{
+	const struct object_id **real = ctx;
+	size_t a = *(const size_t *)va, b = *(const size_t *)vb;
+
+	return oidcmp(real[a], real[b]);
+}
+
+static int compare_batch_entries(const void *va, const void *vb, void *ctx)
+{
+	const struct pack_entry *e = ctx;
+	const struct pack_entry *a = &e[*(const size_t *)va];
+	const struct pack_entry *b = &e[*(const size_t *)vb];
+
+	if (a->p != b->p)
+		return (uintptr_t)a->p < (uintptr_t)b->p ? -1 : 1;
+	return a->offset < b->offset ? -1 : a->offset > b->offset;
+}
+
+void oid_object_info_batch(struct repository *r,
+			   const struct object_id *oids,
+			   struct object_info *oi, int *ret,
+			   size_t nr, unsigned flags)
+{
+	const struct object_id **real;
+	struct object_id *sorted;
+	struct pack_entry *e;
+	size_t *order, *packed;
+	size_t i, nr_order = 0, nr_packed = 0;
+	unsigned fallback_flags = flags & ~OBJECT_INFO_LOOKUP_REPLACE;
+
+	ALLOC_ARRAY(real, nr);
+	ALLOC_ARRAY(order, nr);
+
+	obj_read_lock();
+	for (i = 0; i < nr; i++) {
+		real[i] = &oids[i];
+		if (flags & OBJECT_INFO_LOOKUP_REPLACE)
+			real[i] = lookup_replace_object(r, &oids[i]);
+
+		if (is_null_oid(real[i]) || find_cached_object(real[i]))
+			ret[i] = do_oid_object_info_extended(r, real[i], &oi[i],
+							     fallback_flags);
+		else
+			order[nr_order++] = i;
+	}
+
+	/* Find the pack entries of all objects, in oid order. */
+	QSORT_S(order, nr_order, compare_batch_oids, real);
+	ALLOC_ARRAY(sorted, nr_order);
+	for (i = 0; i < nr_order; i++)
+		oidcpy(&sorted[i], real[order[i]]);
+	CALLOC_ARRAY(e, nr_order);
+	find_pack_entries(r, sorted, nr_order, e);
+
+	/*
+	 * Read the packed objects in pack order; anything that is not in
+	 * a pack (or cannot be read from it) takes the slow path.
+	 */
+	ALLOC_ARRAY(packed, nr_order);
+	for (i = 0; i < nr_order; i++) {
+		if (e[i].p)
+			packed[nr_packed++] = i;
+		else
+			ret[order[i]] = do_oid_object_info_extended(r, real[order[i]],
+								    &oi[order[i]],
+								    fallback_flags);
+	}
+	QSORT_S(packed, nr_packed, compare_batch_entries, e);
+	for (i = 0; i < nr_packed; i++) {
+		struct pack_entry *entry = &e[packed[i]];
+		size_t pos = order[packed[i]];
+		int rtype = packed_object_info(r, entry->p, entry->offset, &oi[pos]);
+
+		if (rtype < 0) {
+			mark_bad_packed_object(entry->p, real[pos]);
+			ret[pos] = do_oid_object_info_extended(r, real[pos],
+							       &oi[pos], 0);
+			continue;
+		}
+		if (oi[pos].whence == OI_PACKED) {
+			oi[pos].u.packed.offset = entry->offset;
+			oi[pos].u.packed.pack = entry->p;
+			oi[pos].u.packed.is_delta = (rtype == OBJ_REF_DELTA ||
+						     rtype == OBJ_OFS_DELTA);
+		}
+		ret[pos] = 0;
+	}
+	obj_read_unlock();
+
+	free(packed);
+	free(e);
+	free(sorted);
+	free(order);
+	free(real);
+}
+
 /* returns enum object_type or negative */
 int oid_object_info(struct repository *r,
 		    const struct object_id *oid,
@@ -2050,19 +2149,26 @@ static int write_loose_object(const struct object_id *oid, char *hdr,
 	git_zstream stream;
 	git_hash_ctx c;
 	struct object_id parano_oid;
-	static struct strbuf tmp_file = STRBUF_INIT;
-	static struct strbuf filename = STRBUF_INIT;
+	struct strbuf tmp_file = STRBUF_INIT;
+	struct strbuf filename = STRBUF_INIT;
 
-	if (batch_fsync_enabled(FSYNC_COMPONENT_LOOSE_OBJECT))
+	if (batch_fsync_enabled(FSYNC_COMPONENT_LOOSE_OBJECT)) {
+		/* this may replace the primary odb under other readers */
+		obj_read_lock();
 		prepare_loose_object_bulk_checkin();
+		obj_read_unlock();
+	}
 
 	loose_object_path(the_repository, &filename, oid);
 
 	fd = start_loose_object_common(&tmp_file, filename.buf, flags,
 				       &stream, compressed, sizeof(compressed),
 				       &c, hdr, hdrlen);
-	if (fd < 0)
+	if (fd < 0) {
+		strbuf_release(&tmp_file);
+		strbuf_release(&filename);
 		return -1;
+	}
 
 	/* Then the data itself.. */
 	stream.next_in = (void *)buf;
@@ -2096,7 +2202,10 @@ static int write_loose_object(const struct object_id *oid, char *hdr,
 			warning_errno(_("failed utime() on %s"), tmp_file.buf);
 	}
 
-	return finalize_object_file(tmp_file.buf, filename.buf);
+	ret = finalize_object_file(tmp_file.buf, filename.buf);
+	strbuf_release(&tmp_file);
+	strbuf_release(&filename);
+	return ret;
 }
 
 static int freshen_loose_object(const struct object_id *oid)
@@ -2229,13 +2338,17 @@ int write_object_file_flags(const void *buf, unsigned long len,
 {
 	char hdr[MAX_HEADER_LEN];
 	int hdrlen = sizeof(hdr);
+	int found;
 
 	/* Normally if we have it in the pack then we do not bother writing
 	 * it out into .git/objects/??/?{38} file.
 	 */
 	write_object_file_prepare(the_hash_algo, buf, len, type, oid, hdr,
 				  &hdrlen);
-	if (freshen_packed_object(oid) || freshen_loose_object(oid))
+	obj_read_lock();
+	found = freshen_packed_object(oid) || freshen_loose_object(oid);
+	obj_read_unlock();
+	if (found)
 		return 0;
 	return write_loose_object(oid, hdr, hdrlen, buf, len, 0, flags);
 }
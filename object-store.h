@@ -359,7 +359,9 @@ void assert_oid_type(const struct object_id *oid, enum object_type expect);
  * Enabling the object read lock allows multiple threads to safely call the
  * following functions in parallel: repo_read_object_file(), read_object_file(),
  * read_object_file_extended(), read_object_with_reference(), read_object(),
- * oid_object_info() and oid_object_info_extended().
+ * oid_object_info() and oid_object_info_extended().  Loose objects may
+ * also be written with write_object_file() and write_object_file_flags()
+ * from several threads; their hashing and deflation run in parallel.
  *
  * obj_read_lock() and obj_read_unlock() may also be used to protect other
  * section which cannot execute in parallel with object reading. Since the used
@@ -451,6 +453,17 @@ int oid_object_info_extended(struct repository *r,
 			     const struct object_id *,
 			     struct object_info *, unsigned flags);
 
+/*
+ * Like calling oid_object_info_extended(r, &oids[i], &oi[i], flags) for
+ * each of the "nr" objects and storing its return value in ret[i], but
+ * faster for large batches: the objects are looked up in each pack index
+ * in sorted order, and their info is read in pack order.
+ */
+void oid_object_info_batch(struct repository *r,
+			   const struct object_id *oids,
+			   struct object_info *oi, int *ret,
+			   size_t nr, unsigned flags);
+
 /*
  * Iterate over the files in the loose-object parts of the object
  * directory "path", triggering the following callbacks:
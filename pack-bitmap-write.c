@@ -1,4 +1,5 @@
 #include "cache.h"
+#include "config.h"
 #include "object-store.h"
 #include "commit.h"
 #include "tag.h"
@@ -13,6 +14,7 @@
 #include "pack-objects.h"
 #include "commit-reach.h"
 #include "prio-queue.h"
+#include "thread-utils.h"
 
 struct bitmapped_commit {
 	struct commit *commit;
@@ -23,6 +25,12 @@ struct bitmapped_commit {
 	uint32_t commit_pos;
 };
 
+struct tree_bitmap {
+	struct object_id oid;
+	uint32_t pos;
+	struct ewah_bitmap *bitmap;
+};
+
 struct bitmap_writer {
 	struct ewah_bitmap *commits;
 	struct ewah_bitmap *trees;
@@ -38,6 +46,25 @@ struct bitmap_writer {
 	struct progress *progress;
 	int show_progress;
 	unsigned char pack_checksum[GIT_MAX_RAWSZ];
+
+	/* version of the bitmap index to write; see bitmap_writer_build() */
+	uint16_t version;
+
+	/*
+	 * When writing the bitmaps of an incremental MIDX layer, those of
+	 * the layers below it. Their "base_nr" objects come first in the
+	 * bit order, before the objects of "to_pack".
+	 */
+	struct bitmap_index *base;
+	uint32_t base_nr;
+
+	/*
+	 * The bitmaps of the top-level trees that several selected commits
+	 * have in common, in bit order. They are used instead of walking
+	 * these trees again. Read-only while the threads run.
+	 */
+	struct tree_bitmap *tree_cache;
+	size_t tree_cache_nr;
 };
 
 static struct bitmap_writer writer;
@@ -47,6 +74,29 @@ void bitmap_writer_show_progress(int show)
 	writer.show_progress = show;
 }
 
+void bitmap_writer_set_base(struct bitmap_index *base, uint32_t base_nr)
+{
+	writer.base = base;
+	writer.base_nr = base_nr;
+}
+
+static void copy_base_type_index(struct ewah_bitmap *dst,
+				 struct ewah_bitmap *src)
+{
+	struct ewah_iterator it;
+	eword_t word;
+	uint32_t pos = 0;
+
+	ewah_iterator_init(&it, src);
+	while (ewah_iterator_next(&word, &it)) {
+		while (word) {
+			ewah_set(dst, pos + ewah_bit_ctz64(word));
+			word &= word - 1;
+		}
+		pos += BITS_IN_EWORD;
+	}
+}
+
 /**
  * Build the initial type index for the packfile or multi-pack-index
  */
@@ -62,8 +112,20 @@ void bitmap_writer_build_type_index(struct packing_data *to_pack,
 	writer.tags = ewah_new();
 	ALLOC_ARRAY(to_pack->in_pack_pos, to_pack->nr_objects);
 
+	if (writer.base) {
+		copy_base_type_index(writer.commits,
+				     bitmap_type_index(writer.base, OBJ_COMMIT));
+		copy_base_type_index(writer.trees,
+				     bitmap_type_index(writer.base, OBJ_TREE));
+		copy_base_type_index(writer.blobs,
+				     bitmap_type_index(writer.base, OBJ_BLOB));
+		copy_base_type_index(writer.tags,
+				     bitmap_type_index(writer.base, OBJ_TAG));
+	}
+
 	for (i = 0; i < index_nr; ++i) {
 		struct object_entry *entry = (struct object_entry *)index[i];
+		uint32_t pos = writer.base_nr + i;
 		enum object_type real_type;
 
 		oe_set_in_pack_pos(to_pack, entry, i);
@@ -84,19 +146,19 @@ void bitmap_writer_build_type_index(struct packing_data *to_pack,
 
 		switch (real_type) {
 		case OBJ_COMMIT:
-			ewah_set(writer.commits, i);
+			ewah_set(writer.commits, pos);
 			break;
 
 		case OBJ_TREE:
-			ewah_set(writer.trees, i);
+			ewah_set(writer.trees, pos);
 			break;
 
 		case OBJ_BLOB:
-			ewah_set(writer.blobs, i);
+			ewah_set(writer.blobs, pos);
 			break;
 
 		case OBJ_TAG:
-			ewah_set(writer.tags, i);
+			ewah_set(writer.tags, pos);
 			break;
 
 		default:
@@ -129,6 +191,15 @@ static uint32_t find_object_pos(const struct object_id *oid, int *found)
 {
 	struct object_entry *entry = packlist_find(writer.to_pack, oid);
 
+	if (!entry && writer.base) {
+		int pos = bitmap_position(writer.base, oid);
+		if (pos >= 0) {
+			if (found)
+				*found = 1;
+			return pos;
+		}
+	}
+
 	if (!entry) {
 		if (found)
 			*found = 0;
@@ -139,12 +210,16 @@ static uint32_t find_object_pos(const struct object_id *oid, int *found)
 
 	if (found)
 		*found = 1;
-	return oe_in_pack_pos(writer.to_pack, entry);
+	return writer.base_nr + oe_in_pack_pos(writer.to_pack, entry);
 }
 
 static void compute_xor_offsets(void)
 {
-	static const int MAX_XOR_OFFSET_SEARCH = 10;
+	/*
+	 * Version 2 indexes store the commit bitmaps as roaring bitmaps,
+	 * which are never XOR'd against each other.
+	 */
+	const int MAX_XOR_OFFSET_SEARCH = writer.version == 2 ? 0 : 10;
 
 	int i, next = 0;
 
@@ -337,41 +412,84 @@ static void bitmap_builder_clear(struct bitmap_builder *bb)
 	bb->commits_nr = bb->commits_alloc = 0;
 }
 
+/*
+ * Serializes the lookups of commit trees and of existing bitmaps, which
+ * update shared state, when the bitmaps are built on several threads.
+ */
+static pthread_mutex_t commit_mutex;
+#define commit_lock()		pthread_mutex_lock(&commit_mutex)
+#define commit_unlock()		pthread_mutex_unlock(&commit_mutex)
+
+static struct tree_bitmap *find_tree_bitmap(uint32_t pos)
+{
+	size_t lo = 0, hi = writer.tree_cache_nr;
+
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+		struct tree_bitmap *tb = &writer.tree_cache[mi];
+
+		if (tb->pos == pos)
+			return tb;
+		if (tb->pos < pos)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return NULL;
+}
+
 static int fill_bitmap_tree(struct bitmap *bitmap,
-			    struct tree *tree)
+			    const struct object_id *oid)
 {
+	struct tree_bitmap *cached;
 	int found;
 	uint32_t pos;
 	struct tree_desc desc;
 	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
 
 	/*
 	 * If our bit is already set, then there is nothing to do. Both this
 	 * tree and all of its children will be set.
 	 */
-	pos = find_object_pos(&tree->object.oid, &found);
+	pos = find_object_pos(oid, &found);
 	if (!found)
 		return -1;
 	if (bitmap_get(bitmap, pos))
 		return 0;
+
+	cached = find_tree_bitmap(pos);
+	if (cached) {
+		bitmap_or_ewah(bitmap, cached->bitmap);
+		return 0;
+	}
 	bitmap_set(bitmap, pos);
 
-	if (parse_tree(tree) < 0)
-		die("unable to load tree object %s",
-		    oid_to_hex(&tree->object.oid));
-	init_tree_desc(&desc, tree->buffer, tree->size);
+	/*
+	 * Read the tree without going through its "struct tree", so
+	 * that several threads can walk the same trees.
+	 */
+	buf = repo_read_object_file(writer.to_pack->repo, oid, &type, &size);
+	if (!buf || type != OBJ_TREE)
+		die("unable to load tree object %s", oid_to_hex(oid));
+	init_tree_desc(&desc, buf, size);
 
 	while (tree_entry(&desc, &entry)) {
 		switch (object_type(entry.mode)) {
 		case OBJ_TREE:
-			if (fill_bitmap_tree(bitmap,
-					     lookup_tree(the_repository, &entry.oid)) < 0)
+			if (fill_bitmap_tree(bitmap, &entry.oid) < 0) {
+				free(buf);
 				return -1;
+			}
 			break;
 		case OBJ_BLOB:
 			pos = find_object_pos(&entry.oid, &found);
-			if (!found)
+			if (!found) {
+				free(buf);
 				return -1;
+			}
 			bitmap_set(bitmap, pos);
 			break;
 		default:
@@ -380,14 +498,20 @@ static int fill_bitmap_tree(struct bitmap *bitmap,
 		}
 	}
 
-	free_tree_buffer(tree);
+	free(buf);
 	return 0;
 }
 
+/*
+ * Add the objects reachable from "commit" to its bitmap. The walk stops
+ * at the commits already in the bitmap, and at those in "stop" if given.
+ * Without "tree_queue", only the commits are added.
+ */
 static int fill_bitmap_commit(struct bb_commit *ent,
 			      struct commit *commit,
 			      struct prio_queue *queue,
 			      struct prio_queue *tree_queue,
+			      struct bitmap *stop,
 			      struct bitmap_index *old_bitmap,
 			      const uint32_t *mapping)
 {
@@ -402,15 +526,30 @@ static int fill_bitmap_commit(struct bb_commit *ent,
 		struct commit_list *p;
 		struct commit *c = prio_queue_get(queue);
 
-		if (old_bitmap && mapping) {
-			struct ewah_bitmap *old = bitmap_for_commit(old_bitmap, c);
-			/*
-			 * If this commit has an old bitmap, then translate that
-			 * bitmap and add its bits to this one. No need to walk
-			 * parents or the tree for this commit.
-			 */
-			if (old && !rebuild_bitmap(mapping, old, ent->bitmap))
+		if (old_bitmap) {
+			struct ewah_bitmap *old;
+
+			commit_lock();
+			old = bitmap_for_commit(old_bitmap, c);
+			commit_unlock();
+
+			if (old && mapping) {
+				/*
+				 * If this commit has an old bitmap, then
+				 * translate that bitmap and add its bits to
+				 * this one. No need to walk parents or the
+				 * tree for this commit.
+				 */
+				if (!rebuild_bitmap(mapping, old, ent->bitmap))
+					continue;
+			} else if (old) {
+				/*
+				 * The bitmaps of the base layers use the same
+				 * bit positions as ours, and can be used as-is.
+				 */
+				bitmap_or_ewah(ent->bitmap, old);
 				continue;
+			}
 		}
 
 		/*
@@ -421,42 +560,542 @@ static int fill_bitmap_commit(struct bb_commit *ent,
 		if (!found)
 			return -1;
 		bitmap_set(ent->bitmap, pos);
-		prio_queue_put(tree_queue, get_commit_tree(c));
+		if (tree_queue) {
+			commit_lock();
+			prio_queue_put(tree_queue, get_commit_tree(c));
+			commit_unlock();
+		}
 
 		for (p = c->parents; p; p = p->next) {
 			pos = find_object_pos(&p->item->object.oid, &found);
 			if (!found)
 				return -1;
-			if (!bitmap_get(ent->bitmap, pos)) {
+			if (!bitmap_get(ent->bitmap, pos) &&
+			    !(stop && bitmap_get(stop, pos))) {
 				bitmap_set(ent->bitmap, pos);
 				prio_queue_put(queue, p->item);
 			}
 		}
 	}
 
-	while (tree_queue->nr) {
-		if (fill_bitmap_tree(ent->bitmap,
-				     prio_queue_get(tree_queue)) < 0)
+	while (tree_queue && tree_queue->nr) {
+		struct tree *tree = prio_queue_get(tree_queue);
+
+		if (fill_bitmap_tree(ent->bitmap, &tree->object.oid) < 0)
 			return -1;
 	}
 	return 0;
 }
 
-static void store_selected(struct bb_commit *ent, struct commit *commit)
+static void index_selected(struct bitmapped_commit *stored)
 {
-	struct bitmapped_commit *stored = &writer.selected[ent->idx];
 	khiter_t hash_pos;
 	int hash_ret;
 
-	stored->bitmap = bitmap_to_ewah(ent->bitmap);
-
-	hash_pos = kh_put_oid_map(writer.bitmaps, commit->object.oid, &hash_ret);
+	hash_pos = kh_put_oid_map(writer.bitmaps, stored->commit->object.oid,
+				  &hash_ret);
 	if (hash_ret == 0)
 		die("Duplicate entry when writing index: %s",
-		    oid_to_hex(&commit->object.oid));
+		    oid_to_hex(&stored->commit->object.oid));
 	kh_value(writer.bitmaps, hash_pos) = stored;
 }
 
+static void store_selected(struct bb_commit *ent, struct commit *commit)
+{
+	struct bitmapped_commit *stored = &writer.selected[ent->idx];
+
+	stored->bitmap = bitmap_to_ewah(ent->bitmap);
+	index_selected(stored);
+}
+
+/*
+ * Hand the bitmap of "ent", once filled, to the maximal commits that
+ * build on it. The first one takes it over, the others get a copy or
+ * OR it into theirs.
+ */
+static void pass_bitmap(struct bb_commit *ent, struct bb_commit *child_ent,
+			int *reused)
+{
+	if (child_ent->bitmap)
+		bitmap_or(child_ent->bitmap, ent->bitmap);
+	else if (*reused)
+		child_ent->bitmap = bitmap_dup(ent->bitmap);
+	else {
+		child_ent->bitmap = ent->bitmap;
+		*reused = 1;
+	}
+}
+
+static uint16_t bitmap_writer_version(struct repository *r)
+{
+	int version = 1;
+
+	repo_config_get_int(r, "pack.bitmapversion", &version);
+	version = git_env_ulong("GIT_TEST_BITMAP_VERSION", version);
+	if (version != 1 && version != 2)
+		die(_("bad pack.bitmapVersion=%d"), version);
+	return version;
+}
+
+/*
+ * Building the bitmaps on several threads.
+ *
+ * The maximal commits are processed in the same order as on one thread,
+ * but cut in "segments" of consecutive commits, each of which is built
+ * on a single thread as usual. A commit inheriting from a commit of
+ * another segment starts from what it inherits within its own segment,
+ * and only gets the rest at the end: its walk stops at the commits
+ * reachable from the other segments (computed beforehand by a walk of
+ * the commits only, which is cheap), so it only finds the objects that
+ * these do not reach, plus some that they do, which is harmless. Adding
+ * the bitmaps of all the commits it inherits from afterwards gives the
+ * same bitmaps as building them on one thread.
+ *
+ * The first commits of the segments walk their trees from scratch, but
+ * the top-level trees they have in common with other commits are mostly
+ * found in the tree cache (see build_tree_cache()).
+ */
+#define BITMAP_THREAD_MIN_COMMITS 64
+
+/*
+ * Runs "nr" jobs on "nr_threads" threads, the main thread included.
+ * "failed" stops handing out jobs.
+ */
+struct bitmap_jobs {
+	pthread_mutex_t mutex;
+	int nr_threads;
+	void *data;
+
+	void (*fn)(struct bitmap_jobs *jobs, size_t job);
+	size_t nr, next;
+	int failed;
+};
+
+struct bb_thread_commit {
+	struct commit *commit;
+	struct bb_commit *ent;
+	unsigned segment;
+	/* whether it inherits from another segment */
+	unsigned external:1;
+	/* whether "partial" lacks what it inherits from other segments */
+	unsigned incomplete:1;
+	/* for "external" commits, the commits reachable from what it inherits */
+	struct ewah_bitmap *stop;
+	/* its bitmap, complete once all segments are done */
+	struct ewah_bitmap *partial;
+};
+
+struct bitmap_build_threads {
+	struct bitmap_jobs jobs;
+
+	struct bitmap_index *old_bitmap;
+	const uint32_t *mapping;
+
+	/* the maximal commits, in the order they are processed */
+	struct bb_thread_commit *commits;
+	size_t commits_nr;
+	kh_oid_pos_t *positions;
+	/* segment "s" is commits[segments[s]] to commits[segments[s + 1] - 1] */
+	size_t *segments;
+	size_t segments_nr;
+
+	int nr_stored;
+};
+
+static struct bb_thread_commit *bt_commit(struct bitmap_build_threads *bt,
+					  struct commit *commit)
+{
+	khiter_t pos = kh_get_oid_pos(bt->positions, commit->object.oid);
+
+	if (pos >= kh_end(bt->positions))
+		BUG("commit %s is not a maximal commit",
+		    oid_to_hex(&commit->object.oid));
+	return &bt->commits[kh_value(bt->positions, pos)];
+}
+
+static void *bitmap_jobs_thread(void *data)
+{
+	struct bitmap_jobs *jobs = data;
+
+	while (1) {
+		size_t job;
+
+		pthread_mutex_lock(&jobs->mutex);
+		if (jobs->failed || jobs->next >= jobs->nr) {
+			pthread_mutex_unlock(&jobs->mutex);
+			break;
+		}
+		job = jobs->next++;
+		pthread_mutex_unlock(&jobs->mutex);
+
+		jobs->fn(jobs, job);
+	}
+	return NULL;
+}
+
+static void run_bitmap_jobs(struct bitmap_jobs *jobs,
+			    void (*fn)(struct bitmap_jobs *, size_t),
+			    size_t nr)
+{
+	pthread_t *threads;
+	int i, nr_threads;
+
+	if (!nr)
+		return;
+	jobs->fn = fn;
+	jobs->nr = nr;
+	jobs->next = 0;
+
+	/* the main thread takes jobs, too */
+	nr_threads = jobs->nr_threads - 1;
+	if (nr_threads > nr - 1)
+		nr_threads = nr - 1;
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL,
+					 bitmap_jobs_thread, jobs);
+		if (err)
+			die(_("unable to create bitmap thread: %s"),
+			    strerror(err));
+	}
+	bitmap_jobs_thread(jobs);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+/*
+ * Walk the commits only, in the usual order, to find those inheriting
+ * from other segments, and where their walks can stop.
+ */
+static int bitmap_build_walk_commits(struct bitmap_build_threads *bt)
+{
+	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
+	size_t i;
+
+	for (i = 0; i < bt->commits_nr; i++) {
+		struct bb_thread_commit *tc = &bt->commits[i];
+		struct bb_commit *ent = tc->ent;
+		struct commit_list *p;
+		int reused = 0;
+
+		if (tc->external)
+			tc->stop = bitmap_to_ewah(ent->bitmap);
+		if (fill_bitmap_commit(ent, tc->commit, &queue, NULL, NULL,
+				       bt->old_bitmap, bt->mapping) < 0) {
+			clear_prio_queue(&queue);
+			return -1;
+		}
+
+		for (p = ent->reverse_edges; p; p = p->next) {
+			struct bb_thread_commit *child = bt_commit(bt, p->item);
+
+			if (child->segment != tc->segment)
+				child->external = child->incomplete = 1;
+			else if (tc->incomplete)
+				child->incomplete = 1;
+			pass_bitmap(ent, child->ent, &reused);
+		}
+		if (!reused)
+			bitmap_free(ent->bitmap);
+		ent->bitmap = NULL;
+	}
+	clear_prio_queue(&queue);
+	return 0;
+}
+
+static void bitmap_build_segment(struct bitmap_jobs *jobs, size_t s)
+{
+	struct bitmap_build_threads *bt = jobs->data;
+	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
+	struct prio_queue tree_queue = { NULL };
+	size_t i;
+
+	for (i = bt->segments[s]; i < bt->segments[s + 1]; i++) {
+		struct bb_thread_commit *tc = &bt->commits[i];
+		struct bb_commit *ent = tc->ent;
+		struct bitmap *stop = NULL;
+		struct commit_list *p;
+		int reused = 0, ret;
+
+		if (tc->stop)
+			stop = ewah_to_bitmap(tc->stop);
+		ret = fill_bitmap_commit(ent, tc->commit, &queue, &tree_queue,
+					 stop, bt->old_bitmap, bt->mapping);
+		bitmap_free(stop);
+
+		pthread_mutex_lock(&jobs->mutex);
+		if (ret < 0)
+			jobs->failed = 1;
+		ret = jobs->failed;
+		pthread_mutex_unlock(&jobs->mutex);
+		if (ret)
+			break;
+
+		tc->partial = bitmap_to_ewah(ent->bitmap);
+		if (ent->selected && !tc->incomplete) {
+			writer.selected[ent->idx].bitmap = tc->partial;
+			pthread_mutex_lock(&jobs->mutex);
+			display_progress(writer.progress, ++bt->nr_stored);
+			pthread_mutex_unlock(&jobs->mutex);
+		}
+
+		/* the commits of other segments get it at the end */
+		for (p = ent->reverse_edges; p; p = p->next) {
+			struct bb_thread_commit *child = bt_commit(bt, p->item);
+
+			if (child->segment == s)
+				pass_bitmap(ent, child->ent, &reused);
+		}
+		if (!reused)
+			bitmap_free(ent->bitmap);
+		ent->bitmap = NULL;
+	}
+	clear_prio_queue(&queue);
+	clear_prio_queue(&tree_queue);
+}
+
+/*
+ * Complete the bitmaps of the commits inheriting from other segments,
+ * in the usual order.
+ */
+static void bitmap_build_complete(struct bitmap_build_threads *bt)
+{
+	size_t i;
+
+	for (i = 0; i < bt->commits_nr; i++) {
+		struct bb_thread_commit *tc = &bt->commits[i];
+		struct bb_commit *ent = tc->ent;
+		struct commit_list *p;
+
+		if (tc->incomplete) {
+			if (!ent->bitmap)
+				ent->bitmap = bitmap_new();
+			bitmap_or_ewah(ent->bitmap, tc->partial);
+			ewah_free(tc->partial);
+			tc->partial = bitmap_to_ewah(ent->bitmap);
+			bitmap_free(ent->bitmap);
+			ent->bitmap = NULL;
+
+			if (ent->selected) {
+				writer.selected[ent->idx].bitmap = tc->partial;
+				display_progress(writer.progress, ++bt->nr_stored);
+			}
+		}
+
+		for (p = ent->reverse_edges; p; p = p->next) {
+			struct bb_thread_commit *child = bt_commit(bt, p->item);
+
+			if (!child->incomplete)
+				continue;
+			if (!child->ent->bitmap)
+				child->ent->bitmap = bitmap_new();
+			bitmap_or_ewah(child->ent->bitmap, tc->partial);
+		}
+	}
+}
+
+static void build_tree_bitmap(struct bitmap_jobs *jobs, size_t i)
+{
+	struct tree_bitmap *tb = (struct tree_bitmap *)jobs->data + i;
+	struct bitmap *bitmap = bitmap_new();
+
+	if (!fill_bitmap_tree(bitmap, &tb->oid))
+		tb->bitmap = bitmap_to_ewah(bitmap);
+	bitmap_free(bitmap);
+}
+
+static int tree_bitmap_cmp(const void *_a, const void *_b)
+{
+	const struct tree_bitmap *a = _a, *b = _b;
+
+	if (a->pos < b->pos)
+		return -1;
+	return a->pos > b->pos;
+}
+
+/*
+ * Compute the bitmaps of the top-level trees found in the trees of two
+ * selected commits or more, so that identical subtrees on different
+ * branches are walked once, and not once per branch.
+ */
+static void build_tree_cache(int nr_threads)
+{
+	struct repository *r = writer.to_pack->repo;
+	kh_oid_pos_t *seen = kh_init_oid_pos();
+	struct bitmap_jobs jobs = { .nr_threads = nr_threads };
+	struct tree_bitmap *trees = NULL;
+	size_t nr = 0, alloc = 0, i, j;
+	int own_obj_read_lock = 0;
+
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct tree *tree = repo_get_commit_tree(r, writer.selected[i].commit);
+		struct tree_desc desc;
+		struct name_entry entry;
+		enum object_type type;
+		unsigned long size;
+		void *buf;
+
+		if (!tree)
+			continue;
+		buf = repo_read_object_file(r, &tree->object.oid, &type, &size);
+		if (!buf || type != OBJ_TREE) {
+			free(buf);
+			continue;
+		}
+		init_tree_desc(&desc, buf, size);
+		while (tree_entry(&desc, &entry)) {
+			khiter_t pos;
+			int hash_ret, found;
+
+			if (object_type(entry.mode) != OBJ_TREE)
+				continue;
+			pos = kh_put_oid_pos(seen, entry.oid, &hash_ret);
+			if (hash_ret)
+				kh_value(seen, pos) = 0;
+			if (++kh_value(seen, pos) != 2)
+				continue;
+
+			ALLOC_GROW(trees, nr + 1, alloc);
+			oidcpy(&trees[nr].oid, &entry.oid);
+			trees[nr].pos = find_object_pos(&entry.oid, &found);
+			trees[nr].bitmap = NULL;
+			if (found)
+				nr++;
+		}
+		free(buf);
+	}
+	kh_destroy_oid_pos(seen);
+
+	jobs.data = trees;
+	pthread_mutex_init(&jobs.mutex, NULL);
+	if (nr_threads > 1) {
+		own_obj_read_lock = !obj_read_use_lock;
+		enable_obj_read_lock();
+	}
+	run_bitmap_jobs(&jobs, build_tree_bitmap, nr);
+	if (own_obj_read_lock)
+		disable_obj_read_lock();
+	pthread_mutex_destroy(&jobs.mutex);
+
+	/* the trees we could not walk are walked (and fail) as usual */
+	for (i = j = 0; i < nr; i++)
+		if (trees[i].bitmap)
+			trees[j++] = trees[i];
+	QSORT(trees, j, tree_bitmap_cmp);
+
+	writer.tree_cache = trees;
+	writer.tree_cache_nr = j;
+	trace2_data_intmax("pack-bitmap-write", the_repository,
+			   "build/tree_bitmaps", j);
+}
+
+static void free_tree_cache(void)
+{
+	size_t i;
+
+	for (i = 0; i < writer.tree_cache_nr; i++)
+		ewah_free(writer.tree_cache[i].bitmap);
+	FREE_AND_NULL(writer.tree_cache);
+	writer.tree_cache_nr = 0;
+}
+
+static int bitmap_writer_build_threaded(struct bitmap_builder *bb,
+					int nr_threads,
+					struct bitmap_index *old_bitmap,
+					const uint32_t *mapping)
+{
+	struct bitmap_build_threads bt = { .jobs.nr_threads = nr_threads };
+	int own_obj_read_lock, ret = 0;
+	size_t i;
+
+	bt.old_bitmap = old_bitmap;
+	bt.mapping = mapping;
+	bt.commits_nr = bb->commits_nr;
+	CALLOC_ARRAY(bt.commits, bt.commits_nr);
+	bt.positions = kh_init_oid_pos();
+
+	bt.segments_nr = nr_threads * 2;
+	if (bt.segments_nr > bt.commits_nr)
+		bt.segments_nr = bt.commits_nr;
+	ALLOC_ARRAY(bt.segments, bt.segments_nr + 1);
+	for (i = 0; i <= bt.segments_nr; i++)
+		bt.segments[i] = i * bt.commits_nr / bt.segments_nr;
+
+	for (i = 0; i < bt.commits_nr; i++) {
+		struct bb_thread_commit *tc = &bt.commits[i];
+		khiter_t pos;
+		int hash_ret;
+
+		tc->commit = bb->commits[bb->commits_nr - 1 - i];
+		tc->ent = bb_data_at(&bb->data, tc->commit);
+		tc->segment = i * bt.segments_nr / bt.commits_nr;
+		while (bt.segments[tc->segment + 1] <= i)
+			tc->segment++;
+		while (bt.segments[tc->segment] > i)
+			tc->segment--;
+
+		pos = kh_put_oid_pos(bt.positions, tc->commit->object.oid,
+				     &hash_ret);
+		kh_value(bt.positions, pos) = i;
+	}
+
+	trace2_region_enter("pack-bitmap-write", "build/threaded",
+			    the_repository);
+	trace2_data_intmax("pack-bitmap-write", the_repository,
+			   "build/threads", nr_threads);
+	trace2_data_intmax("pack-bitmap-write", the_repository,
+			   "build/segments", bt.segments_nr);
+
+	if (bitmap_build_walk_commits(&bt) < 0) {
+		ret = -1;
+		goto cleanup;
+	}
+
+	bt.jobs.data = &bt;
+	pthread_mutex_init(&bt.jobs.mutex, NULL);
+	own_obj_read_lock = !obj_read_use_lock;
+	enable_obj_read_lock();
+
+	run_bitmap_jobs(&bt.jobs, bitmap_build_segment, bt.segments_nr);
+
+	if (own_obj_read_lock)
+		disable_obj_read_lock();
+	pthread_mutex_destroy(&bt.jobs.mutex);
+
+	if (bt.jobs.failed) {
+		ret = -1;
+		goto cleanup;
+	}
+	bitmap_build_complete(&bt);
+
+	for (i = 0; i < writer.selected_nr; i++)
+		index_selected(&writer.selected[i]);
+
+cleanup:
+	trace2_region_leave("pack-bitmap-write", "build/threaded",
+			    the_repository);
+
+	for (i = 0; i < bt.commits_nr; i++) {
+		struct bb_thread_commit *tc = &bt.commits[i];
+
+		ewah_free(tc->stop);
+		if (!tc->ent->selected || ret < 0)
+			ewah_free(tc->partial);
+		bitmap_free(tc->ent->bitmap);
+		tc->ent->bitmap = NULL;
+		free_commit_list(tc->ent->reverse_edges);
+		tc->ent->reverse_edges = NULL;
+	}
+	if (ret < 0)
+		for (i = 0; i < writer.selected_nr; i++)
+			writer.selected[i].bitmap = NULL;
+	free(bt.segments);
+	kh_destroy_oid_pos(bt.positions);
+	free(bt.commits);
+	return ret;
+}
+
 int bitmap_writer_build(struct packing_data *to_pack)
 {
 	struct bitmap_builder bb;
@@ -466,30 +1105,50 @@ int bitmap_writer_build(struct packing_data *to_pack)
 	struct prio_queue tree_queue = { NULL };
 	struct bitmap_index *old_bitmap;
 	uint32_t *mapping;
+	int nr_threads;
 	int closed = 1; /* until proven otherwise */
 
 	writer.bitmaps = kh_init_oid_map();
 	writer.to_pack = to_pack;
+	writer.version = bitmap_writer_version(to_pack->repo);
 
 	if (writer.show_progress)
 		writer.progress = start_progress("Building bitmaps", writer.selected_nr);
 	trace2_region_enter("pack-bitmap-write", "building_bitmaps_total",
 			    the_repository);
 
-	old_bitmap = prepare_bitmap_git(to_pack->repo);
-	if (old_bitmap)
-		mapping = create_bitmap_mapping(old_bitmap, to_pack);
-	else
+	if (writer.base) {
+		old_bitmap = writer.base;
 		mapping = NULL;
+	} else {
+		old_bitmap = prepare_bitmap_git(to_pack->repo);
+		if (old_bitmap)
+			mapping = create_bitmap_mapping(old_bitmap, to_pack);
+		else
+			mapping = NULL;
+	}
 
+	pthread_mutex_init(&commit_mutex, NULL);
 	bitmap_builder_init(&bb, &writer, old_bitmap);
+	nr_threads = HAVE_THREADS ?
+		repo_config_thread_count(to_pack->repo, "pack.bitmapthreads",
+					 "GIT_TEST_BITMAP_THREADS",
+					 bb.commits_nr < BITMAP_THREAD_MIN_COMMITS) : 1;
+	build_tree_cache(nr_threads);
+	if (nr_threads > 1 && bb.commits_nr > 1) {
+		if (bitmap_writer_build_threaded(&bb, nr_threads,
+						 old_bitmap, mapping) < 0)
+			closed = 0;
+		goto done;
+	}
+
 	for (i = bb.commits_nr; i > 0; i--) {
 		struct commit *commit = bb.commits[i-1];
 		struct bb_commit *ent = bb_data_at(&bb.data, commit);
 		struct commit *child;
 		int reused = 0;
 
-		if (fill_bitmap_commit(ent, commit, &queue, &tree_queue,
+		if (fill_bitmap_commit(ent, commit, &queue, &tree_queue, NULL,
 				       old_bitmap, mapping) < 0) {
 			closed = 0;
 			break;
@@ -501,33 +1160,26 @@ int bitmap_writer_build(struct packing_data *to_pack)
 			display_progress(writer.progress, nr_stored);
 		}
 
-		while ((child = pop_commit(&ent->reverse_edges))) {
-			struct bb_commit *child_ent =
-				bb_data_at(&bb.data, child);
-
-			if (child_ent->bitmap)
-				bitmap_or(child_ent->bitmap, ent->bitmap);
-			else if (reused)
-				child_ent->bitmap = bitmap_dup(ent->bitmap);
-			else {
-				child_ent->bitmap = ent->bitmap;
-				reused = 1;
-			}
-		}
+		while ((child = pop_commit(&ent->reverse_edges)))
+			pass_bitmap(ent, bb_data_at(&bb.data, child), &reused);
 		if (!reused)
 			bitmap_free(ent->bitmap);
 		ent->bitmap = NULL;
 	}
+done:
 	clear_prio_queue(&queue);
 	clear_prio_queue(&tree_queue);
 	bitmap_builder_clear(&bb);
-	free_bitmap_index(old_bitmap);
+	pthread_mutex_destroy(&commit_mutex);
+	if (old_bitmap != writer.base)
+		free_bitmap_index(old_bitmap);
 	free(mapping);
 
 	trace2_region_leave("pack-bitmap-write", "building_bitmaps_total",
 			    the_repository);
 
 	stop_progress(&writer.progress);
+	free_tree_cache();
 
 	if (closed)
 		compute_xor_offsets();
@@ -642,6 +1294,15 @@ static inline void dump_bitmap(struct hashfile *f, struct ewah_bitmap *bitmap)
 		die("Failed to write bitmap index");
 }
 
+static void dump_roaring(struct hashfile *f, struct ewah_bitmap *bitmap)
+{
+	struct strbuf buf = STRBUF_INIT;
+
+	roaring_serialize_ewah(bitmap, &buf);
+	hashwrite(f, buf.buf, buf.len);
+	strbuf_release(&buf);
+}
+
 static const struct object_id *oid_access(size_t pos, const void *table)
 {
 	const struct pack_idx_entry * const *index = table;
@@ -664,7 +1325,10 @@ static void write_selected_commits_v1(struct hashfile *f,
 		hashwrite_u8(f, stored->xor_offset);
 		hashwrite_u8(f, stored->flags);
 
-		dump_bitmap(f, stored->write_as);
+		if (writer.version == 2)
+			dump_roaring(f, stored->write_as);
+		else
+			dump_bitmap(f, stored->write_as);
 	}
 }
 
@@ -763,7 +1427,6 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 			  const char *filename,
 			  uint16_t options)
 {
-	static uint16_t default_version = 1;
 	static uint16_t flags = BITMAP_OPT_FULL_DAG;
 	struct strbuf tmp_file = STRBUF_INIT;
 	struct hashfile *f;
@@ -778,7 +1441,7 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	f = hashfd(fd, tmp_file.buf);
 
 	memcpy(header.magic, BITMAP_IDX_SIGNATURE, sizeof(BITMAP_IDX_SIGNATURE));
-	header.version = htons(default_version);
+	header.version = htons(writer.version);
 	header.options = htons(flags | options);
 	header.entry_count = htonl(writer.selected_nr);
 	hashcpy(header.checksum, writer.pack_checksum);
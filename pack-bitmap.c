@@ -25,6 +25,11 @@ struct stored_bitmap {
 	struct object_id oid;
 	struct ewah_bitmap *root;
 	struct stored_bitmap *xor;
+	/*
+	 * In version 2 indexes, the bitmap as it is stored on disk; `root`
+	 * is only built from it when a caller asks for an EWAH bitmap.
+	 */
+	struct roaring_bitmap *roaring;
 	int flags;
 };
 
@@ -47,6 +52,13 @@ struct bitmap_index {
 	struct packed_git *pack;
 	struct multi_pack_index *midx;
 
+	/*
+	 * For the bitmap of an incremental MIDX layer, the bitmap of the
+	 * layer below it. The objects of the layers below come first in
+	 * the bit order, and the bitmaps of their commits are used as-is.
+	 */
+	struct bitmap_index *base;
+
 	/*
 	 * Mark the first `reuse_objects` in the packfile as reused:
 	 * they will be sent as-is without using them for repacking
@@ -118,6 +130,12 @@ static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 	struct ewah_bitmap *parent;
 	struct ewah_bitmap *composed;
 
+	if (st->roaring && !st->root) {
+		struct bitmap *flat = roaring_to_bitmap(st->roaring);
+		st->root = bitmap_to_ewah(flat);
+		bitmap_free(flat);
+	}
+
 	if (!st->xor)
 		return st->root;
 
@@ -157,10 +175,67 @@ static struct ewah_bitmap *read_bitmap_1(struct bitmap_index *index)
 static uint32_t bitmap_num_objects(struct bitmap_index *index)
 {
 	if (index->midx)
-		return index->midx->num_objects;
+		return index->midx->num_objects_in_base +
+		       index->midx->num_objects;
 	return index->pack->num_objects;
 }
 
+/*
+ * Same as read_bitmap_1(), for the roaring bitmaps of the commits in a
+ * version 2 index.
+ */
+static struct roaring_bitmap *read_roaring_1(struct bitmap_index *index)
+{
+	struct roaring_bitmap *b = roaring_new();
+
+	ssize_t bitmap_size = roaring_read_mmap(b,
+		index->map + index->map_pos,
+		index->map_size - index->map_pos,
+		bitmap_num_objects(index));
+
+	if (bitmap_size < 0) {
+		error(_("failed to load bitmap index (corrupted?)"));
+		roaring_free(b);
+		return NULL;
+	}
+
+	index->map_pos += bitmap_size;
+	return b;
+}
+
+/*
+ * Read the bitmap of a commit entry, in whichever format the index
+ * stores them, into either "ewah" or "roaring".
+ */
+static int read_commit_bitmap_1(struct bitmap_index *index,
+				struct ewah_bitmap **ewah,
+				struct roaring_bitmap **roaring)
+{
+	*ewah = NULL;
+	*roaring = NULL;
+	if (index->version == 2)
+		*roaring = read_roaring_1(index);
+	else
+		*ewah = read_bitmap_1(index);
+	return *ewah || *roaring ? 0 : -1;
+}
+
+/*
+ * Find the layer of the (possibly incremental) MIDX bitmap "*bitmap_git"
+ * holding the object at bit position "pos", point "*bitmap_git" at it,
+ * and return the position of the object in that layer of the MIDX.
+ */
+static uint32_t bitmap_pos_to_midx(struct bitmap_index **bitmap_git,
+				   uint32_t pos)
+{
+	struct bitmap_index *b = *bitmap_git;
+
+	while (pos < b->midx->num_objects_in_base)
+		b = b->base;
+	*bitmap_git = b;
+	return pack_pos_to_midx(b->midx, pos - b->midx->num_objects_in_base);
+}
+
 static int load_bitmap_header(struct bitmap_index *index)
 {
 	struct bitmap_disk_header *header = (void *)index->map;
@@ -173,13 +248,16 @@ static int load_bitmap_header(struct bitmap_index *index)
 		return error(_("corrupted bitmap index file (wrong header)"));
 
 	index->version = ntohs(header->version);
-	if (index->version != 1)
+	if (index->version != 1 && index->version != 2)
 		return error(_("unsupported version '%d' for bitmap index file"), index->version);
 
 	/* Parse known bitmap format options */
 	{
 		uint32_t flags = ntohs(header->options);
-		size_t cache_size = st_mult(bitmap_num_objects(index), sizeof(uint32_t));
+		/* the hash cache only covers the objects of this MIDX layer */
+		size_t cache_size = st_mult(index->midx ? index->midx->num_objects :
+					    index->pack->num_objects,
+					    sizeof(uint32_t));
 		unsigned char *index_end = index->map + index->map_size - the_hash_algo->rawsz;
 
 		if ((flags & BITMAP_OPT_FULL_DAG) == 0)
@@ -212,6 +290,7 @@ static int load_bitmap_header(struct bitmap_index *index)
 
 static struct stored_bitmap *store_bitmap(struct bitmap_index *index,
 					  struct ewah_bitmap *root,
+					  struct roaring_bitmap *roaring,
 					  const struct object_id *oid,
 					  struct stored_bitmap *xor_with,
 					  int flags)
@@ -222,6 +301,7 @@ static struct stored_bitmap *store_bitmap(struct bitmap_index *index,
 
 	stored = xmalloc(sizeof(struct stored_bitmap));
 	stored->root = root;
+	stored->roaring = roaring;
 	stored->xor = xor_with;
 	stored->flags = flags;
 	oidcpy(&stored->oid, oid);
@@ -273,6 +353,7 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 	for (i = 0; i < index->entry_count; ++i) {
 		int xor_offset, flags;
 		struct ewah_bitmap *bitmap = NULL;
+		struct roaring_bitmap *roaring = NULL;
 		struct stored_bitmap *xor_bitmap = NULL;
 		uint32_t commit_idx_pos;
 		struct object_id oid;
@@ -288,11 +369,11 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 			return error(_("corrupt ewah bitmap: commit index %u out of range"),
 				     (unsigned)commit_idx_pos);
 
-		bitmap = read_bitmap_1(index);
-		if (!bitmap)
+		if (read_commit_bitmap_1(index, &bitmap, &roaring) < 0)
 			return -1;
 
-		if (xor_offset > MAX_XOR_OFFSET || xor_offset > i)
+		if (xor_offset > MAX_XOR_OFFSET || xor_offset > i ||
+		    (roaring && xor_offset))
 			return error(_("corrupted bitmap pack index"));
 
 		if (xor_offset > 0) {
@@ -303,7 +384,7 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 		}
 
 		recent_bitmaps[i % MAX_XOR_OFFSET] = store_bitmap(
-			index, bitmap, &oid, xor_bitmap, flags);
+			index, bitmap, roaring, &oid, xor_bitmap, flags);
 	}
 
 	return 0;
@@ -313,7 +394,7 @@ char *midx_bitmap_filename(struct multi_pack_index *midx)
 {
 	struct strbuf buf = STRBUF_INIT;
 
-	get_midx_filename(&buf, midx->object_dir);
+	get_midx_filename_prefix(&buf, midx);
 	strbuf_addf(&buf, "-%s.bitmap", hash_to_hex(get_midx_checksum(midx)));
 
 	return strbuf_detach(&buf, NULL);
@@ -387,6 +468,19 @@ static int open_midx_bitmap_1(struct bitmap_index *bitmap_git,
 			    bitmap_git->midx->pack_names[i]);
 	}
 
+	if (midx->base_midx) {
+		/*
+		 * The preferred pack belongs to the regular MIDX at the
+		 * bottom, and is checked when opening its bitmap.
+		 */
+		bitmap_git->base = prepare_midx_bitmap_git(midx->base_midx);
+		if (!bitmap_git->base) {
+			warning(_("multi-pack bitmap layer is missing the bitmap of its base"));
+			goto cleanup;
+		}
+		return 0;
+	}
+
 	preferred = bitmap_git->midx->packs[midx_preferred_pack(bitmap_git)];
 	if (!is_pack_valid(preferred)) {
 		warning(_("preferred pack (%s) is invalid"),
@@ -397,6 +491,8 @@ static int open_midx_bitmap_1(struct bitmap_index *bitmap_git,
 	return 0;
 
 cleanup:
+	free_bitmap_index(bitmap_git->base);
+	bitmap_git->base = NULL;
 	munmap(bitmap_git->map, bitmap_git->map_size);
 	bitmap_git->map_size = 0;
 	bitmap_git->map_pos = 0;
@@ -535,6 +631,15 @@ static int open_pack_bitmap(struct repository *r,
 	return ret;
 }
 
+static int midx_is_layer_of(struct multi_pack_index *m,
+			    struct multi_pack_index *top)
+{
+	for (; top; top = top->base_midx)
+		if (m == top)
+			return 1;
+	return 0;
+}
+
 static int open_midx_bitmap(struct repository *r,
 			    struct bitmap_index *bitmap_git)
 {
@@ -544,6 +649,9 @@ static int open_midx_bitmap(struct repository *r,
 	assert(!bitmap_git->map);
 
 	for (midx = get_multi_pack_index(r); midx; midx = midx->next) {
+		/* the layers below an opened one come with it */
+		if (midx_is_layer_of(midx, bitmap_git->midx))
+			continue;
 		if (!open_midx_bitmap_1(bitmap_git, midx))
 			ret = 0;
 	}
@@ -697,6 +805,7 @@ static struct stored_bitmap *lazy_bitmap_for_commit(struct bitmap_index *bitmap_
 	struct bitmap_lookup_table_triplet triplet;
 	struct object_id *oid = &commit->object.oid;
 	struct ewah_bitmap *bitmap;
+	struct roaring_bitmap *roaring;
 	struct stored_bitmap *xor_bitmap = NULL;
 	const int bitmap_header_size = 6;
 	static struct bitmap_lookup_table_xor_item *xor_items = NULL;
@@ -722,6 +831,11 @@ static struct stored_bitmap *lazy_bitmap_for_commit(struct bitmap_index *bitmap_
 	while (xor_row != 0xffffffff) {
 		ALLOC_GROW(xor_items, xor_items_nr + 1, xor_items_alloc);
 
+		if (bitmap_git->version == 2) {
+			error(_("corrupt bitmap lookup table: xor row in a version 2 index"));
+			goto corrupt;
+		}
+
 		if (xor_items_nr + 1 >= bitmap_git->entry_count) {
 			error(_("corrupt bitmap lookup table: xor chain exceeds entry count"));
 			goto corrupt;
@@ -771,7 +885,7 @@ static struct stored_bitmap *lazy_bitmap_for_commit(struct bitmap_index *bitmap_
 		if (!bitmap)
 			goto corrupt;
 
-		xor_bitmap = store_bitmap(bitmap_git, bitmap, &xor_item->oid, xor_bitmap, xor_flags);
+		xor_bitmap = store_bitmap(bitmap_git, bitmap, NULL, &xor_item->oid, xor_bitmap, xor_flags);
 		xor_items_nr--;
 	}
 
@@ -807,12 +921,10 @@ static struct stored_bitmap *lazy_bitmap_for_commit(struct bitmap_index *bitmap_
 	 */
 	bitmap_git->map_pos += sizeof(uint32_t) + sizeof(uint8_t);
 	flags = read_u8(bitmap_git->map, &bitmap_git->map_pos);
-	bitmap = read_bitmap_1(bitmap_git);
-
-	if (!bitmap)
+	if (read_commit_bitmap_1(bitmap_git, &bitmap, &roaring) < 0)
 		goto corrupt;
 
-	return store_bitmap(bitmap_git, bitmap, oid, xor_bitmap, flags);
+	return store_bitmap(bitmap_git, bitmap, roaring, oid, xor_bitmap, flags);
 
 corrupt:
 	free(xor_items);
@@ -820,24 +932,44 @@ static struct stored_bitmap *lazy_bitmap_for_commit(struct bitmap_index *bitmap_
 	return NULL;
 }
 
-struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *bitmap_git,
-				      struct commit *commit)
+static struct stored_bitmap *stored_bitmap_for_commit(struct bitmap_index *bitmap_git,
+						      struct commit *commit)
 {
+	struct stored_bitmap *stored = NULL;
 	khiter_t hash_pos = kh_get_oid_map(bitmap_git->bitmaps,
 					   commit->object.oid);
-	if (hash_pos >= kh_end(bitmap_git->bitmaps)) {
-		struct stored_bitmap *bitmap = NULL;
-		if (!bitmap_git->table_lookup)
-			return NULL;
+	if (hash_pos < kh_end(bitmap_git->bitmaps))
+		return kh_value(bitmap_git->bitmaps, hash_pos);
 
+	if (bitmap_git->table_lookup) {
 		/* this is a fairly hot codepath - no trace2_region please */
 		/* NEEDSWORK: cache misses aren't recorded */
-		bitmap = lazy_bitmap_for_commit(bitmap_git, commit);
-		if (!bitmap)
-			return NULL;
-		return lookup_stored_bitmap(bitmap);
+		stored = lazy_bitmap_for_commit(bitmap_git, commit);
 	}
-	return lookup_stored_bitmap(kh_value(bitmap_git->bitmaps, hash_pos));
+	if (!stored && bitmap_git->base)
+		stored = stored_bitmap_for_commit(bitmap_git->base, commit);
+	return stored;
+}
+
+struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *bitmap_git,
+				      struct commit *commit)
+{
+	struct stored_bitmap *bitmap = stored_bitmap_for_commit(bitmap_git, commit);
+	if (!bitmap)
+		return NULL;
+	return lookup_stored_bitmap(bitmap);
+}
+
+/*
+ * OR the bitmap of a commit into "base". Roaring bitmaps are used as
+ * they are mapped, without going through EWAH.
+ */
+static void bitmap_or_stored(struct bitmap *base, struct stored_bitmap *st)
+{
+	if (st->roaring)
+		bitmap_or_roaring(base, st->roaring);
+	else
+		bitmap_or_ewah(base, lookup_stored_bitmap(st));
 }
 
 static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
@@ -871,16 +1003,21 @@ static int bitmap_position_midx(struct bitmap_index *bitmap_git,
 				const struct object_id *oid)
 {
 	uint32_t want, got;
-	if (!bsearch_midx(oid, bitmap_git->midx, &want))
-		return -1;
 
-	if (midx_to_pack_pos(bitmap_git->midx, want, &got) < 0)
-		return -1;
-	return got;
+	for (; bitmap_git; bitmap_git = bitmap_git->base) {
+		struct multi_pack_index *m = bitmap_git->midx;
+
+		if (!bsearch_midx(oid, m, &want))
+			continue;
+		if (midx_to_pack_pos(m, want, &got) < 0)
+			return -1;
+		return m->num_objects_in_base + got;
+	}
+	return -1;
 }
 
-static int bitmap_position(struct bitmap_index *bitmap_git,
-			   const struct object_id *oid)
+int bitmap_position(struct bitmap_index *bitmap_git,
+		    const struct object_id *oid)
 {
 	int pos;
 	if (bitmap_is_midx(bitmap_git))
@@ -947,7 +1084,7 @@ static int add_to_include_set(struct bitmap_index *bitmap_git,
 			      struct commit *commit,
 			      int bitmap_pos)
 {
-	struct ewah_bitmap *partial;
+	struct stored_bitmap *partial;
 
 	if (data->seen && bitmap_get(data->seen, bitmap_pos))
 		return 0;
@@ -955,9 +1092,9 @@ static int add_to_include_set(struct bitmap_index *bitmap_git,
 	if (bitmap_get(data->base, bitmap_pos))
 		return 0;
 
-	partial = bitmap_for_commit(bitmap_git, commit);
+	partial = stored_bitmap_for_commit(bitmap_git, commit);
 	if (partial) {
-		bitmap_or_ewah(data->base, partial);
+		bitmap_or_stored(data->base, partial);
 		return 0;
 	}
 
@@ -1010,15 +1147,18 @@ static int add_commit_to_bitmap(struct bitmap_index *bitmap_git,
 				struct bitmap **base,
 				struct commit *commit)
 {
-	struct ewah_bitmap *or_with = bitmap_for_commit(bitmap_git, commit);
+	struct stored_bitmap *or_with = stored_bitmap_for_commit(bitmap_git, commit);
 
 	if (!or_with)
 		return 0;
 
-	if (!*base)
-		*base = ewah_to_bitmap(or_with);
-	else
-		bitmap_or_ewah(*base, or_with);
+	if (!*base && !or_with->roaring)
+		*base = ewah_to_bitmap(lookup_stored_bitmap(or_with));
+	else {
+		if (!*base)
+			*base = bitmap_new();
+		bitmap_or_stored(*base, or_with);
+	}
 
 	return 1;
 }
@@ -1145,33 +1285,34 @@ static void show_extended_objects(struct bitmap_index *bitmap_git,
 	}
 }
 
-static void init_type_iterator(struct ewah_iterator *it,
-			       struct bitmap_index *bitmap_git,
-			       enum object_type type)
+struct ewah_bitmap *bitmap_type_index(struct bitmap_index *bitmap_git,
+				      enum object_type type)
 {
 	switch (type) {
 	case OBJ_COMMIT:
-		ewah_iterator_init(it, bitmap_git->commits);
-		break;
+		return bitmap_git->commits;
 
 	case OBJ_TREE:
-		ewah_iterator_init(it, bitmap_git->trees);
-		break;
+		return bitmap_git->trees;
 
 	case OBJ_BLOB:
-		ewah_iterator_init(it, bitmap_git->blobs);
-		break;
+		return bitmap_git->blobs;
 
 	case OBJ_TAG:
-		ewah_iterator_init(it, bitmap_git->tags);
-		break;
+		return bitmap_git->tags;
 
 	default:
 		BUG("object type %d not stored by bitmap type index", type);
-		break;
 	}
 }
 
+static void init_type_iterator(struct ewah_iterator *it,
+			       struct bitmap_index *bitmap_git,
+			       enum object_type type)
+{
+	ewah_iterator_init(it, bitmap_type_index(bitmap_git, type));
+}
+
 static void show_objects_for_type(
 	struct bitmap_index *bitmap_git,
 	enum object_type object_type,
@@ -1196,6 +1337,7 @@ static void show_objects_for_type(
 			continue;
 
 		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
+			struct bitmap_index *layer = bitmap_git;
 			struct packed_git *pack;
 			struct object_id oid;
 			uint32_t hash = 0, index_pos;
@@ -1207,15 +1349,16 @@ static void show_objects_for_type(
 			offset += ewah_bit_ctz64(word >> offset);
 
 			if (bitmap_is_midx(bitmap_git)) {
-				struct multi_pack_index *m = bitmap_git->midx;
+				struct multi_pack_index *m;
 				uint32_t pack_id;
 
-				index_pos = pack_pos_to_midx(m, pos + offset);
+				index_pos = bitmap_pos_to_midx(&layer, pos + offset);
+				m = layer->midx;
 				ofs = nth_midxed_offset(m, index_pos);
 				nth_midxed_object_oid(&oid, m, index_pos);
 
 				pack_id = nth_midxed_pack_int_id(m, index_pos);
-				pack = bitmap_git->midx->packs[pack_id];
+				pack = m->packs[pack_id];
 			} else {
 				index_pos = pack_pos_to_index(bitmap_git->pack, pos + offset);
 				ofs = pack_pos_to_offset(bitmap_git->pack, pos + offset);
@@ -1224,8 +1367,8 @@ static void show_objects_for_type(
 				pack = bitmap_git->pack;
 			}
 
-			if (bitmap_git->hashes)
-				hash = get_be32(bitmap_git->hashes + index_pos);
+			if (layer->hashes)
+				hash = get_be32(layer->hashes + index_pos);
 
 			show_reach(&oid, object_type, 0, hash, pack, ofs);
 		}
@@ -1240,8 +1383,11 @@ static int in_bitmapped_pack(struct bitmap_index *bitmap_git,
 		roots = roots->next;
 
 		if (bitmap_is_midx(bitmap_git)) {
-			if (bsearch_midx(&object->oid, bitmap_git->midx, NULL))
-				return 1;
+			struct bitmap_index *b;
+
+			for (b = bitmap_git; b; b = b->base)
+				if (bsearch_midx(&object->oid, b->midx, NULL))
+					return 1;
 		} else {
 			if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0)
 				return 1;
@@ -1342,11 +1488,12 @@ static unsigned long get_size_by_pos(struct bitmap_index *bitmap_git,
 		off_t ofs;
 
 		if (bitmap_is_midx(bitmap_git)) {
-			uint32_t midx_pos = pack_pos_to_midx(bitmap_git->midx, pos);
-			uint32_t pack_id = nth_midxed_pack_int_id(bitmap_git->midx, midx_pos);
+			struct bitmap_index *layer = bitmap_git;
+			uint32_t midx_pos = bitmap_pos_to_midx(&layer, pos);
+			uint32_t pack_id = nth_midxed_pack_int_id(layer->midx, midx_pos);
 
-			pack = bitmap_git->midx->packs[pack_id];
-			ofs = nth_midxed_offset(bitmap_git->midx, midx_pos);
+			pack = layer->midx->packs[pack_id];
+			ofs = nth_midxed_offset(layer->midx, midx_pos);
 		} else {
 			pack = bitmap_git->pack;
 			ofs = pack_pos_to_offset(pack, pos);
@@ -1712,9 +1859,23 @@ static int try_partial_reuse(struct packed_git *pack,
 	return 0;
 }
 
+/*
+ * The bitmap of the regular MIDX below the incremental layers of
+ * "bitmap_git", if any.
+ */
+static struct bitmap_index *bitmap_midx_root(struct bitmap_index *bitmap_git)
+{
+	while (bitmap_git->base)
+		bitmap_git = bitmap_git->base;
+	return bitmap_git;
+}
+
 uint32_t midx_preferred_pack(struct bitmap_index *bitmap_git)
 {
-	struct multi_pack_index *m = bitmap_git->midx;
+	struct multi_pack_index *m;
+
+	bitmap_git = bitmap_midx_root(bitmap_git);
+	m = bitmap_git->midx;
 	if (!m)
 		BUG("midx_preferred_pack: requires non-empty MIDX");
 	return nth_midxed_pack_int_id(m, pack_pos_to_midx(bitmap_git->midx, 0));
@@ -1738,7 +1899,7 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 	load_reverse_index(bitmap_git);
 
 	if (bitmap_is_midx(bitmap_git))
-		pack = bitmap_git->midx->packs[midx_preferred_pack(bitmap_git)];
+		pack = bitmap_midx_root(bitmap_git)->midx->packs[midx_preferred_pack(bitmap_git)];
 	else
 		pack = bitmap_git->pack;
 	objects_nr = pack->num_objects;
@@ -1833,49 +1994,25 @@ void traverse_bitmap_commit_list(struct bitmap_index *bitmap_git,
 	show_extended_objects(bitmap_git, revs, show_reachable);
 }
 
-static uint32_t count_object_type(struct bitmap_index *bitmap_git,
-				  enum object_type type)
-{
-	struct bitmap *objects = bitmap_git->result;
-	struct eindex *eindex = &bitmap_git->ext_index;
-
-	uint32_t i = 0, count = 0;
-	struct ewah_iterator it;
-	eword_t filter;
-
-	init_type_iterator(&it, bitmap_git, type);
-
-	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
-		eword_t word = objects->words[i++] & filter;
-		count += ewah_bit_popcount64(word);
-	}
-
-	for (i = 0; i < eindex->count; ++i) {
-		if (eindex->objects[i]->type == type &&
-			bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
-			count++;
-	}
-
-	return count;
-}
-
 void count_bitmap_commit_list(struct bitmap_index *bitmap_git,
 			      uint32_t *commits, uint32_t *trees,
 			      uint32_t *blobs, uint32_t *tags)
 {
-	assert(bitmap_git->result);
+	struct bitmap_type_stats stats[OBJ_TAG + 1];
+
+	get_stats_from_bitmap(bitmap_git, 0, 0, stats);
 
 	if (commits)
-		*commits = count_object_type(bitmap_git, OBJ_COMMIT);
+		*commits = stats[OBJ_COMMIT].count;
 
 	if (trees)
-		*trees = count_object_type(bitmap_git, OBJ_TREE);
+		*trees = stats[OBJ_TREE].count;
 
 	if (blobs)
-		*blobs = count_object_type(bitmap_git, OBJ_BLOB);
+		*blobs = stats[OBJ_BLOB].count;
 
 	if (tags)
-		*tags = count_object_type(bitmap_git, OBJ_TAG);
+		*tags = stats[OBJ_TAG].count;
 }
 
 struct bitmap_test_data {
@@ -2063,15 +2200,19 @@ int test_bitmap_hashes(struct repository *r)
 		goto cleanup;
 
 	for (i = 0; i < bitmap_num_objects(bitmap_git); i++) {
+		struct bitmap_index *layer = bitmap_git;
+
 		if (bitmap_is_midx(bitmap_git))
-			index_pos = pack_pos_to_midx(bitmap_git->midx, i);
+			index_pos = bitmap_pos_to_midx(&layer, i);
 		else
 			index_pos = pack_pos_to_index(bitmap_git->pack, i);
+		if (!layer->hashes)
+			continue;
 
-		nth_bitmap_object_oid(bitmap_git, &oid, index_pos);
+		nth_bitmap_object_oid(layer, &oid, index_pos);
 
 		printf_ln("%s %"PRIu32"",
-		       oid_to_hex(&oid), get_be32(bitmap_git->hashes + index_pos));
+		       oid_to_hex(&oid), get_be32(layer->hashes + index_pos));
 	}
 
 cleanup:
@@ -2127,21 +2268,22 @@ uint32_t *create_bitmap_mapping(struct bitmap_index *bitmap_git,
 	CALLOC_ARRAY(reposition, num_objects);
 
 	for (i = 0; i < num_objects; ++i) {
+		struct bitmap_index *layer = bitmap_git;
 		struct object_id oid;
 		struct object_entry *oe;
 		uint32_t index_pos;
 
 		if (bitmap_is_midx(bitmap_git))
-			index_pos = pack_pos_to_midx(bitmap_git->midx, i);
+			index_pos = bitmap_pos_to_midx(&layer, i);
 		else
 			index_pos = pack_pos_to_index(bitmap_git->pack, i);
-		nth_bitmap_object_oid(bitmap_git, &oid, index_pos);
+		nth_bitmap_object_oid(layer, &oid, index_pos);
 		oe = packlist_find(mapping, &oid);
 
 		if (oe) {
 			reposition[i] = oe_in_pack_pos(mapping, oe) + 1;
-			if (bitmap_git->hashes && !oe->hash)
-				oe->hash = get_be32(bitmap_git->hashes + index_pos);
+			if (layer->hashes && !oe->hash)
+				oe->hash = get_be32(layer->hashes + index_pos);
 		}
 	}
 
@@ -2163,6 +2305,7 @@ void free_bitmap_index(struct bitmap_index *b)
 		struct stored_bitmap *sb;
 		kh_foreach_value(b->bitmaps, sb, {
 			ewah_pool_free(sb->root);
+			roaring_free(sb->roaring);
 			free(sb);
 		});
 	}
@@ -2185,6 +2328,7 @@ void free_bitmap_index(struct bitmap_index *b)
 		 */
 		close_midx_revindex(b->midx);
 	}
+	free_bitmap_index(b->base);
 	free(b);
 }
 
@@ -2195,103 +2339,161 @@ int bitmap_has_oid_in_uninteresting(struct bitmap_index *bitmap_git,
 		bitmap_walk_contains(bitmap_git, bitmap_git->haves, oid);
 }
 
-static off_t get_disk_usage_for_type(struct bitmap_index *bitmap_git,
-				     enum object_type object_type)
+/*
+ * Find where the object at "pos" in the bit order of "bitmap_git" is
+ * stored: in which pack, at which offset, and at which position in the
+ * pack order.
+ */
+static void bitmap_pos_to_pack(struct bitmap_index *bitmap_git, uint32_t pos,
+			       struct packed_git **pack, off_t *offset,
+			       uint32_t *pack_pos)
 {
-	struct bitmap *result = bitmap_git->result;
-	off_t total = 0;
-	struct ewah_iterator it;
-	eword_t filter;
-	size_t i;
-
-	init_type_iterator(&it, bitmap_git, object_type);
-	for (i = 0; i < result->word_alloc &&
-			ewah_iterator_next(&filter, &it); i++) {
-		eword_t word = result->words[i] & filter;
-		size_t base = (i * BITS_IN_EWORD);
-		unsigned offset;
+	if (bitmap_is_midx(bitmap_git)) {
+		struct bitmap_index *layer = bitmap_git;
+		uint32_t midx_pos = bitmap_pos_to_midx(&layer, pos);
+		uint32_t pack_id = nth_midxed_pack_int_id(layer->midx, midx_pos);
 
-		if (!word)
-			continue;
+		*pack = layer->midx->packs[pack_id];
+		*offset = nth_midxed_offset(layer->midx, midx_pos);
+		if (offset_to_pack_pos(*pack, *offset, pack_pos) < 0) {
+			struct object_id oid;
+			nth_midxed_object_oid(&oid, layer->midx, midx_pos);
 
-		for (offset = 0; offset < BITS_IN_EWORD; offset++) {
-			if ((word >> offset) == 0)
-				break;
+			die(_("could not find '%s' in pack '%s' at offset %"PRIuMAX),
+			    oid_to_hex(&oid),
+			    (*pack)->pack_name,
+			    (uintmax_t)*offset);
+		}
+	} else {
+		*pack = bitmap_git->pack;
+		*pack_pos = pos;
+		*offset = pack_pos_to_offset(*pack, pos);
+	}
+}
 
-			offset += ewah_bit_ctz64(word >> offset);
+static void add_packed_object_stats(struct bitmap_index *bitmap_git,
+				    uint32_t pos, unsigned flags,
+				    struct bitmap_type_stats *stats)
+{
+	struct packed_git *pack;
+	uint32_t pack_pos;
+	off_t offset;
 
-			if (bitmap_is_midx(bitmap_git)) {
-				uint32_t pack_pos;
-				uint32_t midx_pos = pack_pos_to_midx(bitmap_git->midx, base + offset);
-				off_t offset = nth_midxed_offset(bitmap_git->midx, midx_pos);
+	bitmap_pos_to_pack(bitmap_git, pos, &pack, &offset, &pack_pos);
 
-				uint32_t pack_id = nth_midxed_pack_int_id(bitmap_git->midx, midx_pos);
-				struct packed_git *pack = bitmap_git->midx->packs[pack_id];
+	if (flags & BITMAP_STATS_DISK_SIZE)
+		stats->disk_size += pack_pos_to_offset(pack, pack_pos + 1) - offset;
+	if (flags & BITMAP_STATS_SIZE) {
+		struct object_info oi = OBJECT_INFO_INIT;
+		unsigned long size;
 
-				if (offset_to_pack_pos(pack, offset, &pack_pos) < 0) {
-					struct object_id oid;
-					nth_midxed_object_oid(&oid, bitmap_git->midx, midx_pos);
+		oi.sizep = &size;
+		if (packed_object_info(the_repository, pack, offset, &oi) < 0)
+			die(_("unable to get size of object at offset %"PRIuMAX" in '%s'"),
+			    (uintmax_t)offset, pack->pack_name);
+		stats->size += size;
+	}
+}
 
-					die(_("could not find '%s' in pack '%s' at offset %"PRIuMAX),
-					    oid_to_hex(&oid),
-					    pack->pack_name,
-					    (uintmax_t)offset);
-				}
+static void add_extended_object_stats(struct object *obj, unsigned flags,
+				      struct bitmap_type_stats *stats)
+{
+	struct object_info oi = OBJECT_INFO_INIT;
+	unsigned long size;
+	off_t disk_size;
 
-				total += pack_pos_to_offset(pack, pack_pos + 1) - offset;
-			} else {
-				size_t pos = base + offset;
-				total += pack_pos_to_offset(bitmap_git->pack, pos + 1) -
-					 pack_pos_to_offset(bitmap_git->pack, pos);
-			}
-		}
-	}
+	if (flags & BITMAP_STATS_DISK_SIZE)
+		oi.disk_sizep = &disk_size;
+	if (flags & BITMAP_STATS_SIZE)
+		oi.sizep = &size;
+	if (oid_object_info_extended(the_repository, &obj->oid, &oi, 0) < 0)
+		die(_("unable to get disk usage of '%s'"), oid_to_hex(&obj->oid));
 
-	return total;
+	if (flags & BITMAP_STATS_DISK_SIZE)
+		stats->disk_size += disk_size;
+	if (flags & BITMAP_STATS_SIZE)
+		stats->size += size;
 }
 
-static off_t get_disk_usage_for_extended(struct bitmap_index *bitmap_git)
+void get_stats_from_bitmap(struct bitmap_index *bitmap_git,
+			   unsigned types, unsigned flags,
+			   struct bitmap_type_stats *stats)
 {
 	struct bitmap *result = bitmap_git->result;
 	struct eindex *eindex = &bitmap_git->ext_index;
-	off_t total = 0;
-	struct object_info oi = OBJECT_INFO_INIT;
-	off_t object_size;
+	struct ewah_iterator it[OBJ_TAG + 1];
+	eword_t filter[OBJ_TAG + 1];
+	enum object_type type;
 	size_t i;
 
-	oi.disk_sizep = &object_size;
+	assert(result);
+
+	memset(stats, 0, sizeof(*stats) * (OBJ_TAG + 1));
+	for (type = OBJ_COMMIT; type <= OBJ_TAG; type++)
+		init_type_iterator(&it[type], bitmap_git, type);
+
+	/*
+	 * Go through the result once for all the types: the type bitmaps
+	 * are iterated in lockstep, so that each word of the result is
+	 * split into the words of each type.
+	 */
+	for (i = 0; i < result->word_alloc; i++) {
+		for (type = OBJ_COMMIT; type <= OBJ_TAG; type++) {
+			eword_t word;
+			unsigned offset;
+
+			if (!ewah_iterator_next(&filter[type], &it[type]))
+				filter[type] = 0;
+			word = result->words[i] & filter[type];
+			if (!word)
+				continue;
+
+			stats[type].count += ewah_bit_popcount64(word);
+			if (!flags || !(types & (1 << type)))
+				continue;
+
+			for (offset = 0; offset < BITS_IN_EWORD; offset++) {
+				if ((word >> offset) == 0)
+					break;
+
+				offset += ewah_bit_ctz64(word >> offset);
+				add_packed_object_stats(bitmap_git,
+							i * BITS_IN_EWORD + offset,
+							flags, &stats[type]);
+			}
+		}
+	}
 
 	for (i = 0; i < eindex->count; i++) {
 		struct object *obj = eindex->objects[i];
 
-		if (!bitmap_get(result, bitmap_num_objects(bitmap_git) + i))
+		if (obj->type < OBJ_COMMIT || obj->type > OBJ_TAG ||
+		    !bitmap_get(result, bitmap_num_objects(bitmap_git) + i))
 			continue;
 
-		if (oid_object_info_extended(the_repository, &obj->oid, &oi, 0) < 0)
-			die(_("unable to get disk usage of '%s'"),
-			    oid_to_hex(&obj->oid));
-
-		total += object_size;
+		stats[obj->type].count++;
+		if (flags && (types & (1 << obj->type)))
+			add_extended_object_stats(obj, flags, &stats[obj->type]);
 	}
-	return total;
 }
 
 off_t get_disk_usage_from_bitmap(struct bitmap_index *bitmap_git,
 				 struct rev_info *revs)
 {
-	off_t total = 0;
+	struct bitmap_type_stats stats[OBJ_TAG + 1];
+	unsigned types = 1 << OBJ_COMMIT;
 
-	total += get_disk_usage_for_type(bitmap_git, OBJ_COMMIT);
 	if (revs->tree_objects)
-		total += get_disk_usage_for_type(bitmap_git, OBJ_TREE);
+		types |= 1 << OBJ_TREE;
 	if (revs->blob_objects)
-		total += get_disk_usage_for_type(bitmap_git, OBJ_BLOB);
+		types |= 1 << OBJ_BLOB;
 	if (revs->tag_objects)
-		total += get_disk_usage_for_type(bitmap_git, OBJ_TAG);
+		types |= 1 << OBJ_TAG;
 
-	total += get_disk_usage_for_extended(bitmap_git);
+	get_stats_from_bitmap(bitmap_git, types, BITMAP_STATS_DISK_SIZE, stats);
 
-	return total;
+	return stats[OBJ_COMMIT].disk_size + stats[OBJ_TREE].disk_size +
+	       stats[OBJ_BLOB].disk_size + stats[OBJ_TAG].disk_size;
 }
 
 int bitmap_is_midx(struct bitmap_index *bitmap_git)
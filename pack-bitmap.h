@@ -84,7 +84,34 @@ int bitmap_has_oid_in_uninteresting(struct bitmap_index *, const struct object_i
 
 off_t get_disk_usage_from_bitmap(struct bitmap_index *, struct rev_info *);
 
+struct bitmap_type_stats {
+	uint32_t count;
+	off_t disk_size; /* with BITMAP_STATS_DISK_SIZE */
+	uint64_t size; /* with BITMAP_STATS_SIZE */
+};
+
+enum bitmap_stats_flags {
+	BITMAP_STATS_DISK_SIZE = (1 << 0),
+	BITMAP_STATS_SIZE = (1 << 1),
+};
+
+/*
+ * After a traversal has been performed by prepare_bitmap_walk(), count
+ * the objects of each type in its result, in a single pass over it.
+ * "stats" has OBJ_TAG + 1 entries and is indexed by object type. For
+ * the types whose "1 << type" is in "types", the on-disk and inflated
+ * sizes of the objects are also added up, as "flags" asks; they are
+ * found from the pack reverse indexes and the headers of the objects.
+ */
+void get_stats_from_bitmap(struct bitmap_index *, unsigned types,
+			   unsigned flags, struct bitmap_type_stats *stats);
+
 void bitmap_writer_show_progress(int show);
+/*
+ * Build the bitmaps of an incremental MIDX layer on top of "base", the
+ * bitmaps of the layers below it, which cover "base_nr" objects.
+ */
+void bitmap_writer_set_base(struct bitmap_index *base, uint32_t base_nr);
 void bitmap_writer_set_checksum(const unsigned char *sha1);
 void bitmap_writer_build_type_index(struct packing_data *to_pack,
 				    struct pack_idx_entry **index,
@@ -96,6 +123,10 @@ int rebuild_bitmap(const uint32_t *reposition,
 		   struct bitmap *dest);
 struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *bitmap_git,
 				      struct commit *commit);
+int bitmap_position(struct bitmap_index *bitmap_git,
+		    const struct object_id *oid);
+struct ewah_bitmap *bitmap_type_index(struct bitmap_index *bitmap_git,
+				      enum object_type type);
 void bitmap_writer_select_commits(struct commit **indexed_commits,
 		unsigned int indexed_commits_nr, int max_bitmaps);
 int bitmap_writer_build(struct packing_data *to_pack);
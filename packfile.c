@@ -873,7 +873,8 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 	if (!report_garbage)
 		return;
 
-	if (!strcmp(file_name, "multi-pack-index"))
+	if (!strcmp(file_name, "multi-pack-index") ||
+	    !strcmp(file_name, "multi-pack-index.d"))
 		return;
 	if (starts_with(file_name, "multi-pack-index") &&
 	    (ends_with(file_name, ".bitmap") || ends_with(file_name, ".rev")))
@@ -1342,10 +1343,30 @@ static enum object_type packed_to_object_type(struct repository *r,
 	goto out;
 }
 
-static struct hashmap delta_base_cache;
-static size_t delta_base_cached;
+/*
+ * The delta base cache is split into shards, each with its own hashmap, LRU
+ * list and mutex, so that threads unpacking unrelated objects do not
+ * serialize on a single lock. The memory budget (delta_base_cache_limit) is
+ * still global: "delta_base_cached" tracks the total across all shards and
+ * is protected by its own mutex, which may be taken while holding a shard
+ * lock (but never the other way around).
+ *
+ * The locks are only used after enable_delta_base_cache_locks(), which
+ * enable_obj_read_lock() calls before any reader thread is started.
+ */
+#define DELTA_BASE_CACHE_SHARDS 16
+
+struct delta_base_cache_shard {
+	pthread_mutex_t mutex;
+	struct hashmap map;
+	struct list_head lru;
+};
 
-static LIST_HEAD(delta_base_cache_lru);
+static struct delta_base_cache_shard delta_base_cache[DELTA_BASE_CACHE_SHARDS];
+static int delta_base_cache_initialized;
+static int delta_base_cache_use_locks;
+static pthread_mutex_t delta_base_cached_mutex;
+static size_t delta_base_cached;
 
 struct delta_base_cache_key {
 	struct packed_git *p;
@@ -1370,22 +1391,6 @@ static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
 	return hash;
 }
 
-static struct delta_base_cache_entry *
-get_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
-{
-	struct hashmap_entry entry, *e;
-	struct delta_base_cache_key key;
-
-	if (!delta_base_cache.cmpfn)
-		return NULL;
-
-	hashmap_entry_init(&entry, pack_entry_hash(p, base_offset));
-	key.p = p;
-	key.base_offset = base_offset;
-	e = hashmap_get(&delta_base_cache, &entry, &key);
-	return e ? container_of(e, struct delta_base_cache_entry, ent) : NULL;
-}
-
 static int delta_base_cache_key_eq(const struct delta_base_cache_key *a,
 				   const struct delta_base_cache_key *b)
 {
@@ -1409,21 +1414,113 @@ static int delta_base_cache_hash_cmp(const void *cmp_data UNUSED,
 		return !delta_base_cache_key_eq(&a->key, &b->key);
 }
 
+static void init_delta_base_cache(void)
+{
+	int i;
+
+	if (delta_base_cache_initialized)
+		return;
+
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		struct delta_base_cache_shard *shard = &delta_base_cache[i];
+
+		pthread_mutex_init(&shard->mutex, NULL);
+		hashmap_init(&shard->map, delta_base_cache_hash_cmp, NULL, 0);
+		INIT_LIST_HEAD(&shard->lru);
+	}
+	pthread_mutex_init(&delta_base_cached_mutex, NULL);
+	delta_base_cache_initialized = 1;
+}
+
+void enable_delta_base_cache_locks(void)
+{
+	init_delta_base_cache();
+	delta_base_cache_use_locks = 1;
+}
+
+void disable_delta_base_cache_locks(void)
+{
+	delta_base_cache_use_locks = 0;
+}
+
+/*
+ * The low bits of pack_entry_hash() select the hashmap bucket, so mix the
+ * hash before picking a shard from its top bits; otherwise each shard would
+ * only ever populate a fraction of its buckets.
+ */
+static struct delta_base_cache_shard *delta_base_cache_shard(unsigned int hash)
+{
+	init_delta_base_cache();
+	return &delta_base_cache[(hash * 2654435761U) >> 28];
+}
+
+static void lock_delta_base_cache_shard(struct delta_base_cache_shard *shard)
+{
+	if (delta_base_cache_use_locks)
+		pthread_mutex_lock(&shard->mutex);
+}
+
+static void unlock_delta_base_cache_shard(struct delta_base_cache_shard *shard)
+{
+	if (delta_base_cache_use_locks)
+		pthread_mutex_unlock(&shard->mutex);
+}
+
+static size_t account_delta_base_cached(ssize_t delta)
+{
+	size_t ret;
+
+	if (delta_base_cache_use_locks)
+		pthread_mutex_lock(&delta_base_cached_mutex);
+	delta_base_cached += delta;
+	ret = delta_base_cached;
+	if (delta_base_cache_use_locks)
+		pthread_mutex_unlock(&delta_base_cached_mutex);
+	return ret;
+}
+
+/*
+ * The caller must hold the lock of "shard", which must be the shard for
+ * the given pack and offset.
+ */
+static struct delta_base_cache_entry *
+get_delta_base_cache_entry(struct delta_base_cache_shard *shard,
+			   struct packed_git *p, off_t base_offset)
+{
+	struct hashmap_entry entry, *e;
+	struct delta_base_cache_key key;
+
+	hashmap_entry_init(&entry, pack_entry_hash(p, base_offset));
+	key.p = p;
+	key.base_offset = base_offset;
+	e = hashmap_get(&shard->map, &entry, &key);
+	return e ? container_of(e, struct delta_base_cache_entry, ent) : NULL;
+}
+
 static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
 {
-	return !!get_delta_base_cache_entry(p, base_offset);
+	struct delta_base_cache_shard *shard;
+	int ret;
+
+	shard = delta_base_cache_shard(pack_entry_hash(p, base_offset));
+	lock_delta_base_cache_shard(shard);
+	ret = !!get_delta_base_cache_entry(shard, p, base_offset);
+	unlock_delta_base_cache_shard(shard);
+	return ret;
 }
 
 /*
  * Remove the entry from the cache, but do _not_ free the associated
  * entry data. The caller takes ownership of the "data" buffer, and
- * should copy out any fields it wants before detaching.
+ * should copy out any fields it wants before detaching. The caller must
+ * hold the lock of "shard".
  */
-static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
+static void detach_delta_base_cache_entry(struct delta_base_cache_shard *shard,
+					  struct delta_base_cache_entry *ent)
 {
-	hashmap_remove(&delta_base_cache, &ent->ent, &ent->key);
+	hashmap_remove(&shard->map, &ent->ent, &ent->key);
 	list_del(&ent->lru);
-	delta_base_cached -= ent->size;
+	account_delta_base_cached(-(ssize_t)ent->size);
 	free(ent);
 }
 
@@ -1431,73 +1528,130 @@ static void *cache_or_unpack_entry(struct repository *r, struct packed_git *p,
 				   off_t base_offset, unsigned long *base_size,
 				   enum object_type *type)
 {
+	struct delta_base_cache_shard *shard;
 	struct delta_base_cache_entry *ent;
+	void *ret = NULL;
+
+	/*
+	 * The shard lock is enough to keep the entry alive while we copy it,
+	 * so let other readers proceed without waiting for a potentially
+	 * large memcpy(). Never wait for the obj_read_mutex while holding a
+	 * shard lock, though, since unpack_entry() nests them the other way.
+	 */
+	obj_read_unlock();
+	shard = delta_base_cache_shard(pack_entry_hash(p, base_offset));
+	lock_delta_base_cache_shard(shard);
+	ent = get_delta_base_cache_entry(shard, p, base_offset);
+	if (ent) {
+		if (type)
+			*type = ent->type;
+		if (base_size)
+			*base_size = ent->size;
+		ret = xmemdupz(ent->data, ent->size);
+	}
+	unlock_delta_base_cache_shard(shard);
+	obj_read_lock();
 
-	ent = get_delta_base_cache_entry(p, base_offset);
 	if (!ent)
 		return unpack_entry(r, p, base_offset, type, base_size);
-
-	if (type)
-		*type = ent->type;
-	if (base_size)
-		*base_size = ent->size;
-	return xmemdupz(ent->data, ent->size);
+	return ret;
 }
 
-static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+static inline void release_delta_base_cache(struct delta_base_cache_shard *shard,
+					    struct delta_base_cache_entry *ent)
 {
 	free(ent->data);
-	detach_delta_base_cache_entry(ent);
+	detach_delta_base_cache_entry(shard, ent);
 }
 
 void clear_delta_base_cache(void)
 {
-	struct list_head *lru, *tmp;
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
-		struct delta_base_cache_entry *entry =
-			list_entry(lru, struct delta_base_cache_entry, lru);
-		release_delta_base_cache(entry);
+	int i;
+
+	if (!delta_base_cache_initialized)
+		return;
+
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		struct delta_base_cache_shard *shard = &delta_base_cache[i];
+		struct list_head *lru, *tmp;
+
+		lock_delta_base_cache_shard(shard);
+		list_for_each_safe(lru, tmp, &shard->lru) {
+			struct delta_base_cache_entry *entry =
+				list_entry(lru, struct delta_base_cache_entry, lru);
+			release_delta_base_cache(shard, entry);
+		}
+		unlock_delta_base_cache_shard(shard);
+	}
+}
+
+/*
+ * Evict least-recently-used entries until "incoming" more bytes fit in the
+ * global budget, starting with the shard the new entry will go to. Only one
+ * shard lock is held at a time.
+ */
+static void prune_delta_base_cache(struct delta_base_cache_shard *start,
+				   size_t incoming)
+{
+	size_t cached = account_delta_base_cached(0);
+	int i, first = start - delta_base_cache;
+
+	for (i = 0;
+	     i < DELTA_BASE_CACHE_SHARDS &&
+	     cached + incoming > delta_base_cache_limit;
+	     i++) {
+		struct delta_base_cache_shard *shard =
+			&delta_base_cache[(first + i) % DELTA_BASE_CACHE_SHARDS];
+		struct list_head *lru, *tmp;
+
+		lock_delta_base_cache_shard(shard);
+		list_for_each_safe(lru, tmp, &shard->lru) {
+			struct delta_base_cache_entry *f =
+				list_entry(lru, struct delta_base_cache_entry, lru);
+			if (cached + incoming <= delta_base_cache_limit)
+				break;
+			cached -= f->size;
+			release_delta_base_cache(shard, f);
+		}
+		unlock_delta_base_cache_shard(shard);
+		cached = account_delta_base_cached(0);
 	}
 }
 
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	void *base, unsigned long base_size, enum object_type type)
 {
+	struct delta_base_cache_shard *shard;
 	struct delta_base_cache_entry *ent;
-	struct list_head *lru, *tmp;
+	unsigned int hash = pack_entry_hash(p, base_offset);
+
+	shard = delta_base_cache_shard(hash);
+	prune_delta_base_cache(shard, base_size);
 
 	/*
 	 * Check required to avoid redundant entries when more than one thread
 	 * is unpacking the same object, in unpack_entry() (since its phases I
 	 * and III might run concurrently across multiple threads).
 	 */
-	if (in_delta_base_cache(p, base_offset)) {
+	lock_delta_base_cache_shard(shard);
+	if (get_delta_base_cache_entry(shard, p, base_offset)) {
+		unlock_delta_base_cache_shard(shard);
 		free(base);
 		return;
 	}
 
-	delta_base_cached += base_size;
-
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
-		struct delta_base_cache_entry *f =
-			list_entry(lru, struct delta_base_cache_entry, lru);
-		if (delta_base_cached <= delta_base_cache_limit)
-			break;
-		release_delta_base_cache(f);
-	}
-
 	ent = xmalloc(sizeof(*ent));
 	ent->key.p = p;
 	ent->key.base_offset = base_offset;
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	list_add_tail(&ent->lru, &delta_base_cache_lru);
+	list_add_tail(&ent->lru, &shard->lru);
 
-	if (!delta_base_cache.cmpfn)
-		hashmap_init(&delta_base_cache, delta_base_cache_hash_cmp, NULL, 0);
-	hashmap_entry_init(&ent->ent, pack_entry_hash(p, base_offset));
-	hashmap_add(&delta_base_cache, &ent->ent);
+	hashmap_entry_init(&ent->ent, hash);
+	hashmap_add(&shard->map, &ent->ent);
+	account_delta_base_cached(base_size);
+	unlock_delta_base_cache_shard(shard);
 }
 
 int packed_object_info(struct repository *r, struct packed_git *p,
@@ -1685,17 +1839,22 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 	for (;;) {
 		off_t base_offset;
 		int i;
+		struct delta_base_cache_shard *shard;
 		struct delta_base_cache_entry *ent;
 
-		ent = get_delta_base_cache_entry(p, curpos);
+		shard = delta_base_cache_shard(pack_entry_hash(p, curpos));
+		lock_delta_base_cache_shard(shard);
+		ent = get_delta_base_cache_entry(shard, p, curpos);
 		if (ent) {
 			type = ent->type;
 			data = ent->data;
 			size = ent->size;
-			detach_delta_base_cache_entry(ent);
+			detach_delta_base_cache_entry(shard, ent);
 			base_from_cache = 1;
-			break;
 		}
+		unlock_delta_base_cache_shard(shard);
+		if (base_from_cache)
+			break;
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
 			uint32_t pack_pos, index_pos;
@@ -1826,8 +1985,14 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			      (uintmax_t)curpos, p->pack_name);
 			data = NULL;
 		} else {
+			/*
+			 * Both buffers are private to this thread, so other
+			 * readers may proceed while we apply the delta.
+			 */
+			obj_read_unlock();
 			data = patch_delta(base, base_size, delta_data,
 					   delta_size, &size);
+			obj_read_lock();
 
 			/*
 			 * We could not apply the delta; warn the user, but
@@ -1844,11 +2009,11 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 
 		/*
 		 * We delay adding `base` to the cache until the end of the loop
-		 * because unpack_compressed_entry() momentarily releases the
-		 * obj_read_mutex, giving another thread the chance to access
-		 * the cache. Therefore, if `base` was already there, this other
-		 * thread could free() it (e.g. to make space for another entry)
-		 * before we are done using it.
+		 * because unpack_compressed_entry() and patch_delta() run
+		 * without the obj_read_mutex, giving another thread the chance
+		 * to access the cache. Therefore, if `base` was already there,
+		 * this other thread could free() it (e.g. to make space for
+		 * another entry) before we are done using it.
 		 */
 		if (!external_base)
 			add_delta_base_cache(p, base_obj_offset, base, base_size, type);
@@ -1872,6 +2037,12 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 }
 
 int bsearch_pack(const struct object_id *oid, const struct packed_git *p, uint32_t *result)
+{
+	return bsearch_pack_from(oid, p, 0, result);
+}
+
+int bsearch_pack_from(const struct object_id *oid, const struct packed_git *p,
+		      uint32_t start, uint32_t *result)
 {
 	const unsigned char *index_fanout = p->index_data;
 	const unsigned char *index_lookup;
@@ -1891,8 +2062,8 @@ int bsearch_pack(const struct object_id *oid, const struct packed_git *p, uint32
 		index_lookup += 8;
 	}
 
-	return bsearch_hash(oid->hash, (const uint32_t*)index_fanout,
-			    index_lookup, index_lookup_width, result);
+	return bsearch_hash_from(oid->hash, (const uint32_t*)index_fanout,
+				 index_lookup, index_lookup_width, start, result);
 }
 
 int nth_packed_object_id(struct object_id *oid,
@@ -2055,6 +2226,61 @@ int find_pack_entry(struct repository *r, const struct object_id *oid, struct pa
 	return 0;
 }
 
+/*
+ * Fill in the entries in "e" that are still unset with the objects found
+ * in "p", searching its index in one forward sweep. Returns the number of
+ * entries filled in.
+ */
+static size_t fill_pack_entries(struct packed_git *p,
+				const struct object_id *oids, size_t nr,
+				struct pack_entry *e)
+{
+	uint32_t pos = 0;
+	size_t i, found = 0;
+
+	if (!p->index_data && open_pack_index(p))
+		return 0;
+
+	for (i = 0; i < nr; i++) {
+		if (e[i].p)
+			continue;
+		if (!bsearch_pack_from(&oids[i], p, pos, &pos))
+			continue;
+		if (oidset_size(&p->bad_objects) &&
+		    oidset_contains(&p->bad_objects, &oids[i]))
+			continue;
+		if (!found && !is_pack_valid(p))
+			return 0;
+		e[i].offset = nth_packed_object_offset(p, pos);
+		e[i].p = p;
+		found++;
+	}
+	return found;
+}
+
+void find_pack_entries(struct repository *r, const struct object_id *oids,
+		       size_t nr, struct pack_entry *e)
+{
+	struct list_head *pos;
+	struct multi_pack_index *m;
+	size_t i, found = 0;
+
+	for (i = 0; i < nr; i++)
+		e[i].p = NULL;
+
+	prepare_packed_git(r);
+	for (m = r->objects->multi_pack_index; m && found < nr; m = m->next)
+		found += fill_midx_entries(r, oids, nr, e, m);
+
+	list_for_each(pos, &r->objects->packed_git_mru) {
+		struct packed_git *p = list_entry(pos, struct packed_git, mru);
+		if (found == nr)
+			break;
+		if (!p->multi_pack_index)
+			found += fill_pack_entries(p, oids, nr, e);
+	}
+}
+
 static void maybe_invalidate_kept_pack_cache(struct repository *r,
 					     unsigned flags)
 {
@@ -94,6 +94,15 @@ void close_pack(struct packed_git *);
 void close_object_store(struct raw_object_store *o);
 void unuse_pack(struct pack_window **);
 void clear_delta_base_cache(void);
+
+/*
+ * Make the delta base cache safe to use from multiple threads at once. This
+ * is done by enable_obj_read_lock(), and must happen before any reader thread
+ * is started.
+ */
+void enable_delta_base_cache_locks(void);
+void disable_delta_base_cache_locks(void);
+
 struct packed_git *add_packed_git(const char *path, size_t path_len, int local);
 
 /*
@@ -121,6 +130,13 @@ void check_pack_index_ptr(const struct packed_git *p, const void *ptr);
  */
 int bsearch_pack(const struct object_id *oid, const struct packed_git *p, uint32_t *result);
 
+/*
+ * Like bsearch_pack(), but start searching at index "start"; see
+ * 'bsearch_hash_from'.
+ */
+int bsearch_pack_from(const struct object_id *oid, const struct packed_git *p,
+		      uint32_t start, uint32_t *result);
+
 /*
  * Write the oid of the nth object within the specified packfile into the first
  * parameter. Open the index if it is not already open.  Returns 0 on success,
@@ -169,6 +185,14 @@ const struct packed_git *has_packed_and_bad(struct repository *, const struct ob
  * return true and store its location to e.
  */
 int find_pack_entry(struct repository *r, const struct object_id *oid, struct pack_entry *e);
+
+/*
+ * Like find_pack_entry(), but look up "nr" object ids at once. The oids
+ * must be sorted (duplicates are allowed). On return, e[i].p is NULL if
+ * oids[i] was not found in any pack.
+ */
+void find_pack_entries(struct repository *r, const struct object_id *oids,
+		       size_t nr, struct pack_entry *e);
 int find_kept_pack_entry(struct repository *r, const struct object_id *oid, unsigned flags, struct pack_entry *e);
 
 int has_object_pack(const struct object_id *oid);
@@ -9,6 +9,9 @@
 #include "progress.h"
 #include "thread-utils.h"
 #include "repository.h"
+#ifdef HAVE_IO_URING
+#include "compat/linux/statx-batch.h"
+#endif
 
 /*
  * Mostly randomly chosen maximum thread counts: we
@@ -19,6 +22,12 @@
 #define MAX_PARALLEL (20)
 #define THREAD_COST (500)
 
+/*
+ * Number of lstat()s queued at once on a thread's io_uring, when
+ * core.preloadIoUring is in effect.
+ */
+#define STATX_BATCH_SIZE (256)
+
 struct progress_data {
 	unsigned long n;
 	struct progress *progress;
@@ -31,9 +40,51 @@ struct thread_data {
 	struct pathspec pathspec;
 	struct progress_data *progress;
 	int offset, nr;
+	int use_io_uring;
 	int t2_nr_lstat;
+	int t2_nr_statx_batch;
+};
+
+static void preload_ce(struct index_state *index, struct cache_entry *ce,
+		       struct stat *st)
+{
+	if (ie_match_stat(index, ce, st, CE_MATCH_RACY_IS_DIRTY|CE_MATCH_IGNORE_FSMONITOR))
+		return;
+	ce_mark_uptodate(ce);
+	mark_fsmonitor_valid(index, ce);
+}
+
+#ifdef HAVE_IO_URING
+struct statx_queue {
+	struct statx_batch *batch;
+	unsigned nr;
+	struct cache_entry *ce[STATX_BATCH_SIZE];
+	const char *path[STATX_BATCH_SIZE];
+	struct stat st[STATX_BATCH_SIZE];
+	int err[STATX_BATCH_SIZE];
 };
 
+static void flush_statx_queue(struct thread_data *p, struct statx_queue *q)
+{
+	unsigned i;
+
+	if (!q->nr)
+		return;
+	p->t2_nr_statx_batch++;
+	if (statx_batch_run(q->batch, q->path, q->st, q->err, q->nr) < 0) {
+		/* the ring broke down; finish the job the usual way */
+		statx_batch_release(q->batch);
+		q->batch = NULL;
+		for (i = 0; i < q->nr; i++)
+			q->err[i] = lstat(q->path[i], &q->st[i]) ? errno : 0;
+	}
+	for (i = 0; i < q->nr; i++)
+		if (!q->err[i])
+			preload_ce(p->index, q->ce[i], &q->st[i]);
+	q->nr = 0;
+}
+#endif
+
 static void *preload_thread(void *_data)
 {
 	int nr, last_nr;
@@ -41,6 +92,17 @@ static void *preload_thread(void *_data)
 	struct index_state *index = p->index;
 	struct cache_entry **cep = index->cache + p->offset;
 	struct cache_def cache = CACHE_DEF_INIT;
+#ifdef HAVE_IO_URING
+	struct statx_queue *q = NULL;
+
+	if (p->use_io_uring) {
+		struct statx_batch *batch = statx_batch_init(STATX_BATCH_SIZE);
+		if (batch) {
+			CALLOC_ARRAY(q, 1);
+			q->batch = batch;
+		}
+	}
+#endif
 
 	nr = p->nr;
 	if (nr + p->offset > index->cache_nr)
@@ -75,13 +137,26 @@ static void *preload_thread(void *_data)
 		if (threaded_has_symlink_leading_path(&cache, ce->name, ce_namelen(ce)))
 			continue;
 		p->t2_nr_lstat++;
-		if (lstat(ce->name, &st))
+#ifdef HAVE_IO_URING
+		if (q && q->batch) {
+			q->ce[q->nr] = ce;
+			q->path[q->nr] = ce->name;
+			if (++q->nr == STATX_BATCH_SIZE)
+				flush_statx_queue(p, q);
 			continue;
-		if (ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY|CE_MATCH_IGNORE_FSMONITOR))
+		}
+#endif
+		if (lstat(ce->name, &st))
 			continue;
-		ce_mark_uptodate(ce);
-		mark_fsmonitor_valid(index, ce);
+		preload_ce(index, ce, &st);
 	} while (--nr > 0);
+#ifdef HAVE_IO_URING
+	if (q) {
+		flush_statx_queue(p, q);
+		statx_batch_release(q->batch);
+		free(q);
+	}
+#endif
 	if (p->progress) {
 		struct progress_data *pd = p->progress;
 
@@ -101,10 +176,20 @@ void preload_index(struct index_state *index,
 	struct thread_data data[MAX_PARALLEL];
 	struct progress_data pd;
 	int t2_sum_lstat = 0;
+	int t2_sum_statx_batch = 0;
+	int use_io_uring = 0;
 
 	if (!HAVE_THREADS || !core_preload_index)
 		return;
 
+#ifdef HAVE_IO_URING
+	use_io_uring = git_env_bool("GIT_TEST_PRELOAD_IO_URING", -1);
+	if (use_io_uring < 0 &&
+	    repo_config_get_bool(index->repo ? index->repo : the_repository,
+				 "core.preloadiouring", &use_io_uring))
+		use_io_uring = 0;
+#endif
+
 	threads = index->cache_nr / THREAD_COST;
 	if ((index->cache_nr > 1) && (threads < 2) && git_env_bool("GIT_TEST_PRELOAD_INDEX", 0))
 		threads = 2;
@@ -135,6 +220,7 @@ void preload_index(struct index_state *index,
 			copy_pathspec(&p->pathspec, pathspec);
 		p->offset = offset;
 		p->nr = work;
+		p->use_io_uring = use_io_uring;
 		if (pd.progress)
 			p->progress = &pd;
 		offset += work;
@@ -148,6 +234,7 @@ void preload_index(struct index_state *index,
 		if (pthread_join(p->pthread, NULL))
 			die("unable to join threaded lstat");
 		t2_sum_lstat += p->t2_nr_lstat;
+		t2_sum_statx_batch += p->t2_nr_statx_batch;
 	}
 	stop_progress(&pd.progress);
 
@@ -160,6 +247,9 @@ void preload_index(struct index_state *index,
 	trace_performance_leave("preload index");
 
 	trace2_data_intmax("index", NULL, "preload/sum_lstat", t2_sum_lstat);
+	if (use_io_uring)
+		trace2_data_intmax("index", NULL, "preload/sum_statx_batch",
+				   t2_sum_statx_batch);
 	trace2_region_leave("index", "preload", NULL);
 }
 
@@ -29,6 +29,7 @@
 #include "csum-file.h"
 #include "promisor-remote.h"
 #include "hook.h"
+#include "ewah/ewok.h"
 
 /* Mask for the name length in ce_flags in the on-disk index */
 
@@ -52,12 +53,51 @@
 #define CACHE_EXT_ENDOFINDEXENTRIES 0x454F4945	/* "EOIE" */
 #define CACHE_EXT_INDEXENTRYOFFSETTABLE 0x49454F54 /* "IEOT" */
 #define CACHE_EXT_SPARSE_DIRECTORIES 0x73646972 /* "sdir" */
+#define CACHE_EXT_JOURNAL 0x6a726e6c	  /* "jrnl" */
+#define CACHE_EXT_NAME_HASH 0x4e485348	  /* "NHSH" */
 
 /* changes that can be kept in $GIT_DIR/index (basically all extensions) */
 #define EXTMASK (RESOLVE_UNDO_CHANGED | CACHE_TREE_CHANGED | \
 		 CE_ENTRY_ADDED | CE_ENTRY_REMOVED | CE_ENTRY_CHANGED | \
 		 SPLIT_INDEX_ORDERED | UNTRACKED_CHANGED | FSMONITOR_CHANGED)
 
+/*
+ * When "index.journal" is enabled, the index file is written with an
+ * empty "jrnl" extension as its last extension. Later updates that only
+ * touch a few entries are written to "<index>.journal" instead of
+ * rewriting the index (the "base"); see write_index_journal().
+ *
+ * The journal describes the difference between the base and the state
+ * at the time it was written, and is replaced as a whole through a
+ * lockfile while the index itself is locked. It consists of:
+ *
+ *   - 4-byte signature "jrnl" and 4-byte version (1)
+ *   - the checksum of the base it applies to
+ *   - the 4-byte number of entries to add or replace, the 4-byte size
+ *     of an EWAH bitmap of the base entries to delete, the bitmap
+ *     itself, the entries in version 3 format and finally the
+ *     extensions of the new state
+ *   - the hash of all of the above
+ *
+ * A journal whose base checksum does not match the index is left over
+ * from before the index was last rewritten in full and is ignored.
+ */
+#define INDEX_JOURNAL_VERSION 1
+
+struct index_journal {
+	/* size of the base, i.e. the index file */
+	size_t base_size;
+	/* size of the journal file, or 0 if there is none */
+	size_t size;
+	struct object_id base_oid;
+
+	/*
+	 * The entries of the base, in order. Entries that are still
+	 * in the index have their 1-based position here in `index`.
+	 */
+	struct cache_entry **base;
+	unsigned int base_nr;
+};
 
 /*
  * This is an estimate of the pathname length in the index.  We use
@@ -1812,10 +1852,8 @@ int verify_index_checksum;
 /* Allow fsck to force verification of the cache entry order. */
 int verify_ce_order;
 
-static int verify_hdr(const struct cache_header *hdr, unsigned long size)
+static int verify_hdr(const struct cache_header *hdr)
 {
-	git_hash_ctx c;
-	unsigned char hash[GIT_MAX_RAWSZ];
 	int hdr_version;
 
 	if (hdr->hdr_signature != htonl(CACHE_SIGNATURE))
@@ -1823,6 +1861,17 @@ static int verify_hdr(const struct cache_header *hdr, unsigned long size)
 	hdr_version = ntohl(hdr->hdr_version);
 	if (hdr_version < INDEX_FORMAT_LB || INDEX_FORMAT_UB < hdr_version)
 		return error(_("bad index version %d"), hdr_version);
+	return 0;
+}
+
+/*
+ * Check the checksum at the end of the first `size` bytes of the index,
+ * which is either its end or the end of the base of a journaled index.
+ */
+static int verify_hdr_checksum(const struct cache_header *hdr, unsigned long size)
+{
+	git_hash_ctx c;
+	unsigned char hash[GIT_MAX_RAWSZ];
 
 	if (!verify_index_checksum)
 		return 0;
@@ -1863,6 +1912,13 @@ static int read_index_extension(struct index_state *istate,
 		/* no content, only an indicator */
 		istate->sparse_index = INDEX_COLLAPSED;
 		break;
+	case CACHE_EXT_JOURNAL:
+		/* marks the end of the base, handled in do_read_index() */
+		break;
+	case CACHE_EXT_NAME_HASH:
+		free_name_hash_snapshot(istate);
+		istate->name_hash_snapshot = read_name_hash_snapshot(data, sz);
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error(_("index uses %.4s extension, which we do not understand"),
@@ -2300,6 +2356,224 @@ static void set_new_index_sparsity(struct index_state *istate)
 	}
 }
 
+static int use_index_journal(void)
+{
+	int val;
+
+	if (!git_config_get_bool("index.journal", &val))
+		return val;
+	return git_env_bool("GIT_TEST_INDEX_JOURNAL", 0);
+}
+
+static void discard_index_journal(struct index_state *istate)
+{
+	if (!istate->journal)
+		return;
+	free(istate->journal->base);
+	FREE_AND_NULL(istate->journal);
+}
+
+/*
+ * Make `base`, the entries of the `base_size` bytes long index file, the
+ * base of the journal of `istate`, which is `size` bytes long.
+ */
+static void set_index_journal(struct index_state *istate,
+			      struct cache_entry **base, unsigned int base_nr,
+			      size_t base_size, size_t size,
+			      const unsigned char *base_hash)
+{
+	struct index_journal *j;
+	unsigned int i;
+
+	discard_index_journal(istate);
+	CALLOC_ARRAY(j, 1);
+	j->base_size = base_size;
+	j->size = size;
+	oidread(&j->base_oid, base_hash);
+	j->base = base;
+	j->base_nr = base_nr;
+	for (i = 0; i < base_nr; i++) {
+		base[i]->index = i + 1;
+		base[i]->ce_flags &= ~CE_UPDATE_IN_BASE;
+	}
+	istate->journal = j;
+}
+
+/*
+ * Walk the extensions starting at `offset` and return whether the last
+ * of them is the journal marker.
+ */
+static int index_has_journal(const char *mmap, size_t mmap_size,
+			     size_t offset)
+{
+	const unsigned hashsz = the_hash_algo->rawsz;
+
+	while (offset <= mmap_size - hashsz - 8) {
+		const char *ext = mmap + offset;
+		uint32_t extsize = get_be32(ext + 4);
+
+		offset += 8;
+		offset += extsize;
+		if (CACHE_EXT(ext) == CACHE_EXT_JOURNAL) {
+			if (offset != mmap_size - hashsz)
+				die(_("index file corrupt"));
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int index_journal_ok(const char *journal, size_t size,
+			    const unsigned char *base_hash)
+{
+	const unsigned hashsz = the_hash_algo->rawsz;
+
+	return size >= 16 + 2 * hashsz &&
+	       CACHE_EXT(journal) == CACHE_EXT_JOURNAL &&
+	       get_be32(journal + 4) == INDEX_JOURNAL_VERSION &&
+	       !memcmp(journal + 8, base_hash, hashsz) &&
+	       hashfile_checksum_valid((const unsigned char *)journal, size);
+}
+
+static int cmp_cache_name_stage(const struct cache_entry *a,
+				const struct cache_entry *b)
+{
+	return cache_name_stage_compare(a->name, ce_namelen(a), ce_stage(a),
+					b->name, ce_namelen(b), ce_stage(b));
+}
+
+/*
+ * Replace the entries read from the base with the result of applying
+ * the journal record whose payload (without the base checksum) is in
+ * [data, end), and return the start of the extensions of the record.
+ */
+static const char *apply_index_journal_record(struct index_state *istate,
+					      const char *data, const char *end)
+{
+	struct cache_entry **base = istate->cache, *prev = NULL;
+	unsigned int base_nr = istate->cache_nr, nr, i = 0, j;
+	struct ewah_bitmap *ewah;
+	struct bitmap *deleted;
+	uint32_t ewah_size;
+
+	if (end - data < 8)
+		die(_("index file corrupt"));
+	nr = get_be32(data);
+	ewah_size = get_be32(data + 4);
+	data += 8;
+	if (ewah_size > end - data || nr > end - data - ewah_size)
+		die(_("index file corrupt"));
+
+	ewah = ewah_new();
+	if (ewah_read_mmap(ewah, data, ewah_size) != ewah_size ||
+	    ewah->bit_size > base_nr)
+		die(_("index file corrupt"));
+	deleted = ewah_to_bitmap(ewah);
+	ewah_free(ewah);
+	data += ewah_size;
+
+	istate->cache_alloc = st_add(base_nr, nr);
+	istate->cache_nr = 0;
+	ALLOC_ARRAY(istate->cache, istate->cache_alloc);
+	istate->sparse_index = INDEX_EXPANDED;
+
+	for (j = 0; j < nr; j++) {
+		struct cache_entry *ce;
+		unsigned long consumed;
+
+		if (data >= end)
+			die(_("index file corrupt"));
+		ce = create_from_disk(istate->ce_mem_pool, 3, data, &consumed, NULL);
+		data += consumed;
+		if (data > end || (prev && cmp_cache_name_stage(prev, ce) >= 0))
+			die(_("index file corrupt"));
+		prev = ce;
+
+		while (i < base_nr) {
+			int cmp;
+
+			if (bitmap_get(deleted, i)) {
+				i++;
+				continue;
+			}
+			cmp = cmp_cache_name_stage(base[i], ce);
+			if (cmp > 0)
+				break;
+			if (!cmp) {
+				i++;
+				break;
+			}
+			set_index_entry(istate, istate->cache_nr++, base[i++]);
+		}
+		set_index_entry(istate, istate->cache_nr++, ce);
+	}
+	for (; i < base_nr; i++)
+		if (!bitmap_get(deleted, i))
+			set_index_entry(istate, istate->cache_nr++, base[i]);
+
+	bitmap_free(deleted);
+	return data;
+}
+
+/*
+ * The index at `mmap` is journaled and has been read into `istate`.
+ * Apply the journal open at `fd`, if it belongs to this index, and
+ * point `p` at the extensions to load.
+ */
+static void read_index_journal(struct index_state *istate,
+			       const char *mmap, size_t mmap_size, int fd,
+			       struct load_index_extensions *p)
+{
+	const unsigned hashsz = the_hash_algo->rawsz;
+	const unsigned char *base_hash =
+		(const unsigned char *)mmap + mmap_size - hashsz;
+	struct cache_entry **base = istate->cache;
+	unsigned int base_nr = istate->cache_nr;
+	const char *journal = NULL;
+	size_t size = 0;
+	struct stat st;
+
+	if (fd >= 0 && !fstat(fd, &st) && st.st_size) {
+		size = xsize_t(st.st_size);
+		journal = xmmap_gently(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (journal == MAP_FAILED)
+			die_errno(_("unable to map index journal%s"),
+				  mmap_os_err());
+		if (!index_journal_ok(journal, size, base_hash)) {
+			munmap((void *)journal, size);
+			journal = NULL;
+			size = 0;
+		}
+	}
+
+	if (journal) {
+		const char *end = journal + size - hashsz;
+
+		trace2_data_intmax("index", the_repository,
+				   "read/journal_entries",
+				   get_be32(journal + 8 + hashsz));
+		p->mmap = journal;
+		p->mmap_size = size;
+		p->src_offset = apply_index_journal_record(istate,
+							   journal + 8 + hashsz,
+							   end) - journal;
+		oidread(&istate->oid, (const unsigned char *)end);
+		istate->timestamp.sec = st.st_mtime;
+		istate->timestamp.nsec = ST_MTIME_NSEC(st);
+	}
+
+	if (!use_index_journal()) {
+		if (istate->cache != base)
+			free(base);
+		return;
+	}
+	if (istate->cache == base) {
+		ALLOC_ARRAY(base, base_nr);
+		COPY_ARRAY(base, istate->cache, base_nr);
+	}
+	set_index_journal(istate, base, base_nr, mmap_size, size, base_hash);
+}
+
 /* remember to discard_cache() before reading a different cache! */
 int do_read_index(struct index_state *istate, const char *path, int must_exist)
 {
@@ -2311,17 +2585,29 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	size_t mmap_size;
 	struct load_index_extensions p;
 	size_t extension_offset = 0;
-	int nr_threads, cpus;
+	int nr_threads, cpus, journal_fd;
 	struct index_entry_offset_table *ieot = NULL;
+	struct strbuf journal_path = STRBUF_INIT;
 
 	if (istate->initialized)
 		return istate->cache_nr;
 
+	/*
+	 * Open the journal before the index: a full rewrite only removes
+	 * the journal once the new index is in place, so the journal we
+	 * get either belongs to the index we read or is stale and ignored.
+	 */
+	strbuf_addf(&journal_path, "%s.journal", path);
+	journal_fd = open(journal_path.buf, O_RDONLY);
+	strbuf_release(&journal_path);
+
 	istate->timestamp.sec = 0;
 	istate->timestamp.nsec = 0;
 	fd = open(path, O_RDONLY);
 	if (fd < 0) {
 		if (!must_exist && errno == ENOENT) {
+			if (journal_fd >= 0)
+				close(journal_fd);
 			if (!istate->repo)
 				istate->repo = the_repository;
 			set_new_index_sparsity(istate);
@@ -2344,7 +2630,7 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	close(fd);
 
 	hdr = (const struct cache_header *)mmap;
-	if (verify_hdr(hdr, mmap_size) < 0)
+	if (verify_hdr(hdr) < 0)
 		goto unmap;
 
 	oidread(&istate->oid, (const unsigned char *)hdr + mmap_size - the_hash_algo->rawsz);
@@ -2412,8 +2698,17 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 			die(_("unable to join load_index_extensions thread: %s"), strerror(ret));
 	} else {
 		p.src_offset = src_offset;
+		if (index_has_journal(mmap, mmap_size, src_offset))
+			read_index_journal(istate, mmap, mmap_size, journal_fd, &p);
 		load_index_extensions(&p);
 	}
+	if (journal_fd >= 0)
+		close(journal_fd);
+
+	if (verify_hdr_checksum(hdr, mmap_size) < 0)
+		goto unmap;
+	if (p.mmap != mmap)
+		munmap((void *)p.mmap, p.mmap_size);
 	munmap((void *)mmap, mmap_size);
 
 	/*
@@ -2548,6 +2843,7 @@ int discard_index(struct index_state *istate)
 	istate->timestamp.sec = 0;
 	istate->timestamp.nsec = 0;
 	free_name_hash(istate);
+	free_name_hash_snapshot(istate);
 	cache_tree_free(&(istate->cache_tree));
 	istate->initialized = 0;
 	istate->fsmonitor_has_run_once = 0;
@@ -2555,6 +2851,7 @@ int discard_index(struct index_state *istate)
 	FREE_AND_NULL(istate->cache);
 	istate->cache_alloc = 0;
 	discard_split_index(istate);
+	discard_index_journal(istate);
 	free_untracked_cache(istate->untracked);
 	istate->untracked = NULL;
 
@@ -2797,15 +3094,17 @@ static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
  * This function verifies if index_state has the correct sha1 of the
  * index file.  Don't die if we have any other failure, just return 0.
  */
-static int verify_index_from(const struct index_state *istate, const char *path)
+/*
+ * Check whether the file at `path`, which is expected to be at least
+ * `min_size` bytes long before its trailing checksum, ends with `hash`.
+ */
+static int has_trailing_hash(const char *path, size_t min_size,
+			     const unsigned char *hash)
 {
 	int fd;
 	ssize_t n;
 	struct stat st;
-	unsigned char hash[GIT_MAX_RAWSZ];
-
-	if (!istate->initialized)
-		return 0;
+	unsigned char buf[GIT_MAX_RAWSZ];
 
 	fd = open(path, O_RDONLY);
 	if (fd < 0)
@@ -2814,14 +3113,14 @@ static int verify_index_from(const struct index_state *istate, const char *path)
 	if (fstat(fd, &st))
 		goto out;
 
-	if (st.st_size < sizeof(struct cache_header) + the_hash_algo->rawsz)
+	if (st.st_size < min_size + the_hash_algo->rawsz)
 		goto out;
 
-	n = pread_in_full(fd, hash, the_hash_algo->rawsz, st.st_size - the_hash_algo->rawsz);
+	n = pread_in_full(fd, buf, the_hash_algo->rawsz, st.st_size - the_hash_algo->rawsz);
 	if (n != the_hash_algo->rawsz)
 		goto out;
 
-	if (!hasheq(istate->oid.hash, hash))
+	if (!hasheq(hash, buf))
 		goto out;
 
 	close(fd);
@@ -2832,6 +3131,25 @@ static int verify_index_from(const struct index_state *istate, const char *path)
 	return 0;
 }
 
+static int verify_index_from(const struct index_state *istate, const char *path)
+{
+	struct strbuf journal_path = STRBUF_INIT;
+	int ret;
+
+	if (!istate->initialized)
+		return 0;
+
+	if (has_trailing_hash(path, sizeof(struct cache_header),
+			      istate->oid.hash))
+		return 1;
+
+	/* a journaled index is identified by the checksum of its journal */
+	strbuf_addf(&journal_path, "%s.journal", path);
+	ret = has_trailing_hash(journal_path.buf, 0, istate->oid.hash);
+	strbuf_release(&journal_path);
+	return ret;
+}
+
 static int repo_verify_index(struct repository *repo)
 {
 	return verify_index_from(repo->index, repo->index_file);
@@ -2891,6 +3209,102 @@ static int record_ieot(void)
 	return !git_config_get_index_threads(&val) && val != 1;
 }
 
+static int write_name_hash_snapshot_extension(void)
+{
+	int val;
+
+	if (!git_config_get_bool("index.namehashsnapshot", &val))
+		return val;
+	return git_env_bool("GIT_TEST_NAME_HASH_SNAPSHOT", 0);
+}
+
+/*
+ * Write the extensions describing `istate` other than the ones that
+ * only make sense for a complete index file (IEOT, EOIE and the journal
+ * marker).
+ */
+static int write_index_extensions(struct hashfile *f, git_hash_ctx *eoie_c,
+				  struct index_state *istate,
+				  int strip_extensions, int drop_cache_tree)
+{
+	int err;
+
+	if (!strip_extensions && istate->split_index &&
+	    !is_null_oid(&istate->split_index->base_oid)) {
+		struct strbuf sb = STRBUF_INIT;
+
+		if (istate->sparse_index)
+			die(_("cannot write split index for a sparse index"));
+
+		err = write_link_extension(&sb, istate) < 0 ||
+			write_index_ext_header(f, eoie_c, CACHE_EXT_LINK,
+					       sb.len) < 0;
+		hashwrite(f, sb.buf, sb.len);
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (!strip_extensions && !drop_cache_tree && istate->cache_tree) {
+		struct strbuf sb = STRBUF_INIT;
+
+		cache_tree_write(&sb, istate->cache_tree);
+		err = write_index_ext_header(f, eoie_c, CACHE_EXT_TREE, sb.len) < 0;
+		hashwrite(f, sb.buf, sb.len);
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (!strip_extensions && istate->resolve_undo) {
+		struct strbuf sb = STRBUF_INIT;
+
+		resolve_undo_write(&sb, istate->resolve_undo);
+		err = write_index_ext_header(f, eoie_c, CACHE_EXT_RESOLVE_UNDO,
+					     sb.len) < 0;
+		hashwrite(f, sb.buf, sb.len);
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (!strip_extensions && istate->untracked) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_untracked_extension(&sb, istate->untracked);
+		err = write_index_ext_header(f, eoie_c, CACHE_EXT_UNTRACKED,
+					     sb.len) < 0;
+		hashwrite(f, sb.buf, sb.len);
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (!strip_extensions && istate->fsmonitor_last_update) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_fsmonitor_extension(&sb, istate);
+		err = write_index_ext_header(f, eoie_c, CACHE_EXT_FSMONITOR, sb.len) < 0;
+		hashwrite(f, sb.buf, sb.len);
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (!strip_extensions && !istate->split_index &&
+	    write_name_hash_snapshot_extension()) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_name_hash_snapshot(&sb, istate);
+		err = write_index_ext_header(f, eoie_c, CACHE_EXT_NAME_HASH,
+					     sb.len) < 0;
+		hashwrite(f, sb.buf, sb.len);
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (istate->sparse_index) {
+		if (write_index_ext_header(f, eoie_c, CACHE_EXT_SPARSE_DIRECTORIES, 0) < 0)
+			return -1;
+	}
+	return 0;
+}
+
 /*
  * On success, `tempfile` is closed. If it is the temporary file
  * of a `struct lock_file`, we will therefore effectively perform
@@ -2917,6 +3331,8 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	int ieot_entries = 1;
 	struct index_entry_offset_table *ieot = NULL;
 	int nr, nr_threads;
+	int journal = !strip_extensions && !istate->split_index &&
+		use_index_journal();
 
 	f = hashfd(tempfile->fd, tempfile->filename.buf);
 
@@ -2950,7 +3366,11 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	if (!HAVE_THREADS || git_config_get_index_threads(&nr_threads))
 		nr_threads = 1;
 
-	if (nr_threads != 1 && record_ieot()) {
+	/*
+	 * IEOT is useless without EOIE, which a journaled index cannot
+	 * have as the journal is appended after it.
+	 */
+	if (nr_threads != 1 && !journal && record_ieot()) {
 		int ieot_blocks, cpus;
 
 		/*
@@ -3044,7 +3464,7 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	 * The extension headers must be hashed on their own for the
 	 * EOIE extension. Create a hashfile here to compute that hash.
 	 */
-	if (offset && record_eoie()) {
+	if (offset && !journal && record_eoie()) {
 		CALLOC_ARRAY(eoie_c, 1);
 		the_hash_algo->init_fn(eoie_c);
 	}
@@ -3068,67 +3488,12 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 			return -1;
 	}
 
-	if (!strip_extensions && istate->split_index &&
-	    !is_null_oid(&istate->split_index->base_oid)) {
-		struct strbuf sb = STRBUF_INIT;
-
-		if (istate->sparse_index)
-			die(_("cannot write split index for a sparse index"));
-
-		err = write_link_extension(&sb, istate) < 0 ||
-			write_index_ext_header(f, eoie_c, CACHE_EXT_LINK,
-					       sb.len) < 0;
-		hashwrite(f, sb.buf, sb.len);
-		strbuf_release(&sb);
-		if (err)
-			return -1;
-	}
-	if (!strip_extensions && !drop_cache_tree && istate->cache_tree) {
-		struct strbuf sb = STRBUF_INIT;
-
-		cache_tree_write(&sb, istate->cache_tree);
-		err = write_index_ext_header(f, eoie_c, CACHE_EXT_TREE, sb.len) < 0;
-		hashwrite(f, sb.buf, sb.len);
-		strbuf_release(&sb);
-		if (err)
-			return -1;
-	}
-	if (!strip_extensions && istate->resolve_undo) {
-		struct strbuf sb = STRBUF_INIT;
-
-		resolve_undo_write(&sb, istate->resolve_undo);
-		err = write_index_ext_header(f, eoie_c, CACHE_EXT_RESOLVE_UNDO,
-					     sb.len) < 0;
-		hashwrite(f, sb.buf, sb.len);
-		strbuf_release(&sb);
-		if (err)
-			return -1;
-	}
-	if (!strip_extensions && istate->untracked) {
-		struct strbuf sb = STRBUF_INIT;
-
-		write_untracked_extension(&sb, istate->untracked);
-		err = write_index_ext_header(f, eoie_c, CACHE_EXT_UNTRACKED,
-					     sb.len) < 0;
-		hashwrite(f, sb.buf, sb.len);
-		strbuf_release(&sb);
-		if (err)
-			return -1;
-	}
-	if (!strip_extensions && istate->fsmonitor_last_update) {
-		struct strbuf sb = STRBUF_INIT;
-
-		write_fsmonitor_extension(&sb, istate);
-		err = write_index_ext_header(f, eoie_c, CACHE_EXT_FSMONITOR, sb.len) < 0;
-		hashwrite(f, sb.buf, sb.len);
-		strbuf_release(&sb);
-		if (err)
-			return -1;
-	}
-	if (istate->sparse_index) {
-		if (write_index_ext_header(f, eoie_c, CACHE_EXT_SPARSE_DIRECTORIES, 0) < 0)
-			return -1;
-	}
+	if (write_index_extensions(f, eoie_c, istate, strip_extensions,
+				   drop_cache_tree) < 0)
+		return -1;
+	if (journal &&
+	    write_index_ext_header(f, eoie_c, CACHE_EXT_JOURNAL, 0) < 0)
+		return -1;
 
 	/*
 	 * CACHE_EXT_ENDOFINDEXENTRIES must be written as the last entry before the SHA1
@@ -3151,9 +3516,21 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	if (!alternate_index_output && (flags & COMMIT_LOCK))
 		csum_fsync_flag = CSUM_FSYNC;
 
+	offset = hashfile_total(f) + the_hash_algo->rawsz;
 	finalize_hashfile(f, istate->oid.hash, FSYNC_COMPONENT_INDEX,
 			  CSUM_HASH_IN_STREAM | csum_fsync_flag);
 
+	if (journal) {
+		struct cache_entry **base;
+
+		ALLOC_ARRAY(base, entries - removed);
+		for (i = nr = 0; i < entries; i++)
+			if (!(cache[i]->ce_flags & CE_REMOVE))
+				base[nr++] = cache[i];
+		set_index_journal(istate, base, nr, offset, 0,
+				  istate->oid.hash);
+	}
+
 	if (close_tempfile_gently(tempfile)) {
 		error(_("could not close '%s'"), get_tempfile_path(tempfile));
 		return -1;
@@ -3189,6 +3566,199 @@ static int commit_locked_index(struct lock_file *lk)
 		return commit_lock_file(lk);
 }
 
+static const int default_max_percent_journal_change = 20;
+
+static int too_many_journal_changes(struct index_state *istate,
+				    unsigned int changes)
+{
+	int max_change = -1;
+
+	if (!git_config_get_int("index.journalmaxpercentchange", &max_change) &&
+	    (max_change < 0 || 100 < max_change))
+		max_change = error(_("index.journalMaxPercentChange value '%d' "
+				     "should be between 0 and 100"), max_change);
+
+	switch (max_change) {
+	case -1:
+		/* not or badly configured: use the default value */
+		max_change = default_max_percent_journal_change;
+		break;
+	case 0:
+		return 1; /* 0% means never append to the journal */
+	case 100:
+		return 0; /* 100% means always append to the journal */
+	default:
+		break;
+	}
+
+	return (int64_t)istate->cache_nr * max_change < (int64_t)changes * 100;
+}
+
+/*
+ * Forget about the journal of `istate`, so that the next write rewrites
+ * the index in full.
+ */
+static void drop_index_journal(struct index_state *istate)
+{
+	struct index_journal *j = istate->journal;
+	unsigned int i;
+
+	if (!j)
+		return;
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (ce->index && ce->index <= j->base_nr &&
+		    ce == j->base[ce->index - 1])
+			ce->index = 0;
+	}
+	discard_index_journal(istate);
+}
+
+/*
+ * Remove the journal of the index file at `path`, which has just been
+ * rewritten in full. This has to happen after the new index is in
+ * place; see do_read_index().
+ */
+static void remove_index_journal(const char *path)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	strbuf_addf(&sb, "%s.journal", path);
+	unlink_or_warn(sb.buf);
+	strbuf_release(&sb);
+}
+
+/*
+ * Record the difference between `istate` and the base of its journal
+ * in the journal of the index file protected by `lock`, leaving the
+ * index file itself alone. Returns 0 on success, -1 on error and 1 if
+ * the index should rather be written in full.
+ */
+static int write_index_journal(struct index_state *istate,
+			       struct lock_file *lock)
+{
+	struct index_journal *j = istate->journal;
+	const unsigned hashsz = the_hash_algo->rawsz;
+	struct cache_entry **upserts = NULL;
+	unsigned int nr = 0, alloc = 0, live = 0, i;
+	struct bitmap *matched = bitmap_new();
+	struct ewah_bitmap *deleted = NULL;
+	struct ondisk_cache_entry ondisk;
+	struct lock_file journal_lock = LOCK_INIT;
+	struct strbuf sb = STRBUF_INIT, journal_path = STRBUF_INIT;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	struct hashfile *f;
+	struct stat st;
+	char *path = NULL;
+	size_t size;
+	int fd, err = 0, ret = 1;
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		if (ce->index && ce->index <= j->base_nr &&
+		    ce == j->base[ce->index - 1] &&
+		    !(ce->ce_flags & CE_UPDATE_IN_BASE) &&
+		    (ce_uptodate(ce) || !is_racy_timestamp(istate, ce))) {
+			bitmap_set(matched, ce->index - 1);
+			live++;
+			continue;
+		}
+		if (is_null_oid(&ce->oid))
+			goto out;
+		ALLOC_GROW(upserts, nr + 1, alloc);
+		upserts[nr++] = ce;
+	}
+
+	if (too_many_journal_changes(istate, nr + j->base_nr - live) ||
+	    j->size > j->base_size)
+		goto out;
+
+	/*
+	 * The index may have been rewritten since we read it, in which
+	 * case the journal would not apply to it.
+	 */
+	path = get_locked_file_path(lock);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		goto out;
+	if (fstat(fd, &st) || st.st_size != j->base_size ||
+	    pread_in_full(fd, hash, hashsz, j->base_size - hashsz) != hashsz ||
+	    !hasheq(hash, j->base_oid.hash)) {
+		close(fd);
+		goto out;
+	}
+	close(fd);
+
+	strbuf_addf(&journal_path, "%s.journal", path);
+	if (hold_lock_file_for_update(&journal_lock, journal_path.buf, 0) < 0)
+		goto out;
+
+	deleted = ewah_new();
+	for (i = 0; i < j->base_nr; i++)
+		if (!bitmap_get(matched, i))
+			ewah_set(deleted, i);
+	ewah_serialize_strbuf(deleted, &sb);
+
+	f = hashfd(get_lock_file_fd(&journal_lock),
+		   get_lock_file_path(&journal_lock));
+	hashwrite_be32(f, CACHE_EXT_JOURNAL);
+	hashwrite_be32(f, INDEX_JOURNAL_VERSION);
+	hashwrite(f, j->base_oid.hash, hashsz);
+	hashwrite_be32(f, nr);
+	hashwrite_be32(f, sb.len);
+	hashwrite(f, sb.buf, sb.len);
+	for (i = 0; i < nr; i++) {
+		struct cache_entry *ce = upserts[i];
+
+		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
+			ce_smudge_racily_clean_entry(istate, ce);
+		ce->ce_flags &= ~CE_EXTENDED;
+		if (ce->ce_flags & CE_EXTENDED_FLAGS)
+			ce->ce_flags |= CE_EXTENDED;
+		if (ce_write_entry(f, ce, NULL, &ondisk) < 0)
+			err = -1;
+	}
+	if (!err && write_index_extensions(f, NULL, istate, 0,
+					   istate->drop_cache_tree) < 0)
+		err = -1;
+	size = hashfile_total(f) + hashsz;
+	finalize_hashfile(f, hash, FSYNC_COMPONENT_INDEX,
+			  CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+	if (err) {
+		rollback_lock_file(&journal_lock);
+		ret = err;
+		goto out;
+	}
+	if (commit_lock_file(&journal_lock)) {
+		ret = error_errno(_("unable to write index journal '%s'"),
+				  journal_path.buf);
+		goto out;
+	}
+
+	j->size = size;
+	oidread(&istate->oid, hash);
+	if (!stat(journal_path.buf, &st)) {
+		istate->timestamp.sec = (unsigned int)st.st_mtime;
+		istate->timestamp.nsec = ST_MTIME_NSEC(st);
+	}
+	trace2_data_intmax("index", the_repository, "write/journal_entries", nr);
+	ret = 0;
+
+out:
+	free(path);
+	strbuf_release(&sb);
+	strbuf_release(&journal_path);
+	if (deleted)
+		ewah_free(deleted);
+	bitmap_free(matched);
+	free(upserts);
+	return ret;
+}
+
 static int do_write_locked_index(struct index_state *istate, struct lock_file *lock,
 				 unsigned flags)
 {
@@ -3202,6 +3772,21 @@ static int do_write_locked_index(struct index_state *istate, struct lock_file *l
 		return ret;
 	}
 
+	if (istate->journal) {
+		ret = 1;
+		if (!(istate->cache_changed & ~EXTMASK))
+			ret = write_index_journal(istate, lock);
+		if (ret <= 0) {
+			if (was_full)
+				ensure_full_index(istate);
+			if (ret)
+				return ret;
+			rollback_lock_file(lock);
+			goto done;
+		}
+		drop_index_journal(istate);
+	}
+
 	/*
 	 * TODO trace2: replace "the_repository" with the actual repo instance
 	 * that is associated with the given "istate".
@@ -3217,11 +3802,21 @@ static int do_write_locked_index(struct index_state *istate, struct lock_file *l
 
 	if (ret)
 		return ret;
-	if (flags & COMMIT_LOCK)
+	if (flags & COMMIT_LOCK) {
+		char *path = alternate_index_output ?
+			xstrdup(alternate_index_output) :
+			get_locked_file_path(lock);
+
 		ret = commit_locked_index(lock);
-	else
+		/* the journal of the old index does not apply anymore */
+		if (!ret)
+			remove_index_journal(path);
+		free(path);
+	} else {
 		ret = close_lock_file_gently(lock);
+	}
 
+done:
 	run_hooks_l("post-index-change",
 			istate->updated_workdir ? "1" : "0",
 			istate->updated_skipworktree ? "1" : "0", NULL);
@@ -3386,6 +3981,11 @@ int write_locked_index(struct index_state *istate, struct lock_file *lock,
 
 	test_split_index_env = git_env_bool("GIT_TEST_SPLIT_INDEX", 0);
 
+	/* only a plain index written in place can be journaled */
+	if (si || test_split_index_env || alternate_index_output ||
+	    !(flags & COMMIT_LOCK))
+		drop_index_journal(istate);
+
 	if ((!si && !test_split_index_env) ||
 	    alternate_index_output ||
 	    (istate->cache_changed & ~EXTMASK)) {
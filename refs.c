@@ -36,6 +36,35 @@ static struct ref_storage_be *find_ref_storage_backend(const char *name)
 	return NULL;
 }
 
+/*
+ * The names under which each reference storage format is recorded in
+ * "extensions.refStorage"; these double as the backend names.
+ */
+static const char *ref_storage_format_names[] = {
+	[REF_STORAGE_FORMAT_FILES] = "files",
+	[REF_STORAGE_FORMAT_REFTABLE] = "reftable",
+};
+
+int ref_storage_format_by_name(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(ref_storage_format_names); i++)
+		if (ref_storage_format_names[i] &&
+		    !strcmp(ref_storage_format_names[i], name))
+			return i;
+	return REF_STORAGE_FORMAT_UNKNOWN;
+}
+
+const char *ref_storage_format_to_name(int ref_storage_format)
+{
+	if (ref_storage_format < 0 ||
+	    (size_t)ref_storage_format >= ARRAY_SIZE(ref_storage_format_names) ||
+	    !ref_storage_format_names[ref_storage_format])
+		return "unknown";
+	return ref_storage_format_names[ref_storage_format];
+}
+
 /*
  * How to handle various characters in refnames:
  * 0: An acceptable character for refs
@@ -1990,7 +2019,7 @@ static struct ref_store *ref_store_init(struct repository *repo,
 					const char *gitdir,
 					unsigned int flags)
 {
-	const char *be_name = "files";
+	const char *be_name = ref_storage_format_to_name(repo->ref_storage_format);
 	struct ref_storage_be *be = find_ref_storage_backend(be_name);
 	struct ref_store *refs;
 
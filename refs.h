@@ -12,6 +12,15 @@ struct string_list;
 struct string_list_item;
 struct worktree;
 
+/*
+ * Map between the REF_STORAGE_FORMAT_* constants and the names used
+ * for them in "extensions.refStorage" and "git init --ref-format".
+ * ref_storage_format_by_name() returns REF_STORAGE_FORMAT_UNKNOWN for
+ * names it does not recognize.
+ */
+int ref_storage_format_by_name(const char *name);
+const char *ref_storage_format_to_name(int ref_storage_format);
+
 /*
  * Resolve a reference, recursively following symbolic refererences.
  *
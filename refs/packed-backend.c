@@ -6,6 +6,8 @@
 #include "../iterator.h"
 #include "../lockfile.h"
 #include "../chdir-notify.h"
+#include "../csum-file.h"
+#include "../trace2.h"
 
 enum mmap_strategy {
 	/*
@@ -37,6 +39,7 @@ static enum mmap_strategy mmap_strategy = MMAP_OK;
 #endif
 
 struct packed_ref_store;
+struct packed_refs_index;
 
 /*
  * A `snapshot` represents one snapshot of a `packed-refs` file.
@@ -92,6 +95,12 @@ struct snapshot {
 	 */
 	enum { PEELED_NONE, PEELED_TAGS, PEELED_FULLY } peeled;
 
+	/*
+	 * The `packed-refs.idx` sidecar, if one was found that matches
+	 * the file this snapshot was read from; otherwise, NULL.
+	 */
+	struct packed_refs_index *index;
+
 	/*
 	 * Count of references to this instance, including the pointer
 	 * from `packed_ref_store::snapshot`, if any. The instance
@@ -131,6 +140,9 @@ struct packed_ref_store {
 	/* The path of the "packed-refs" file: */
 	char *path;
 
+	/* The path of its "packed-refs.idx" sidecar: */
+	char *index_path;
+
 	/*
 	 * A snapshot of the values read from the `packed-refs` file,
 	 * if it might still be current; otherwise, NULL.
@@ -151,6 +163,66 @@ struct packed_ref_store {
 	struct tempfile *tempfile;
 };
 
+/*
+ * A `packed-refs.idx` file lets readers find records in a sorted
+ * `packed-refs` file without scanning for line boundaries. It is
+ * written next to `packed-refs` whenever that file is rewritten and
+ * `core.packedRefsIndex` is enabled. All integers are in network byte
+ * order:
+ *
+ *   - 4-byte signature "PRIX" and 4-byte version number (1)
+ *
+ *   - the stat data of the `packed-refs` file it describes (ctime,
+ *     mtime, dev, ino, uid, gid and size, each 4 bytes and laid out as
+ *     in the index), followed by its full 8-byte size
+ *
+ *   - 4-byte number of records N
+ *
+ *   - 4-byte number of records that sort before the first refname
+ *     starting with "refs/"
+ *
+ *   - 256-entry fanout table: entry C is the index of the first record
+ *     that sorts after every "refs/<C>..." refname. Records starting
+ *     with "refs/<C>" therefore span from entry C-1 (or the count
+ *     above, for C = 0) up to entry C.
+ *
+ *   - N 8-byte offsets of the start of each record (its object ID),
+ *     relative to the first byte after the header line
+ *
+ *   - a trailing checksum over all of the above
+ *
+ * The index is only trusted while the stat data still matches, and
+ * only for files that carry the `sorted` trait. Record offsets are
+ * checked to land on a record boundary before they are used; if one
+ * does not, the index is dropped and we fall back to scanning.
+ */
+#define PACKED_REFS_INDEX_SIGNATURE 0x50524958 /* "PRIX" */
+#define PACKED_REFS_INDEX_VERSION 1
+#define PACKED_REFS_INDEX_HEADER_SIZE (4 + 4 + 36 + 8 + 4 + 4)
+#define PACKED_REFS_INDEX_FANOUT_SIZE (256 * 4)
+
+struct packed_refs_index {
+	const unsigned char *data;
+	size_t len;
+	int mmapped;
+
+	uint32_t nr;
+	uint32_t refs_start;
+	const unsigned char *fanout;
+	const unsigned char *offsets;
+};
+
+static void free_packed_refs_index(struct packed_refs_index *index)
+{
+	if (!index)
+		return;
+	if (index->mmapped)
+		munmap((void *)index->data, index->len);
+	else
+		free((void *)index->data);
+	free(index);
+}
+
 /*
  * Increment the reference count of `*snapshot`.
  */
@@ -185,6 +257,7 @@ static int release_snapshot(struct snapshot *snapshot)
 {
 	if (!--snapshot->referrers) {
 		stat_validity_clear(&snapshot->validity);
+		free_packed_refs_index(snapshot->index);
 		clear_snapshot_buffer(snapshot);
 		free(snapshot);
 		return 1;
@@ -207,6 +280,8 @@ struct ref_store *packed_ref_store_create(struct repository *repo,
 	strbuf_addf(&sb, "%s/packed-refs", gitdir);
 	refs->path = strbuf_detach(&sb, NULL);
 	chdir_notify_reparent("packed-refs", &refs->path);
+	refs->index_path = xstrfmt("%s.idx", refs->path);
+	chdir_notify_reparent("packed-refs index", &refs->index_path);
 	return ref_store;
 }
 
@@ -468,13 +543,12 @@ static void verify_buffer_safe(struct snapshot *snapshot)
 /*
  * Depending on `mmap_strategy`, either mmap or read the contents of
  * the `packed-refs` file into the snapshot. Return 1 if the file
- * existed and was read, or 0 if the file was absent or empty. Die on
- * errors.
+ * existed and was read (and fill `st` with its stat data), or 0 if the
+ * file was absent or empty. Die on errors.
  */
-static int load_contents(struct snapshot *snapshot)
+static int load_contents(struct snapshot *snapshot, struct stat *st)
 {
 	int fd;
-	struct stat st;
 	size_t size;
 	ssize_t bytes_read;
 
@@ -496,9 +570,9 @@ static int load_contents(struct snapshot *snapshot)
 
 	stat_validity_update(&snapshot->validity, fd);
 
-	if (fstat(fd, &st) < 0)
+	if (fstat(fd, st) < 0)
 		die_errno("couldn't stat %s", snapshot->refs->path);
-	size = xsize_t(st.st_size);
+	size = xsize_t(st->st_size);
 
 	if (!size) {
 		close(fd);
@@ -521,6 +595,170 @@ static int load_contents(struct snapshot *snapshot)
 	return 1;
 }
 
+/*
+ * Read the `packed-refs.idx` sidecar of `refs`, if any, and return it
+ * if it describes the `packed-refs` file whose stat data is `packed_st`.
+ * Return NULL if there is no such file or it cannot be used.
+ */
+static struct packed_refs_index *load_packed_refs_index(struct packed_ref_store *refs,
+							struct stat *packed_st)
+{
+	struct packed_refs_index *index;
+	const unsigned char *p;
+	struct stat_data sd;
+	struct stat st;
+	size_t len, min_len;
+	uint32_t i, prev;
+	int fd;
+
+	fd = git_open(refs->index_path);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	len = xsize_t(st.st_size);
+	min_len = PACKED_REFS_INDEX_HEADER_SIZE +
+		  PACKED_REFS_INDEX_FANOUT_SIZE + the_hash_algo->rawsz;
+	if (len < min_len) {
+		close(fd);
+		return NULL;
+	}
+
+	CALLOC_ARRAY(index, 1);
+	index->len = len;
+	if (mmap_strategy == MMAP_OK) {
+		index->data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		index->mmapped = 1;
+	} else {
+		void *buf = xmalloc(len);
+
+		index->data = buf;
+		if (read_in_full(fd, buf, len) != len) {
+			close(fd);
+			goto invalid;
+		}
+	}
+	close(fd);
+
+	p = index->data;
+	if (get_be32(p) != PACKED_REFS_INDEX_SIGNATURE ||
+	    get_be32(p + 4) != PACKED_REFS_INDEX_VERSION)
+		goto invalid;
+	p += 8;
+
+	sd.sd_ctime.sec = get_be32(p);
+	sd.sd_ctime.nsec = get_be32(p + 4);
+	sd.sd_mtime.sec = get_be32(p + 8);
+	sd.sd_mtime.nsec = get_be32(p + 12);
+	sd.sd_dev = get_be32(p + 16);
+	sd.sd_ino = get_be32(p + 20);
+	sd.sd_uid = get_be32(p + 24);
+	sd.sd_gid = get_be32(p + 28);
+	sd.sd_size = get_be32(p + 32);
+	if (match_stat_data(&sd, packed_st) ||
+	    get_be64(p + 36) != (uint64_t)packed_st->st_size)
+		goto invalid;
+	p += 44;
+
+	index->nr = get_be32(p);
+	index->refs_start = get_be32(p + 4);
+	index->fanout = index->data + PACKED_REFS_INDEX_HEADER_SIZE;
+	index->offsets = index->fanout + PACKED_REFS_INDEX_FANOUT_SIZE;
+
+	if (index->nr != (len - min_len) / 8 ||
+	    (len - min_len) % 8)
+		goto invalid;
+
+	prev = index->refs_start;
+	for (i = 0; i < 256; i++) {
+		uint32_t next = get_be32(index->fanout + 4 * i);
+
+		if (next < prev)
+			goto invalid;
+		prev = next;
+	}
+	if (prev > index->nr)
+		goto invalid;
+
+	trace2_data_intmax("packed-refs", refs->base.repo, "index/records",
+			   index->nr);
+	return index;
+
+invalid:
+	free_packed_refs_index(index);
+	return NULL;
+}
+
+/*
+ * Return a pointer to the record at position `i` in the index of
+ * `snapshot`, or NULL if the index does not point at the start of a
+ * record there.
+ */
+static const char *index_record(struct snapshot *snapshot, uint32_t i)
+{
+	uint64_t offset = get_be64(snapshot->index->offsets + 8 * (size_t)i);
+	const char *rec;
+
+	if (offset > (uint64_t)(snapshot->eof - snapshot->start) ||
+	    snapshot->eof - snapshot->start - offset < the_hash_algo->hexsz + 2)
+		return NULL;
+
+	rec = snapshot->start + offset;
+	if (rec != snapshot->start && rec[-1] != '\n')
+		return NULL;
+	return rec;
+}
+
+/*
+ * Like `find_reference_location()`, but use the index of `snapshot`.
+ * Store the result in `*result` and return 0, or return -1 if the
+ * index turns out to be unusable.
+ */
+static int find_reference_location_indexed(struct snapshot *snapshot,
+					   const char *refname, int mustexist,
+					   const char **result)
+{
+	struct packed_refs_index *index = snapshot->index;
+	uint32_t lo = 0, hi = index->nr;
+	const char *rest;
+
+	if (skip_prefix(refname, "refs/", &rest) && *rest) {
+		unsigned char c = *rest;
+
+		lo = c ? get_be32(index->fanout + 4 * (c - 1)) : index->refs_start;
+		hi = get_be32(index->fanout + 4 * c);
+	}
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		const char *rec = index_record(snapshot, mid);
+		int cmp;
+
+		if (!rec)
+			return -1;
+		cmp = cmp_record_to_refname(rec, refname);
+		if (cmp < 0) {
+			lo = mid + 1;
+		} else if (cmp > 0) {
+			hi = mid;
+		} else {
+			*result = rec;
+			return 0;
+		}
+	}
+
+	if (mustexist)
+		*result = NULL;
+	else if (lo == index->nr)
+		*result = snapshot->eof;
+	else if (!(*result = index_record(snapshot, lo)))
+		return -1;
+	return 0;
+}
+
 /*
  * Find the place in `snapshot->buf` where the start of the record for
  * `refname` starts. If `mustexist` is true and the reference doesn't
@@ -560,6 +798,18 @@ static const char *find_reference_location(struct snapshot *snapshot,
 	 */
 	const char *hi = snapshot->eof;
 
+	if (snapshot->index) {
+		const char *rec;
+
+		if (!find_reference_location_indexed(snapshot, refname,
+						     mustexist, &rec))
+			return rec;
+
+		/* The index is inconsistent; stop using it. */
+		free_packed_refs_index(snapshot->index);
+		snapshot->index = NULL;
+	}
+
 	while (lo != hi) {
 		const char *mid, *rec;
 		int cmp;
@@ -618,13 +868,14 @@ static const char *find_reference_location(struct snapshot *snapshot,
 static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 {
 	struct snapshot *snapshot = xcalloc(1, sizeof(*snapshot));
+	struct stat st;
 	int sorted = 0;
 
 	snapshot->refs = refs;
 	acquire_snapshot(snapshot);
 	snapshot->peeled = PEELED_NONE;
 
-	if (!load_contents(snapshot))
+	if (!load_contents(snapshot, &st))
 		return snapshot;
 
 	/* If the file has a header line, process it: */
@@ -675,6 +926,8 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 		 * safety again:
 		 */
 		verify_buffer_safe(snapshot);
+	} else {
+		snapshot->index = load_packed_refs_index(refs, &st);
 	}
 
 	if (mmap_strategy != MMAP_OK && snapshot->mmapped) {
@@ -986,6 +1239,107 @@ static int write_packed_entry(FILE *fh, const char *refname,
 	return 0;
 }
 
+/*
+ * The record offsets and fanout counts collected while writing a new
+ * `packed-refs` file, from which its `packed-refs.idx` is written.
+ */
+struct packed_refs_index_builder {
+	off_t body_start;
+	uint64_t *offsets;
+	size_t nr, alloc;
+	uint32_t refs_start;
+	uint32_t fanout[256];
+};
+
+static void packed_refs_index_builder_release(struct packed_refs_index_builder *b)
+{
+	free(b->offsets);
+	memset(b, 0, sizeof(*b));
+}
+
+/*
+ * Note that the record for `refname` is about to be written to `fh`.
+ */
+static int add_packed_refs_index_entry(struct packed_refs_index_builder *b,
+				       FILE *fh, const char *refname)
+{
+	off_t pos = ftello(fh);
+	const char *rest;
+
+	if (pos < 0)
+		return -1;
+	if (b->nr >= UINT32_MAX) {
+		errno = EFBIG;
+		return -1;
+	}
+
+	ALLOC_GROW(b->offsets, b->nr + 1, b->alloc);
+	b->offsets[b->nr++] = pos - b->body_start;
+
+	if (skip_prefix(refname, "refs/", &rest))
+		b->fanout[(unsigned char)*rest]++;
+	else if (b->nr == b->refs_start + 1)
+		b->refs_start++;
+	return 0;
+}
+
+/*
+ * Write `packed-refs.idx` for the `packed-refs` file that was just
+ * renamed into place. Failing to do so is not fatal: an index that
+ * does not match `packed-refs` is ignored by readers.
+ */
+static void write_packed_refs_index(struct packed_ref_store *refs,
+				    struct packed_refs_index_builder *b)
+{
+	struct lock_file lock = LOCK_INIT;
+	struct hashfile *f;
+	struct stat_data sd;
+	struct stat st;
+	uint32_t total;
+	size_t i;
+
+	if (stat(refs->path, &st) < 0) {
+		warning_errno("unable to stat %s", refs->path);
+		return;
+	}
+	if (hold_lock_file_for_update(&lock, refs->index_path, 0) < 0) {
+		warning_errno("unable to lock %s", refs->index_path);
+		return;
+	}
+
+	fill_stat_data(&sd, &st);
+
+	f = hashfd(get_lock_file_fd(&lock), get_lock_file_path(&lock));
+	hashwrite_be32(f, PACKED_REFS_INDEX_SIGNATURE);
+	hashwrite_be32(f, PACKED_REFS_INDEX_VERSION);
+	hashwrite_be32(f, sd.sd_ctime.sec);
+	hashwrite_be32(f, sd.sd_ctime.nsec);
+	hashwrite_be32(f, sd.sd_mtime.sec);
+	hashwrite_be32(f, sd.sd_mtime.nsec);
+	hashwrite_be32(f, sd.sd_dev);
+	hashwrite_be32(f, sd.sd_ino);
+	hashwrite_be32(f, sd.sd_uid);
+	hashwrite_be32(f, sd.sd_gid);
+	hashwrite_be32(f, sd.sd_size);
+	hashwrite_be64(f, st.st_size);
+	hashwrite_be32(f, b->nr);
+	hashwrite_be32(f, b->refs_start);
+
+	total = b->refs_start;
+	for (i = 0; i < ARRAY_SIZE(b->fanout); i++) {
+		total += b->fanout[i];
+		hashwrite_be32(f, total);
+	}
+
+	for (i = 0; i < b->nr; i++)
+		hashwrite_be64(f, b->offsets[i]);
+
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_REFERENCE,
+			  CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+	if (commit_lock_file(&lock) < 0)
+		warning_errno("unable to write %s", refs->index_path);
+}
+
 int packed_refs_lock(struct ref_store *ref_store, int flags, struct strbuf *err)
 {
 	struct packed_ref_store *refs =
@@ -1092,11 +1446,15 @@ static int packed_init_db(struct ref_store *ref_store UNUSED,
  * values are `struct ref_update *`. On error, rollback the tempfile,
  * write an error message to `err`, and return a nonzero value.
  *
+ * If `index` is non-NULL, record the position of every record written
+ * in it.
+ *
  * The packfile must be locked before calling this function and will
  * remain locked when it is done.
  */
 static int write_with_updates(struct packed_ref_store *refs,
 			      struct string_list *updates,
+			      struct packed_refs_index_builder *index,
 			      struct strbuf *err)
 {
 	struct ref_iterator *iter = NULL;
@@ -1136,6 +1494,9 @@ static int write_with_updates(struct packed_ref_store *refs,
 	if (fprintf(out, "%s", PACKED_REFS_HEADER) < 0)
 		goto write_error;
 
+	if (index && (index->body_start = ftello(out)) < 0)
+		goto write_error;
+
 	/*
 	 * We iterate in parallel through the current list of refs and
 	 * the list of updates, processing an entry from at least one
@@ -1227,6 +1588,9 @@ static int write_with_updates(struct packed_ref_store *refs,
 			struct object_id peeled;
 			int peel_error = ref_iterator_peel(iter, &peeled);
 
+			if (index &&
+			    add_packed_refs_index_entry(index, out, iter->refname))
+				goto write_error;
 			if (write_packed_entry(out, iter->refname,
 					       iter->oid,
 					       peel_error ? NULL : &peeled))
@@ -1248,6 +1612,9 @@ static int write_with_updates(struct packed_ref_store *refs,
 			int peel_error = peel_object(&update->new_oid,
 						     &peeled);
 
+			if (index &&
+			    add_packed_refs_index_entry(index, out, update->refname))
+				goto write_error;
 			if (write_packed_entry(out, update->refname,
 					       &update->new_oid,
 					       peel_error ? NULL : &peeled))
@@ -1387,6 +1754,9 @@ struct packed_transaction_backend_data {
 	int own_lock;
 
 	struct string_list updates;
+
+	/* Non-NULL iff a `packed-refs.idx` should be written. */
+	struct packed_refs_index_builder *index;
 };
 
 static void packed_transaction_cleanup(struct packed_ref_store *refs,
@@ -1397,6 +1767,11 @@ static void packed_transaction_cleanup(struct packed_ref_store *refs,
 	if (data) {
 		string_list_clear(&data->updates, 0);
 
+		if (data->index) {
+			packed_refs_index_builder_release(data->index);
+			FREE_AND_NULL(data->index);
+		}
+
 		if (is_tempfile_active(refs->tempfile))
 			delete_tempfile(&refs->tempfile);
 
@@ -1422,6 +1797,7 @@ static int packed_transaction_prepare(struct ref_store *ref_store,
 			"ref_transaction_prepare");
 	struct packed_transaction_backend_data *data;
 	size_t i;
+	int write_index = 0;
 	int ret = TRANSACTION_GENERIC_ERROR;
 
 	/*
@@ -1461,7 +1837,11 @@ static int packed_transaction_prepare(struct ref_store *ref_store,
 		data->own_lock = 1;
 	}
 
-	if (write_with_updates(refs, &data->updates, err))
+	if (!repo_config_get_bool(ref_store->repo, "core.packedrefsindex",
+				  &write_index) && write_index)
+		CALLOC_ARRAY(data->index, 1);
+
+	if (write_with_updates(refs, &data->updates, data->index, err))
 		goto failure;
 
 	transaction->state = REF_TRANSACTION_PREPARED;
@@ -1493,6 +1873,7 @@ static int packed_transaction_finish(struct ref_store *ref_store,
 			ref_store,
 			REF_STORE_READ | REF_STORE_WRITE | REF_STORE_ODB,
 			"ref_transaction_finish");
+	struct packed_transaction_backend_data *data = transaction->backend_data;
 	int ret = TRANSACTION_GENERIC_ERROR;
 	char *packed_refs_path;
 
@@ -1505,6 +1886,11 @@ static int packed_transaction_finish(struct ref_store *ref_store,
 		goto cleanup;
 	}
 
+	if (data->index)
+		write_packed_refs_index(refs, data->index);
+	else
+		unlink_or_warn(refs->index_path);
+
 	ret = 0;
 
 cleanup:
@@ -0,0 +1,2418 @@
+#include "../cache.h"
+#include "../config.h"
+#include "../dir.h"
+#include "../refs.h"
+#include "refs-internal.h"
+#include "../iterator.h"
+#include "../object.h"
+#include "../strmap.h"
+#include "../chdir-notify.h"
+#include "../reftable/reftable-error.h"
+#include "../reftable/reftable-iterator.h"
+#include "../reftable/reftable-merged.h"
+#include "../reftable/reftable-record.h"
+#include "../reftable/reftable-stack.h"
+
+/*
+ * Used as a flag in ref_update::flags when the ref_update was via an
+ * update to HEAD.
+ */
+#define REF_UPDATE_VIA_HEAD (1 << 8)
+
+/*
+ * A single reftable stack together with the directory hosting it. The
+ * directory is created lazily the first time we write to the stack, which
+ * is how per-worktree stacks come into existence.
+ */
+struct reftable_backend {
+	struct reftable_stack *stack;
+	char *dir;
+};
+
+struct reftable_ref_store {
+	struct ref_store base;
+
+	/*
+	 * The main backend lives in $GIT_COMMON_DIR/reftable and holds the
+	 * shared refs as well as the per-worktree refs of the main worktree.
+	 */
+	struct reftable_backend main_backend;
+
+	/*
+	 * When the ref store was opened via a linked worktree, this backend
+	 * lives in $GIT_DIR/reftable and holds its per-worktree refs. It is
+	 * NULL otherwise.
+	 */
+	struct reftable_backend *worktree_backend;
+
+	/*
+	 * Backends of other worktrees, keyed by worktree name. They are set
+	 * up lazily when accessing "worktrees/<name>/" refs.
+	 */
+	struct strmap worktree_backends;
+
+	struct reftable_write_options write_options;
+	char *gitcommondir;
+	unsigned int store_flags;
+	int err;
+
+	/*
+	 * Number of ref iterators that are currently alive. Reloading or
+	 * compacting a stack may release the tables that an iterator is
+	 * reading from, so neither happens while this is non-zero. Reads
+	 * performed while iterating thus see the same snapshot as the
+	 * iterator itself.
+	 */
+	unsigned int iterators_active;
+};
+
+/*
+ * Downcast ref_store to reftable_ref_store. Die if ref_store is not a
+ * reftable_ref_store. required_flags is compared with ref_store's
+ * store_flags to ensure the ref_store has all required capabilities.
+ * "caller" is used in any necessary error messages.
+ */
+static struct reftable_ref_store *reftable_be_downcast(struct ref_store *ref_store,
+						       unsigned int required_flags,
+						       const char *caller)
+{
+	struct reftable_ref_store *refs;
+
+	if (ref_store->be != &refs_be_reftable)
+		BUG("ref_store is type \"%s\" not \"reftable\" in %s",
+		    ref_store->be->name, caller);
+
+	refs = (struct reftable_ref_store *)ref_store;
+
+	if ((refs->store_flags & required_flags) != required_flags)
+		BUG("operation %s requires abilities 0x%x, but only have 0x%x",
+		    caller, required_flags, refs->store_flags);
+
+	return refs;
+}
+
+static int reftable_backend_init(struct reftable_backend *be, const char *dir,
+				 struct reftable_write_options opts)
+{
+	be->dir = xstrdup(dir);
+	return reftable_new_stack(&be->stack, be->dir, opts);
+}
+
+static void reftable_backend_release(struct reftable_backend *be)
+{
+	if (be->stack)
+		reftable_stack_destroy(be->stack);
+	be->stack = NULL;
+	FREE_AND_NULL(be->dir);
+}
+
+/*
+ * Look up the backend that hosts `refname` and store it in `out`. The
+ * refname with any "main-worktree/" or "worktrees/<name>/" prefix
+ * stripped is stored in `rewritten_ref`. If `reload` is set, the stack
+ * is brought up to date with what is on disk unless an iterator is
+ * active. Returns 0 on success, a reftable error code otherwise.
+ */
+static int backend_for(struct reftable_backend **out,
+		       struct reftable_ref_store *refs,
+		       const char *refname,
+		       const char **rewritten_ref,
+		       int reload)
+{
+	struct reftable_backend *be;
+	const char *wtname;
+	int wtname_len;
+	int ret;
+
+	if (refs->err)
+		return refs->err;
+
+	switch (parse_worktree_ref(refname, &wtname, &wtname_len, rewritten_ref)) {
+	case REF_WORKTREE_OTHER: {
+		static struct strbuf wtname_buf = STRBUF_INIT;
+
+		strbuf_reset(&wtname_buf);
+		strbuf_add(&wtname_buf, wtname, wtname_len);
+
+		/*
+		 * When the worktree in question is the current one we end up
+		 * with two stacks for the same directory. This is harmless, as
+		 * each of them is reloaded before use and writes go through
+		 * the stack lock.
+		 */
+		be = strmap_get(&refs->worktree_backends, wtname_buf.buf);
+		if (!be) {
+			struct strbuf dir = STRBUF_INIT;
+
+			strbuf_addf(&dir, "%s/worktrees/%s/reftable",
+				    refs->gitcommondir, wtname_buf.buf);
+			CALLOC_ARRAY(be, 1);
+			ret = reftable_backend_init(be, dir.buf,
+						    refs->write_options);
+			strbuf_release(&dir);
+			if (ret) {
+				reftable_backend_release(be);
+				free(be);
+				return ret;
+			}
+			strmap_put(&refs->worktree_backends, wtname_buf.buf, be);
+		}
+		break;
+	}
+	case REF_WORKTREE_CURRENT:
+		/*
+		 * Without a worktree backend we are in the main worktree,
+		 * whose per-worktree refs live in the main stack.
+		 */
+		be = refs->worktree_backend ? refs->worktree_backend :
+			&refs->main_backend;
+		break;
+	case REF_WORKTREE_MAIN:
+	case REF_WORKTREE_SHARED:
+		be = &refs->main_backend;
+		break;
+	default:
+		BUG("unhandled worktree reference type");
+	}
+
+	if (reload && !refs->iterators_active) {
+		ret = reftable_stack_reload(be->stack);
+		if (ret)
+			return ret;
+	}
+
+	*out = be;
+	return 0;
+}
+
+static int should_write_log(struct ref_store *refs, const char *refname)
+{
+	if (log_all_ref_updates == LOG_REFS_UNSET)
+		log_all_ref_updates = is_bare_repository() ?
+			LOG_REFS_NONE : LOG_REFS_NORMAL;
+
+	if (should_autocreate_reflog(refname))
+		return 1;
+	return refs_reflog_exists(refs, refname);
+}
+
+/*
+ * Initialize `log` as an update record carrying the current committer
+ * identity and zeroed object IDs, to be filled in by the caller.
+ */
+static void fill_reftable_log_record(struct reftable_log_record *log)
+{
+	const char *info = git_committer_info(0);
+	struct ident_split split = { 0 };
+	int sign = 1;
+
+	if (split_ident_line(&split, info, strlen(info)))
+		BUG("failed splitting committer info");
+
+	reftable_log_record_release(log);
+	log->value_type = REFTABLE_LOG_UPDATE;
+	log->value.update.name =
+		xstrndup(split.name_begin, split.name_end - split.name_begin);
+	log->value.update.email =
+		xstrndup(split.mail_begin, split.mail_end - split.mail_begin);
+	log->value.update.time = atol(split.date_begin);
+	if (*split.tz_begin == '-') {
+		sign = -1;
+		split.tz_begin++;
+	} else if (*split.tz_begin == '+') {
+		split.tz_begin++;
+	}
+	log->value.update.tz_offset = sign * atoi(split.tz_begin);
+	log->value.update.old_hash = xcalloc(1, GIT_MAX_RAWSZ);
+	log->value.update.new_hash = xcalloc(1, GIT_MAX_RAWSZ);
+}
+
+/*
+ * Log messages are stored on a single line; anything larger than half a
+ * block is truncated so that the record always fits.
+ */
+static char *reftable_log_message(struct reftable_ref_store *refs,
+				  const char *msg)
+{
+	return xstrndup(msg ? msg : "", refs->write_options.block_size / 2);
+}
+
+static void append_log_tombstone(struct reftable_log_record **logs,
+				 size_t *logs_nr, size_t *logs_alloc,
+				 const char *refname, uint64_t update_index)
+{
+	struct reftable_log_record *log;
+
+	ALLOC_GROW(*logs, *logs_nr + 1, *logs_alloc);
+	log = &(*logs)[(*logs_nr)++];
+	memset(log, 0, sizeof(*log));
+	log->refname = xstrdup(refname);
+	log->value_type = REFTABLE_LOG_DELETION;
+	log->update_index = update_index;
+}
+
+/*
+ * Queue tombstones for all reflog entries of `refname` in `mt`.
+ */
+static int append_reflog_tombstones(struct reftable_merged_table *mt,
+				    const char *refname,
+				    struct reftable_log_record **logs,
+				    size_t *logs_nr, size_t *logs_alloc)
+{
+	struct reftable_log_record log = { 0 };
+	struct reftable_iterator it = { 0 };
+	int ret;
+
+	ret = reftable_merged_table_seek_log(mt, &it, refname);
+	while (!ret) {
+		ret = reftable_iterator_next_log(&it, &log);
+		if (ret < 0)
+			break;
+		if (ret > 0 || strcmp(log.refname, refname)) {
+			ret = 0;
+			break;
+		}
+		append_log_tombstone(logs, logs_nr, logs_alloc, refname,
+				     log.update_index);
+	}
+
+	reftable_log_record_release(&log);
+	reftable_iterator_destroy(&it);
+	return ret;
+}
+
+static void release_log_records(struct reftable_log_record *logs,
+				size_t logs_nr)
+{
+	size_t i;
+
+	for (i = 0; i < logs_nr; i++)
+		reftable_log_record_release(&logs[i]);
+	free(logs);
+}
+
+static struct ref_store *reftable_be_init(struct repository *repo,
+					  const char *gitdir,
+					  unsigned int store_flags)
+{
+	struct reftable_ref_store *refs = xcalloc(1, sizeof(*refs));
+	struct strbuf sb = STRBUF_INIT;
+	int is_worktree;
+	mode_t mask;
+
+	mask = umask(0);
+	umask(mask);
+
+	base_ref_store_init(&refs->base, repo, gitdir, &refs_be_reftable);
+	strmap_init(&refs->worktree_backends);
+	refs->store_flags = store_flags;
+	refs->write_options.block_size = 4096;
+	refs->write_options.hash_id = repo->hash_algo->format_id;
+	refs->write_options.default_permissions = calc_shared_perm(0666 & ~mask);
+	/*
+	 * Name and D/F conflicts are checked by the generic refs code via
+	 * refs_verify_refname_available(), including against refs that are
+	 * part of the same transaction.
+	 */
+	refs->write_options.skip_name_check = 1;
+
+	/*
+	 * The main stack lives in the common directory. When we are in a
+	 * linked worktree, get_common_dir_noenv() has already resolved it
+	 * to an absolute path for us.
+	 */
+	is_worktree = get_common_dir_noenv(&sb, gitdir);
+	if (!is_worktree) {
+		strbuf_reset(&sb);
+		strbuf_realpath(&sb, gitdir, 1);
+	}
+	refs->gitcommondir = xstrdup(sb.buf);
+
+	strbuf_addstr(&sb, "/reftable");
+	refs->err = reftable_backend_init(&refs->main_backend, sb.buf,
+					  refs->write_options);
+	if (refs->err)
+		goto done;
+
+	if (is_worktree) {
+		strbuf_reset(&sb);
+		strbuf_realpath(&sb, gitdir, 1);
+		strbuf_addstr(&sb, "/reftable");
+
+		CALLOC_ARRAY(refs->worktree_backend, 1);
+		refs->err = reftable_backend_init(refs->worktree_backend,
+						  sb.buf, refs->write_options);
+		if (refs->err)
+			goto done;
+	}
+
+	chdir_notify_reparent("reftable-backend $GIT_DIR", &refs->base.gitdir);
+
+done:
+	strbuf_release(&sb);
+	return &refs->base;
+}
+
+static int reftable_be_init_db(struct ref_store *ref_store,
+			       struct strbuf *err UNUSED)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, "init_db");
+	struct strbuf sb = STRBUF_INIT;
+
+	safe_create_dir(refs->main_backend.dir, 1);
+
+	/*
+	 * Older versions of Git only recognize a repository if it has a
+	 * HEAD file and a refs/ directory. Write a HEAD that points to an
+	 * invalid branch name and turn refs/heads into a file, so that they
+	 * notice the repository but refuse to operate on it. These only
+	 * belong in the common directory; the store of a linked worktree
+	 * has nothing to add.
+	 */
+	if (refs->worktree_backend)
+		return 0;
+
+	strbuf_addf(&sb, "%s/HEAD", refs->gitcommondir);
+	if (!file_exists(sb.buf)) {
+		write_file(sb.buf, "ref: refs/heads/.invalid");
+		adjust_shared_perm(sb.buf);
+	}
+
+	strbuf_reset(&sb);
+	strbuf_addf(&sb, "%s/refs", refs->gitcommondir);
+	safe_create_dir(sb.buf, 1);
+
+	strbuf_addstr(&sb, "/heads");
+	if (!file_exists(sb.buf)) {
+		write_file(sb.buf, "this repository uses the reftable format");
+		adjust_shared_perm(sb.buf);
+	}
+
+	strbuf_release(&sb);
+	return 0;
+}
+
+/*
+ * Lock the stack of `be` for writing and start a new addition. The
+ * backend directory is created if needed. Lock contention is retried
+ * for core.filesRefLockTimeout milliseconds.
+ */
+static int reftable_be_lock_stack(struct reftable_ref_store *refs,
+				  struct reftable_backend *be,
+				  struct reftable_addition **out)
+{
+	long timeout_ms = get_files_ref_lock_timeout_ms();
+	uint64_t deadline = getnanotime() + (uint64_t)timeout_ms * 1000000;
+	long wait_ms = 1;
+	int ret;
+
+	if (mkdir(be->dir, 0777) < 0) {
+		if (errno != EEXIST)
+			return REFTABLE_IO_ERROR;
+	} else if (adjust_shared_perm(be->dir)) {
+		return REFTABLE_IO_ERROR;
+	}
+
+	while (1) {
+		/*
+		 * An outdated stack cannot be locked, so bring it up to date
+		 * first. With iterators active we may not reload; the only
+		 * tables we could have missed are those added by another
+		 * process, in which case locking fails like it would on
+		 * contention.
+		 */
+		if (!refs->iterators_active) {
+			ret = reftable_stack_reload(be->stack);
+			if (ret)
+				return ret;
+		}
+
+		ret = reftable_stack_new_addition(out, be->stack);
+		if (ret != REFTABLE_LOCK_ERROR)
+			return ret;
+
+		if (timeout_ms >= 0 && getnanotime() >= deadline)
+			return ret;
+		sleep_millisec(wait_ms);
+		wait_ms = wait_ms < 500 ? wait_ms * 2 : 1000;
+	}
+}
+
+/*
+ * Compact the stack unless an iterator might still be reading from the
+ * tables that compaction would remove. Failing to take the lock is fine,
+ * as whoever holds it will compact the stack in our place.
+ */
+static int reftable_be_auto_compact(struct reftable_ref_store *refs,
+				    struct reftable_backend *be)
+{
+	int ret;
+
+	if (refs->iterators_active)
+		return 0;
+
+	ret = reftable_stack_auto_compact(be->stack);
+	if (ret == REFTABLE_LOCK_ERROR)
+		ret = 0;
+	return ret;
+}
+
+static int read_ref_without_reload(struct reftable_stack *stack,
+				   const char *refname,
+				   struct object_id *oid,
+				   struct strbuf *referent,
+				   unsigned int *type)
+{
+	struct reftable_ref_record ref = { 0 };
+	int ret;
+
+	ret = reftable_stack_read_ref(stack, refname, &ref);
+	if (ret)
+		goto done;
+
+	if (ref.value_type == REFTABLE_REF_SYMREF) {
+		strbuf_reset(referent);
+		strbuf_addstr(referent, ref.value.symref);
+		*type |= REF_ISSYMREF;
+	} else if (reftable_ref_record_val1(&ref)) {
+		oidread(oid, reftable_ref_record_val1(&ref));
+	} else {
+		/* Deletions are suppressed by the merged table. */
+		BUG("unhandled reference value type %d", ref.value_type);
+	}
+
+done:
+	reftable_ref_record_release(&ref);
+	return ret;
+}
+
+static int reftable_be_read_raw_ref(struct ref_store *ref_store,
+				    const char *refname,
+				    struct object_id *oid,
+				    struct strbuf *referent,
+				    unsigned int *type,
+				    int *failure_errno)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_READ, "read_raw_ref");
+	struct reftable_backend *be;
+	int ret;
+
+	*type = 0;
+
+	ret = backend_for(&be, refs, refname, &refname, 1);
+	if (ret)
+		return ret;
+
+	ret = read_ref_without_reload(be->stack, refname, oid, referent, type);
+	if (ret < 0)
+		return ret;
+	if (ret > 0) {
+		*failure_errno = ENOENT;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int reftable_be_read_symbolic_ref(struct ref_store *ref_store,
+					 const char *refname,
+					 struct strbuf *referent)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_READ, "read_symbolic_ref");
+	struct reftable_ref_record ref = { 0 };
+	struct reftable_backend *be;
+	int ret;
+
+	ret = backend_for(&be, refs, refname, &refname, 1);
+	if (ret)
+		return ret;
+
+	ret = reftable_stack_read_ref(be->stack, refname, &ref);
+	if (ret > 0)
+		ret = -1;
+	else if (!ret && ref.value_type == REFTABLE_REF_SYMREF)
+		strbuf_addstr(referent, ref.value.symref);
+	else if (!ret)
+		ret = 1;
+
+	reftable_ref_record_release(&ref);
+	return ret;
+}
+
+/*
+ * Select the next entry when merging the per-worktree stack (iter0) with
+ * the main stack (iter1). Both are ordered. Per-worktree refs of the
+ * main worktree are stored in the main stack and must be hidden, and a
+ * per-worktree ref shadows a shared ref of the same name.
+ */
+static enum iterator_selection iterator_select(struct ref_iterator *iter_worktree,
+					       struct ref_iterator *iter_common,
+					       void *cb_data UNUSED)
+{
+	int cmp;
+
+	if (!iter_worktree && !iter_common)
+		return ITER_SELECT_DONE;
+	if (!iter_common)
+		return ITER_SELECT_0;
+
+	cmp = iter_worktree ? strcmp(iter_worktree->refname, iter_common->refname) : 1;
+	if (cmp < 0)
+		return ITER_SELECT_0;
+	if (!cmp)
+		return ITER_SELECT_0_SKIP_1;
+
+	if (parse_worktree_ref(iter_common->refname, NULL, NULL, NULL) ==
+	    REF_WORKTREE_CURRENT)
+		return ITER_SKIP_1;
+	return ITER_SELECT_1;
+}
+
+/*
+ * Bring all stacks that an iterator reads from up to date. This is a
+ * no-op if another iterator is already active.
+ */
+static int reload_for_iteration(struct reftable_ref_store *refs)
+{
+	int ret;
+
+	if (refs->err)
+		return refs->err;
+	if (refs->iterators_active)
+		return 0;
+
+	ret = reftable_stack_reload(refs->main_backend.stack);
+	if (!ret && refs->worktree_backend)
+		ret = reftable_stack_reload(refs->worktree_backend->stack);
+	return ret;
+}
+
+struct reftable_ref_iterator {
+	struct ref_iterator base;
+	struct reftable_ref_store *refs;
+	struct reftable_iterator iter;
+	struct reftable_ref_record ref;
+	struct object_id oid;
+
+	char *prefix;
+	size_t prefix_len;
+	unsigned int flags;
+	int err;
+};
+
+static int reftable_ref_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+	struct reftable_ref_store *refs = iter->refs;
+
+	while (!iter->err) {
+		int flags = 0;
+
+		iter->err = reftable_iterator_next_ref(&iter->iter, &iter->ref);
+		if (iter->err)
+			break;
+
+		if (strncmp(iter->prefix, iter->ref.refname, iter->prefix_len)) {
+			iter->err = 1;
+			break;
+		}
+
+		/*
+		 * Like the files backend, only list refs under "refs/". Root
+		 * refs like HEAD sort before those.
+		 */
+		if (!starts_with(iter->ref.refname, "refs/"))
+			continue;
+
+		if (iter->flags & DO_FOR_EACH_PER_WORKTREE_ONLY &&
+		    parse_worktree_ref(iter->ref.refname, NULL, NULL, NULL) !=
+		    REF_WORKTREE_CURRENT)
+			continue;
+
+		switch (iter->ref.value_type) {
+		case REFTABLE_REF_VAL1:
+			oidread(&iter->oid, iter->ref.value.val1);
+			break;
+		case REFTABLE_REF_VAL2:
+			oidread(&iter->oid, iter->ref.value.val2.value);
+			break;
+		case REFTABLE_REF_SYMREF:
+			if (!refs_resolve_ref_unsafe(&refs->base, iter->ref.refname,
+						     RESOLVE_REF_READING,
+						     &iter->oid, &flags))
+				oidclr(&iter->oid);
+			break;
+		default:
+			BUG("unhandled reference value type %d",
+			    iter->ref.value_type);
+		}
+
+		if (is_null_oid(&iter->oid))
+			flags |= REF_ISBROKEN;
+
+		if (check_refname_format(iter->ref.refname, REFNAME_ALLOW_ONELEVEL)) {
+			if (!refname_is_safe(iter->ref.refname))
+				die(_("refname is dangerous: %s"),
+				    iter->ref.refname);
+			oidclr(&iter->oid);
+			flags |= REF_BAD_NAME | REF_ISBROKEN;
+		}
+
+		if (iter->flags & DO_FOR_EACH_OMIT_DANGLING_SYMREFS &&
+		    flags & REF_ISSYMREF && flags & REF_ISBROKEN)
+			continue;
+
+		if (!(iter->flags & DO_FOR_EACH_INCLUDE_BROKEN) &&
+		    !ref_resolves_to_object(iter->ref.refname, refs->base.repo,
+					    &iter->oid, flags))
+			continue;
+
+		iter->base.refname = iter->ref.refname;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		break;
+	}
+
+	if (iter->err > 0) {
+		if (ref_iterator_abort(ref_iterator) != ITER_DONE)
+			return ITER_ERROR;
+		return ITER_DONE;
+	}
+
+	if (iter->err < 0) {
+		ref_iterator_abort(ref_iterator);
+		return ITER_ERROR;
+	}
+
+	return ITER_OK;
+}
+
+static int reftable_ref_iterator_peel(struct ref_iterator *ref_iterator,
+				      struct object_id *peeled)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	if (iter->ref.value_type == REFTABLE_REF_VAL2) {
+		oidread(peeled, iter->ref.value.val2.target_value);
+		return 0;
+	}
+
+	return peel_object(&iter->oid, peeled) ? -1 : 0;
+}
+
+static int reftable_ref_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	reftable_ref_record_release(&iter->ref);
+	reftable_iterator_destroy(&iter->iter);
+	iter->refs->iterators_active--;
+	free(iter->prefix);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_ref_iterator_vtable = {
+	.advance = reftable_ref_iterator_advance,
+	.peel = reftable_ref_iterator_peel,
+	.abort = reftable_ref_iterator_abort
+};
+
+static struct ref_iterator *ref_iterator_for_stack(struct reftable_ref_store *refs,
+						   struct reftable_stack *stack,
+						   const char *prefix,
+						   unsigned int flags,
+						   int err)
+{
+	struct reftable_ref_iterator *iter;
+
+	CALLOC_ARRAY(iter, 1);
+	base_ref_iterator_init(&iter->base, &reftable_ref_iterator_vtable, 1);
+	iter->base.oid = &iter->oid;
+	iter->refs = refs;
+	iter->prefix = xstrdup(prefix);
+	iter->prefix_len = strlen(prefix);
+	iter->flags = flags;
+	refs->iterators_active++;
+
+	if (!err)
+		err = reftable_merged_table_seek_ref(reftable_stack_merged_table(stack),
+						     &iter->iter, prefix);
+	iter->err = err;
+
+	return &iter->base;
+}
+
+static struct ref_iterator *reftable_be_iterator_begin(struct ref_store *ref_store,
+						       const char *prefix,
+						       unsigned int flags)
+{
+	struct ref_iterator *main_iter, *worktree_iter;
+	struct reftable_ref_store *refs;
+	unsigned int required_flags = REF_STORE_READ;
+	int err;
+
+	if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN))
+		required_flags |= REF_STORE_ODB;
+	refs = reftable_be_downcast(ref_store, required_flags, "ref_iterator_begin");
+
+	err = reload_for_iteration(refs);
+	main_iter = ref_iterator_for_stack(refs, refs->main_backend.stack,
+					   prefix, flags, err);
+	if (!refs->worktree_backend)
+		return main_iter;
+
+	worktree_iter = ref_iterator_for_stack(refs, refs->worktree_backend->stack,
+					       prefix, flags, err);
+	return merge_ref_iterator_begin(1, worktree_iter, main_iter,
+					iterator_select, NULL);
+}
+
+/*
+ * Per-update state of a transaction: the refname as stored in its stack
+ * and the value the ref had when the transaction was prepared.
+ */
+struct reftable_update_data {
+	const char *refname;
+	struct object_id current_oid;
+};
+
+struct write_transaction_table_arg {
+	struct reftable_ref_store *refs;
+	struct reftable_backend *be;
+	struct reftable_addition *addition;
+	struct ref_update **updates;
+	size_t updates_nr;
+	size_t updates_alloc;
+};
+
+struct reftable_transaction_data {
+	struct write_transaction_table_arg *args;
+	size_t args_nr, args_alloc;
+};
+
+static void free_transaction_data(struct ref_transaction *transaction)
+{
+	struct reftable_transaction_data *tx_data = transaction->backend_data;
+	size_t i;
+
+	for (i = 0; i < transaction->nr; i++)
+		FREE_AND_NULL(transaction->updates[i]->backend_data);
+
+	if (!tx_data)
+		return;
+	for (i = 0; i < tx_data->args_nr; i++) {
+		reftable_addition_destroy(tx_data->args[i].addition);
+		free(tx_data->args[i].updates);
+	}
+	free(tx_data->args);
+	free(tx_data);
+	transaction->backend_data = NULL;
+}
+
+/*
+ * Return the transaction arguments for the stack of `be`, locking the
+ * stack on first use.
+ */
+static int transaction_args_for(struct reftable_ref_store *refs,
+				struct reftable_transaction_data *tx_data,
+				struct reftable_backend *be,
+				struct write_transaction_table_arg **out,
+				struct strbuf *err)
+{
+	struct write_transaction_table_arg *arg;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < tx_data->args_nr; i++) {
+		if (tx_data->args[i].be == be) {
+			*out = &tx_data->args[i];
+			return 0;
+		}
+	}
+
+	ALLOC_GROW(tx_data->args, tx_data->args_nr + 1, tx_data->args_alloc);
+	arg = &tx_data->args[tx_data->args_nr];
+	memset(arg, 0, sizeof(*arg));
+	arg->refs = refs;
+	arg->be = be;
+
+	ret = reftable_be_lock_stack(refs, be, &arg->addition);
+	if (ret) {
+		if (ret == REFTABLE_LOCK_ERROR)
+			strbuf_addf(err, _("cannot lock references in '%s': %s"),
+				    be->dir, reftable_error_str(ret));
+		else
+			strbuf_addf(err, _("reftable: transaction prepare: %s"),
+				    reftable_error_str(ret));
+		return TRANSACTION_GENERIC_ERROR;
+	}
+	tx_data->args_nr++;
+
+	*out = arg;
+	return 0;
+}
+
+/*
+ * Return the refname under which update was originally requested.
+ */
+static const char *original_update_refname(struct ref_update *update)
+{
+	while (update->parent_update)
+		update = update->parent_update;
+
+	return update->refname;
+}
+
+/*
+ * Check whether the REF_HAVE_OLD and old_oid values stored in update
+ * are consistent with oid, which is the reference's current value. If
+ * everything is OK, return 0; otherwise, write an error message to
+ * err and return -1.
+ */
+static int check_old_oid(struct ref_update *update, struct object_id *oid,
+			 struct strbuf *err)
+{
+	if (!(update->flags & REF_HAVE_OLD) ||
+	    oideq(oid, &update->old_oid))
+		return 0;
+
+	if (is_null_oid(&update->old_oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference already exists",
+			    original_update_refname(update));
+	else if (is_null_oid(oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference is missing but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(&update->old_oid));
+	else
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "is at %s but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(oid),
+			    oid_to_hex(&update->old_oid));
+
+	return -1;
+}
+
+static int verify_new_oid(struct reftable_ref_store *refs,
+			  struct ref_update *u, struct strbuf *err)
+{
+	struct object *o;
+
+	if (!(u->flags & REF_HAVE_NEW) || is_null_oid(&u->new_oid) ||
+	    u->flags & (REF_SKIP_OID_VERIFICATION | REF_LOG_ONLY))
+		return 0;
+
+	o = parse_object(refs->base.repo, &u->new_oid);
+	if (!o) {
+		strbuf_addf(err,
+			    "trying to write ref '%s' with nonexistent object %s",
+			    u->refname, oid_to_hex(&u->new_oid));
+		return -1;
+	}
+	if (o->type != OBJ_COMMIT && is_branch(u->refname)) {
+		strbuf_addf(err,
+			    "trying to write non-commit object %s to branch '%s'",
+			    oid_to_hex(&u->new_oid), u->refname);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Read the current value of the ref updated by `u`, split symref and HEAD
+ * updates the same way the files backend does, verify the old value and
+ * queue the update for writing unless it is a no-op.
+ */
+static int prepare_single_update(struct reftable_ref_store *refs,
+				 struct reftable_transaction_data *tx_data,
+				 struct ref_transaction *transaction,
+				 struct ref_update *u,
+				 const char *head_referent,
+				 struct string_list *affected_refnames,
+				 struct strbuf *err)
+{
+	struct reftable_update_data *data = u->backend_data;
+	struct write_transaction_table_arg *arg;
+	struct strbuf referent = STRBUF_INIT;
+	struct ref_update *parent;
+	struct reftable_backend *be;
+	int ret;
+
+	ret = backend_for(&be, refs, u->refname, &data->refname, 0);
+	if (ret) {
+		strbuf_addf(err, _("reftable: transaction prepare: %s"),
+			    reftable_error_str(ret));
+		return TRANSACTION_GENERIC_ERROR;
+	}
+
+	if (verify_new_oid(refs, u, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto done;
+	}
+
+	/*
+	 * When updating the ref HEAD points to directly, also record the
+	 * update in the reflog of HEAD.
+	 */
+	if (head_referent &&
+	    !(u->flags & (REF_LOG_ONLY | REF_UPDATE_VIA_HEAD)) &&
+	    !strcmp(u->refname, head_referent)) {
+		struct ref_update *new_update;
+		struct string_list_item *item;
+
+		if (string_list_has_string(affected_refnames, "HEAD")) {
+			strbuf_addf(err,
+				    "multiple updates for 'HEAD' (including one "
+				    "via its referent '%s') are not allowed",
+				    u->refname);
+			ret = TRANSACTION_NAME_CONFLICT;
+			goto done;
+		}
+
+		new_update = ref_transaction_add_update(
+				transaction, "HEAD",
+				u->flags | REF_LOG_ONLY | REF_NO_DEREF,
+				&u->new_oid, &u->old_oid, u->msg);
+		new_update->backend_data = xcalloc(1, sizeof(*data));
+		item = string_list_insert(affected_refnames, new_update->refname);
+		item->util = new_update;
+	}
+
+	/* Once the stack is locked, our reads are consistent with the write. */
+	ret = transaction_args_for(refs, tx_data, be, &arg, err);
+	if (ret)
+		goto done;
+
+	ret = read_ref_without_reload(be->stack, data->refname,
+				      &data->current_oid, &referent, &u->type);
+	if (ret < 0) {
+		strbuf_addf(err, _("reftable: transaction prepare: %s"),
+			    reftable_error_str(ret));
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto done;
+	}
+
+	if (ret > 0) {
+		ret = 0;
+		oidclr(&data->current_oid);
+
+		if ((u->flags & REF_HAVE_OLD) && !is_null_oid(&u->old_oid)) {
+			strbuf_addf(err, "cannot lock ref '%s': "
+				    "unable to resolve reference '%s'",
+				    original_update_refname(u), u->refname);
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto done;
+		}
+
+		/*
+		 * Report conflicts with existing refs now rather than
+		 * writing a table that shadows them.
+		 */
+		if (refs_verify_refname_available(&refs->base, u->refname,
+						  affected_refnames, NULL, err)) {
+			ret = TRANSACTION_NAME_CONFLICT;
+			goto done;
+		}
+	} else if (u->type & REF_ISSYMREF) {
+		if (u->flags & REF_NO_DEREF) {
+			/*
+			 * We are replacing the symref itself, so record the
+			 * value it resolves to for the reflog and old value
+			 * check.
+			 */
+			if (!refs_resolve_ref_unsafe(&refs->base, referent.buf, 0,
+						     &data->current_oid, NULL)) {
+				oidclr(&data->current_oid);
+				if (u->flags & REF_HAVE_OLD) {
+					strbuf_addf(err, "cannot lock ref '%s': "
+						    "error reading reference",
+						    original_update_refname(u));
+					ret = TRANSACTION_GENERIC_ERROR;
+					goto done;
+				}
+			}
+		} else {
+			struct string_list_item *item;
+			struct ref_update *new_update;
+			unsigned int new_flags = u->flags;
+
+			if (string_list_has_string(affected_refnames, referent.buf)) {
+				strbuf_addf(err,
+					    "multiple updates for '%s' (including one "
+					    "via symref '%s') are not allowed",
+					    referent.buf, u->refname);
+				ret = TRANSACTION_NAME_CONFLICT;
+				goto done;
+			}
+
+			if (!strcmp(u->refname, "HEAD"))
+				new_flags |= REF_UPDATE_VIA_HEAD;
+
+			/*
+			 * Update the referent in a separate update, which
+			 * will be split again when it is a symref, too. The
+			 * symref itself only gets a reflog entry and its old
+			 * value is verified via the referent.
+			 */
+			new_update = ref_transaction_add_update(
+					transaction, referent.buf, new_flags,
+					&u->new_oid, &u->old_oid, u->msg);
+			new_update->parent_update = u;
+			new_update->backend_data = xcalloc(1, sizeof(*data));
+
+			u->flags |= REF_LOG_ONLY | REF_NO_DEREF;
+			u->flags &= ~REF_HAVE_OLD;
+
+			item = string_list_insert(affected_refnames,
+						  new_update->refname);
+			item->util = new_update;
+		}
+	}
+
+	if (check_old_oid(u, &data->current_oid, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto done;
+	}
+
+	/*
+	 * Symref updates that were split up write their reflog entry with
+	 * the old value of the ref they point to.
+	 */
+	if (!(u->type & REF_ISSYMREF)) {
+		for (parent = u->parent_update; parent; parent = parent->parent_update) {
+			struct reftable_update_data *parent_data = parent->backend_data;
+			oidcpy(&parent_data->current_oid, &data->current_oid);
+		}
+	}
+
+	/*
+	 * Updates that leave a regular ref at its current value are no-ops
+	 * and must not produce a reflog entry. Deleting a missing ref still
+	 * has to drop a dangling reflog.
+	 */
+	if ((u->type & REF_ISSYMREF) || (u->flags & REF_LOG_ONLY) ||
+	    ((u->flags & REF_HAVE_NEW) &&
+	     (is_null_oid(&u->new_oid) || !oideq(&data->current_oid, &u->new_oid)))) {
+		ALLOC_GROW(arg->updates, arg->updates_nr + 1, arg->updates_alloc);
+		arg->updates[arg->updates_nr++] = u;
+	}
+
+done:
+	strbuf_release(&referent);
+	return ret;
+}
+
+static int reftable_be_transaction_prepare(struct ref_store *ref_store,
+					   struct ref_transaction *transaction,
+					   struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE | REF_STORE_MAIN,
+				     "ref_transaction_prepare");
+	struct string_list affected_refnames = STRING_LIST_INIT_NODUP;
+	struct reftable_transaction_data *tx_data;
+	char *head_referent = NULL;
+	int head_type;
+	size_t i;
+	int ret = 0;
+
+	CALLOC_ARRAY(tx_data, 1);
+	transaction->backend_data = tx_data;
+
+	if (refs->err) {
+		strbuf_addf(err, _("reftable: transaction prepare: %s"),
+			    reftable_error_str(refs->err));
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto done;
+	}
+
+	/*
+	 * Fail if a refname appears more than once in the transaction.
+	 * Refs added while splitting symref and HEAD updates are checked
+	 * when they are created.
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *u = transaction->updates[i];
+		struct string_list_item *item =
+			string_list_append(&affected_refnames, u->refname);
+
+		item->util = u;
+		u->backend_data = xcalloc(1, sizeof(struct reftable_update_data));
+	}
+	string_list_sort(&affected_refnames);
+	if (ref_update_reject_duplicates(&affected_refnames, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto done;
+	}
+
+	/*
+	 * If HEAD is a symref, record the branch it points to so that direct
+	 * updates of that branch are reflected in HEAD's reflog, too.
+	 */
+	head_referent = refs_resolve_refdup(ref_store, "HEAD",
+					    RESOLVE_REF_NO_RECURSE,
+					    NULL, &head_type);
+	if (head_referent && !(head_type & REF_ISSYMREF))
+		FREE_AND_NULL(head_referent);
+
+	/*
+	 * Note that prepare_single_update() may append updates to the
+	 * transaction, which are processed by this loop, too.
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		ret = prepare_single_update(refs, tx_data, transaction,
+					    transaction->updates[i],
+					    head_referent, &affected_refnames,
+					    err);
+		if (ret)
+			goto done;
+	}
+
+done:
+	if (ret) {
+		free_transaction_data(transaction);
+		transaction->state = REF_TRANSACTION_CLOSED;
+	} else {
+		transaction->state = REF_TRANSACTION_PREPARED;
+	}
+	string_list_clear(&affected_refnames, 0);
+	free(head_referent);
+	return ret;
+}
+
+static int reftable_be_transaction_abort(struct ref_store *ref_store UNUSED,
+					 struct ref_transaction *transaction,
+					 struct strbuf *err UNUSED)
+{
+	free_transaction_data(transaction);
+	transaction->state = REF_TRANSACTION_CLOSED;
+	return 0;
+}
+
+static int transaction_update_cmp(const void *a, const void *b)
+{
+	const struct reftable_update_data *ua = (*(struct ref_update * const *)a)->backend_data;
+	const struct reftable_update_data *ub = (*(struct ref_update * const *)b)->backend_data;
+
+	return strcmp(ua->refname, ub->refname);
+}
+
+static int write_transaction_table(struct reftable_writer *writer, void *cb_data)
+{
+	struct write_transaction_table_arg *arg = cb_data;
+	struct reftable_merged_table *mt =
+		reftable_stack_merged_table(arg->be->stack);
+	uint64_t ts = reftable_stack_next_update_index(arg->be->stack);
+	struct reftable_log_record *logs = NULL;
+	size_t logs_nr = 0, logs_alloc = 0, i;
+	int ret = 0;
+
+	QSORT(arg->updates, arg->updates_nr, transaction_update_cmp);
+
+	reftable_writer_set_limits(writer, ts, ts);
+
+	for (i = 0; i < arg->updates_nr; i++) {
+		struct ref_update *u = arg->updates[i];
+		struct reftable_update_data *data = u->backend_data;
+		struct reftable_ref_record ref = {
+			.refname = (char *)data->refname,
+			.update_index = ts,
+		};
+		struct object_id peeled;
+
+		if (!(u->flags & REF_HAVE_NEW))
+			continue;
+
+		/*
+		 * Deleting a ref also deletes its reflog. Log-only updates of
+		 * a deletion instead record it in the reflog, like for HEAD
+		 * when deleting the branch it points to.
+		 */
+		if (is_null_oid(&u->new_oid) && !(u->flags & REF_LOG_ONLY)) {
+			ref.value_type = REFTABLE_REF_DELETION;
+			ret = reftable_writer_add_ref(writer, &ref);
+			if (ret < 0)
+				goto done;
+			ret = append_reflog_tombstones(mt, data->refname, &logs,
+						       &logs_nr, &logs_alloc);
+			if (ret < 0)
+				goto done;
+			continue;
+		}
+
+		if ((u->flags & REF_FORCE_CREATE_REFLOG) ||
+		    should_write_log(&arg->refs->base, u->refname)) {
+			struct reftable_log_record *log;
+
+			ALLOC_GROW(logs, logs_nr + 1, logs_alloc);
+			log = &logs[logs_nr++];
+			memset(log, 0, sizeof(*log));
+			fill_reftable_log_record(log);
+			log->refname = xstrdup(data->refname);
+			log->update_index = ts;
+			log->value.update.message =
+				reftable_log_message(arg->refs, u->msg);
+			memcpy(log->value.update.new_hash, u->new_oid.hash,
+			       GIT_MAX_RAWSZ);
+			memcpy(log->value.update.old_hash, data->current_oid.hash,
+			       GIT_MAX_RAWSZ);
+		}
+
+		if (u->flags & REF_LOG_ONLY)
+			continue;
+
+		if (peel_object(&u->new_oid, &peeled) == PEEL_PEELED) {
+			ref.value_type = REFTABLE_REF_VAL2;
+			ref.value.val2.value = u->new_oid.hash;
+			ref.value.val2.target_value = peeled.hash;
+		} else {
+			ref.value_type = REFTABLE_REF_VAL1;
+			ref.value.val1 = u->new_oid.hash;
+		}
+
+		ret = reftable_writer_add_ref(writer, &ref);
+		if (ret < 0)
+			goto done;
+	}
+
+	ret = reftable_writer_add_logs(writer, logs, logs_nr);
+
+done:
+	release_log_records(logs, logs_nr);
+	return ret;
+}
+
+static int reftable_be_transaction_finish(struct ref_store *ref_store,
+					  struct ref_transaction *transaction,
+					  struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE,
+				     "ref_transaction_finish");
+	struct reftable_transaction_data *tx_data = transaction->backend_data;
+	size_t i;
+	int ret = 0;
+
+	for (i = 0; i < tx_data->args_nr; i++) {
+		struct write_transaction_table_arg *arg = &tx_data->args[i];
+
+		if (!arg->updates_nr)
+			continue;
+
+		ret = reftable_addition_add(arg->addition,
+					    write_transaction_table, arg);
+		if (ret < 0)
+			goto done;
+
+		ret = reftable_addition_commit(arg->addition);
+		if (ret < 0)
+			goto done;
+
+		ret = reftable_be_auto_compact(refs, arg->be);
+		if (ret < 0)
+			goto done;
+	}
+
+done:
+	free_transaction_data(transaction);
+	transaction->state = REF_TRANSACTION_CLOSED;
+
+	if (ret) {
+		strbuf_addf(err, _("reftable: transaction failure: %s"),
+			    reftable_error_str(ret));
+		return -1;
+	}
+	return 0;
+}
+
+static int reftable_be_initial_transaction_commit(struct ref_store *ref_store,
+						  struct ref_transaction *transaction,
+						  struct strbuf *err)
+{
+	int ret = reftable_be_transaction_prepare(ref_store, transaction, err);
+	if (ret)
+		return ret;
+	return reftable_be_transaction_finish(ref_store, transaction, err);
+}
+
+static int reftable_be_pack_refs(struct ref_store *ref_store, unsigned int flags)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE | REF_STORE_ODB,
+				     "pack_refs");
+	struct reftable_backend *backends[2];
+	size_t i, nr = 0;
+	int ret;
+
+	if (refs->err)
+		return refs->err;
+
+	backends[nr++] = &refs->main_backend;
+	if (refs->worktree_backend)
+		backends[nr++] = refs->worktree_backend;
+
+	/*
+	 * Packing maps to compaction: "--all" merges each stack into a
+	 * single table, otherwise we only restore the geometric sequence
+	 * of table sizes, which is cheap when there is little to do.
+	 */
+	for (i = 0; i < nr; i++) {
+		ret = reftable_stack_reload(backends[i]->stack);
+		if (!ret && (flags & PACK_REFS_ALL))
+			ret = reftable_stack_compact_all(backends[i]->stack, NULL);
+		else if (!ret)
+			ret = reftable_stack_auto_compact(backends[i]->stack);
+		if (ret) {
+			ret = error(_("unable to compact stack: %s"),
+				    reftable_error_str(ret));
+			break;
+		}
+
+		ret = reftable_stack_clean(backends[i]->stack);
+		if (ret)
+			break;
+	}
+
+	return ret;
+}
+
+struct write_create_symref_arg {
+	struct reftable_ref_store *refs;
+	struct reftable_stack *stack;
+	/* The refname as passed by the caller and as stored in the stack. */
+	const char *orig_refname;
+	const char *refname;
+	const char *target;
+	const char *logmsg;
+};
+
+static int write_create_symref_table(struct reftable_writer *writer, void *cb_data)
+{
+	struct write_create_symref_arg *create = cb_data;
+	uint64_t ts = reftable_stack_next_update_index(create->stack);
+	struct reftable_ref_record ref = {
+		.refname = (char *)create->refname,
+		.value_type = REFTABLE_REF_SYMREF,
+		.value.symref = (char *)create->target,
+		.update_index = ts,
+	};
+	struct reftable_log_record log = { 0 };
+	struct object_id new_oid, old_oid;
+	int ret;
+
+	reftable_writer_set_limits(writer, ts, ts);
+
+	/*
+	 * Resolve the old value before the symref is overwritten. Note that
+	 * the reads go through the stack we have locked, so they cannot
+	 * race with other writers.
+	 */
+	if (!refs_resolve_ref_unsafe(&create->refs->base, create->orig_refname,
+				     RESOLVE_REF_READING, &old_oid, NULL))
+		oidclr(&old_oid);
+
+	ret = reftable_writer_add_ref(writer, &ref);
+	if (ret)
+		return ret;
+
+	/*
+	 * Like the files backend, only log when the new target resolves.
+	 * This also means that creating HEAD of a new repository does not
+	 * consult core.logAllRefUpdates yet.
+	 */
+	if (!create->logmsg ||
+	    !refs_resolve_ref_unsafe(&create->refs->base, create->target,
+				     RESOLVE_REF_READING, &new_oid, NULL) ||
+	    !should_write_log(&create->refs->base, create->orig_refname))
+		return 0;
+
+	fill_reftable_log_record(&log);
+	log.refname = xstrdup(create->refname);
+	log.update_index = ts;
+	log.value.update.message = reftable_log_message(create->refs,
+							create->logmsg);
+	memcpy(log.value.update.new_hash, new_oid.hash, GIT_MAX_RAWSZ);
+	memcpy(log.value.update.old_hash, old_oid.hash, GIT_MAX_RAWSZ);
+
+	ret = reftable_writer_add_log(writer, &log);
+	reftable_log_record_release(&log);
+	return ret;
+}
+
+/*
+ * Lock the stack of `be`, write a single table via `write_table` and
+ * commit it. Errors raised by `write_table` via error() are passed
+ * through as -1, reftable errors are reported here.
+ */
+static int write_single_table(struct reftable_ref_store *refs,
+			      struct reftable_backend *be,
+			      int (*write_table)(struct reftable_writer *, void *),
+			      void *arg)
+{
+	struct reftable_addition *add = NULL;
+	int ret;
+
+	ret = reftable_be_lock_stack(refs, be, &add);
+	if (!ret)
+		ret = reftable_addition_add(add, write_table, arg);
+	if (!ret)
+		ret = reftable_addition_commit(add);
+	reftable_addition_destroy(add);
+	if (!ret)
+		ret = reftable_be_auto_compact(refs, be);
+
+	if (ret < -1)
+		ret = error(_("reftable: %s"), reftable_error_str(ret));
+	return ret;
+}
+
+static int reftable_be_create_symref(struct ref_store *ref_store,
+				     const char *refname,
+				     const char *target,
+				     const char *logmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, "create_symref");
+	struct write_create_symref_arg arg = {
+		.refs = refs,
+		.orig_refname = refname,
+		.target = target,
+		.logmsg = logmsg,
+	};
+	struct reftable_backend *be;
+	int ret;
+
+	ret = backend_for(&be, refs, refname, &arg.refname, 0);
+	if (ret)
+		return error(_("unable to write symref for %s: %s"),
+			     refname, reftable_error_str(ret));
+	arg.stack = be->stack;
+
+	ret = write_single_table(refs, be, write_create_symref_table, &arg);
+	if (ret)
+		return error(_("unable to write symref for %s"), refname);
+	return 0;
+}
+
+static int reftable_be_delete_refs(struct ref_store *ref_store,
+				   const char *msg,
+				   struct string_list *refnames,
+				   unsigned int flags)
+{
+	struct ref_transaction *transaction;
+	struct strbuf err = STRBUF_INIT;
+	struct string_list_item *item;
+	int ret = 0, failures = 0;
+
+	if (!refnames->nr)
+		return 0;
+
+	transaction = ref_store_transaction_begin(ref_store, &err);
+	if (!transaction)
+		return error("%s", err.buf);
+
+	for_each_string_list_item(item, refnames) {
+		if (ref_transaction_delete(transaction, item->string, NULL,
+					   flags, msg, &err)) {
+			warning(_("could not delete reference %s: %s"),
+				item->string, err.buf);
+			strbuf_reset(&err);
+			failures = 1;
+		}
+	}
+
+	if (ref_transaction_commit(transaction, &err)) {
+		if (refnames->nr == 1)
+			error(_("could not delete reference %s: %s"),
+			      refnames->items[0].string, err.buf);
+		else
+			error(_("could not delete references: %s"), err.buf);
+		ret = -1;
+	}
+
+	ref_transaction_free(transaction);
+	strbuf_release(&err);
+	return ret || failures ? -1 : 0;
+}
+
+struct write_copy_arg {
+	struct reftable_ref_store *refs;
+	struct reftable_stack *stack;
+	/* The refnames as passed by the caller and as stored in the stack. */
+	const char *orig_oldname, *orig_newname;
+	const char *oldname;
+	const char *newname;
+	const char *logmsg;
+	int delete_old;
+	/* Whether HEAD is stored in the same stack as the refs. */
+	int head_in_stack;
+};
+
+static int write_copy_table(struct reftable_writer *writer, void *cb_data)
+{
+	struct write_copy_arg *arg = cb_data;
+	struct reftable_merged_table *mt = reftable_stack_merged_table(arg->stack);
+	uint64_t ts = reftable_stack_next_update_index(arg->stack);
+	struct reftable_ref_record old_ref = { 0 }, refs[2] = { { 0 } };
+	struct reftable_log_record *logs = NULL, log = { 0 };
+	size_t logs_nr = 0, logs_alloc = 0, copied_nr, i;
+	struct reftable_iterator it = { 0 };
+	struct string_list skip = STRING_LIST_INIT_NODUP;
+	struct strbuf errbuf = STRBUF_INIT;
+	struct object_id old_oid;
+	int ret, log_exists;
+
+	ret = reftable_stack_read_ref(arg->stack, arg->oldname, &old_ref);
+	if (ret) {
+		ret = ret < 0 ? ret : error(_("refname %s not found"), arg->oldname);
+		goto done;
+	}
+	if (old_ref.value_type == REFTABLE_REF_SYMREF) {
+		ret = error(_("refname %s is a symbolic ref, %s it is not supported"),
+			    arg->oldname, arg->delete_old ? "renaming" : "copying");
+		goto done;
+	}
+	oidread(&old_oid, reftable_ref_record_val1(&old_ref));
+
+	if (!strcmp(arg->oldname, arg->newname))
+		goto done;
+
+	/* only a rename frees up the name of the old ref */
+	if (arg->delete_old)
+		string_list_insert(&skip, arg->orig_oldname);
+	if (refs_verify_refname_available(&arg->refs->base, arg->orig_newname,
+					  NULL, &skip, &errbuf)) {
+		ret = error("%s", errbuf.buf);
+		goto done;
+	}
+
+	reftable_writer_set_limits(writer, ts, ts);
+
+	refs[0] = old_ref;
+	refs[0].refname = (char *)arg->newname;
+	refs[0].update_index = ts;
+	if (arg->delete_old) {
+		refs[1].refname = (char *)arg->oldname;
+		refs[1].value_type = REFTABLE_REF_DELETION;
+		refs[1].update_index = ts;
+	}
+	ret = reftable_writer_add_refs(writer, refs, arg->delete_old ? 2 : 1);
+	if (ret < 0)
+		goto done;
+
+	/*
+	 * The new ref takes over the reflog of the old one, newest entry
+	 * first. When renaming, the old reflog goes away.
+	 */
+	log_exists = 0;
+	ret = reftable_merged_table_seek_log(mt, &it, arg->oldname);
+	while (!ret) {
+		ret = reftable_iterator_next_log(&it, &log);
+		if (ret < 0)
+			goto done;
+		if (ret > 0 || strcmp(log.refname, arg->oldname)) {
+			ret = 0;
+			break;
+		}
+		log_exists = 1;
+
+		if (arg->delete_old)
+			append_log_tombstone(&logs, &logs_nr, &logs_alloc,
+					     arg->oldname, log.update_index);
+
+		ALLOC_GROW(logs, logs_nr + 1, logs_alloc);
+		free(log.refname);
+		log.refname = xstrdup(arg->newname);
+		logs[logs_nr++] = log;
+		memset(&log, 0, sizeof(log));
+	}
+	reftable_iterator_destroy(&it);
+	copied_nr = logs_nr;
+
+	/*
+	 * Entries of the new ref's previous reflog are replaced, except for
+	 * those that were just overwritten by a copied entry with the same
+	 * update index.
+	 */
+	ret = reftable_merged_table_seek_log(mt, &it, arg->newname);
+	while (!ret) {
+		int overwritten = 0;
+
+		ret = reftable_iterator_next_log(&it, &log);
+		if (ret < 0)
+			goto done;
+		if (ret > 0 || strcmp(log.refname, arg->newname)) {
+			ret = 0;
+			break;
+		}
+
+		for (i = 0; i < copied_nr && !overwritten; i++)
+			overwritten = !strcmp(logs[i].refname, arg->newname) &&
+				logs[i].update_index == log.update_index;
+		if (!overwritten)
+			append_log_tombstone(&logs, &logs_nr, &logs_alloc,
+					     arg->newname, log.update_index);
+	}
+	reftable_iterator_destroy(&it);
+
+	/*
+	 * Deleting the branch HEAD points to is recorded in the reflog of
+	 * HEAD, like the files backend does when it deletes the old ref.
+	 */
+	if (arg->delete_old && arg->head_in_stack) {
+		struct strbuf head_referent = STRBUF_INIT;
+		struct object_id head_oid;
+		unsigned int head_type = 0;
+
+		if (!read_ref_without_reload(arg->stack, "HEAD", &head_oid,
+					     &head_referent, &head_type) &&
+		    (head_type & REF_ISSYMREF) &&
+		    !strcmp(head_referent.buf, arg->orig_oldname) &&
+		    should_write_log(&arg->refs->base, "HEAD")) {
+			struct reftable_log_record *entry;
+
+			ALLOC_GROW(logs, logs_nr + 1, logs_alloc);
+			entry = &logs[logs_nr++];
+			memset(entry, 0, sizeof(*entry));
+			fill_reftable_log_record(entry);
+			entry->refname = xstrdup("HEAD");
+			entry->update_index = ts;
+			entry->value.update.message =
+				reftable_log_message(arg->refs, arg->logmsg);
+			memcpy(entry->value.update.old_hash, old_oid.hash, GIT_MAX_RAWSZ);
+		}
+		strbuf_release(&head_referent);
+	}
+
+	if (log_exists || should_write_log(&arg->refs->base, arg->orig_newname)) {
+		struct reftable_log_record *entry;
+
+		ALLOC_GROW(logs, logs_nr + 1, logs_alloc);
+		entry = &logs[logs_nr++];
+		memset(entry, 0, sizeof(*entry));
+		fill_reftable_log_record(entry);
+		entry->refname = xstrdup(arg->newname);
+		entry->update_index = ts;
+		entry->value.update.message = reftable_log_message(arg->refs,
+								   arg->logmsg);
+		/* like the files backend, log the carried-over value as both sides */
+		memcpy(entry->value.update.old_hash, old_oid.hash, GIT_MAX_RAWSZ);
+		memcpy(entry->value.update.new_hash, old_oid.hash, GIT_MAX_RAWSZ);
+	}
+
+	ret = reftable_writer_add_logs(writer, logs, logs_nr);
+
+done:
+	reftable_iterator_destroy(&it);
+	reftable_ref_record_release(&old_ref);
+	reftable_log_record_release(&log);
+	release_log_records(logs, logs_nr);
+	string_list_clear(&skip, 0);
+	strbuf_release(&errbuf);
+	return ret;
+}
+
+static int reftable_be_copy_or_rename_ref(struct ref_store *ref_store,
+					  const char *oldrefname,
+					  const char *newrefname,
+					  const char *logmsg,
+					  int delete_old,
+					  const char *caller)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, caller);
+	struct write_copy_arg arg = {
+		.refs = refs,
+		.orig_oldname = oldrefname,
+		.orig_newname = newrefname,
+		.logmsg = logmsg,
+		.delete_old = delete_old,
+	};
+	struct reftable_backend *be, *new_be, *head_be;
+	const char *head_name;
+	int ret;
+
+	ret = backend_for(&be, refs, oldrefname, &arg.oldname, 0);
+	if (!ret)
+		ret = backend_for(&new_be, refs, newrefname, &arg.newname, 0);
+	if (!ret)
+		ret = backend_for(&head_be, refs, "HEAD", &head_name, 0);
+	if (ret)
+		return error(_("reftable: %s"), reftable_error_str(ret));
+	if (be != new_be)
+		return error(_("cannot %s '%s' to '%s': refs are stored separately"),
+			     delete_old ? "rename" : "copy", oldrefname, newrefname);
+	arg.stack = be->stack;
+	arg.head_in_stack = head_be == be;
+
+	return write_single_table(refs, be, write_copy_table, &arg);
+}
+
+static int reftable_be_rename_ref(struct ref_store *ref_store,
+				  const char *oldrefname,
+				  const char *newrefname,
+				  const char *logmsg)
+{
+	return reftable_be_copy_or_rename_ref(ref_store, oldrefname, newrefname,
+					      logmsg, 1, "rename_ref");
+}
+
+static int reftable_be_copy_ref(struct ref_store *ref_store,
+				const char *oldrefname,
+				const char *newrefname,
+				const char *logmsg)
+{
+	return reftable_be_copy_or_rename_ref(ref_store, oldrefname, newrefname,
+					      logmsg, 0, "copy_ref");
+}
+
+struct reftable_reflog_iterator {
+	struct ref_iterator base;
+	struct reftable_ref_store *refs;
+	struct reftable_iterator iter;
+	struct reftable_log_record log;
+	char *last_name;
+	struct object_id oid;
+	int err;
+};
+
+static int reftable_reflog_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	while (!iter->err) {
+		int flags;
+
+		iter->err = reftable_iterator_next_log(&iter->iter, &iter->log);
+		if (iter->err)
+			break;
+
+		/*
+		 * Log records of a ref are stored next to each other, so we
+		 * only need to remember the last refname we have yielded.
+		 */
+		if (iter->last_name && !strcmp(iter->log.refname, iter->last_name))
+			continue;
+
+		if (!refs_resolve_ref_unsafe(&iter->refs->base, iter->log.refname,
+					     0, &iter->oid, &flags)) {
+			error(_("bad ref for %s"), iter->log.refname);
+			continue;
+		}
+
+		free(iter->last_name);
+		iter->last_name = xstrdup(iter->log.refname);
+		iter->base.refname = iter->last_name;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		break;
+	}
+
+	if (iter->err > 0) {
+		if (ref_iterator_abort(ref_iterator) != ITER_DONE)
+			return ITER_ERROR;
+		return ITER_DONE;
+	}
+
+	if (iter->err < 0) {
+		ref_iterator_abort(ref_iterator);
+		return ITER_ERROR;
+	}
+
+	return ITER_OK;
+}
+
+static int reftable_reflog_iterator_peel(struct ref_iterator *ref_iterator UNUSED,
+					 struct object_id *peeled UNUSED)
+{
+	BUG("reftable reflog iterator cannot be peeled");
+	return -1;
+}
+
+static int reftable_reflog_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	reftable_log_record_release(&iter->log);
+	reftable_iterator_destroy(&iter->iter);
+	iter->refs->iterators_active--;
+	free(iter->last_name);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_reflog_iterator_vtable = {
+	.advance = reftable_reflog_iterator_advance,
+	.peel = reftable_reflog_iterator_peel,
+	.abort = reftable_reflog_iterator_abort
+};
+
+static struct ref_iterator *reflog_iterator_for_stack(struct reftable_ref_store *refs,
+						      struct reftable_stack *stack,
+						      int err)
+{
+	struct reftable_reflog_iterator *iter;
+
+	CALLOC_ARRAY(iter, 1);
+	base_ref_iterator_init(&iter->base, &reftable_reflog_iterator_vtable, 1);
+	iter->refs = refs;
+	iter->base.oid = &iter->oid;
+	refs->iterators_active++;
+
+	if (!err)
+		err = reftable_merged_table_seek_log(reftable_stack_merged_table(stack),
+						     &iter->iter, "");
+	iter->err = err;
+
+	return &iter->base;
+}
+
+static struct ref_iterator *reftable_be_reflog_iterator_begin(struct ref_store *ref_store)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_READ, "reflog_iterator_begin");
+	struct ref_iterator *main_iter, *worktree_iter;
+	int err;
+
+	err = reload_for_iteration(refs);
+	main_iter = reflog_iterator_for_stack(refs, refs->main_backend.stack, err);
+	if (!refs->worktree_backend)
+		return main_iter;
+
+	worktree_iter = reflog_iterator_for_stack(refs, refs->worktree_backend->stack,
+						  err);
+	return merge_ref_iterator_begin(1, worktree_iter, main_iter,
+					iterator_select, NULL);
+}
+
+/*
+ * Reflogs that exist but have no entries are represented by a single
+ * record with null old and new object IDs, which callers never see.
+ */
+static int is_reflog_placeholder(struct reftable_log_record *log, int hash_size)
+{
+	static const uint8_t null_hash[GIT_MAX_RAWSZ];
+
+	return !memcmp(log->value.update.old_hash, null_hash, hash_size) &&
+		!memcmp(log->value.update.new_hash, null_hash, hash_size);
+}
+
+static int yield_log_record(struct reftable_log_record *log,
+			    each_reflog_ent_fn fn,
+			    void *cb_data)
+{
+	struct strbuf committer = STRBUF_INIT;
+	struct object_id old_oid, new_oid;
+	int ret;
+
+	if (is_reflog_placeholder(log, the_hash_algo->rawsz))
+		return 0;
+
+	oidread(&old_oid, log->value.update.old_hash);
+	oidread(&new_oid, log->value.update.new_hash);
+	strbuf_addf(&committer, "%s <%s>", log->value.update.name,
+		    log->value.update.email);
+
+	ret = fn(&old_oid, &new_oid, committer.buf, log->value.update.time,
+		 log->value.update.tz_offset,
+		 log->value.update.message ? log->value.update.message : "",
+		 cb_data);
+
+	strbuf_release(&committer);
+	return ret;
+}
+
+/*
+ * Read all reflog entries of `refname`, newest first. Returns 0 on
+ * success, 1 if there is no reflog at all and a reftable error code
+ * otherwise. Placeholder records are included.
+ */
+static int read_reflog(struct reftable_stack *stack, const char *refname,
+		       struct reftable_log_record **logs, size_t *logs_nr)
+{
+	struct reftable_merged_table *mt = reftable_stack_merged_table(stack);
+	struct reftable_log_record log = { 0 };
+	struct reftable_iterator it = { 0 };
+	size_t logs_alloc = 0;
+	int ret;
+
+	*logs = NULL;
+	*logs_nr = 0;
+
+	ret = reftable_merged_table_seek_log(mt, &it, refname);
+	while (!ret) {
+		ret = reftable_iterator_next_log(&it, &log);
+		if (ret)
+			break;
+		if (strcmp(log.refname, refname)) {
+			ret = 1;
+			break;
+		}
+
+		ALLOC_GROW(*logs, *logs_nr + 1, logs_alloc);
+		(*logs)[(*logs_nr)++] = log;
+		memset(&log, 0, sizeof(log));
+	}
+
+	reftable_log_record_release(&log);
+	reftable_iterator_destroy(&it);
+	if (ret > 0)
+		ret = *logs_nr ? 0 : 1;
+	return ret;
+}
+
+static int reftable_be_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+						   const char *refname,
+						   each_reflog_ent_fn fn,
+						   void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_READ, "for_each_reflog_ent_reverse");
+	struct reftable_log_record log = { 0 };
+	struct reftable_iterator it = { 0 };
+	struct reftable_backend *be;
+	int ret, found = 0;
+
+	ret = backend_for(&be, refs, refname, &refname, 1);
+	if (ret)
+		return ret;
+
+	/* The callback may read refs, which must not reload the stack. */
+	refs->iterators_active++;
+
+	ret = reftable_merged_table_seek_log(reftable_stack_merged_table(be->stack),
+					     &it, refname);
+	while (!ret) {
+		ret = reftable_iterator_next_log(&it, &log);
+		if (ret < 0)
+			break;
+		if (ret > 0 || strcmp(log.refname, refname)) {
+			ret = 0;
+			break;
+		}
+
+		found = 1;
+		ret = yield_log_record(&log, fn, cb_data);
+	}
+
+	reftable_log_record_release(&log);
+	reftable_iterator_destroy(&it);
+	refs->iterators_active--;
+
+	/* Like a missing reflog file in the files backend. */
+	if (!ret && !found)
+		return -1;
+	return ret;
+}
+
+static int reftable_be_for_each_reflog_ent(struct ref_store *ref_store,
+					   const char *refname,
+					   each_reflog_ent_fn fn,
+					   void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_READ, "for_each_reflog_ent");
+	struct reftable_log_record *logs;
+	struct reftable_backend *be;
+	size_t logs_nr, i;
+	int ret;
+
+	ret = backend_for(&be, refs, refname, &refname, 1);
+	if (ret)
+		return ret;
+
+	ret = read_reflog(be->stack, refname, &logs, &logs_nr);
+	if (ret > 0)
+		return -1;
+
+	for (i = logs_nr; !ret && i > 0; i--)
+		ret = yield_log_record(&logs[i - 1], fn, cb_data);
+
+	release_log_records(logs, logs_nr);
+	return ret;
+}
+
+static int reftable_be_reflog_exists(struct ref_store *ref_store,
+				     const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_READ, "reflog_exists");
+	struct reftable_log_record log = { 0 };
+	struct reftable_iterator it = { 0 };
+	struct reftable_backend *be;
+	int ret;
+
+	ret = backend_for(&be, refs, refname, &refname, 1);
+	if (ret)
+		return 0;
+
+	ret = reftable_merged_table_seek_log(reftable_stack_merged_table(be->stack),
+					     &it, refname);
+	if (!ret)
+		ret = reftable_iterator_next_log(&it, &log);
+	ret = !ret && !strcmp(log.refname, refname);
+
+	reftable_log_record_release(&log);
+	reftable_iterator_destroy(&it);
+	return ret;
+}
+
+struct write_reflog_existence_arg {
+	struct reftable_ref_store *refs;
+	struct reftable_stack *stack;
+	const char *refname;
+};
+
+static int write_reflog_existence_table(struct reftable_writer *writer,
+					void *cb_data)
+{
+	struct write_reflog_existence_arg *arg = cb_data;
+	uint64_t ts = reftable_stack_next_update_index(arg->stack);
+	struct reftable_log_record log = { 0 };
+	int ret;
+
+	ret = reftable_stack_read_log(arg->stack, arg->refname, &log);
+	if (ret <= 0)
+		goto done;
+
+	reftable_writer_set_limits(writer, ts, ts);
+
+	/*
+	 * The existence of a reflog without entries is recorded as an entry
+	 * with null object IDs.
+	 */
+	fill_reftable_log_record(&log);
+	log.refname = xstrdup(arg->refname);
+	log.update_index = ts;
+	ret = reftable_writer_add_log(writer, &log);
+
+done:
+	reftable_log_record_release(&log);
+	return ret;
+}
+
+static int reftable_be_create_reflog(struct ref_store *ref_store,
+				     const char *refname,
+				     struct strbuf *errmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, "create_reflog");
+	struct write_reflog_existence_arg arg = {
+		.refs = refs,
+	};
+	struct reftable_backend *be;
+	int ret;
+
+	ret = backend_for(&be, refs, refname, &arg.refname, 1);
+	if (!ret) {
+		arg.stack = be->stack;
+		ret = write_single_table(refs, be, write_reflog_existence_table, &arg);
+	}
+	if (ret) {
+		strbuf_addf(errmsg, _("unable to create reflog for '%s'"), refname);
+		return -1;
+	}
+	return 0;
+}
+
+struct write_reflog_delete_arg {
+	struct reftable_stack *stack;
+	const char *refname;
+};
+
+static int write_reflog_delete_table(struct reftable_writer *writer, void *cb_data)
+{
+	struct write_reflog_delete_arg *arg = cb_data;
+	struct reftable_log_record *logs = NULL;
+	size_t logs_nr = 0, logs_alloc = 0;
+	uint64_t ts = reftable_stack_next_update_index(arg->stack);
+	int ret;
+
+	reftable_writer_set_limits(writer, ts, ts);
+
+	ret = append_reflog_tombstones(reftable_stack_merged_table(arg->stack),
+				       arg->refname, &logs, &logs_nr, &logs_alloc);
+	if (!ret)
+		ret = reftable_writer_add_logs(writer, logs, logs_nr);
+
+	release_log_records(logs, logs_nr);
+	return ret;
+}
+
+static int reftable_be_delete_reflog(struct ref_store *ref_store,
+				     const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, "delete_reflog");
+	struct write_reflog_delete_arg arg = { 0 };
+	struct reftable_backend *be;
+	int ret;
+
+	ret = backend_for(&be, refs, refname, &arg.refname, 1);
+	if (ret)
+		return error(_("reftable: %s"), reftable_error_str(ret));
+	arg.stack = be->stack;
+
+	return write_single_table(refs, be, write_reflog_delete_table, &arg);
+}
+
+struct reflog_expiry_arg {
+	struct reftable_ref_store *refs;
+	struct reftable_stack *stack;
+	const char *refname;
+	struct reftable_log_record *logs;
+	size_t logs_nr;
+	/* Set on records that need to be written, i.e. changed ones. */
+	unsigned char *dirty;
+	struct object_id update_oid;
+	int update_ref;
+	int write_placeholder;
+};
+
+static void turn_into_tombstone(struct reftable_log_record *log)
+{
+	char *refname = log->refname;
+	uint64_t update_index = log->update_index;
+
+	log->refname = NULL;
+	reftable_log_record_release(log);
+	log->refname = refname;
+	log->update_index = update_index;
+	log->value_type = REFTABLE_LOG_DELETION;
+}
+
+static int write_reflog_expiry_table(struct reftable_writer *writer, void *cb_data)
+{
+	struct reflog_expiry_arg *arg = cb_data;
+	uint64_t ts = reftable_stack_next_update_index(arg->stack);
+	struct reftable_log_record placeholder = { 0 };
+	size_t i;
+	int ret;
+
+	reftable_writer_set_limits(writer, ts, ts);
+
+	if (arg->update_ref) {
+		struct reftable_ref_record ref = {
+			.refname = (char *)arg->refname,
+			.value_type = REFTABLE_REF_VAL1,
+			.value.val1 = arg->update_oid.hash,
+			.update_index = ts,
+		};
+		struct object_id peeled;
+
+		if (peel_object(&arg->update_oid, &peeled) == PEEL_PEELED) {
+			ref.value_type = REFTABLE_REF_VAL2;
+			ref.value.val2.value = arg->update_oid.hash;
+			ref.value.val2.target_value = peeled.hash;
+		}
+
+		ret = reftable_writer_add_ref(writer, &ref);
+		if (ret < 0)
+			return ret;
+	}
+
+	/*
+	 * Records are ordered newest first, which is also the order the
+	 * writer expects for records of the same ref.
+	 */
+	if (arg->write_placeholder) {
+		fill_reftable_log_record(&placeholder);
+		placeholder.refname = xstrdup(arg->refname);
+		placeholder.update_index = ts;
+		ret = reftable_writer_add_log(writer, &placeholder);
+		reftable_log_record_release(&placeholder);
+		if (ret < 0)
+			return ret;
+	}
+
+	for (i = 0; i < arg->logs_nr; i++) {
+		if (!arg->dirty[i])
+			continue;
+		ret = reftable_writer_add_log(writer, &arg->logs[i]);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int reftable_be_reflog_expire(struct ref_store *ref_store,
+				     const char *refname,
+				     unsigned int flags,
+				     reflog_expiry_prepare_fn prepare_fn,
+				     reflog_expiry_should_prune_fn should_prune_fn,
+				     reflog_expiry_cleanup_fn cleanup_fn,
+				     void *policy_cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, "reflog_expire");
+	struct reflog_expiry_arg arg = {
+		.refs = refs,
+	};
+	struct reftable_addition *add = NULL;
+	struct object_id oid, last_kept_oid;
+	struct strbuf committer = STRBUF_INIT;
+	struct reftable_backend *be;
+	size_t i, live = 0;
+	int hash_size = the_hash_algo->rawsz;
+	int ret, type;
+
+	ret = backend_for(&be, refs, refname, &arg.refname, 1);
+	if (ret)
+		goto done;
+	arg.stack = be->stack;
+
+	/*
+	 * Hold the lock while reading the reflog and consulting the policy,
+	 * so that nobody can add entries that we would then drop.
+	 */
+	ret = reftable_be_lock_stack(refs, be, &add);
+	if (ret)
+		goto done;
+
+	ret = read_reflog(be->stack, arg.refname, &arg.logs, &arg.logs_nr);
+	if (ret > 0) {
+		/* Somebody deleted the reflog, so there is nothing to do. */
+		ret = 0;
+		goto done;
+	}
+	if (ret < 0)
+		goto done;
+	CALLOC_ARRAY(arg.dirty, arg.logs_nr);
+
+	if (!refs_resolve_ref_unsafe(ref_store, refname, 0, &oid, NULL))
+		oidclr(&oid);
+	prepare_fn(refname, &oid, policy_cb_data);
+
+	/*
+	 * The policy is applied from oldest to newest entry, with the old
+	 * object ID optionally rewritten to the last entry that was kept.
+	 */
+	oidclr(&last_kept_oid);
+	for (i = arg.logs_nr; i > 0; i--) {
+		struct reftable_log_record *log = &arg.logs[i - 1];
+		struct object_id old_oid, new_oid;
+
+		if (is_reflog_placeholder(log, hash_size)) {
+			/* Superseded by the real entries or rewritten below. */
+			continue;
+		}
+
+		oidread(&old_oid, log->value.update.old_hash);
+		oidread(&new_oid, log->value.update.new_hash);
+		if (flags & EXPIRE_REFLOGS_REWRITE)
+			oidcpy(&old_oid, &last_kept_oid);
+
+		strbuf_reset(&committer);
+		strbuf_addf(&committer, "%s <%s>", log->value.update.name,
+			    log->value.update.email);
+
+		if (should_prune_fn(&old_oid, &new_oid, committer.buf,
+				    log->value.update.time,
+				    log->value.update.tz_offset,
+				    log->value.update.message ?
+				    log->value.update.message : "",
+				    policy_cb_data)) {
+			turn_into_tombstone(log);
+			arg.dirty[i - 1] = 1;
+			continue;
+		}
+
+		if (memcmp(log->value.update.old_hash, old_oid.hash, hash_size)) {
+			memcpy(log->value.update.old_hash, old_oid.hash, hash_size);
+			arg.dirty[i - 1] = 1;
+		}
+		oidcpy(&last_kept_oid, &new_oid);
+		live++;
+	}
+	cleanup_fn(policy_cb_data);
+
+	/*
+	 * Placeholders only exist to keep an empty reflog alive. Drop them
+	 * once there are real entries, and keep exactly one otherwise.
+	 */
+	for (i = 0; i < arg.logs_nr; i++) {
+		struct reftable_log_record *log = &arg.logs[i];
+
+		if (log->value_type != REFTABLE_LOG_UPDATE ||
+		    !is_reflog_placeholder(log, hash_size))
+			continue;
+		if (!live && !arg.write_placeholder) {
+			/* Reuse the existing placeholder. */
+			arg.write_placeholder = -1;
+			continue;
+		}
+		turn_into_tombstone(log);
+		arg.dirty[i] = 1;
+	}
+	if (!live && !arg.write_placeholder)
+		arg.write_placeholder = 1;
+	else if (arg.write_placeholder < 0)
+		arg.write_placeholder = 0;
+
+	if ((flags & EXPIRE_REFLOGS_UPDATE_REF) && !is_null_oid(&last_kept_oid) &&
+	    refs_resolve_ref_unsafe(ref_store, refname, RESOLVE_REF_NO_RECURSE,
+				    NULL, &type) &&
+	    !(type & REF_ISSYMREF)) {
+		arg.update_ref = 1;
+		oidcpy(&arg.update_oid, &last_kept_oid);
+	}
+
+	if (flags & EXPIRE_REFLOGS_DRY_RUN)
+		goto done;
+
+	ret = reftable_addition_add(add, write_reflog_expiry_table, &arg);
+	if (!ret)
+		ret = reftable_addition_commit(add);
+
+done:
+	reftable_addition_destroy(add);
+	release_log_records(arg.logs, arg.logs_nr);
+	free(arg.dirty);
+	strbuf_release(&committer);
+	if (ret < 0)
+		return error(_("unable to expire reflog of '%s': %s"), refname,
+			     reftable_error_str(ret));
+	return ret;
+}
+
+struct ref_storage_be refs_be_reftable = {
+	.next = NULL,
+	.name = "reftable",
+	.init = reftable_be_init,
+	.init_db = reftable_be_init_db,
+	.transaction_prepare = reftable_be_transaction_prepare,
+	.transaction_finish = reftable_be_transaction_finish,
+	.transaction_abort = reftable_be_transaction_abort,
+	.initial_transaction_commit = reftable_be_initial_transaction_commit,
+
+	.pack_refs = reftable_be_pack_refs,
+	.create_symref = reftable_be_create_symref,
+	.delete_refs = reftable_be_delete_refs,
+	.rename_ref = reftable_be_rename_ref,
+	.copy_ref = reftable_be_copy_ref,
+
+	.iterator_begin = reftable_be_iterator_begin,
+	.read_raw_ref = reftable_be_read_raw_ref,
+	.read_symbolic_ref = reftable_be_read_symbolic_ref,
+
+	.reflog_iterator_begin = reftable_be_reflog_iterator_begin,
+	.for_each_reflog_ent = reftable_be_for_each_reflog_ent,
+	.for_each_reflog_ent_reverse = reftable_be_for_each_reflog_ent_reverse,
+	.reflog_exists = reftable_be_reflog_exists,
+	.create_reflog = reftable_be_create_reflog,
+	.delete_reflog = reftable_be_delete_reflog,
+	.reflog_expire = reftable_be_reflog_expire,
+};
@@ -383,6 +383,41 @@ static void test_reftable_stack_lock_failure(void)
 	clear_dir(dir);
 }
 
+static void test_reftable_stack_lock_held(void)
+{
+	char *dir = get_tmp_dir(__LINE__);
+	struct reftable_write_options cfg = { 0 };
+	struct reftable_stack *st1 = NULL, *st2 = NULL;
+	struct reftable_addition *add1 = NULL, *add2 = NULL;
+	struct strbuf lock_name = STRBUF_INIT;
+	struct stat st;
+	int err;
+
+	err = reftable_new_stack(&st1, dir, cfg);
+	EXPECT_ERR(err);
+	err = reftable_new_stack(&st2, dir, cfg);
+	EXPECT_ERR(err);
+
+	err = reftable_stack_new_addition(&add1, st1);
+	EXPECT_ERR(err);
+
+	/* failing to take the lock must leave the holder's lock alone */
+	err = reftable_stack_new_addition(&add2, st2);
+	EXPECT(err == REFTABLE_LOCK_ERROR);
+	strbuf_addf(&lock_name, "%s/tables.list.lock", dir);
+	EXPECT(!stat(lock_name.buf, &st));
+	err = reftable_stack_new_addition(&add2, st2);
+	EXPECT(err == REFTABLE_LOCK_ERROR);
+
+	reftable_addition_destroy(add1);
+	EXPECT(stat(lock_name.buf, &st) < 0);
+
+	strbuf_release(&lock_name);
+	reftable_stack_destroy(st1);
+	reftable_stack_destroy(st2);
+	clear_dir(dir);
+}
+
 static void test_reftable_stack_add(void)
 {
 	int i = 0;
@@ -964,6 +999,7 @@ int stack_test_main(int argc, const char *argv[])
 	RUN_TEST(test_reftable_stack_compaction_concurrent_clean);
 	RUN_TEST(test_reftable_stack_hash_id);
 	RUN_TEST(test_reftable_stack_lock_failure);
+	RUN_TEST(test_reftable_stack_lock_held);
 	RUN_TEST(test_reftable_stack_log_normalize);
 	RUN_TEST(test_reftable_stack_tombstone);
 	RUN_TEST(test_reftable_stack_transaction_api);
@@ -13,6 +13,7 @@ license that can be found in the LICENSE file or at
 
 #include "git-compat-util.h"
 #include "strbuf.h"
+#include "tempfile.h"
 #include "hash.h" /* hash ID, sizes.*/
 #include "dir.h" /* remove_dir_recursively, for tests.*/
 
@@ -205,6 +205,7 @@ int convert_to_sparse(struct index_state *istate, int flags)
 	}
 
 	remove_fsmonitor(istate);
+	free_name_hash_snapshot(istate);
 
 	trace2_region_enter("index", "convert_to_sparse", istate->repo);
 	istate->cache_nr = convert_to_sparse_rec(istate,
@@ -409,6 +410,7 @@ void expand_index(struct index_state *istate, struct pattern_list *pl)
 	istate->cache_nr = full->cache_nr;
 	istate->cache_alloc = full->cache_alloc;
 	istate->fsmonitor_has_run_once = 0;
+	free_name_hash_snapshot(istate);
 	FREE_AND_NULL(istate->fsmonitor_dirty);
 	FREE_AND_NULL(istate->fsmonitor_last_update);
 
@@ -0,0 +1,104 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "delta.h"
+#include "object-store.h"
+#include "parse-options.h"
+
+struct delta_pair {
+	void *base, *target;
+	unsigned long base_size, target_size;
+};
+
+static void *read_blob(const char *hex, unsigned long *size)
+{
+	struct object_id oid;
+	enum object_type type;
+	void *buf;
+
+	if (get_oid_hex(hex, &oid))
+		die("not an object id: %s", hex);
+	buf = read_object_file(&oid, &type, size);
+	if (!buf)
+		die("unable to read %s", hex);
+	return buf;
+}
+
+/*
+ * Read "<base> <target>" object id pairs from stdin and time how long it
+ * takes to create a delta index for each base and a delta of the target
+ * against it, as pack-objects does in try_delta().  Loading the objects
+ * is not part of the timing.
+ */
+int cmd__delta_speed(int argc, const char **argv)
+{
+	struct delta_pair *pairs = NULL;
+	size_t nr = 0, alloc = 0, i;
+	struct strbuf line = STRBUF_INIT;
+	uint64_t start, elapsed;
+	uintmax_t input = 0, output = 0;
+	int rounds = 1, round;
+	const char * const usage[] = {
+		"test-tool delta-speed [--rounds=<n>] <pairs",
+		NULL
+	};
+	struct option options[] = {
+		OPT_INTEGER(0, "rounds", &rounds,
+			    "how often to delta every pair"),
+		OPT_END()
+	};
+
+	argc = parse_options(argc, argv, NULL, options, usage, 0);
+	if (argc || rounds < 1)
+		usage_with_options(usage, options);
+
+	setup_git_directory();
+
+	while (strbuf_getline(&line, stdin) != EOF) {
+		struct delta_pair *p;
+		char *sp = strchr(line.buf, ' ');
+
+		if (!sp)
+			die("expected '<base> <target>': %s", line.buf);
+		*sp++ = '\0';
+
+		ALLOC_GROW(pairs, nr + 1, alloc);
+		p = &pairs[nr++];
+		p->base = read_blob(line.buf, &p->base_size);
+		p->target = read_blob(sp, &p->target_size);
+	}
+	strbuf_release(&line);
+
+	start = getnanotime();
+	for (round = 0; round < rounds; round++) {
+		for (i = 0; i < nr; i++) {
+			struct delta_pair *p = &pairs[i];
+			struct delta_index *index;
+			unsigned long delta_size = 0;
+			void *delta;
+
+			index = create_delta_index(p->base, p->base_size);
+			delta = index ? create_delta(index, p->target,
+						     p->target_size,
+						     &delta_size, 0) : NULL;
+
+			input += p->target_size;
+			output += delta_size;
+			free(delta);
+			free_delta_index(index);
+		}
+	}
+	elapsed = getnanotime() - start;
+
+	printf("pairs: %"PRIuMAX"\n", (uintmax_t)nr);
+	printf("rounds: %d\n", rounds);
+	printf("target bytes: %"PRIuMAX"\n", input);
+	printf("delta bytes: %"PRIuMAX"\n", output);
+	printf("time: %.3f s\n", elapsed / 1e9);
+
+	for (i = 0; i < nr; i++) {
+		free(pairs[i].base);
+		free(pairs[i].target);
+	}
+	free(pairs);
+	return 0;
+}
@@ -4,12 +4,31 @@
 
 static int single;
 static int multi;
+static int snapshot;
 static int count = 1;
 static int dump;
 static int perf;
 static int analyze;
 static int analyze_step;
 
+/*
+ * Unless asked to load the hash tables from the snapshot stored in
+ * the index, forget about it so that they get computed.
+ */
+static void prepare_snapshot(void)
+{
+	if (!snapshot)
+		free_name_hash_snapshot(&the_index);
+	else if (!the_index.name_hash_snapshot)
+		die("the index has no name hash snapshot");
+}
+
+static void check_snapshot_used(void)
+{
+	if (the_index.name_hash_snapshot)
+		die("name hash snapshot not used");
+}
+
 /*
  * Dump the contents of the "dir" and "name" hash tables to stdout.
  * If you sort the result, you can compare it with the other type
@@ -33,7 +52,11 @@ static void dump_run(void)
 	struct cache_entry *ce;
 
 	read_cache();
-	if (single) {
+	prepare_snapshot();
+	if (snapshot) {
+		test_lazy_init_name_hash(&the_index, 0);
+		check_snapshot_used();
+	} else if (single) {
 		test_lazy_init_name_hash(&the_index, 0);
 	} else {
 		int nr_threads_used = test_lazy_init_name_hash(&the_index, 1);
@@ -67,6 +90,7 @@ static uint64_t time_runs(int try_threaded)
 	for (i = 0; i < count; i++) {
 		t0 = getnanotime();
 		read_cache();
+		prepare_snapshot();
 		t1 = getnanotime();
 		nr_threads_used = test_lazy_init_name_hash(&the_index, try_threaded);
 		t2 = getnanotime();
@@ -76,7 +100,13 @@ static uint64_t time_runs(int try_threaded)
 		if (try_threaded && !nr_threads_used)
 			die("non-threaded code path used");
 
-		if (nr_threads_used)
+		if (snapshot) {
+			check_snapshot_used();
+			printf("%f %f %d snapshot\n",
+				   ((double)(t1 - t0))/1000000000,
+				   ((double)(t2 - t1))/1000000000,
+				   the_index.cache_nr);
+		} else if (nr_threads_used)
 			printf("%f %f %d multi %d\n",
 				   ((double)(t1 - t0))/1000000000,
 				   ((double)(t2 - t1))/1000000000,
@@ -96,6 +126,7 @@ static uint64_t time_runs(int try_threaded)
 	if (count > 1)
 		printf("avg %f %s\n",
 			   (double)avg/1000000000,
+			   snapshot ? "snapshot" :
 			   (try_threaded) ? "multi" : "single");
 
 	return avg;
@@ -129,6 +160,7 @@ static void analyze_run(void)
 
 		for (i = 0; i < count; i++) {
 			read_cache();
+			free_name_hash_snapshot(&the_index);
 			the_index.cache_nr = nr; /* cheap truncate of index */
 			t1s = getnanotime();
 			test_lazy_init_name_hash(&the_index, 0);
@@ -138,6 +170,7 @@ static void analyze_run(void)
 			discard_cache();
 
 			read_cache();
+			free_name_hash_snapshot(&the_index);
 			the_index.cache_nr = nr; /* cheap truncate of index */
 			t1m = getnanotime();
 			nr_threads_used = test_lazy_init_name_hash(&the_index, 1);
@@ -189,11 +222,14 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 		"test-tool lazy-init-name-hash -a a [--step s] [-c c]",
 		"test-tool lazy-init-name-hash (-s | -m) [-c c]",
 		"test-tool lazy-init-name-hash -s -m [-c c]",
+		"test-tool lazy-init-name-hash --snapshot [-d | -c c]",
 		NULL
 	};
 	struct option options[] = {
 		OPT_BOOL('s', "single", &single, "run single-threaded code"),
 		OPT_BOOL('m', "multi", &multi, "run multi-threaded code"),
+		OPT_BOOL(0, "snapshot", &snapshot,
+			 "load the hash tables from the index snapshot"),
 		OPT_INTEGER('c', "count", &count, "number of passes"),
 		OPT_BOOL('d', "dump", &dump, "dump hash tables"),
 		OPT_BOOL('p', "perf", &perf, "compare single vs multi"),
@@ -213,6 +249,9 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 	 */
 	ignore_case = 1;
 
+	if (snapshot && (single || multi || perf || analyze))
+		die("cannot combine snapshot with single, multi, perf or analyze");
+
 	if (dump) {
 		if (perf || analyze > 0)
 			die("cannot combine dump, perf, or analyze");
@@ -220,8 +259,8 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 			die("count not valid with dump");
 		if (single && multi)
 			die("cannot use both single and multi with dump");
-		if (!single && !multi)
-			die("dump requires either single or multi");
+		if (!single && !multi && !snapshot)
+			die("dump requires either single, multi or snapshot");
 		dump_run();
 		return 0;
 	}
@@ -249,6 +288,11 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 		return 0;
 	}
 
+	if (snapshot) {
+		time_runs(0);
+		return 0;
+	}
+
 	if (!single && !multi)
 		die("require either -s or -m or both");
 
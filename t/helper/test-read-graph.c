@@ -56,6 +56,8 @@ int cmd__read_graph(int argc, const char **argv)
 		printf(" read_generation_data");
 	if (graph->topo_levels)
 		printf(" topo_levels");
+	if (graph->chain_lookup)
+		printf(" chain_lookup");
 	printf("\n");
 
 	UNLEAK(graph);
@@ -53,4 +53,17 @@ test_perf "multi-threaded, $desc" --prereq REPO_BIG_ENOUGH_FOR_MULTI "
 	test-tool lazy-init-name-hash --multi --count=$count
 "
 
+test_expect_success 'write the name hash snapshot' '
+	git -c core.ignorecase=true -c index.nameHashSnapshot=true \
+		update-index --force-write-index &&
+	test-tool lazy-init-name-hash --dump --snapshot >out.snapshot &&
+	sort <out.snapshot >sorted.snapshot &&
+	sort <out.single >sorted.single &&
+	test_cmp sorted.single sorted.snapshot
+'
+
+test_perf "from snapshot, $desc" "
+	test-tool lazy-init-name-hash --snapshot --count=$count
+"
+
 test_done
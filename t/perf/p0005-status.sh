@@ -46,4 +46,34 @@ test_perf "read-tree status br_ballast ($nr_files)" '
 	git status
 '
 
+test_perf "status br_ballast ($nr_files)" '
+	git status
+'
+
+test_perf "status br_ballast, io_uring preload ($nr_files)" '
+	git -c core.preloadIoUring=true status
+'
+
+test_expect_success "setup untracked directories" '
+	git config core.untrackedCache false &&
+	for i in $(test_seq 100)
+	do
+		mkdir -p p0005-untracked/$i/a/b &&
+		touch p0005-untracked/$i/a/file p0005-untracked/$i/a/b/file ||
+		return 1
+	done
+'
+
+test_perf "status -uall, untracked scan on one thread" '
+	git -c core.untrackedScanThreads=1 status -uall
+'
+
+test_perf "status -uall, untracked scan on threads" '
+	git -c core.untrackedScanThreads=true status -uall
+'
+
+test_expect_success "cleanup untracked directories" '
+	rm -rf p0005-untracked
+'
+
 test_done
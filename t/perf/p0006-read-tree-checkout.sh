@@ -49,11 +49,32 @@ test_perf "read-tree br_base br_ballast ($nr_files)" '
 	git read-tree -n -m br_base br_ballast
 '
 
+test_perf "read-tree br_base br_ballast, single thread ($nr_files)" '
+	git -c index.unpackThreads=1 read-tree -n -m br_base br_ballast
+'
+
 test_perf "switch between br_base br_ballast ($nr_files)" '
 	git checkout -q br_base &&
 	git checkout -q br_ballast
 '
 
+test_perf "switch between br_base br_ballast, single thread ($nr_files)" '
+	git -c index.unpackThreads=1 checkout -q br_base &&
+	git -c index.unpackThreads=1 checkout -q br_ballast
+'
+
+test_perf "write-tree with an invalid cache-tree ($nr_files)" '
+	git read-tree br_ballast &&
+	test-tool scrap-cache-tree &&
+	git write-tree
+'
+
+test_perf "write-tree with an invalid cache-tree, single thread ($nr_files)" '
+	git read-tree br_ballast &&
+	test-tool scrap-cache-tree &&
+	git -c index.cacheTreeThreads=1 write-tree
+'
+
 test_perf "switch between br_ballast br_ballast_plus_1 ($nr_files)" '
 	git checkout -q br_ballast_plus_1 &&
 	git checkout -q br_ballast
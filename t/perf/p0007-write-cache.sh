@@ -26,4 +26,14 @@ test_perf "write_locked_index $count times ($nr_files files)" "
 	test-tool write-cache $count
 "
 
+test_expect_success "enable the index journal" "
+	git update-index --index-version 2 &&
+	git config index.journal true &&
+	git update-index --force-write-index
+"
+
+test_perf "write_locked_index $count times ($nr_files files, journal)" "
+	test-tool write-cache $count
+"
+
 test_done
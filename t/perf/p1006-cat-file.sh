@@ -9,4 +9,17 @@ test_perf 'cat-file --batch-check' '
 	git cat-file --batch-all-objects --batch-check
 '
 
+test_expect_success 'list objects in random order' '
+	git cat-file --batch-all-objects --batch-check="%(objectname)" >list &&
+	perl -MList::Util=shuffle -e "print shuffle <>" <list >shuffled
+'
+
+test_perf 'cat-file --batch-check, unbuffered' '
+	git cat-file --batch-check --no-buffer <shuffled >/dev/null
+'
+
+test_perf 'cat-file --batch-check --buffer' '
+	git cat-file --batch-check --buffer <shuffled >/dev/null
+'
+
 test_done
@@ -0,0 +1,73 @@
+#!/bin/sh
+
+test_description="Compare the files and reftable ref storage formats"
+
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success "setup" '
+	test_commit PRE &&
+	test_commit POST &&
+	pre=$(git rev-parse PRE) &&
+	post=$(git rev-parse POST) &&
+	for i in $(test_seq 10000)
+	do
+		echo "create refs/heads/branch-$i $pre" || return 1
+	done >create &&
+	for i in $(test_seq 10000)
+	do
+		echo "update refs/heads/branch-$i $post $pre" || return 1
+	done >update &&
+	for i in $(test_seq 10000)
+	do
+		echo "create refs/remotes/origin/branch-$i $post" || return 1
+	done >remote &&
+	git update-ref --stdin <remote &&
+
+	for format in files reftable
+	do
+		git init --ref-format=$format $format &&
+		git -C $format fetch -q .. POST:refs/heads/main || return 1
+	done
+'
+
+for format in files reftable
+do
+	test_perf "update-ref --stdin ($format)" "
+		git -C $format update-ref --stdin <create &&
+		git -C $format update-ref --stdin <update &&
+		git -C $format for-each-ref --format='delete %(refname)' 'refs/heads/branch-*' |
+		git -C $format update-ref --stdin
+	"
+done
+
+for format in files reftable
+do
+	test_expect_success "populate refs ($format)" "
+		git -C $format update-ref --stdin <create &&
+		git -C $format pack-refs --all
+	"
+
+	test_perf "for-each-ref ($format)" "
+		for i in \$(test_seq 10)
+		do
+			git -C $format for-each-ref >/dev/null || return 1
+		done
+	"
+
+	test_perf "for-each-ref with prefix ($format)" "
+		for i in \$(test_seq 100)
+		do
+			git -C $format for-each-ref refs/heads/branch-1 >/dev/null || return 1
+		done
+	"
+
+	test_perf "fetch ($format)" "
+		git -C $format fetch -q .. refs/remotes/origin/*:refs/remotes/origin/* &&
+		git -C $format for-each-ref --format='delete %(refname)' refs/remotes/ |
+		git -C $format update-ref --stdin
+	"
+done
+
+test_done
@@ -125,5 +125,10 @@ test_perf_on_all git checkout-index -f --all
 test_perf_on_all git update-index --add --remove $SPARSE_CONE/a
 test_perf_on_all "git rm -f $SPARSE_CONE/a && git checkout HEAD -- $SPARSE_CONE/a"
 test_perf_on_all git grep --cached --sparse bogus -- "f2/f1/f1/*"
+test_perf_on_all git grep --cached bogus -- "$SPARSE_CONE/*"
+test_perf_on_all git ls-files -- "$SPARSE_CONE/*"
+test_perf_on_all "git mv $SPARSE_CONE/a $SPARSE_CONE/b && git mv $SPARSE_CONE/b $SPARSE_CONE/a"
+test_perf_on_all git describe --always --dirty
+test_perf_on_all "git stash push -- $SPARSE_CONE/a && git stash pop"
 
 test_done
@@ -0,0 +1,25 @@
+#!/bin/sh
+
+test_description='Tests delta creation performance'
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+# Use the blob deltas that the last repack chose as the corpus, so that
+# every pair is one that pack-objects found worth storing as a delta.
+test_expect_success 'collect blob delta pairs' '
+	git repack -adq &&
+	git cat-file --batch-all-objects --unordered \
+		--batch-check="%(objecttype) %(deltabase) %(objectname)" >objects &&
+	grep "^blob " objects |
+	grep -v " $ZERO_OID " |
+	cut -d" " -f2,3 |
+	head -n 10000 >pairs &&
+	test_file_not_empty pairs
+'
+
+test_perf 'create deltas' '
+	test-tool delta-speed <pairs
+'
+
+test_done
@@ -31,10 +31,15 @@ test_lookup_pack_bitmap () {
 		git config pack.writeBitmapLookupTable '"$1"'
 	'
 
+	test_expect_success "bitmap version: ${2:-1}" '
+		git config pack.bitmapVersion '"${2:-1}"'
+	'
+
 	test_pack_bitmap
 }
 
 test_lookup_pack_bitmap false
 test_lookup_pack_bitmap true
+test_lookup_pack_bitmap true 2
 
 test_done
@@ -6,6 +6,7 @@ test_description='Tests performance using midx bitmaps'
 
 test_bitmap () {
 	local enabled="$1"
+	local version="${2:-1}"
 
 	test_expect_success "remove existing repo (lookup=$enabled)" '
 		rm -fr * .git
@@ -23,6 +24,10 @@ test_bitmap () {
 		git config pack.writeBitmapLookupTable '"$enabled"'
 	'
 
+	test_expect_success "bitmap version: $version" '
+		git config pack.bitmapVersion '"$version"'
+	'
+
 	test_expect_success "start with bitmapped pack (lookup=$enabled)" '
 		git repack -adb
 	'
@@ -63,5 +68,6 @@ test_bitmap () {
 
 test_bitmap false
 test_bitmap true
+test_bitmap true 2
 
 test_done
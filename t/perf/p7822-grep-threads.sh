@@ -0,0 +1,50 @@
+#!/bin/sh
+
+test_description='Tests concurrent object reading via multi-threaded git-grep
+
+Each grep test reads every blob of HEAD out of the object store with the
+given number of threads, so the timings show how well object reading scales
+as threads are added. The cat-file --batch test reads the same blobs with a
+single reader and serves as the baseline.
+'
+
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+test_expect_success 'repack' '
+	git repack -adq
+'
+
+test_expect_success 'list blobs of HEAD' '
+	git ls-tree -r HEAD >tree &&
+	sed -n "s/^[0-9]* blob \([0-9a-f]*\).*/\1/p" tree >blobs
+'
+
+# Rather than counting up and doubling each time, count down from the endpoint,
+# halving each time. That ensures that our final test uses as many threads as
+# CPUs, even if it isn't a power of 2.
+test_expect_success 'set up thread-counting tests' '
+	t=$(test-tool online-cpus) &&
+	threads= &&
+	while test $t -gt 0
+	do
+		threads="$t $threads" &&
+		t=$((t / 2)) || return 1
+	done
+'
+
+test_perf 'cat-file --batch' '
+	git cat-file --batch <blobs >/dev/null
+'
+
+for t in $threads
+do
+	THREADS=$t
+	export THREADS
+	test_perf "grep HEAD, $t threads" '
+		git grep --threads=$THREADS some_nonexistent_string HEAD || :
+	'
+done
+
+test_done
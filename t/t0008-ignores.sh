@@ -911,6 +911,91 @@ test_expect_success 'info/exclude trumps core.excludesfile' '
 	test_cmp expect actual
 '
 
+test_expect_success 'long pattern lists match like short ones' '
+	test_when_finished "rm -rf long-list" &&
+	git init long-list &&
+	cat >patterns <<-\EOF &&
+	*.o
+	!keep.o
+	Thumbs.db
+	*.tmp
+	/build
+	!build/
+	out/
+	sub/generated.c
+	/sub/deep/literal
+	!*.c
+	vendor/**/x
+	data?.bin
+	*.log
+	!important.log
+	doc/*.html
+	cache/
+	!/cache
+	a/b/c
+	EOF
+	for i in $(test_seq 40)
+	do
+		echo "padding-$i" &&
+		echo "*.pad$i" &&
+		echo "pad/dir$i" || return 1
+	done >padding &&
+	cat padding patterns >long-list/.gitignore &&
+	cp patterns short.gitignore &&
+	cat >paths <<-\EOF &&
+	a.o
+	sub/keep.o
+	Thumbs.db
+	dir/Thumbs.db
+	x.tmp
+	build
+	sub/build
+	out
+	sub/out
+	sub/generated.c
+	other/sub/generated.c
+	sub/deep/literal
+	deep/literal
+	foo.c
+	vendor/a/b/x
+	data1.bin
+	data12.bin
+	err.log
+	important.log
+	doc/index.html
+	doc/sub/index.html
+	cache
+	sub/cache
+	a/b/c
+	a/b/c/d
+	padding-7
+	y.pad12
+	pad/dir3
+	EOF
+	for d in build out cache sub/build sub/out sub/cache a/b/c
+	do
+		mkdir -p long-list/$d || return 1
+	done &&
+	(
+		cd long-list &&
+		git check-ignore -v -n --no-index --stdin <../paths >../long.out
+	) &&
+	sed -e "s/:[0-9]*:/::/" -e "s/^\.gitignore/X/" <long.out >long &&
+	grep -v "pad" long >actual &&
+	mv long-list/.gitignore long-list/.gitignore.long &&
+	cp short.gitignore long-list/.gitignore &&
+	(
+		cd long-list &&
+		git check-ignore -v -n --no-index --stdin <../paths >../short.out
+	) &&
+	sed -e "s/:[0-9]*:/::/" -e "s/^\.gitignore/X/" <short.out >short &&
+	grep -v "pad" short >expect &&
+	test_cmp expect actual &&
+	grep "^X::padding-7	padding-7" long &&
+	grep "^X::\*\.pad12	y.pad12" long &&
+	grep "^X::pad/dir3	pad/dir3" long
+'
+
 test_expect_success SYMLINKS 'set up ignore file for symlink tests' '
 	echo "*" >ignore &&
 	rm -f .gitignore .git/info/exclude
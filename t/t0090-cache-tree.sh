@@ -258,6 +258,30 @@ test_expect_success 'partial commit gives cache-tree' '
 	test_cache_tree expected.status
 '
 
+test_expect_success 'diff-index --cached uses a matching cache-tree' '
+	git reset --hard &&
+	git read-tree HEAD &&
+	rm -f trace &&
+	GIT_TRACE2_PERF="$(pwd)/trace" git diff-index --cached HEAD >actual &&
+	test_must_be_empty actual &&
+	grep "diff_cache:cache-tree" trace &&
+	! grep traverse_trees trace &&
+
+	git diff-index --cached HEAD^ >actual &&
+	test_line_count = 1 actual &&
+	git diff-index --cached --find-copies-harder HEAD >actual &&
+	test_must_be_empty actual &&
+
+	echo more >>one.t &&
+	git add one.t &&
+	rm -f trace &&
+	GIT_TRACE2_PERF="$(pwd)/trace" git diff-index --cached --name-only HEAD >actual &&
+	echo one.t >expect &&
+	test_cmp expect actual &&
+	! grep "diff_cache:cache-tree" trace &&
+	git reset --hard
+'
+
 test_expect_success 'no phantom error when switching trees' '
 	mkdir newdir &&
 	>newdir/one &&
@@ -0,0 +1,102 @@
+#!/bin/sh
+
+test_description='cache-tree rebuilt on several threads'
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+sane_unset GIT_TEST_CACHE_TREE_THREADS
+
+test_expect_success 'setup' '
+	for d in $(test_seq 6)
+	do
+		for s in a b c
+		do
+			mkdir -p dir$d/$s/deep &&
+			echo $d$s >dir$d/$s/file &&
+			echo $d$s >dir$d/$s/deep/file || return 1
+		done &&
+		echo $d >dir$d/top || return 1
+	done &&
+	echo top >top &&
+	git add . &&
+	test_tick &&
+	git commit -m base
+'
+
+test_expect_success 'write-tree gives the same trees on threads' '
+	git write-tree >expect &&
+	git read-tree --empty &&
+	git read-tree --index-output=.git/index.plain HEAD &&
+	GIT_INDEX_FILE=.git/index.plain git ls-files -s >entries &&
+	git update-index --index-info <entries &&
+	rm -f .git/trace.perf &&
+	GIT_TEST_CACHE_TREE_THREADS=4 \
+	GIT_TRACE2_PERF="$(pwd)/.git/trace.perf" git write-tree >actual &&
+	test_cmp expect actual &&
+	grep "update/threads" .git/trace.perf &&
+	test-tool dump-cache-tree >actual.threads &&
+	git read-tree HEAD &&
+	test-tool dump-cache-tree >expect.threads &&
+	test_cmp expect.threads actual.threads
+'
+
+test_expect_success 'partially invalid cache-tree is rebuilt on threads' '
+	test_when_finished "git reset -q --hard" &&
+	git read-tree HEAD &&
+	echo changed >dir2/b/deep/file &&
+	echo changed >dir5/top &&
+	git add dir2/b/deep/file dir5/top &&
+	git write-tree >expect &&
+	git read-tree HEAD &&
+	git add dir2/b/deep/file dir5/top &&
+	GIT_TEST_CACHE_TREE_THREADS=4 git write-tree >actual &&
+	test_cmp expect actual &&
+	git cat-file -e $(git rev-parse $(cat actual):dir2/b/deep)
+'
+
+test_expect_success 'intent-to-add entries invalidate the subtrees' '
+	test_when_finished "git rm -q --cached dir3/a/new && rm dir3/a/new" &&
+	git read-tree HEAD &&
+	>dir3/a/new &&
+	git add -N dir3/a/new &&
+	git read-tree --empty &&
+	git read-tree HEAD &&
+	git add -N dir3/a/new &&
+	GIT_TEST_CACHE_TREE_THREADS=4 git write-tree >actual &&
+	git rev-parse HEAD^{tree} >expect &&
+	test_cmp expect actual &&
+	test-tool dump-cache-tree >dump &&
+	grep "^invalid .*dir3/" dump
+'
+
+test_expect_success 'missing objects are reported as on one thread' '
+	git read-tree HEAD &&
+	missing=$(echo missing | git hash-object --stdin) &&
+	git update-index --add --cacheinfo 100644,$missing,dir4/c/gone &&
+	test_must_fail git write-tree 2>expect &&
+	test_must_fail env GIT_TEST_CACHE_TREE_THREADS=4 \
+		git write-tree 2>actual &&
+	test_cmp expect actual &&
+	git read-tree HEAD
+'
+
+test_expect_success 'sparse directory entries' '
+	test_when_finished "git sparse-checkout disable && git reset -q --hard" &&
+	git reset -q --hard &&
+	GIT_TEST_CACHE_TREE_THREADS=4 \
+		git sparse-checkout set --cone --sparse-index dir1 &&
+	git ls-files --sparse >entries &&
+	grep "^dir2/$" entries &&
+	echo changed >dir1/a/file &&
+	echo changed >dir1/b/file &&
+	git add dir1 &&
+	GIT_TEST_CACHE_TREE_THREADS=4 git write-tree >actual &&
+	git ls-files --sparse >entries &&
+	grep "^dir2/$" entries &&
+	git sparse-checkout disable &&
+	git write-tree >expect &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,286 @@
+#!/bin/sh
+#
+# Copyright (c) 2020 Google LLC
+#
+
+test_description='reftable ref storage backend'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+INVALID_OID=$(test_oid 001)
+
+test_expect_success 'init: creates basic reftable structures' '
+	test_when_finished "rm -rf repo" &&
+	git init --ref-format=reftable repo &&
+	test_path_is_dir repo/.git/reftable &&
+	test_path_is_file repo/.git/reftable/tables.list &&
+	echo reftable >expect &&
+	git -C repo config extensions.refstorage >actual &&
+	test_cmp expect actual &&
+	echo 1 >expect &&
+	git -C repo config core.repositoryformatversion >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'init: HEAD stub protects against files-based tools' '
+	test_when_finished "rm -rf repo" &&
+	git init --ref-format=reftable repo &&
+	echo "ref: refs/heads/.invalid" >expect &&
+	test_cmp expect repo/.git/HEAD &&
+	test_path_is_file repo/.git/refs/heads &&
+	echo refs/heads/main >expect &&
+	git -C repo symbolic-ref HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'init: GIT_DEFAULT_REF_FORMAT selects the format' '
+	test_when_finished "rm -rf repo" &&
+	GIT_DEFAULT_REF_FORMAT=reftable git init repo &&
+	test_path_is_dir repo/.git/reftable
+'
+
+test_expect_success 'init: unknown format is rejected' '
+	test_must_fail git init --ref-format=bogus repo 2>err &&
+	test_i18ngrep "unknown ref storage format" err &&
+	test_must_fail env GIT_DEFAULT_REF_FORMAT=bogus git init repo 2>err &&
+	test_i18ngrep "unknown ref storage format" err
+'
+
+test_expect_success 'init: reinitializing with a different format fails' '
+	test_when_finished "rm -rf repo" &&
+	git init --ref-format=files repo &&
+	test_must_fail git init --ref-format=reftable repo 2>err &&
+	test_i18ngrep "attempt to reinitialize repository with different reference storage format" err
+'
+
+test_expect_success 'setup reftable repository' '
+	git init --ref-format=reftable repo &&
+	test_commit -C repo A &&
+	test_commit -C repo B
+'
+
+test_expect_success 'update-ref: create, update and delete' '
+	A=$(git -C repo rev-parse A) &&
+	B=$(git -C repo rev-parse B) &&
+	git -C repo update-ref refs/heads/topic $A &&
+	echo $A >expect &&
+	git -C repo rev-parse refs/heads/topic >actual &&
+	test_cmp expect actual &&
+	git -C repo update-ref refs/heads/topic $B $A &&
+	echo $B >expect &&
+	git -C repo rev-parse refs/heads/topic >actual &&
+	test_cmp expect actual &&
+	git -C repo update-ref -d refs/heads/topic $B &&
+	test_must_fail git -C repo rev-parse --verify -q refs/heads/topic
+'
+
+test_expect_success 'update-ref: stale old value is rejected' '
+	A=$(git -C repo rev-parse A) &&
+	B=$(git -C repo rev-parse B) &&
+	git -C repo update-ref refs/heads/stale $A &&
+	test_must_fail git -C repo update-ref refs/heads/stale $B $B 2>err &&
+	test_i18ngrep "is at $A but expected $B" err &&
+	test_must_fail git -C repo update-ref refs/heads/stale $B $INVALID_OID &&
+	git -C repo update-ref -d refs/heads/stale
+'
+
+test_expect_success 'update-ref: D/F conflicts are detected' '
+	A=$(git -C repo rev-parse A) &&
+	git -C repo update-ref refs/heads/df $A &&
+	test_must_fail git -C repo update-ref refs/heads/df/sub $A 2>err &&
+	test_i18ngrep "refs/heads/df.* exists" err &&
+	git -C repo update-ref -d refs/heads/df
+'
+
+test_expect_success 'update-ref --stdin: multiple updates are atomic' '
+	A=$(git -C repo rev-parse A) &&
+	B=$(git -C repo rev-parse B) &&
+	cat >input <<-EOF &&
+	create refs/heads/atomic-1 $A
+	create refs/heads/atomic-2 $A
+	update refs/heads/main $A $A
+	EOF
+	test_must_fail git -C repo update-ref --stdin <input &&
+	test_must_fail git -C repo rev-parse --verify -q refs/heads/atomic-1 &&
+	cat >input <<-EOF &&
+	create refs/heads/atomic-1 $A
+	create refs/heads/atomic-2 $B
+	EOF
+	git -C repo update-ref --stdin <input &&
+	git -C repo rev-parse refs/heads/atomic-1 refs/heads/atomic-2 >actual &&
+	printf "%s\n" $A $B >expect &&
+	test_cmp expect actual &&
+	git -C repo update-ref -d refs/heads/atomic-1 &&
+	git -C repo update-ref -d refs/heads/atomic-2
+'
+
+test_expect_success 'for-each-ref: lists refs in order' '
+	cat >expect <<-EOF &&
+	$(git -C repo rev-parse B) commit	refs/heads/main
+	$(git -C repo rev-parse A) commit	refs/tags/A
+	$(git -C repo rev-parse B) commit	refs/tags/B
+	EOF
+	git -C repo for-each-ref --format="%(objectname) %(objecttype)	%(refname)" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'for-each-ref: prefix filtering' '
+	echo refs/tags/A >expect &&
+	echo refs/tags/B >>expect &&
+	git -C repo for-each-ref --format="%(refname)" refs/tags/ >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'symbolic-ref: create, read and delete' '
+	git -C repo symbolic-ref refs/heads/sym refs/heads/main &&
+	echo refs/heads/main >expect &&
+	git -C repo symbolic-ref refs/heads/sym >actual &&
+	test_cmp expect actual &&
+	git -C repo rev-parse main >expect &&
+	git -C repo rev-parse refs/heads/sym >actual &&
+	test_cmp expect actual &&
+	git -C repo symbolic-ref -d refs/heads/sym &&
+	test_must_fail git -C repo symbolic-ref refs/heads/sym
+'
+
+test_expect_success 'reflog: entries are written and can be read' '
+	test_when_finished "rm -rf reflog" &&
+	git init --ref-format=reftable reflog &&
+	test_commit -C reflog first &&
+	test_commit -C reflog second &&
+	git -C reflog reflog exists refs/heads/main &&
+	git -C reflog reflog show --format="%gs" main >actual &&
+	cat >expect <<-\EOF &&
+	commit: second
+	commit (initial): first
+	EOF
+	test_cmp expect actual &&
+	git -C reflog reflog show --format="%gs" HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'reflog: expire and delete' '
+	test_when_finished "rm -rf reflog" &&
+	git init --ref-format=reftable reflog &&
+	test_commit -C reflog first &&
+	test_commit -C reflog second &&
+	test_commit -C reflog third &&
+	git -C reflog reflog delete main@{1} &&
+	git -C reflog reflog show --format="%gs" main >actual &&
+	cat >expect <<-\EOF &&
+	commit: third
+	commit (initial): first
+	EOF
+	test_cmp expect actual &&
+	git -C reflog reflog expire --expire=all --all &&
+	git -C reflog reflog show main >actual &&
+	test_must_be_empty actual &&
+	git -C reflog reflog exists refs/heads/main
+'
+
+test_expect_success 'reflog: deleting a ref deletes its reflog' '
+	test_when_finished "rm -rf reflog" &&
+	git init --ref-format=reftable reflog &&
+	test_commit -C reflog first &&
+	git -C reflog branch topic &&
+	git -C reflog reflog exists refs/heads/topic &&
+	git -C reflog branch -D topic &&
+	test_must_fail git -C reflog reflog exists refs/heads/topic
+'
+
+test_expect_success 'branch: rename and copy carry the reflog along' '
+	test_when_finished "rm -rf branch" &&
+	git init --ref-format=reftable branch &&
+	test_commit -C branch first &&
+	git -C branch branch topic &&
+	git -C branch branch -m topic renamed &&
+	test_must_fail git -C branch rev-parse --verify -q refs/heads/topic &&
+	test_must_fail git -C branch reflog exists refs/heads/topic &&
+	git -C branch reflog show --format="%gs" renamed >actual &&
+	cat >expect <<-\EOF &&
+	Branch: renamed refs/heads/topic to refs/heads/renamed
+	branch: Created from main
+	EOF
+	test_cmp expect actual &&
+	git -C branch branch -c renamed copied &&
+	git -C branch rev-parse renamed >expect &&
+	git -C branch rev-parse copied >actual &&
+	test_cmp expect actual &&
+	git -C branch reflog exists refs/heads/renamed &&
+	git -C branch reflog exists refs/heads/copied
+'
+
+test_expect_success 'pack-refs: compacts the stack' '
+	test_when_finished "rm -rf pack" &&
+	git init --ref-format=reftable pack &&
+	test_commit -C pack first &&
+	for i in $(test_seq 10)
+	do
+		git -C pack update-ref refs/heads/branch-$i HEAD || return 1
+	done &&
+	git -C pack pack-refs --all &&
+	test_line_count = 1 pack/.git/reftable/tables.list &&
+	git -C pack for-each-ref refs/heads/ >actual &&
+	test_line_count = 11 actual
+'
+
+test_expect_success 'pack-refs: removes stale tables' '
+	test_when_finished "rm -rf pack" &&
+	git init --ref-format=reftable pack &&
+	test_commit -C pack first &&
+	git -C pack pack-refs --all &&
+	ls pack/.git/reftable/*.ref >tables &&
+	test_line_count = 1 tables
+'
+
+test_expect_success 'worktree: per-worktree refs are kept separate' '
+	test_when_finished "rm -rf wt-repo" &&
+	git init --ref-format=reftable wt-repo &&
+	test_commit -C wt-repo first &&
+	git -C wt-repo worktree add ../wt &&
+	test_when_finished "rm -rf wt" &&
+	test_path_is_dir wt-repo/.git/worktrees/wt/reftable &&
+
+	git -C wt-repo update-ref refs/bisect/main HEAD &&
+	git -C wt update-ref refs/bisect/wt HEAD &&
+	test_must_fail git -C wt-repo rev-parse --verify -q refs/bisect/wt &&
+	test_must_fail git -C wt rev-parse --verify -q refs/bisect/main &&
+	git -C wt-repo rev-parse --verify worktrees/wt/refs/bisect/wt &&
+	git -C wt rev-parse --verify main-worktree/refs/bisect/main &&
+
+	echo refs/heads/main >expect &&
+	git -C wt-repo symbolic-ref HEAD >actual &&
+	test_cmp expect actual &&
+	echo refs/heads/wt >expect &&
+	git -C wt symbolic-ref HEAD >actual &&
+	test_cmp expect actual &&
+
+	git -C wt update-ref refs/heads/shared HEAD &&
+	git -C wt-repo rev-parse --verify refs/heads/shared
+'
+
+test_expect_success 'clone: --ref-format selects the format' '
+	test_when_finished "rm -rf clone" &&
+	git clone --ref-format=reftable repo clone &&
+	echo reftable >expect &&
+	git -C clone config extensions.refstorage >actual &&
+	test_cmp expect actual &&
+	git -C repo rev-parse main >expect &&
+	git -C clone rev-parse origin/main >actual &&
+	test_cmp expect actual &&
+	git -C clone fsck
+'
+
+test_expect_success 'clone: files repository from reftable source' '
+	test_when_finished "rm -rf clone" &&
+	git clone --ref-format=files repo clone &&
+	test_path_is_missing clone/.git/reftable &&
+	git -C repo rev-parse main >expect &&
+	git -C clone rev-parse origin/main >actual &&
+	test_cmp expect actual
+'
+
+test_done
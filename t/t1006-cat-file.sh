@@ -1067,6 +1067,33 @@ test_expect_success 'cat-file --batch-check respects replace objects' '
 	test_cmp expect actual
 '
 
+test_expect_success 'cat-file --batch-check --buffer respects replace objects' '
+	git cat-file --batch-check --buffer >actual <<-EOF &&
+	$orig
+	EOF
+	echo "$orig commit $fake_size" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cat-file --batch-check --buffer matches unbuffered output' '
+	git cat-file --batch-all-objects --batch-check="%(objectname)" >all &&
+	{
+		for i in $(test_seq 5000)
+		do
+			cat all || return 1
+		done | head -n 5000 &&
+		echo "HEAD:" &&
+		echo "HEAD:does-not-exist" &&
+		echo "$ZERO_OID" &&
+		echo "HEAD some rest"
+	} >in &&
+	format="%(objectname) %(objecttype) %(objectsize)" &&
+	format="$format %(objectsize:disk) %(deltabase) %(rest)" &&
+	git cat-file --no-buffer --batch-check="$format" <in >expect &&
+	git cat-file --buffer --batch-check="$format" <in >actual &&
+	test_cmp expect actual
+'
+
 # Pull the entry for object with oid "$1" out of the output of
 # "cat-file --batch", including its object content (which requires
 # parsing and reading a set amount of bytes, hence perl).
@@ -0,0 +1,76 @@
+#!/bin/sh
+
+test_description='read-tree and checkout reading trees ahead on threads'
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_UNPACK_THREADS
+
+test_expect_success 'setup' '
+	for d in $(test_seq 8)
+	do
+		for s in a b c
+		do
+			mkdir -p dir$d/$s &&
+			echo $d$s >dir$d/$s/file &&
+			echo $d$s >dir$d/$s/other || return 1
+		done
+	done &&
+	git add . &&
+	test_tick &&
+	git commit -m base &&
+	git tag base &&
+
+	echo side >dir2/a/file &&
+	git rm -rq dir5 &&
+	mkdir -p dir9/a &&
+	echo side >dir9/a/file &&
+	git add . &&
+	test_tick &&
+	git commit -m side &&
+	git tag one &&
+
+	git checkout -q base &&
+	echo other >dir7/b/file &&
+	git rm -rq dir3/c &&
+	git add . &&
+	test_tick &&
+	git commit -m other &&
+	git tag two
+'
+
+for threads in 1 4
+do
+	test_expect_success "read-tree -m with $threads thread(s)" "
+		git reset -q --hard one &&
+		git -c index.unpackThreads=$threads read-tree -m base one two &&
+		git ls-files -s >actual.$threads &&
+		git reset -q --hard base
+	"
+
+	test_expect_success "checkout with $threads thread(s)" "
+		git -c index.unpackThreads=$threads checkout -q one &&
+		git ls-files -s >checkout.$threads &&
+		git diff-index --cached --quiet one &&
+		git diff --quiet &&
+		git -c index.unpackThreads=$threads checkout -q two &&
+		git diff-index --cached --quiet two &&
+		git diff --quiet &&
+		git checkout -q base
+	"
+done
+
+test_expect_success 'threads do not change the result' '
+	test_cmp actual.1 actual.4 &&
+	test_cmp checkout.1 checkout.4
+'
+
+test_expect_success 'trees are read ahead' '
+	git checkout -q base &&
+	GIT_TRACE2_PERF="$(pwd)/trace" \
+		git -c index.unpackThreads=4 read-tree -m -u base one &&
+	grep "prefetch/threads:3" trace &&
+	git reset -q --hard base
+'
+
+test_done
@@ -2020,6 +2020,57 @@ test_expect_success 'grep is not expanded' '
 	ensure_not_expanded grep --cached a -- "deep/*"
 '
 
+test_expect_success 'sparse index is not expanded: ls-files' '
+	init_repos &&
+
+	ensure_not_expanded ls-files -- deep/a &&
+	ensure_not_expanded ls-files --stage -- "deep/deeper1/*" &&
+	ensure_not_expanded ls-files -m -- deep &&
+	test_all_match git ls-files -- a deep/a "deep/deeper1/*" &&
+
+	# a pathspec reaching into a sparse directory still expands
+	test_all_match git ls-files -- folder1 &&
+	test_all_match git ls-files -- "folder*"
+'
+
+test_expect_success 'sparse index is not expanded: mv' '
+	init_repos &&
+
+	ensure_not_expanded mv deep/a deep/moved &&
+	ensure_not_expanded mv deep/moved deep/a &&
+	ensure_not_expanded mv deep/deeper1 deep/moved &&
+	ensure_not_expanded mv deep/moved deep/deeper1 &&
+
+	run_on_all git mv deep/a deep/deeper2/a-moved &&
+	test_all_match git status --porcelain=v2 -uno
+'
+
+test_expect_success 'sparse index is not expanded: describe' '
+	init_repos &&
+
+	ensure_not_expanded describe --always --dirty &&
+	ensure_not_expanded describe --always --broken &&
+
+	run_on_all ../edit-contents deep/a &&
+	ensure_not_expanded describe --always --dirty &&
+	ensure_not_expanded describe --always --broken &&
+	test_all_match git describe --always --dirty
+'
+
+test_expect_success 'sparse index is not expanded: stash with pathspec' '
+	init_repos &&
+
+	echo >>sparse-index/deep/a &&
+	ensure_not_expanded stash push -- deep/a &&
+	ensure_not_expanded stash pop &&
+
+	run_on_all ../edit-contents deep/a &&
+	test_all_match git stash push -- deep/a &&
+	test_all_match git status --porcelain=v2 -uno &&
+	run_on_all git stash pop &&
+	test_all_match git status --porcelain=v2 -uno
+'
+
 # NEEDSWORK: when running `grep` in the superproject with --recurse-submodules,
 # Git expands the index of the submodules unexpectedly. Even though `grep`
 # builtin is marked as "command_requires_full_index = 0", this config is only
@@ -62,7 +62,7 @@ test_expect_success "delete $m without oldvalue verification" '
 	test_must_fail git show-ref --verify -q $m
 '
 
-test_expect_success "fail to create $n" '
+test_expect_success REFFILES "fail to create $n" '
 	test_when_finished "rm -f .git/$n_dir" &&
 	touch .git/$n_dir &&
 	test_must_fail git update-ref $n $A
@@ -86,7 +86,7 @@ test_expect_success "delete $m (by HEAD)" '
 	test_must_fail git show-ref --verify -q $m
 '
 
-test_expect_success "deleting current branch adds message to HEAD's log" '
+test_expect_success REFFILES "deleting current branch adds message to HEAD's log" '
 	test_when_finished "git update-ref -d $m" &&
 	git update-ref $m $A &&
 	git symbolic-ref HEAD $m &&
@@ -95,7 +95,7 @@ test_expect_success "deleting current branch adds message to HEAD's log" '
 	grep "delete-$m$" .git/logs/HEAD
 '
 
-test_expect_success "deleting by HEAD adds message to HEAD's log" '
+test_expect_success REFFILES "deleting by HEAD adds message to HEAD's log" '
 	test_when_finished "git update-ref -d $m" &&
 	git update-ref $m $A &&
 	git symbolic-ref HEAD $m &&
@@ -130,7 +130,7 @@ test_expect_success 'creates no reflog in bare repository' '
 	test_must_fail git -C $bare reflog exists $m
 '
 
-test_expect_success 'core.logAllRefUpdates=true creates reflog in bare repository' '
+test_expect_success REFFILES 'core.logAllRefUpdates=true creates reflog in bare repository' '
 	test_when_finished "git -C $bare config --unset core.logAllRefUpdates && \
 		rm $bare/logs/$m" &&
 	git -C $bare config core.logAllRefUpdates true &&
@@ -220,7 +220,7 @@ test_expect_success 'delete symref without dereference when the referred ref is
 	test_must_fail git symbolic-ref SYMREF
 '
 
-test_expect_success 'update-ref -d is not confused by self-reference' '
+test_expect_success REFFILES 'update-ref -d is not confused by self-reference' '
 	git symbolic-ref refs/heads/self refs/heads/self &&
 	test_when_finished "rm -f .git/refs/heads/self" &&
 	test_path_is_file .git/refs/heads/self &&
@@ -228,7 +228,7 @@ test_expect_success 'update-ref -d is not confused by self-reference' '
 	test_path_is_file .git/refs/heads/self
 '
 
-test_expect_success 'update-ref --no-deref -d can delete self-reference' '
+test_expect_success REFFILES 'update-ref --no-deref -d can delete self-reference' '
 	git symbolic-ref refs/heads/self refs/heads/self &&
 	test_when_finished "rm -f .git/refs/heads/self" &&
 	test_path_is_file .git/refs/heads/self &&
@@ -236,7 +236,7 @@ test_expect_success 'update-ref --no-deref -d can delete self-reference' '
 	test_must_fail git show-ref --verify -q refs/heads/self
 '
 
-test_expect_success 'update-ref --no-deref -d can delete reference to bad ref' '
+test_expect_success REFFILES 'update-ref --no-deref -d can delete reference to bad ref' '
 	>.git/refs/heads/bad &&
 	test_when_finished "rm -f .git/refs/heads/bad" &&
 	git symbolic-ref refs/heads/ref-to-bad refs/heads/bad &&
@@ -285,7 +285,7 @@ test_expect_success "set $m (logged by touch)" '
 	test $A = $(git show-ref -s --verify $m)
 '
 
-test_expect_success 'empty directory removal' '
+test_expect_success REFFILES 'empty directory removal' '
 	git branch d1/d2/r1 HEAD &&
 	git branch d1/r2 HEAD &&
 	test_path_is_file .git/refs/heads/d1/d2/r1 &&
@@ -297,7 +297,7 @@ test_expect_success 'empty directory removal' '
 	test_path_is_file .git/logs/refs/heads/d1/r2
 '
 
-test_expect_success 'symref empty directory removal' '
+test_expect_success REFFILES 'symref empty directory removal' '
 	git branch e1/e2/r1 HEAD &&
 	git branch e1/r2 HEAD &&
 	git checkout e1/e2/r1 &&
@@ -353,7 +353,7 @@ test_expect_success "verifying $m's log (logged by config)" '
 	test_cmp actual expect
 '
 
-test_expect_success 'set up for querying the reflog' '
+test_expect_success REFFILES 'set up for querying the reflog' '
 	git update-ref $m $D &&
 	cat >.git/logs/$m <<-EOF
 	$Z $C $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> 1117150320 -0500
@@ -367,7 +367,7 @@ test_expect_success 'set up for querying the reflog' '
 ed="Thu, 26 May 2005 18:32:00 -0500"
 gd="Thu, 26 May 2005 18:33:00 -0500"
 ld="Thu, 26 May 2005 18:43:00 -0500"
-test_expect_success 'Query "main@{May 25 2005}" (before history)' '
+test_expect_success REFFILES 'Query "main@{May 25 2005}" (before history)' '
 	test_when_finished "rm -f o e" &&
 	git rev-parse --verify "main@{May 25 2005}" >o 2>e &&
 	echo "$C" >expect &&
@@ -375,7 +375,7 @@ test_expect_success 'Query "main@{May 25 2005}" (before history)' '
 	echo "warning: log for '\''main'\'' only goes back to $ed" >expect &&
 	test_cmp expect e
 '
-test_expect_success 'Query main@{2005-05-25} (before history)' '
+test_expect_success REFFILES 'Query main@{2005-05-25} (before history)' '
 	test_when_finished "rm -f o e" &&
 	git rev-parse --verify main@{2005-05-25} >o 2>e &&
 	echo "$C" >expect &&
@@ -383,7 +383,7 @@ test_expect_success 'Query main@{2005-05-25} (before history)' '
 	echo "warning: log for '\''main'\'' only goes back to $ed" >expect &&
 	test_cmp expect e
 '
-test_expect_success 'Query "main@{May 26 2005 23:31:59}" (1 second before history)' '
+test_expect_success REFFILES 'Query "main@{May 26 2005 23:31:59}" (1 second before history)' '
 	test_when_finished "rm -f o e" &&
 	git rev-parse --verify "main@{May 26 2005 23:31:59}" >o 2>e &&
 	echo "$C" >expect &&
@@ -391,42 +391,42 @@ test_expect_success 'Query "main@{May 26 2005 23:31:59}" (1 second before histor
 	echo "warning: log for '\''main'\'' only goes back to $ed" >expect &&
 	test_cmp expect e
 '
-test_expect_success 'Query "main@{May 26 2005 23:32:00}" (exactly history start)' '
+test_expect_success REFFILES 'Query "main@{May 26 2005 23:32:00}" (exactly history start)' '
 	test_when_finished "rm -f o e" &&
 	git rev-parse --verify "main@{May 26 2005 23:32:00}" >o 2>e &&
 	echo "$C" >expect &&
 	test_cmp expect o &&
 	test_must_be_empty e
 '
-test_expect_success 'Query "main@{May 26 2005 23:32:30}" (first non-creation change)' '
+test_expect_success REFFILES 'Query "main@{May 26 2005 23:32:30}" (first non-creation change)' '
 	test_when_finished "rm -f o e" &&
 	git rev-parse --verify "main@{May 26 2005 23:32:30}" >o 2>e &&
 	echo "$A" >expect &&
 	test_cmp expect o &&
 	test_must_be_empty e
 '
-test_expect_success 'Query "main@{2005-05-26 23:33:01}" (middle of history with gap)' '
+test_expect_success REFFILES 'Query "main@{2005-05-26 23:33:01}" (middle of history with gap)' '
 	test_when_finished "rm -f o e" &&
 	git rev-parse --verify "main@{2005-05-26 23:33:01}" >o 2>e &&
 	echo "$B" >expect &&
 	test_cmp expect o &&
 	test_i18ngrep -F "warning: log for ref $m has gap after $gd" e
 '
-test_expect_success 'Query "main@{2005-05-26 23:38:00}" (middle of history)' '
+test_expect_success REFFILES 'Query "main@{2005-05-26 23:38:00}" (middle of history)' '
 	test_when_finished "rm -f o e" &&
 	git rev-parse --verify "main@{2005-05-26 23:38:00}" >o 2>e &&
 	echo "$Z" >expect &&
 	test_cmp expect o &&
 	test_must_be_empty e
 '
-test_expect_success 'Query "main@{2005-05-26 23:43:00}" (exact end of history)' '
+test_expect_success REFFILES 'Query "main@{2005-05-26 23:43:00}" (exact end of history)' '
 	test_when_finished "rm -f o e" &&
 	git rev-parse --verify "main@{2005-05-26 23:43:00}" >o 2>e &&
 	echo "$E" >expect &&
 	test_cmp expect o &&
 	test_must_be_empty e
 '
-test_expect_success 'Query "main@{2005-05-28}" (past end of history)' '
+test_expect_success REFFILES 'Query "main@{2005-05-28}" (past end of history)' '
 	test_when_finished "rm -f o e" &&
 	git rev-parse --verify "main@{2005-05-28}" >o 2>e &&
 	echo "$D" >expect &&
@@ -465,7 +465,7 @@ $h_TEST $h_OTHER $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> 1117150860 +0000	com
 $h_OTHER $h_FIXED $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> 1117151040 +0000	commit (amend): The other day this did not work.
 $h_FIXED $h_MERGED $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> 1117151100 +0000	commit (merge): Merged initial commit and a later commit.
 EOF
-test_expect_success 'git commit logged updates' '
+test_expect_success REFFILES 'git commit logged updates' '
 	test-tool ref-store main for-each-reflog-ent $m >actual &&
 	test_cmp expect actual
 '
@@ -1632,7 +1632,7 @@ test_expect_success PIPE 'transaction flushes status updates' '
 	test_cmp expected actual
 '
 
-test_expect_success 'directory not created deleting packed ref' '
+test_expect_success REFFILES 'directory not created deleting packed ref' '
 	git branch d1/d2/r1 HEAD &&
 	git pack-refs --all &&
 	test_path_is_missing .git/refs/heads/d1/d2 &&
@@ -0,0 +1,90 @@
+#!/bin/sh
+
+test_description='name hash snapshot stored in the index'
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+sane_unset GIT_TEST_NAME_HASH_SNAPSHOT
+
+dump_tables () {
+	test-tool lazy-init-name-hash --dump "$@" >out &&
+	sort out
+}
+
+test_expect_success 'setup' '
+	(
+		test_seq 10 | sed "s/^/top_/" &&
+		test_seq 10 | sed "s|^|dir/sub/file_|" &&
+		test_seq 10 | sed "s|^|Dir/other_|" &&
+		test_seq 5 | sed "s|^|deep/a/b/c/d/file_|" &&
+		echo "deep/a/x"
+	) |
+	sed "s/^/100644 $EMPTY_BLOB	/" |
+	git update-index --index-info
+'
+
+test_expect_success 'no snapshot is written by default' '
+	git update-index --force-write-index &&
+	test_must_fail test-tool lazy-init-name-hash --dump --snapshot 2>err &&
+	grep "has no name hash snapshot" err
+'
+
+test_expect_success 'snapshot builds the same tables' '
+	git -c core.ignorecase=true -c index.nameHashSnapshot=true \
+		update-index --force-write-index &&
+	dump_tables --single >expect &&
+	dump_tables --snapshot >actual &&
+	test_cmp expect actual &&
+	grep "^dir " actual
+'
+
+test_expect_success 'snapshot written without ignorecase lacks directories' '
+	git -c core.ignorecase=false -c index.nameHashSnapshot=true \
+		update-index --force-write-index &&
+	dump_tables --single >expect &&
+	dump_tables --snapshot >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'snapshot follows index updates' '
+	test_config index.nameHashSnapshot true &&
+	git -c core.ignorecase=true update-index --add --cacheinfo \
+		100644,$EMPTY_BLOB,dir/sub/new &&
+	git -c core.ignorecase=true update-index --force-remove top_1 &&
+	dump_tables --single >expect &&
+	dump_tables --snapshot >actual &&
+	test_cmp expect actual &&
+	grep "dir/sub/new" actual &&
+	! grep "top_1$" actual
+'
+
+test_expect_success 'snapshot is used for case-insensitive lookups' '
+	test_config core.ignorecase true &&
+	git -c index.nameHashSnapshot=false update-index --force-write-index &&
+	git -c index.nameHashSnapshot=false status --porcelain >.git/expect &&
+	test_config index.nameHashSnapshot true &&
+	git update-index --force-write-index &&
+	GIT_TRACE2_PERF="$(pwd)/.git/trace.perf" git status --porcelain >.git/actual &&
+	test_cmp .git/expect .git/actual &&
+	grep "name-hash-init/snapshot" .git/trace.perf
+'
+
+test_expect_success 'snapshot is used to fold the case of added paths' '
+	test_config core.ignorecase true &&
+	mkdir -p DIR/SUB &&
+	>DIR/SUB/added &&
+	git -c index.nameHashSnapshot=false add DIR/SUB/added &&
+	git ls-files >expect &&
+	git rm -q --cached "$(grep -i "^dir/sub/added$" expect)" &&
+
+	test_config index.nameHashSnapshot true &&
+	git update-index --force-write-index &&
+	rm -f .git/trace.perf &&
+	GIT_TRACE2_PERF="$(pwd)/.git/trace.perf" git add DIR/SUB/added &&
+	git ls-files >actual &&
+	test_cmp expect actual &&
+	grep "name-hash-init/snapshot" .git/trace.perf
+'
+
+test_done
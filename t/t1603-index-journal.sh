@@ -0,0 +1,174 @@
+#!/bin/sh
+
+test_description='index journal'
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_SPLIT_INDEX GIT_TEST_INDEX_JOURNAL
+
+# Files must not be racily clean, or the index is rewritten in full to
+# smudge them.
+age_worktree () {
+	git ls-files -z | xargs -0 test-tool chmtime =-60
+}
+
+# Start over from a freshly written journaled index.
+reset_index () {
+	git reset -q --hard &&
+	age_worktree &&
+	git -c index.journal=false update-index --refresh &&
+	git update-index --force-write-index
+}
+
+journal_data () {
+	grep "\"key\":\"$1\",\"value\":\"$2\"" trace
+}
+
+test_expect_success 'setup' '
+	git config index.journal true &&
+	for i in $(test_seq 50)
+	do
+		echo $i >file$i || return 1
+	done &&
+	git add . &&
+	git commit -m initial &&
+	git -c index.journal=false ls-files -s >expect &&
+	age_worktree &&
+	git -c index.journal=false update-index --refresh &&
+	! grep jrnl .git/index &&
+	git update-index --force-write-index &&
+	grep jrnl .git/index &&
+	test_path_is_missing .git/index.journal
+'
+
+test_expect_success 'small updates are written to the journal' '
+	test_when_finished reset_index &&
+	cp .git/index index.base &&
+	echo changed >file1 &&
+	test-tool chmtime =-60 file1 &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git add file1 &&
+	journal_data write/journal_entries 1 &&
+	test_path_is_file .git/index.journal &&
+	test_cmp_bin index.base .git/index &&
+
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git rm -q file2 &&
+	journal_data read/journal_entries 1 &&
+	journal_data write/journal_entries 1 &&
+	test_cmp_bin index.base .git/index &&
+
+	git diff --cached --name-status >actual &&
+	cat >expect.diff <<-\EOF &&
+	M	file1
+	D	file2
+	EOF
+	test_cmp expect.diff actual &&
+	git -c index.journal=false diff --cached --name-status >actual &&
+	test_cmp expect.diff actual &&
+	git fsck
+'
+
+test_expect_success 'the journal is cumulative' '
+	test_when_finished reset_index &&
+	for i in 3 4 5
+	do
+		echo changed >file$i &&
+		test-tool chmtime =-60 file$i &&
+		git add file$i || return 1
+	done &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git update-index --force-write-index &&
+	journal_data read/journal_entries 3 &&
+	journal_data write/journal_entries 3 &&
+	git diff --cached --name-only >actual &&
+	test_write_lines file3 file4 file5 >expect.diff &&
+	test_cmp expect.diff actual
+'
+
+test_expect_success 'repeated writes keep appending' '
+	test_when_finished reset_index &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" test-tool write-cache 3 &&
+	grep "\"key\":\"write/journal_entries\"" trace >writes &&
+	test_line_count = 3 writes &&
+	git -c index.journal=false ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'broken journal is ignored' '
+	test_when_finished reset_index &&
+	echo changed >file6 &&
+	test-tool chmtime =-60 file6 &&
+	git add file6 &&
+	size=$(wc -c <.git/index.journal) &&
+	test_copy_bytes $((size - 1)) <.git/index.journal >journal.torn &&
+	mv journal.torn .git/index.journal &&
+	git diff --cached --name-only >actual &&
+	test_must_be_empty actual &&
+	git -c index.journal=false ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'journal of an older index is ignored' '
+	test_when_finished "rm -f journal.old && reset_index" &&
+	echo changed >file6 &&
+	test-tool chmtime =-60 file6 &&
+	git add file6 &&
+	cp .git/index.journal journal.old &&
+	git -c index.journalMaxPercentChange=0 reset -q &&
+	test_path_is_missing .git/index.journal &&
+	cp journal.old .git/index.journal &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git diff --cached --name-only >actual &&
+	! journal_data read/journal_entries "[0-9]*" &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'index is rewritten in full past the change threshold' '
+	test_when_finished reset_index &&
+	echo changed >file7 &&
+	test-tool chmtime =-60 file7 &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c index.journalMaxPercentChange=0 add file7 &&
+	! journal_data write/journal_entries "[0-9]*" &&
+	journal_data write/cache_nr 50 &&
+	grep jrnl .git/index &&
+	test_path_is_missing .git/index.journal &&
+
+	echo changed >file8 &&
+	test-tool chmtime =-60 file8 &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git add file8 &&
+	! journal_data read/journal_entries "[0-9]*" &&
+	journal_data write/journal_entries 1
+'
+
+test_expect_success 'unpack_trees() rewrites the index in full' '
+	echo changed >file9 &&
+	test-tool chmtime =-60 file9 &&
+	git add file9 &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git reset --hard &&
+	! journal_data write/journal_entries "[0-9]*" &&
+	journal_data write/cache_nr 50 &&
+	test_path_is_missing .git/index.journal &&
+	git -c index.journal=false ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'journaled index is not used with split index' '
+	test_when_finished "git update-index --no-split-index && reset_index" &&
+	git update-index --split-index &&
+	test_path_is_file .git/sharedindex.* &&
+	! grep jrnl .git/index &&
+	echo changed >file10 &&
+	test-tool chmtime =-60 file10 &&
+	git add file10 &&
+	git diff --cached --name-only >actual &&
+	echo file10 >expect.diff &&
+	test_cmp expect.diff actual
+'
+
+test_done
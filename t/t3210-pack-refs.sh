@@ -14,6 +14,12 @@ export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
 
 . ./test-lib.sh
 
+if ! test_have_prereq REFFILES
+then
+	skip_all='skipping files-backend specific pack-refs tests'
+	test_done
+fi
+
 test_expect_success 'enable reflogs' '
 	git config core.logallrefupdates true
 '
@@ -241,6 +247,76 @@ test_expect_success 'retry acquiring packed-refs.lock' '
 	git -c core.packedrefstimeout=3000 pack-refs --all --prune
 '
 
+test_expect_success 'setup refs for packed-refs.idx' '
+	git pack-refs --all --prune &&
+	for ns in heads tags notes pull/1 a zz
+	do
+		for i in 1 2 3 10 20
+		do
+			echo "create refs/$ns/idx-$i HEAD" || return 1
+		done
+	done >input &&
+	git update-ref --stdin <input &&
+	git for-each-ref >all-refs-loose
+'
+
+test_expect_success 'pack-refs writes packed-refs.idx with core.packedRefsIndex' '
+	git -c core.packedRefsIndex=true pack-refs --all --prune &&
+	test_path_is_file .git/packed-refs.idx &&
+	test_path_is_missing .git/refs/heads/idx-1 &&
+	git for-each-ref >all-refs-indexed &&
+	test_cmp all-refs-loose all-refs-indexed
+'
+
+test_expect_success 'packed-refs.idx is used for lookups' '
+	test_when_finished "rm -f trace.txt" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" git rev-parse --verify refs/heads/idx-1 &&
+	grep "\"key\":\"index/records\"" trace.txt &&
+	for ns in heads tags notes pull/1 a zz
+	do
+		git for-each-ref --format="%(refname)" refs/$ns/ >actual &&
+		sed -n "s|^.*	\(refs/$ns/\)|\1|p" all-refs-loose >expect &&
+		test_cmp expect actual &&
+		git rev-parse --verify refs/$ns/idx-10 &&
+		test_must_fail git rev-parse --verify refs/$ns/idx-4 || return 1
+	done &&
+	git for-each-ref --format="%(refname)" refs/nothere/ >actual &&
+	test_must_be_empty actual &&
+	git for-each-ref --format="%(refname)" refs/zzz/ >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'packed-refs.idx is kept up to date by ref updates' '
+	test_config core.packedRefsIndex true &&
+	git update-ref -d refs/tags/idx-2 &&
+	test_path_is_file .git/packed-refs.idx &&
+	test_must_fail git rev-parse --verify refs/tags/idx-2 &&
+	git rev-parse --verify refs/tags/idx-3 &&
+	git update-ref refs/tags/idx-2 HEAD &&
+	git pack-refs --all --prune &&
+	git for-each-ref >actual &&
+	test_cmp all-refs-loose actual
+'
+
+test_expect_success 'stale or broken packed-refs.idx is ignored' '
+	test_when_finished "rm -f trace.txt" &&
+	git -c core.packedRefsIndex=true pack-refs --all --prune &&
+	cp .git/packed-refs.idx stale-idx &&
+	git update-ref refs/heads/idx-15 HEAD &&
+	git pack-refs --all --prune &&
+	test_path_is_missing .git/packed-refs.idx &&
+	cp stale-idx .git/packed-refs.idx &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" git rev-parse --verify refs/heads/idx-15 &&
+	! grep "index/records" trace.txt &&
+	git for-each-ref --format="%(refname)" refs/heads/idx-15 >actual &&
+	echo refs/heads/idx-15 >expect &&
+	test_cmp expect actual &&
+	echo garbage >.git/packed-refs.idx &&
+	git rev-parse --verify refs/heads/idx-15 &&
+	rm -f .git/packed-refs.idx &&
+	git update-ref -d refs/heads/idx-15
+'
+
 test_expect_success SYMLINKS 'pack symlinked packed-refs' '
 	# First make sure that symlinking works when reading:
 	git update-ref refs/heads/lossy refs/heads/main &&
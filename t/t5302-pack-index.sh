@@ -116,6 +116,23 @@ test_expect_success OFF64_T 'index-pack --verify on 64-bit offset v2' '
 	git index-pack --verify "test-3-${pack3}.pack"
 '
 
+test_expect_success PTHREADS 'threaded index-pack produces the same index' '
+	git index-pack --threads=1 -o single.idx "test-1-${pack1}.pack" &&
+	git index-pack --threads=4 -o threaded.idx "test-1-${pack1}.pack" &&
+	cmp single.idx threaded.idx &&
+	git -c core.bigFileThreshold=2k \
+		index-pack --threads=4 -o big.idx "test-1-${pack1}.pack" &&
+	cmp single.idx big.idx
+'
+
+test_expect_success PTHREADS 'threaded index-pack --strict --stdin' '
+	rm -rf strict.git &&
+	git init --bare strict.git &&
+	git -C strict.git index-pack --threads=4 --strict --stdin \
+		<"test-1-${pack1}.pack" &&
+	git -C strict.git verify-pack "objects/pack/pack-${pack1}.idx"
+'
+
 # returns the object number for given object in given pack index
 index_obj_nr()
 {
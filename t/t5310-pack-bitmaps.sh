@@ -28,17 +28,20 @@ has_any () {
 
 test_bitmap_cases () {
 	writeLookupTable=false
+	bitmapVersion=1
 	for i in "$@"
 	do
 		case "$i" in
 		"pack.writeBitmapLookupTable") writeLookupTable=true;;
+		"pack.bitmapVersion=2") bitmapVersion=2;;
 		esac
 	done
 
 	test_expect_success 'setup test repository' '
 		rm -fr * .git &&
 		git init &&
-		git config pack.writeBitmapLookupTable '"$writeLookupTable"'
+		git config pack.writeBitmapLookupTable '"$writeLookupTable"' &&
+		git config pack.bitmapVersion '"$bitmapVersion"'
 	'
 	setup_bitmap_history
 
@@ -259,7 +262,7 @@ test_bitmap_cases () {
 	test_expect_success 'truncated bitmap fails gracefully (ewah)' '
 		test_config pack.writebitmaphashcache false &&
 		test_config pack.writebitmaplookuptable false &&
-		git repack -ad &&
+		GIT_TEST_BITMAP_VERSION=1 git repack -ad &&
 		git rev-list --use-bitmap-index --count --all >expect &&
 		bitmap=$(ls .git/objects/pack/*.bitmap) &&
 		test_when_finished "rm -f $bitmap" &&
@@ -468,4 +471,115 @@ test_expect_success 'truncated bitmap fails gracefully (lookup table)' '
 	test_i18ngrep corrupted.bitmap.index stderr
 '
 
+test_bitmap_cases "pack.bitmapVersion=2"
+
+test_bitmap_cases "pack.bitmapVersion=2" "pack.writeBitmapLookupTable"
+
+test_expect_success 'version 2 bitmap is written when configured' '
+	test_config pack.bitmapVersion 2 &&
+	(
+		sane_unset GIT_TEST_BITMAP_VERSION &&
+		git repack -adb
+	) &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	test_copy_bytes 6 <$bitmap | tail -c 2 | od -An -tx1 >actual &&
+	echo " 00 02" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'truncated bitmap fails gracefully (roaring)' '
+	test_config pack.writebitmaphashcache false &&
+	test_config pack.writebitmaplookuptable false &&
+	GIT_TEST_BITMAP_VERSION=2 git repack -ad &&
+	git rev-list --use-bitmap-index --count --all >expect &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	test_when_finished "rm -f $bitmap" &&
+	test_copy_bytes 256 <$bitmap >$bitmap.tmp &&
+	mv -f $bitmap.tmp $bitmap &&
+	git rev-list --use-bitmap-index --count --all >actual 2>stderr &&
+	test_cmp expect actual &&
+	test_i18ngrep corrupt.roaring.bitmap stderr
+'
+
+test_expect_success 'roaring container past the last object is rejected' '
+	test_config pack.writebitmaphashcache false &&
+	test_config pack.writebitmaplookuptable false &&
+	GIT_TEST_BITMAP_VERSION=2 git repack -ad &&
+	git rev-list --use-bitmap-index --count --all >expect &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	test_when_finished "rm -f $bitmap" &&
+	# skip the header and the four type bitmaps, then the position,
+	# XOR offset and flags of the first commit, and its container
+	# count, and set the key of its first container to 0xffff
+	perl -e "
+		binmode STDIN; binmode STDOUT;
+		local \$/; my \$buf = <STDIN>;
+		my \$pos = 12 + $(test_oid rawsz);
+		for (1..4) {
+			my \$words = unpack(\"N\", substr(\$buf, \$pos + 4, 4));
+			\$pos += 12 + 8 * \$words;
+		}
+		substr(\$buf, \$pos + 10, 2) = pack(\"n\", 0xffff);
+		print \$buf;
+	" <$bitmap >$bitmap.tmp &&
+	mv -f $bitmap.tmp $bitmap &&
+	git rev-list --use-bitmap-index --count --all >actual 2>stderr &&
+	test_cmp expect actual &&
+	test_i18ngrep "container 65535 past the last object" stderr
+'
+
+test_expect_success 'bad pack.bitmapVersion' '
+	test_config pack.bitmapVersion 3 &&
+	(
+		sane_unset GIT_TEST_BITMAP_VERSION &&
+		test_must_fail git repack -adb 2>err
+	) &&
+	test_i18ngrep "bad pack.bitmapVersion=3" err
+'
+
+test_expect_success 'bitmaps built on several threads are identical' '
+	rm -f .git/objects/pack/*.bitmap &&
+	GIT_TEST_BITMAP_THREADS=1 git -c pack.threads=1 repack -adb &&
+	cp .git/objects/pack/*.bitmap expect.bitmap &&
+	rm -f .git/objects/pack/*.bitmap &&
+	GIT_TRACE2_EVENT="$(pwd)/trace2" GIT_TEST_BITMAP_THREADS=4 \
+		git -c pack.threads=1 repack -adb &&
+	grep "\"key\":\"build/threads\",\"value\":\"4\"" trace2 &&
+	test_cmp_bin expect.bitmap .git/objects/pack/*.bitmap &&
+	git rev-list --test-bitmap HEAD
+'
+
+test_expect_success 'shared trees are walked once while building bitmaps' '
+	git init shared-trees &&
+	(
+		cd shared-trees &&
+		mkdir -p shared/dir &&
+		echo one >shared/one &&
+		echo two >shared/dir/two &&
+		git add shared &&
+		test_commit base &&
+		git checkout -b side &&
+		test_commit side &&
+		git checkout - &&
+		test_commit main &&
+
+		GIT_TRACE2_EVENT="$(pwd)/trace2" GIT_TEST_BITMAP_THREADS=1 \
+			git repack -adb &&
+		grep "\"key\":\"build/tree_bitmaps\",\"value\":\"1\"" trace2 &&
+		git rev-list --test-bitmap HEAD &&
+
+		echo three >shared/dir/three &&
+		git add shared &&
+		test_commit tip &&
+		for range in "tip" "tip ^main" "tip ^side" "tip side"
+		do
+			git rev-list --objects $range >expect.raw &&
+			cut -d" " -f1 expect.raw | sort >expect &&
+			git rev-list --objects --use-bitmap-index $range >actual.raw &&
+			sort actual.raw >actual &&
+			test_cmp expect actual || return 1
+		done
+	)
+'
+
 test_done
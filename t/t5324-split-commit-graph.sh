@@ -463,6 +463,66 @@ test_expect_success 'prevent regression for duplicate commits across layers' '
 	git -C dup commit-graph verify
 '
 
+test_expect_success 'commitGraph.writeChainLookup writes a lookup index' '
+	rm -rf $graphdir $infodir/commit-graph &&
+	test_config commitGraph.writeChainLookup true &&
+	git rev-parse commits/1 >a &&
+	git rev-parse commits/4 >b &&
+	git rev-parse merge/2 >c &&
+	git commit-graph write --split=no-merge --stdin-commits <a &&
+	git commit-graph write --split=no-merge --stdin-commits <b &&
+	git commit-graph write --split=no-merge --stdin-commits <c &&
+	test_line_count = 3 $graphdir/commit-graph-chain &&
+	test_path_is_file $graphdir/commit-graph-chain.lookup &&
+	test-tool read-graph >output &&
+	grep "^options:.* chain_lookup" output &&
+	git commit-graph verify
+'
+
+graph_git_behavior 'chain with lookup index' merge/2 commits/6
+
+test_expect_success 'corrupt chain lookup position is not trusted' '
+	lookup=$graphdir/commit-graph-chain.lookup &&
+	cp $lookup good.lookup &&
+	test_when_finished "mv good.lookup $lookup" &&
+	size=$(test_file_size $lookup) &&
+	corrupt_file $lookup $(($size - $(test_oid rawsz) - 4)) "\377" &&
+	graph_git_two_modes "log --oneline merge/2" &&
+	graph_git_two_modes "merge-base -a merge/2 commits/6" &&
+	test_must_fail git commit-graph verify 2>err &&
+	test_i18ngrep "chain lookup index has incorrect checksum" err
+'
+
+test_expect_success 'chain lookup index with a bad chunk is ignored' '
+	lookup=$graphdir/commit-graph-chain.lookup &&
+	cp $lookup good.lookup &&
+	test_when_finished "mv good.lookup $lookup" &&
+	# the last byte of the offset of the fanout chunk, which is the
+	# second entry in the table of contents
+	corrupt_file $lookup $((8 + 12 + 11)) "\001" &&
+	test-tool read-graph >output &&
+	! grep "chain_lookup" output &&
+	graph_git_two_modes "log --oneline merge/2"
+'
+
+test_expect_success 'stale chain lookup index is ignored' '
+	cp $graphdir/commit-graph-chain.lookup stale.lookup &&
+	git rev-parse merge/1 >d &&
+	git commit-graph write --split=no-merge --stdin-commits <d &&
+	test_path_is_missing $graphdir/commit-graph-chain.lookup &&
+	cp stale.lookup $graphdir/commit-graph-chain.lookup &&
+	test-tool read-graph >output &&
+	! grep "chain_lookup" output &&
+	graph_git_two_modes "log --oneline merge/1" &&
+	graph_git_two_modes "merge-base -a merge/1 merge/2"
+'
+
+test_expect_success 'chain lookup index is removed when the chain is flattened' '
+	git commit-graph write --reachable &&
+	test_path_is_missing $graphdir/commit-graph-chain &&
+	test_path_is_missing $graphdir/commit-graph-chain.lookup
+'
+
 NUM_FIRST_LAYER_COMMITS=64
 NUM_SECOND_LAYER_COMMITS=16
 NUM_THIRD_LAYER_COMMITS=7
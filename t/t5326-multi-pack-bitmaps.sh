@@ -78,6 +78,7 @@ bitmap_reuse_tests() {
 test_midx_bitmap_cases () {
 	writeLookupTable=false
 	writeBitmapLookupTable=
+	bitmapVersion=1
 
 	for i in "$@"
 	do
@@ -86,13 +87,17 @@ test_midx_bitmap_cases () {
 			writeLookupTable=true
 			writeBitmapLookupTable="$i"
 			;;
+		"pack.bitmapVersion=2")
+			bitmapVersion=2
+			;;
 		esac
 	done
 
 	test_expect_success 'setup test_repository' '
 		rm -rf * .git &&
 		git init &&
-		git config pack.writeBitmapLookupTable '"$writeLookupTable"'
+		git config pack.writeBitmapLookupTable '"$writeLookupTable"' &&
+		git config pack.bitmapVersion '"$bitmapVersion"'
 	'
 
 	midx_bitmap_core
@@ -351,6 +356,8 @@ test_midx_bitmap_cases
 
 test_midx_bitmap_cases "pack.writeBitmapLookupTable"
 
+test_midx_bitmap_cases "pack.bitmapVersion=2" "pack.writeBitmapLookupTable"
+
 test_expect_success 'multi-pack-index write writes lookup table if enabled' '
 	rm -fr repo &&
 	git init repo &&
@@ -0,0 +1,228 @@
+#!/bin/sh
+
+test_description='incremental multi-pack-index layers'
+. ./test-lib.sh
+. "$TEST_DIRECTORY"/lib-bitmap.sh
+
+GIT_TEST_MULTI_PACK_INDEX=0
+GIT_TEST_MULTI_PACK_INDEX_WRITE_BITMAP=0
+sane_unset GIT_TEST_MIDX_WRITE_REV
+sane_unset GIT_TEST_MIDX_READ_RIDX
+
+packdir=.git/objects/pack
+midx_chain=$packdir/multi-pack-index.d/multi-pack-index-chain
+
+# new_packs <name>...: make a commit and a pack for each <name>
+new_packs () {
+	for n in "$@"
+	do
+		test_commit "$n" &&
+		git repack -d || return 1
+	done
+}
+
+test_expect_success 'setup' '
+	git config core.multiPackIndex true &&
+	new_packs one two three &&
+	git multi-pack-index write --bitmap &&
+	test_path_is_missing $packdir/multi-pack-index.d
+'
+
+test_expect_success 'incremental write adds a layer for new packs' '
+	new_packs four five &&
+	git multi-pack-index write --incremental --bitmap &&
+	test_line_count = 1 $midx_chain &&
+	layer=$(cat $midx_chain) &&
+	test_path_is_file $packdir/multi-pack-index.d/multi-pack-index-$layer.midx &&
+	test_path_is_file $packdir/multi-pack-index.d/multi-pack-index-$layer.bitmap
+'
+
+test_expect_success 'incremental write without new packs does nothing' '
+	cp $midx_chain chain.before &&
+	git multi-pack-index write --incremental --bitmap &&
+	test_cmp chain.before $midx_chain
+'
+
+test_expect_success 'objects of all layers are found' '
+	new_packs six &&
+	git multi-pack-index write --incremental --bitmap &&
+	test_line_count = 2 $midx_chain &&
+	for n in one three five six
+	do
+		git cat-file -e $n:$n.t || return 1
+	done &&
+	git rev-list --objects --all >expect &&
+	GIT_TEST_MULTI_PACK_INDEX=1 git rev-list --objects --all >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'bitmaps of the layers are consistent' '
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --test-bitmap five &&
+	git rev-list --test-bitmap two
+'
+
+test_expect_success 'traversals use the bitmaps of the layers' '
+	for range in "HEAD" "HEAD ^two" "six ^four" "--all"
+	do
+		git rev-list --objects $range >expect.raw &&
+		cut -d" " -f1 expect.raw | sort >expect &&
+		rm -f trace.perf &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.perf" \
+			git rev-list --objects --use-bitmap-index $range >actual.raw &&
+		sort actual.raw >actual &&
+		test_cmp expect actual &&
+		grep "\"category\":\"load_midx_revindex\"" trace.perf >loads &&
+		test_line_count = 3 loads || return 1
+	done &&
+	git rev-list --objects --disk-usage HEAD >expect &&
+	git rev-list --objects --disk-usage --use-bitmap-index HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'count-objects --reachable with the bitmaps of the layers' '
+	git -c core.multiPackIndex=false count-objects --reachable >expect &&
+	git count-objects --reachable >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack-objects with the bitmaps of the layers' '
+	git pack-objects --stdout --revs --use-bitmap-index <<-\EOF >all.pack &&
+	HEAD
+	EOF
+	git index-pack -o all.idx all.pack &&
+	git show-index <all.idx >all.objects &&
+	git rev-list --objects HEAD >expect &&
+	test_line_count = $(wc -l <expect) all.objects
+'
+
+test_expect_success 'a layer not matching the chain is ignored' '
+	test_when_finished "mv chain.save $midx_chain" &&
+	cp $midx_chain chain.save &&
+	tail -n 1 chain.save >$midx_chain &&
+	git cat-file -e one:one.t 2>err &&
+	test_i18ngrep "does not match" err &&
+	git cat-file -e six:six.t
+'
+
+test_expect_success 'verify checks every layer' '
+	git multi-pack-index verify &&
+	layer=$(tail -n 1 $midx_chain) &&
+	layer_file=$packdir/multi-pack-index.d/multi-pack-index-$layer.midx &&
+	test_when_finished "mv layer.save $layer_file" &&
+	cp $layer_file layer.save &&
+	chmod u+w $layer_file &&
+	size=$(test_file_size $layer_file) &&
+	printf "\377" | dd of=$layer_file bs=1 seek=$((size - 1)) conv=notrunc &&
+	test_must_fail git multi-pack-index verify 2>err &&
+	test_i18ngrep "incorrect checksum" err &&
+	test_i18ngrep "layer $layer has checksum" err
+'
+
+test_expect_success 'verify reports a layer not matching the chain' '
+	test_when_finished "mv chain.save $midx_chain" &&
+	cp $midx_chain chain.save &&
+	top=$(tail -n 1 chain.save) &&
+	tail -n 1 chain.save >$midx_chain &&
+	test_must_fail git multi-pack-index verify 2>err &&
+	test_i18ngrep "layer $top has 2 bases, expected 1" err
+'
+
+test_expect_success 'verify reports a missing layer' '
+	test_when_finished "mv chain.save $midx_chain" &&
+	cp $midx_chain chain.save &&
+	echo $(test_oid zero) >>$midx_chain &&
+	test_must_fail git multi-pack-index verify 2>err &&
+	test_i18ngrep "failed to load multi-pack-index layer $(test_oid zero)" err
+'
+
+test_expect_success 'incremental bitmap needs a bitmap below' '
+	test_when_finished "rm -fr nobitmap" &&
+	git init nobitmap &&
+	(
+		cd nobitmap &&
+		new_packs a &&
+		git multi-pack-index write &&
+		new_packs b &&
+		test_must_fail git multi-pack-index write --incremental --bitmap &&
+		test_path_is_missing $packdir/multi-pack-index.d &&
+		git multi-pack-index write --incremental &&
+		git cat-file -e b:b.t
+	)
+'
+
+test_expect_success 'incremental write is incompatible with --preferred-pack' '
+	test_must_fail git multi-pack-index write --incremental \
+		--preferred-pack=pack-x.idx 2>err &&
+	test_i18ngrep "cannot be used together" err
+'
+
+test_expect_success 'incremental write of selected packs' '
+	test_when_finished "rm -fr selected" &&
+	git init selected &&
+	(
+		cd selected &&
+		new_packs a &&
+		git multi-pack-index write &&
+		new_packs b &&
+		ls $packdir | grep "\.idx$" | sort >before &&
+		new_packs c &&
+		ls $packdir | grep "\.idx$" | sort >after &&
+		comm -13 before after >new &&
+		test_line_count = 1 new &&
+		git multi-pack-index write --incremental --stdin-packs <new &&
+		test_line_count = 1 $midx_chain &&
+		git multi-pack-index verify &&
+		git multi-pack-index write --incremental &&
+		test_line_count = 2 $midx_chain
+	)
+'
+
+test_expect_success 'writing without --incremental collapses the chain' '
+	git multi-pack-index write --bitmap &&
+	test_path_is_missing $packdir/multi-pack-index.d &&
+	git rev-list --test-bitmap HEAD &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'geometric repack adds a layer on top of the chain' '
+	git init geometric &&
+	(
+		cd geometric &&
+		git config core.multiPackIndex true &&
+		test_commit_bulk --id=base 20 &&
+		git repack -d &&
+		git multi-pack-index write --bitmap &&
+		test_commit_bulk --id=layer 10 &&
+		git repack -d &&
+		git multi-pack-index write --incremental --bitmap &&
+		test_line_count = 1 $midx_chain &&
+
+		new_packs small1 small2 &&
+		ls $packdir/*.pack >packs.before &&
+		git repack --geometric=2 -d --write-midx --write-bitmap-index &&
+		ls $packdir/*.pack >packs.after &&
+		test_line_count = 4 packs.before &&
+		test_line_count = 3 packs.after &&
+		test_line_count = 2 $midx_chain &&
+		git multi-pack-index verify &&
+		git rev-list --test-bitmap HEAD &&
+		git rev-list --objects --all >expect.raw &&
+		cut -d" " -f1 expect.raw | sort >expect &&
+		git rev-list --objects --all --use-bitmap-index >actual.raw &&
+		sort actual.raw >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'repack removing packs of the chain collapses it' '
+	(
+		cd geometric &&
+		git repack -a -d --write-midx --write-bitmap-index &&
+		test_path_is_missing $packdir/multi-pack-index.d &&
+		git multi-pack-index verify &&
+		git rev-list --test-bitmap HEAD
+	)
+'
+
+test_done
@@ -62,6 +62,43 @@ test_expect_success 'rev-list --disk-usage=human with bitmaps' '
 	grep "$(cat actual_size) bytes" actual
 '
 
+# Like the "reachable" lines of "count-objects --reachable -H", as long as
+# no size is above 1KiB.
+reachable_slow () {
+	git rev-list --objects --all --no-object-names |
+	git cat-file --batch-check="%(objecttype) %(objectsize) %(objectsize:disk)" |
+	perl -lane '
+		$n{$F[0]}++; $s{$F[0]} += $F[1]; $d{$F[0]} += $F[2];
+		END {
+			for my $t (qw(commit tree blob tag)) {
+				print "reachable-${t}s: ", $n{$t} || 0;
+				for (["size", $s{$t} || 0], ["disk-usage", $d{$t} || 0]) {
+					my ($k, $v) = @$_;
+					die "too big" if $v > 1024;
+					print "reachable-${t}s-$k: $v byte", $v == 1 ? "" : "s";
+				}
+			}
+		}
+	'
+}
+
+test_expect_success 'count-objects --reachable' '
+	reachable_slow >expect &&
+	git count-objects -H --reachable >out &&
+	grep "^reachable-" out >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'count-objects --reachable without bitmaps' '
+	reachable_slow >expect &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	test_when_finished "mv $bitmap.bak $bitmap" &&
+	mv $bitmap $bitmap.bak &&
+	git count-objects -H --reachable >out &&
+	grep "^reachable-" out >actual &&
+	test_cmp expect actual
+'
+
 test_expect_success 'rev-list use --disk-usage unproperly' '
 	test_must_fail git rev-list --objects HEAD --disk-usage=typo 2>err &&
 	cat >expect <<-\EOF &&
@@ -0,0 +1,93 @@
+#!/bin/sh
+
+test_description='untracked file scan reading directories on threads'
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_UNTRACKED_SCAN_THREADS
+
+test_expect_success 'setup' '
+	git config core.untrackedCache false &&
+	for d in $(test_seq 6)
+	do
+		mkdir -p dir$d/sub &&
+		echo $d >dir$d/tracked &&
+		echo $d >dir$d/sub/tracked || return 1
+	done &&
+	echo "*.o" >.gitignore &&
+	git add . &&
+	git commit -m tracked &&
+
+	mkdir -p dir2/new/deeper dir4/sub/empty dir5/build &&
+	echo new >dir2/new/deeper/file &&
+	echo new >dir3/sub/untracked &&
+	echo obj >dir5/build/obj.o &&
+	echo obj >dir6/sub/obj.o &&
+	echo top >untracked
+'
+
+# scan_on_threads <git-args>: run the command with and without threads,
+# and check that the output is the same. The output is kept out of the
+# worktree, in .git/expect and .git/actual, not to be found by the scan.
+scan_on_threads () {
+	git -c core.untrackedScanThreads=1 "$@" >.git/expect &&
+	git -c core.untrackedScanThreads=4 "$@" >.git/actual &&
+	test_cmp .git/expect .git/actual
+}
+
+test_expect_success 'status finds the same untracked and ignored files' '
+	scan_on_threads status --porcelain -uall --ignored &&
+	grep "^?? dir2/new/deeper/file" .git/actual &&
+	grep "^!! dir5/build/obj.o" .git/actual &&
+	scan_on_threads status --porcelain &&
+	grep "^?? dir2/new/$" .git/actual &&
+	cp .git/actual .git/normal
+'
+
+test_expect_success 'clean finds the same files' '
+	scan_on_threads clean -n -d -x &&
+	grep "Would remove dir6/sub/obj.o" .git/actual
+'
+
+test_expect_success 'ls-files finds the same directories' '
+	scan_on_threads ls-files -o --directory --exclude-standard &&
+	grep "^dir2/new/$" .git/actual &&
+	! grep "obj.o" .git/actual
+'
+
+test_expect_success 'directories are read ahead' '
+	GIT_TRACE2_PERF="$(pwd)/.git/trace" \
+		git -c core.untrackedScanThreads=4 status --porcelain &&
+	grep "prefetch/threads:3" .git/trace
+'
+
+test_expect_success 'no read-ahead with the untracked cache' '
+	git config core.untrackedCache true &&
+	git update-index --untracked-cache &&
+	rm -f .git/trace &&
+	GIT_TRACE2_PERF="$(pwd)/.git/trace" \
+		git -c core.untrackedScanThreads=4 status --porcelain >.git/actual &&
+	! grep "prefetch/threads" .git/trace &&
+	test_cmp .git/normal .git/actual
+'
+
+test_expect_success 'untracked directories are read ahead' '
+	git init untracked-only &&
+	(
+		cd untracked-only &&
+		git config core.untrackedCache false &&
+		for d in $(test_seq 4)
+		do
+			mkdir -p a$d/b/c &&
+			echo $d >a$d/b/c/file || return 1
+		done &&
+		scan_on_threads status --porcelain -uall &&
+		test_line_count = 4 .git/actual &&
+		GIT_TRACE2_PERF="$(pwd)/.git/trace" \
+			git -c core.untrackedScanThreads=4 status -uall &&
+		grep "prefetch/dirs_used" .git/trace >used &&
+		! grep "prefetch/dirs_used:0" used
+	)
+'
+
+test_done
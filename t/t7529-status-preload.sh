@@ -0,0 +1,78 @@
+#!/bin/sh
+
+test_description='git status with the index preloaded in batches'
+
+. ./test-lib.sh
+
+GIT_TEST_PRELOAD_INDEX=true
+export GIT_TEST_PRELOAD_INDEX
+sane_unset GIT_TEST_PRELOAD_IO_URING
+
+test_lazy_prereq IO_URING '
+	GIT_TRACE2_PERF="$(pwd)/io-uring-trace" \
+		git -c core.preloadIndex=true -c core.preloadIoUring=true \
+		status --porcelain &&
+	grep "preload/sum_statx_batch" io-uring-trace
+'
+
+test_expect_success 'setup' '
+	git config core.preloadIndex true &&
+	for i in $(test_seq 600)
+	do
+		mkdir -p dir$((i % 7)) &&
+		echo $i >dir$((i % 7))/file$i || return 1
+	done &&
+	echo link-target >target &&
+	git add . &&
+	git commit -m initial &&
+	test-tool chmtime =-60 $(git ls-files) &&
+
+	echo changed >dir1/file1 &&
+	echo changed >dir2/file2 &&
+	test-tool chmtime =-60 dir2/file2 &&
+	rm dir3/file3 &&
+	touch dir4/file4 &&
+	chmod +x dir5/file5 &&
+	cat >.gitignore <<-\EOF &&
+	.gitignore
+	*.trace
+	expect
+	actual
+	io-uring-trace
+	EOF
+	cat >expect <<-\EOF
+	 M dir1/file1
+	 M dir2/file2
+	 D dir3/file3
+	 M dir5/file5
+	EOF
+'
+
+test_expect_success SYMLINKS 'setup symlink' '
+	rm dir6/file6 &&
+	ln -s ../target dir6/file6 &&
+	echo " T dir6/file6" >>expect
+'
+
+test_expect_success 'status with lstat() preload' '
+	git -c core.preloadIoUring=false status --porcelain -uno >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'status with batched preload' '
+	GIT_TRACE2_PERF="$(pwd)/batch.trace" \
+		git -c core.preloadIoUring=true status --porcelain -uno >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success IO_URING 'lstat() calls were batched' '
+	grep "preload/sum_statx_batch:[1-9]" batch.trace
+'
+
+test_expect_success 'diff-files agrees after a batched preload' '
+	git -c core.preloadIoUring=true diff-files --name-status >actual &&
+	git -c core.preloadIoUring=false diff-files --name-status >expect &&
+	test_cmp expect actual
+'
+
+test_done
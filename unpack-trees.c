@@ -20,6 +20,10 @@
 #include "entry.h"
 #include "parallel-checkout.h"
 #include "sparse-index.h"
+#include "oidmap.h"
+#include "oidset.h"
+#include "pathspec.h"
+#include "thread-utils.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -793,6 +797,16 @@ static int traverse_by_cache_tree(int pos, int nr_entries, int nr_names,
 	if (!o->merge)
 		BUG("We need cache-tree to do this optimization");
 
+	/*
+	 * "diff-index --cached" has nothing to show for entries that
+	 * match the tree, so there is no need to call o->fn on them.
+	 */
+	if (o->diff_index_cached) {
+		for (i = 0; i < nr_entries; i++)
+			mark_ce_used(o->src_index->cache[pos + i], o);
+		return 0;
+	}
+
 	/*
 	 * Do what unpack_callback() and unpack_single_entry() normally
 	 * do. But we walk all paths in an iterative loop instead.
@@ -843,6 +857,393 @@ static int traverse_by_cache_tree(int pos, int nr_entries, int nr_names,
 	return 0;
 }
 
+/*
+ * Reading and inflating tree objects is a large part of the cost of
+ * unpack_trees() when switching between distant commits.  The traversal
+ * itself has to stay on one thread, as the merge functions depend on
+ * visiting the entries in order and on the state they leave behind, but
+ * the trees it is going to need can be read ahead: each worker thread
+ * takes a top-level directory and reads the trees below it, and
+ * traverse_trees_recursive() picks up their buffers when it gets there,
+ * reading whatever they have not got to yet itself.
+ */
+
+/* Workers pause when this much has been read ahead and not used yet. */
+#define TREE_PREFETCH_MAX_BYTES (64 * 1024 * 1024)
+
+struct prefetched_tree {
+	struct oidmap_entry entry;
+	void *buf;
+	unsigned long size;
+};
+
+struct tree_prefetch_job {
+	struct object_id oid[MAX_UNPACK_TREES];
+	unsigned long mask;
+	/* the matching part of the cache-tree snapshot, if any */
+	struct cache_tree *cache_tree;
+};
+
+struct tree_prefetch {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct oidmap trees;
+	struct oidset seen;
+	size_t bytes;
+	int stop;
+	unsigned used;
+
+	int n;
+	struct cache_tree *cache_tree;
+
+	struct tree_prefetch_job *jobs;
+	int nr_jobs, next_job;
+
+	pthread_t *threads;
+	int nr_threads;
+	int own_obj_read_lock;
+};
+
+/*
+ * Like all_trees_same_as_cache_tree(), tell whether the traversal is
+ * going to skip these trees altogether.
+ */
+static int prefetch_job_in_cache_tree(struct tree_prefetch *tp,
+				      struct tree_prefetch_job *job)
+{
+	int i;
+
+	if (!job->cache_tree || job->mask != (1ul << tp->n) - 1)
+		return 0;
+	for (i = 1; i < tp->n; i++)
+		if (!oideq(&job->oid[i], &job->oid[0]))
+			return 0;
+	return job->cache_tree->entry_count > 0 &&
+		oideq(&job->cache_tree->oid, &job->oid[0]);
+}
+
+struct prefetch_subtree {
+	struct object_id oid;
+	const char *path;
+	int pathlen;
+	int tree;
+};
+
+static int prefetch_subtree_cmp(const void *a_, const void *b_)
+{
+	const struct prefetch_subtree *a = a_, *b = b_;
+	int cmp = base_name_compare(a->path, a->pathlen, S_IFDIR,
+				    b->path, b->pathlen, S_IFDIR);
+	return cmp ? cmp : a->tree - b->tree;
+}
+
+/*
+ * Append a job for each directory found in the trees "t" of "parent",
+ * in the order the traversal is going to visit them.
+ */
+static void add_prefetch_jobs(struct tree_prefetch *tp, struct tree_desc *t,
+			      struct tree_prefetch_job *parent,
+			      struct tree_prefetch_job **jobs,
+			      int *nr, int *alloc)
+{
+	struct prefetch_subtree *sub = NULL;
+	size_t sub_nr = 0, sub_alloc = 0, i, j;
+	int k;
+
+	for (k = 0; k < tp->n; k++) {
+		struct tree_desc desc = t[k];
+		struct name_entry entry;
+
+		if (!(parent->mask & (1ul << k)) || !desc.buffer)
+			continue;
+		while (tree_entry_gently(&desc, &entry)) {
+			if (!S_ISDIR(entry.mode))
+				continue;
+			ALLOC_GROW(sub, sub_nr + 1, sub_alloc);
+			oidcpy(&sub[sub_nr].oid, &entry.oid);
+			sub[sub_nr].path = entry.path;
+			sub[sub_nr].pathlen = entry.pathlen;
+			sub[sub_nr].tree = k;
+			sub_nr++;
+		}
+	}
+	QSORT(sub, sub_nr, prefetch_subtree_cmp);
+
+	for (i = 0; i < sub_nr; i = j) {
+		struct tree_prefetch_job job = { 0 };
+
+		for (j = i; j < sub_nr; j++) {
+			if (sub[j].pathlen != sub[i].pathlen ||
+			    memcmp(sub[j].path, sub[i].path, sub[i].pathlen))
+				break;
+			oidcpy(&job.oid[sub[j].tree], &sub[j].oid);
+			job.mask |= 1ul << sub[j].tree;
+		}
+		if (parent->cache_tree) {
+			int pos = cache_tree_subtree_pos(parent->cache_tree,
+							 sub[i].path,
+							 sub[i].pathlen);
+			if (pos >= 0)
+				job.cache_tree = parent->cache_tree->down[pos]->cache_tree;
+		}
+		if (prefetch_job_in_cache_tree(tp, &job))
+			continue;
+		ALLOC_GROW(*jobs, *nr + 1, *alloc);
+		(*jobs)[(*nr)++] = job;
+	}
+	free(sub);
+}
+
+static void *read_prefetch_tree(const struct object_id *oid,
+				unsigned long *size)
+{
+	struct object_info oi = OBJECT_INFO_INIT;
+	enum object_type type;
+	void *buf;
+
+	oi.typep = &type;
+	oi.sizep = size;
+	oi.contentp = &buf;
+	if (oid_object_info_extended(the_repository, oid, &oi,
+				     OBJECT_INFO_LOOKUP_REPLACE |
+				     OBJECT_INFO_SKIP_FETCH_OBJECT) < 0)
+		return NULL;
+	if (type != OBJ_TREE) {
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+/*
+ * Read the trees of "job" that nobody has asked for yet, and push the
+ * directories in them on "stack".  Trees we fail to read are left to the
+ * traversal, which reports the error.
+ */
+static void prefetch_trees(struct tree_prefetch *tp,
+			   struct tree_prefetch_job *job,
+			   struct tree_prefetch_job **stack, int *nr, int *alloc)
+{
+	struct prefetched_tree *read[MAX_UNPACK_TREES];
+	struct tree_desc t[MAX_UNPACK_TREES];
+	int i, k, nr_read = 0, first = *nr;
+
+	memset(t, 0, sizeof(t));
+	for (k = 0; k < tp->n; k++) {
+		struct prefetched_tree *pt;
+		int seen;
+
+		if (!(job->mask & (1ul << k)))
+			continue;
+		for (i = 0; i < k; i++)
+			if ((job->mask & (1ul << i)) &&
+			    oideq(&job->oid[i], &job->oid[k]))
+				break;
+		if (i < k) {
+			t[k] = t[i];
+			continue;
+		}
+
+		pthread_mutex_lock(&tp->mutex);
+		seen = tp->stop || oidset_insert(&tp->seen, &job->oid[k]);
+		pthread_mutex_unlock(&tp->mutex);
+		if (seen)
+			continue;
+
+		CALLOC_ARRAY(pt, 1);
+		oidcpy(&pt->entry.oid, &job->oid[k]);
+		pt->buf = read_prefetch_tree(&job->oid[k], &pt->size);
+		if (!pt->buf ||
+		    init_tree_desc_gently(&t[k], pt->buf, pt->size, 0)) {
+			memset(&t[k], 0, sizeof(t[k]));
+			free(pt->buf);
+			free(pt);
+			continue;
+		}
+		read[nr_read++] = pt;
+	}
+
+	add_prefetch_jobs(tp, t, job, stack, nr, alloc);
+	/* the stack is popped from the end; keep the traversal order */
+	for (i = first, k = *nr - 1; i < k; i++, k--)
+		SWAP((*stack)[i], (*stack)[k]);
+
+	pthread_mutex_lock(&tp->mutex);
+	for (i = 0; i < nr_read; i++) {
+		while (tp->bytes > TREE_PREFETCH_MAX_BYTES && !tp->stop)
+			pthread_cond_wait(&tp->cond, &tp->mutex);
+		if (tp->stop) {
+			free(read[i]->buf);
+			free(read[i]);
+			continue;
+		}
+		oidmap_put(&tp->trees, read[i]);
+		tp->bytes += read[i]->size;
+	}
+	pthread_mutex_unlock(&tp->mutex);
+}
+
+static void *tree_prefetch_thread(void *data)
+{
+	struct tree_prefetch *tp = data;
+	struct tree_prefetch_job *stack = NULL;
+	int nr = 0, alloc = 0;
+
+	while (1) {
+		struct tree_prefetch_job job;
+
+		pthread_mutex_lock(&tp->mutex);
+		if (tp->stop || tp->next_job >= tp->nr_jobs) {
+			pthread_mutex_unlock(&tp->mutex);
+			break;
+		}
+		job = tp->jobs[tp->next_job++];
+		pthread_mutex_unlock(&tp->mutex);
+
+		prefetch_trees(tp, &job, &stack, &nr, &alloc);
+		while (nr) {
+			job = stack[--nr];
+			prefetch_trees(tp, &job, &stack, &nr, &alloc);
+		}
+	}
+	free(stack);
+	return NULL;
+}
+
+static void start_tree_prefetch(struct unpack_trees_options *o,
+				int n, struct tree_desc *t)
+{
+	struct tree_prefetch *tp;
+	struct tree_prefetch_job root = { 0 };
+	int nr_threads, alloc = 0, i;
+
+	if (!HAVE_THREADS || !n || o->prefix ||
+	    (o->pathspec && o->pathspec->nr) || o->src_index->sparse_index)
+		return;
+	nr_threads = repo_config_thread_count(the_repository,
+					      "index.unpackthreads",
+					      "GIT_TEST_UNPACK_THREADS", 0);
+	if (nr_threads < 2)
+		return;
+
+	CALLOC_ARRAY(tp, 1);
+	tp->n = n;
+	/*
+	 * The traversal's own cache-tree may change under us; work from
+	 * a copy of it.
+	 */
+	if (o->merge && o->src_index->cache_tree) {
+		struct strbuf sb = STRBUF_INIT;
+
+		cache_tree_write(&sb, o->src_index->cache_tree);
+		tp->cache_tree = cache_tree_read(sb.buf, sb.len);
+		strbuf_release(&sb);
+	}
+	root.mask = (1ul << n) - 1;
+	root.cache_tree = tp->cache_tree;
+	add_prefetch_jobs(tp, t, &root, &tp->jobs, &tp->nr_jobs, &alloc);
+	if (tp->nr_jobs < 2) {
+		cache_tree_free(&tp->cache_tree);
+		free(tp->jobs);
+		free(tp);
+		return;
+	}
+
+	pthread_mutex_init(&tp->mutex, NULL);
+	pthread_cond_init(&tp->cond, NULL);
+	oidmap_init(&tp->trees, 0);
+	oidset_init(&tp->seen, 0);
+	tp->own_obj_read_lock = !obj_read_use_lock;
+	enable_obj_read_lock();
+
+	/* the main thread does its share of the reading */
+	tp->nr_threads = nr_threads - 1;
+	if (tp->nr_threads > tp->nr_jobs)
+		tp->nr_threads = tp->nr_jobs;
+	CALLOC_ARRAY(tp->threads, tp->nr_threads);
+	for (i = 0; i < tp->nr_threads; i++) {
+		int err = pthread_create(&tp->threads[i], NULL,
+					 tree_prefetch_thread, tp);
+		if (err)
+			die(_("unable to create tree prefetch thread: %s"),
+			    strerror(err));
+	}
+	trace2_data_intmax("unpack_trees", the_repository,
+			   "prefetch/threads", tp->nr_threads);
+	o->prefetch = tp;
+}
+
+static void stop_tree_prefetch(struct unpack_trees_options *o)
+{
+	struct tree_prefetch *tp = o->prefetch;
+	struct oidmap_iter iter;
+	struct prefetched_tree *pt;
+	int i;
+
+	if (!tp)
+		return;
+
+	pthread_mutex_lock(&tp->mutex);
+	tp->stop = 1;
+	pthread_cond_broadcast(&tp->cond);
+	pthread_mutex_unlock(&tp->mutex);
+	for (i = 0; i < tp->nr_threads; i++)
+		pthread_join(tp->threads[i], NULL);
+	if (tp->own_obj_read_lock)
+		disable_obj_read_lock();
+
+	trace2_data_intmax("unpack_trees", the_repository,
+			   "prefetch/trees_used", tp->used);
+
+	oidmap_iter_init(&tp->trees, &iter);
+	while ((pt = oidmap_iter_next(&iter)))
+		free(pt->buf);
+	oidmap_free(&tp->trees, 1);
+	oidset_clear(&tp->seen);
+	pthread_cond_destroy(&tp->cond);
+	pthread_mutex_destroy(&tp->mutex);
+	cache_tree_free(&tp->cache_tree);
+	free(tp->threads);
+	free(tp->jobs);
+	FREE_AND_NULL(o->prefetch);
+}
+
+/*
+ * fill_tree_descriptor(), using the buffer read ahead by the prefetch
+ * threads when there is one.
+ */
+static void *fill_tree_descriptor_prefetched(struct unpack_trees_options *o,
+					     struct tree_desc *desc,
+					     const struct object_id *oid)
+{
+	struct tree_prefetch *tp = o->prefetch;
+	struct prefetched_tree *pt = NULL;
+	void *buf;
+
+	if (!tp || !oid)
+		return fill_tree_descriptor(the_repository, desc, oid);
+
+	pthread_mutex_lock(&tp->mutex);
+	pt = oidmap_remove(&tp->trees, oid);
+	if (pt) {
+		if (tp->bytes > TREE_PREFETCH_MAX_BYTES)
+			pthread_cond_broadcast(&tp->cond);
+		tp->bytes -= pt->size;
+		tp->used++;
+	} else {
+		/* we are reading it ourselves; do not bother the workers */
+		oidset_insert(&tp->seen, oid);
+	}
+	pthread_mutex_unlock(&tp->mutex);
+
+	if (!pt)
+		return fill_tree_descriptor(the_repository, desc, oid);
+	buf = pt->buf;
+	init_tree_desc(desc, buf, pt->size);
+	free(pt);
+	return buf;
+}
+
 static int traverse_trees_recursive(int n, unsigned long dirmask,
 				    unsigned long df_conflicts,
 				    struct name_entry *names,
@@ -914,7 +1315,7 @@ static int traverse_trees_recursive(int n, unsigned long dirmask,
 			const struct object_id *oid = NULL;
 			if (dirmask & 1)
 				oid = &names[i].oid;
-			buf[nr_buf++] = fill_tree_descriptor(the_repository, t + i, oid);
+			buf[nr_buf++] = fill_tree_descriptor_prefetched(o, t + i, oid);
 		}
 	}
 
@@ -1973,7 +2374,9 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 
 		trace_performance_enter();
 		trace2_region_enter("unpack_trees", "traverse_trees", the_repository);
+		start_tree_prefetch(o, len, t);
 		ret = traverse_trees(o->src_index, len, t, &info);
+		stop_tree_prefetch(o);
 		trace2_region_leave("unpack_trees", "traverse_trees", the_repository);
 		trace_performance_leave("traverse_trees");
 		if (ret < 0)
@@ -9,6 +9,7 @@
 #define MAX_UNPACK_TREES MAX_TRAVERSE_TREES
 
 struct cache_entry;
+struct tree_prefetch;
 struct unpack_trees_options;
 struct pattern_list;
 
@@ -97,6 +98,7 @@ struct unpack_trees_options {
 
 	struct pattern_list *pl; /* for internal use */
 	struct dir_struct *dir; /* for internal use only */
+	struct tree_prefetch *prefetch; /* for internal use only */
 	struct checkout_metadata meta;
 };
 